@@ -5,9 +5,13 @@
 
 #ifdef __cplusplus
 
+#include <ctype.h>
+#include <string.h>
+#include <stdio.h>
 #include <unordered_map>
+#include <map>
+#include <vector>
 #include <string>
-#include <sstream>
 
 #include <hex/string_util.h>
 #include <hex/log.h>
@@ -353,13 +357,279 @@ struct TuningStringMatrix: public Tune, public ConfigStringMatrix
 
 #define MAX_TUNING_MAP  10
 
+// Compiled form of the registered tuning name formats
+// Formats are folded into a trie at static-init time so that a name can be resolved,
+// and its embedded int/string placeholders extracted, in a single pass over the name
+// instead of one snprintf + sscanf per registered format.
+// Placeholder semantics follow sscanf: "%d"/"%i"/"%u" match an optionally signed number,
+// "%s" matches a run of non-whitespace and "%[...]" matches a scanset; all are greedy.
+// Formats that cannot be compiled are kept on a fallback list and matched with sscanf.
+class TuneMatcher
+{
+public:
+    struct Match {
+        Tune* tune;
+        const char* format;
+        int ints[2];
+        int numInts;
+        std::string str;
+    };
+
+    TuneMatcher() { m_nodes.emplace_back(); }
+
+    void insert(const char* format, Tune* t)
+    {
+        if (t->nameType == Tune::TUNE_P) {
+            // Plain names are compared verbatim (no placeholder interpretation)
+            int n = 0;
+            for (const char* p = format; *p; ++p)
+                n = literal(n, *p);
+            terminate(n, format, t);
+            return;
+        }
+
+        int n = 0, numInts = 0, numStrs = 0;
+        const char* p = format;
+        while (*p) {
+            if (*p != '%') {
+                n = literal(n, *p++);
+                continue;
+            }
+            ++p;
+            if (*p == '%') {
+                n = literal(n, *p++);
+                continue;
+            }
+            while (isdigit(*p))
+                ++p;
+            if (*p == 'd' || *p == 'i' || *p == 'u') {
+                n = intEdge(n);
+                ++numInts;
+                ++p;
+            }
+            else if (*p == 's') {
+                n = strEdge(n, true, " \t\n\v\f\r", true);
+                ++numStrs;
+                ++p;
+            }
+            else if (*p == '[') {
+                const char* end;
+                bool negate = false;
+                std::string set;
+                ++p;
+                if (*p == '^') {
+                    negate = true;
+                    ++p;
+                }
+                // a leading ']' is part of the scanset
+                end = strchr(*p == ']' ? p + 1 : p, ']');
+                if (end == NULL || memchr(p, '-', end - p) != NULL) {
+                    m_fallback.emplace_back(format, t);
+                    return;
+                }
+                set.assign(p, end - p);
+                n = strEdge(n, negate, set, false);
+                ++numStrs;
+                p = end + 1;
+            }
+            else {
+                m_fallback.emplace_back(format, t);
+                return;
+            }
+        }
+
+        bool ok = false;
+        switch (t->nameType) {
+            case Tune::TUNE_I:
+                ok = (numInts == 1 && numStrs == 0);
+                break;
+            case Tune::TUNE_M:
+                ok = (numInts == 2 && numStrs == 0);
+                break;
+            case Tune::TUNE_S:
+                ok = (numInts == 0 && numStrs == 1);
+                break;
+            default:
+                break;
+        }
+
+        if (ok)
+            terminate(n, format, t);
+        else
+            m_fallback.emplace_back(format, t);
+    }
+
+    bool find(const char* name, Match* m) const
+    {
+        m->numInts = 0;
+        if (walk(0, name, m))
+            return true;
+
+        for (auto it = m_fallback.begin(); it != m_fallback.end(); ++it) {
+            if (scan(name, it->first.c_str(), it->second, m))
+                return true;
+        }
+        return false;
+    }
+
+private:
+    struct StrEdge {
+        bool negate;
+        bool skipws;
+        std::string set;
+        int next;
+    };
+
+    struct Node {
+        std::map<char, int> literals;
+        int intNext = -1;
+        std::vector<StrEdge> strs;
+        Tune* tune = NULL;
+        std::string format;
+    };
+
+    std::vector<Node> m_nodes;
+    std::vector<std::pair<std::string, Tune*> > m_fallback;
+
+    int literal(int n, char c)
+    {
+        auto it = m_nodes[n].literals.find(c);
+        if (it != m_nodes[n].literals.end())
+            return it->second;
+        int next = m_nodes.size();
+        m_nodes.emplace_back();
+        m_nodes[n].literals[c] = next;
+        return next;
+    }
+
+    int intEdge(int n)
+    {
+        if (m_nodes[n].intNext < 0) {
+            int next = m_nodes.size();
+            m_nodes.emplace_back();
+            m_nodes[n].intNext = next;
+        }
+        return m_nodes[n].intNext;
+    }
+
+    int strEdge(int n, bool negate, const std::string& set, bool skipws)
+    {
+        for (auto it = m_nodes[n].strs.begin(); it != m_nodes[n].strs.end(); ++it) {
+            if (it->negate == negate && it->skipws == skipws && it->set == set)
+                return it->next;
+        }
+        int next = m_nodes.size();
+        m_nodes.emplace_back();
+        m_nodes[n].strs.push_back(StrEdge{negate, skipws, set, next});
+        return next;
+    }
+
+    void terminate(int n, const char* format, Tune* t)
+    {
+        // First registration wins, same as inserting into s_tunes
+        if (m_nodes[n].tune == NULL) {
+            m_nodes[n].tune = t;
+            m_nodes[n].format = format;
+        }
+    }
+
+    // Literal edges are tried before placeholders so the most specific format wins
+    bool walk(int n, const char* s, Match* m) const
+    {
+        const Node& node = m_nodes[n];
+
+        if (*s == '\0') {
+            if (node.tune == NULL)
+                return false;
+            m->tune = node.tune;
+            m->format = node.format.c_str();
+            return true;
+        }
+
+        auto it = node.literals.find(*s);
+        if (it != node.literals.end() && walk(it->second, s + 1, m))
+            return true;
+
+        if (node.intNext >= 0 && m->numInts < 2) {
+            const char* p = s;
+            while (isspace(*p))
+                ++p;
+            const char* digits = (*p == '+' || *p == '-') ? p + 1 : p;
+            if (isdigit(*digits)) {
+                char* end;
+                long v = strtol(p, &end, 10);
+                m->ints[m->numInts++] = (int)v;
+                if (walk(node.intNext, end, m))
+                    return true;
+                m->numInts--;
+            }
+        }
+
+        for (auto st = node.strs.begin(); st != node.strs.end(); ++st) {
+            const char* p = s;
+            if (st->skipws) {
+                while (isspace(*p))
+                    ++p;
+            }
+            const char* q = p;
+            while (*q && (strchr(st->set.c_str(), *q) == NULL) == st->negate)
+                ++q;
+            if (q != p) {
+                m->str.assign(p, q - p);
+                if (walk(st->next, q, m))
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
+    static bool scan(const char* name, const char* format, Tune* t, Match* m)
+    {
+        char fmt[1024];
+        int pos = 0;
+        snprintf(fmt, sizeof(fmt), "%s%%n", format);
+        switch (t->nameType) {
+            case Tune::TUNE_P:
+                if (strcmp(name, format) != 0)
+                    return false;
+                break;
+            case Tune::TUNE_I:
+                if (sscanf(name, fmt, &m->ints[0], &pos) != 1 || pos != (int)strlen(name))
+                    return false;
+                m->numInts = 1;
+                break;
+            case Tune::TUNE_M:
+                if (sscanf(name, fmt, &m->ints[0], &m->ints[1], &pos) != 2 || pos != (int)strlen(name))
+                    return false;
+                m->numInts = 2;
+                break;
+            case Tune::TUNE_S: {
+                // As long as the name so that %s cannot write past it
+                size_t len = strlen(name);
+                std::string arg(len + 1, '\0');
+                if (sscanf(name, fmt, &arg[0], &pos) != 1 || pos != (int)len)
+                    return false;
+                m->str = arg.c_str();
+                break;
+            }
+        }
+        m->tune = t;
+        m->format = format;
+        return true;
+    }
+};
+
 static std::unordered_map<std::string, Tune*> s_tunes[MAX_TUNING_MAP];
+static TuneMatcher s_tuneMatchers[MAX_TUNING_MAP];
 
 struct TuneMapping {
     TuneMapping(std::unordered_map<std::string, Tune*> *tunes, const char* format, Tune* t, int idx = 0)
     {
-        if (idx >= 0 && idx < MAX_TUNING_MAP)
-            tunes[idx].insert(std::make_pair(format, t));
+        if (idx >= 0 && idx < MAX_TUNING_MAP) {
+            if (tunes[idx].insert(std::make_pair(format, t)).second)
+                s_tuneMatchers[idx].insert(format, t);
+        }
     }
 };
 
@@ -448,53 +718,27 @@ ParseTune(const char* n, const char* v, bool isNew, int idx = 0) //TODO: move to
     if (idx < 0 || idx >= MAX_TUNING_MAP)
         return TUNE_INVALID_IDX;
 
-    TuneStatus r = TUNE_INVALID_NAME;
-    for (auto it = s_tunes[idx].begin(); r == TUNE_INVALID_NAME && it != s_tunes[idx].end(); ++it) {
-        Tune* t = it->second;
-        const char* format = it->first.c_str();
-        HexLogDebugN(RRA, "Checking %s against %s...", n, format);
-        switch (t->nameType) {
-            case Tune::TUNE_P: {
-                if (strcmp(n, format) == 0) {
-                    r = t->ParseValue(v, isNew);
-                }
-                break;
-            }
-            case Tune::TUNE_I: {
-                int arg, pos = 0;
-                char fmt[1024];
-                snprintf(fmt, sizeof(fmt), "%s%%n", format);
-                if (sscanf(n, fmt, &arg, &pos) == 1 && pos == (int)strlen(n)) {
-                    t->ni = arg;
-                    r = t->ParseValue(v, isNew);
-                }
-                break;
-            }
-            case Tune::TUNE_M: {
-                int arg_first, arg_second, pos = 0;
-                char fmt[1024];
-                snprintf(fmt, sizeof(fmt), "%s%%n", format);
-                if (sscanf(n, fmt, &arg_first, &arg_second, &pos) == 2 && pos == (int)strlen(n)) {
-                    std::stringstream keys;
-                    keys << arg_first << "," << arg_second;
-                    t->ns = keys.str().c_str();
-                    r = t->ParseValue(v, isNew);
-                }
-                break;
-            }
-            case Tune::TUNE_S: {
-                char arg[80], fmt[1024];
-                int pos = 0;
-                snprintf(fmt, sizeof(fmt), "%s%%n", format);
-                if (sscanf(n, fmt, &arg, &pos) == 1 && pos == (int)strlen(n)) {
-                    t->ns = arg;
-                    r = t->ParseValue(v, isNew);
-                }
-                break;
-            }
-        }
-    }
-    return r;
+    TuneMatcher::Match m;
+    if (!s_tuneMatchers[idx].find(n, &m))
+        return TUNE_INVALID_NAME;
+
+    Tune* t = m.tune;
+    HexLogDebugN(RRA, "Matched %s against %s", n, m.format);
+    switch (t->nameType) {
+        case Tune::TUNE_P:
+            break;
+        case Tune::TUNE_I:
+            t->ni = m.ints[0];
+            break;
+        case Tune::TUNE_M:
+            m.str = std::to_string(m.ints[0]) + "," + std::to_string(m.ints[1]);
+            t->ns = m.str.c_str();
+            break;
+        case Tune::TUNE_S:
+            t->ns = m.str.c_str();
+            break;
+    }
+    return t->ParseValue(v, isNew);
 }
 
 static inline bool
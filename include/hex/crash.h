@@ -7,6 +7,8 @@
 extern "C" {
 #endif
 
+// Write a crash file with the stack of every thread when the process crashes
+// SIGRTMIN+14 is reserved for the crash handler to reach the other threads
 int HexCrashInit(const char* name);
 
 typedef void (*HexCrashCallback)(void* data, void* context);
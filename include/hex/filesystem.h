@@ -7,6 +7,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <sys/stat.h>
 
 // Create a directory with given user, group, and permissions.
@@ -20,9 +21,56 @@ int HexMakeDir(const char* dir, const char* user, const char* group, mode_t perm
 
 int HexSetFileMode(const char* path, const char* user, const char* group, mode_t perms);
 
+// Give "path" (a symbolic link itself, not what it points to) the owner and
+// group of a file it was copied from. Only root can give other owners, so a
+// failure is not an error and is ignored.
+void HexCopyOwner(const char* path, uid_t uid, gid_t gid);
+
+// Write all "len" bytes of "buf", retrying interrupted and short writes
+// return  0: success
+//        -1: error in write (errno set)
+int HexWriteAll(int fd, const void* buf, size_t len);
+
+// Copy what is left to read of "in" to "out", sharing blocks or having the
+// kernel copy them when the file systems allow, through a buffer otherwise
+// return  0: success
+//        -1: error (errno set)
+int HexCopyFd(int in, int out);
+
+// Create the missing parent directories of "path" (mode 0755), like unzip
+// and cpio -d; the last component of "path" is left alone
+// return  0: success
+//        -1: error in mkdir (errno set)
+int HexMakeParents(const char* path);
+
+// Return 1 if "name" stays under any directory it is appended to: it is not
+// empty, not absolute and has no ".." component; 0 otherwise
+int HexPathIsBeneath(const char* name);
+
+// Create every missing directory of "path" under "dir" (mode 0755), refusing
+// to go through a symbolic link, so that something extracted under "dir"
+// can neither leave it by a link that was extracted earlier
+// "path" must satisfy HexPathIsBeneath()
+// return  0: success, "dir" + "/" + "path" is a directory
+//        -1: error (errno set: EINVAL for a path leaving "dir", ELOOP for a
+//            symbolic link on the way, ENOTDIR for anything else not a directory)
+int HexMakeDirsBeneath(const char* dir, const char* path);
+
 #ifdef __cplusplus
 } /* end extern "C" */
 #endif
 
+#ifdef __cplusplus
+#include <string>
+#include <vector>
+
+// Append the names in directory "dir", except "." and "..", sorted to "names"
+// The whole directory is read before any of it is used so that walking a deep
+// tree does not hold a descriptor per level.
+// Return false if "dir" cannot be read
+bool HexListDir(const std::string &dir, std::vector<std::string> &names);
+
+#endif /* endif __cplusplus */
+
 #endif /* ifndef HEX_FS_H */
 
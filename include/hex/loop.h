@@ -8,16 +8,62 @@
  *  @brief An API for managing signals, IPC, and timers in a "main loop."
  *
  *  Callers can register callbacks to handle sginals, interval timers,
- *  and I/O on file descriptors.  This API is not threadsafe; it can
- *  only be used in one thread of a process.
+ *  and I/O on file descriptors.
+ *
+ *  The functions below operate on the loop run by the calling thread:
+ *  the default loop (HexLoopInit()/HexLoop()/HexLoopFini()) unless
+ *  called from a thread started by HexLoopSpawn().  A loop must only
+ *  be changed from its own thread; other threads hand work to it with
+ *  HexLoopPost(), which (like HexLoopStop()) is threadsafe.  Signals
+ *  are only handled by the default loop.
  */
 
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/** Callback for file descriptors, signals and timers
+ *
+ *  arg is the file descriptor for HexLoopFdAdd(), the signal number for
+ *  HexLoopSignalAdd() and 0 for timers, including those added by
+ *  HexLoopTimerAdd().  userData is the caller-supplied arg.  auxValue is
+ *  the value sent with a queued signal, 0 otherwise.
+ */
 typedef int (*HexLoopCallback)(int arg, void* userData, int auxValue);
 
+/** Callback for data received by HexLoopRecvAdd()
+ *
+ *  len is the number of bytes at data (only valid during the call), 0
+ *  at end of file or -errno on error; in both latter cases data is NULL
+ *  and the callback is not called again.
+ */
+typedef int (*HexLoopRecvCallback)(int fd, void* userData, const char* data, ssize_t len);
+
+/** Task run by a loop's thread, see HexLoopPost() */
+typedef void (*HexLoopTask)(void* arg);
+
+/** Handle to a loop */
+typedef struct HexLoopCtx* HexLoop_t;
+
+/** Handle to a timer added by HexLoopTimerAddMs() */
+typedef struct HexLoopTimer* HexLoopTimer_t;
+
+/** Flags for HexLoopFdAddFlags(), HexLoopTimerAddMs() and HexLoopInit() */
+enum {
+    HEX_LOOP_EDGE = 0x1,      /**< edge-triggered: callback only when new input arrives */
+    HEX_LOOP_PERIODIC = 0x2,  /**< timer fires every interval instead of once */
+    HEX_LOOP_URING = 0x4,     /**< io_uring backend if available, epoll otherwise */
+};
+
+/** System calls made by a loop's thread, see HexLoopGetStats() */
+struct HexLoopStats {
+    unsigned long waits;      /**< waits for events (epoll_wait or io_uring_enter) */
+    unsigned long syscalls;   /**< all system calls made by the loop itself, including waits
+                                   but not those made by callbacks */
+};
+
 /** @brief Break out of the loop
  *
  *  Can be called from callbacks.
@@ -28,9 +74,15 @@ void HexLoopQuit();
 
 /** @brief Initialize the loop API
  *
- *  TODO
- *  @param flags TODO
- *  @return TODO
+ *  With HEX_LOOP_URING the loop submits and reaps its operations through
+ *  io_uring (Linux 6.0 or later), so that a busy loop makes about one
+ *  system call per batch of events: file descriptors are polled with
+ *  multishot or re-armed one-shot polls, HexLoopRecvAdd() receives with
+ *  multishot receives into provided buffers and the loop's own timer,
+ *  signal and task file descriptors are read as part of the completions.
+ *  If io_uring is unavailable the loop uses epoll, see HexLoopBackend().
+ *  @param flags 0 or HEX_LOOP_URING
+ *  @return 0 on success, -1 on error
  */
 int HexLoopInit(int flags);
 
@@ -38,37 +90,86 @@ int HexLoopInit(int flags);
  *
  *  The file descriptor added will be monitored for input and errors.
  *  When ready, the callback will be called along with the
- *  caller-supplied arg.
- *  @param fd the file descriptor to poll
+ *  caller-supplied arg.  Must be called after HexLoopInit().  A file
+ *  descriptor is only added once: to change its callback, remove it
+ *  with HexLoopFdRemove() and add it again.
+ *  @param fd the file descriptor to monitor
  *  @param cb callback for when the file descriptor is readable
  *  @param arg a value to pass into the callback
- *  @return TODO
+ *  @return 0 on success, -1 on error, before HexLoopInit() or if fd is
+ *  already monitored
  */
 int HexLoopFdAdd(int fd, HexLoopCallback cb, void* arg);
 
+/** @brief Add a file descriptor with trigger flags
+ *
+ *  Same as HexLoopFdAdd(), except with HEX_LOOP_EDGE the callback is
+ *  only called when new input arrives, so it must drain the file
+ *  descriptor (e.g. read until EAGAIN on a non-blocking fd).
+ *  @param fd the file descriptor to monitor
+ *  @param flags 0 (level-triggered) or HEX_LOOP_EDGE
+ *  @param cb callback for when the file descriptor is readable
+ *  @param arg a value to pass into the callback
+ *  @return 0 on success, -1 on error or if fd is already monitored
+ */
+int HexLoopFdAddFlags(int fd, int flags, HexLoopCallback cb, void* arg);
+
+/** @brief Stop monitoring a file descriptor
+ *
+ *  Can be called from callbacks, including for a file descriptor
+ *  whose callback is pending in the same iteration; it won't be called.
+ *  The file descriptor is not closed.
+ *  @param fd the file descriptor added by HexLoopFdAdd()
+ *  @return 0 on success, -1 if fd is not monitored
+ */
+int HexLoopFdRemove(int fd);
+
+/** @brief Add a socket whose data the loop receives for the caller
+ *
+ *  Whenever data arrives it is received and passed to the callback,
+ *  in chunks of up to 16KB.  With the io_uring backend this takes no
+ *  system calls per event.
+ *  @param fd the socket to receive from
+ *  @param cb callback for received data, end of file and errors
+ *  @param arg a value to pass into the callback
+ *  @return 0 on success, -1 on error or if fd is already monitored
+ */
+int HexLoopRecvAdd(int fd, HexLoopRecvCallback cb, void* arg);
+
+/** @brief Stop receiving from a socket added by HexLoopRecvAdd()
+ *
+ *  Can be called from callbacks.  The socket is not closed.
+ *  @param fd the socket
+ *  @return 0 on success, -1 if fd is not monitored
+ */
+int HexLoopRecvRemove(int fd);
+
 
 /** @brief Add a signal for the loop API to manage
  *
  *  When the added signal is delivered, the callback will be called
  *  along with the caller-supplied arg.  The vallback will NOT be
  *  called from the signal handler's context, but from the context of
- *  the calling thread/process.
+ *  the calling thread/process.  Only the default loop handles
+ *  signals, after HexLoopInit().
  *  @param signum the signal to monitor
  *  @param cb callback for when the signal is delivered
  *  @param arg a value to pass into the callback
- *  @return TODO
+ *  @return 0 on success, -1 on error
  */
 int HexLoopSignalAdd(int signum, HexLoopCallback cb, void* arg);
 
 
 /** @brief Add an interval timer for the loop API to manage
  *
- *  Each interval, the callback will be called along with the
- *  caller-supplied arg.
+ *  Each interval, the callback will be called with 0 and the
+ *  caller-supplied arg.  The timer runs on the timer wheel of
+ *  HexLoopTimerAddMs() and has no file descriptor of its own to pass
+ *  as arg.
  *  @param interval the timer's period (in seconds)
  *  @param cb callback for when the timer expires
  *  @param arg a value to pass into the callback
- *  @return TODO
+ *  @return 0 on success, -1 on error or before HexLoopInit()
  */
 int HexLoopTimerAdd(int interval, HexLoopCallback cb, void* arg);
 
@@ -81,6 +182,50 @@ int HexLoopTimerAdd(int interval, HexLoopCallback cb, void* arg);
  */
 int HexLoopTimerChangeInterval(int interval, HexLoopCallback cb);
 
+/** @brief Remove an interval timer using cb as the hook
+ *
+ *  Can be called from callbacks.
+ *  @param cb the callback is used to identify the correct timer
+ *  @return 0 on success, -1 if there is no such timer
+ */
+int HexLoopTimerRemove(HexLoopCallback cb);
+
+/** @brief Add a millisecond timer
+ *
+ *  All timers share one timer wheel with 1ms ticks driven by a single
+ *  timerfd, so arming and cancelling are O(1) and timers expiring in
+ *  the same tick are handled by one wakeup.  The callback is called
+ *  with 0 and the caller-supplied arg.
+ *
+ *  A one-shot timer's handle is freed once its callback returns, unless
+ *  the callback re-armed it with HexLoopTimerRearm().
+ *  @param ms delay until the timer fires (and its period with HEX_LOOP_PERIODIC)
+ *  @param flags 0 (one-shot) or HEX_LOOP_PERIODIC
+ *  @param cb callback for when the timer expires
+ *  @param arg a value to pass into the callback
+ *  @return handle to the timer, or NULL on error
+ */
+HexLoopTimer_t HexLoopTimerAddMs(int ms, int flags, HexLoopCallback cb, void* arg);
+
+/** @brief Restart a timer to fire ms from now
+ *
+ *  For periodic timers ms also becomes the new period.  Can be called
+ *  from callbacks, including the timer's own.
+ *  @param timer handle returned by HexLoopTimerAddMs()
+ *  @param ms the new delay (in milliseconds)
+ *  @return 0 on success, -1 on error
+ */
+int HexLoopTimerRearm(HexLoopTimer_t timer, int ms);
+
+/** @brief Cancel a timer and free its handle
+ *
+ *  Can be called from callbacks, including the timer's own and for a
+ *  timer expiring in the same tick; its callback won't be called.
+ *  @param timer handle returned by HexLoopTimerAddMs()
+ *  @return 0 on success, -1 on error
+ */
+int HexLoopTimerCancel(HexLoopTimer_t timer);
+
 /** @brief Run the "main loop."
  *
  *  Any registered callbacks will be called when appropriate.
@@ -88,6 +233,74 @@ int HexLoopTimerChangeInterval(int interval, HexLoopCallback cb);
  */
 int HexLoop();
 
+/** @brief Get the default loop
+ *
+ *  The loop set up by HexLoopInit() and run by HexLoop(), e.g. for
+ *  other threads to post tasks to.
+ */
+HexLoop_t HexLoopDefault();
+
+/** @brief Get the loop run by the calling thread
+ *
+ *  @return the loop started by HexLoopSpawn() in its thread, otherwise
+ *  the default loop
+ */
+HexLoop_t HexLoopCurrent();
+
+/** @brief Start a loop in a new thread
+ *
+ *  Callbacks are registered on the new loop by posting tasks to it
+ *  that call the functions above.  The thread blocks all signals.
+ *  @param cpu CPU to pin the thread to, or -1 to leave it unpinned
+ *  @param flags as for HexLoopInit()
+ *  @return handle to the loop, or NULL on error
+ */
+HexLoop_t HexLoopSpawn(int cpu, int flags);
+
+/** @brief Stop a loop started by HexLoopSpawn() and free it
+ *
+ *  Waits for its thread to exit.  Tasks that were posted but have not
+ *  run are dropped.  Must not be called from the loop's own thread.
+ *  @param loop handle returned by HexLoopSpawn()
+ *  @return the loop's result (as for HexLoop()), -1 on error
+ */
+int HexLoopJoin(HexLoop_t loop);
+
+/** @brief Break out of a loop from any thread
+ *
+ *  Like HexLoopQuit(), but for the given loop and threadsafe.
+ *  @param loop the loop to stop
+ */
+void HexLoopStop(HexLoop_t loop);
+
+/** @brief Run a task in a loop's thread
+ *
+ *  Threadsafe and lock-free: tasks are queued on the loop's
+ *  multi-producer queue and run in posting order per producer.  The
+ *  loop is woken through an eventfd only when it has no pending tasks
+ *  already.
+ *  @param loop the loop to run fn in
+ *  @param fn the task
+ *  @param arg a value to pass into the task
+ *  @return 0 on success, -1 on error
+ */
+int HexLoopPost(HexLoop_t loop, HexLoopTask fn, void* arg);
+
+/** @brief Get the backend a loop ended up with
+ *
+ *  @return HEX_LOOP_URING for io_uring, 0 for epoll
+ */
+int HexLoopBackend(HexLoop_t loop);
+
+/** @brief Get a loop's system call counters
+ *
+ *  Only to be called from the loop's own thread.
+ *  @param loop the loop
+ *  @param stats receives the counters
+ *  @return 0 on success, -1 on error
+ */
+int HexLoopGetStats(HexLoop_t loop, struct HexLoopStats* stats);
+
 /** @brief Finalize the loop API
  *
  *  TODO
@@ -48,6 +48,8 @@ int HexSystemNoSig(shandler sighandlerfunc, int isChildLeader, int timeout, cons
 // SIGALRM.
 // If timeout is negative (<0), do not wait for the child process to complete, but
 // instead return immediately.
+// The child shares the caller's memory until it execs (clone(CLONE_VM|CLONE_VFORK)),
+// so spawning costs the same however large the caller is.
 
 int HexSpawn(int timeout, const char *arg0, ...) __attribute__ ((sentinel));
 int HexSpawnV(int timeout, char *const argv[]);
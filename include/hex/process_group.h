@@ -0,0 +1,126 @@
+// HEX SDK
+
+#ifndef HEX_PROCESS_GROUP_H
+#define HEX_PROCESS_GROUP_H
+
+// Process group API requires C++
+#ifdef __cplusplus
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Run several commands at once and capture their output
+//
+// Commands are argv-style (no shell) and argv[0] is the path of the program.
+// Each runs in its own process group with stdin on /dev/null and stdout and
+// stderr on pipes, and is killed with its descendants (SIGKILL) once it runs
+// past its own timeout or the group's.
+//
+//     HexProcessGroup group(4 /* at most 4 at once */, 60 /* secs in all */);
+//     size_t a = group.add({ "/usr/bin/lsblk", "-J" }, 10);
+//     size_t b = group.add({ "/usr/sbin/lvs", "--reportformat", "json" }, 10);
+//     group.wait();
+//     if (group.result(a).status == 0)
+//         Parse(group.result(a).out);
+//
+// wait() blocks until every command has finished. Callers with a loop of
+// their own can add fd() to it instead and call poll(0) whenever it is
+// readable, which it becomes on output, exits and deadlines.
+class HexProcessGroup {
+public:
+    // At most maxConcurrent commands run at once (0: no limit) and the group
+    // gets timeout seconds from start() (0: no limit)
+    HexProcessGroup(size_t maxConcurrent = 0, int timeout = 0);
+
+    // Kill and reap any commands still running
+    ~HexProcessGroup();
+
+    // Queue a command with its own timeout in seconds (0: no limit)
+    // Return its index for result()
+    size_t add(const std::vector<std::string>& argv, int timeout = 0);
+
+    // Start the group's clock and as many commands as the limit allows
+    // Called by poll() and wait() if need be
+    // Return false if the group cannot run, all commands then fail with errno
+    bool start();
+
+    // Handle output, exits and deadlines for up to timeoutMs milliseconds
+    // (-1: until something happens), starting queued commands as others finish
+    // Return true once every command has finished
+    bool poll(int timeoutMs);
+
+    // Poll until every command has finished
+    void wait();
+
+    // Readable whenever poll() has something to do, -1 before start()
+    int fd() const { return m_epollFd; }
+
+    struct Result {
+        // Status from waitpid(2), or -1 if the command was never started
+        int status;
+        // errno from starting the command, if that failed
+        int error;
+        // Killed for running past its own or the group's timeout, or never
+        // started before the group's
+        bool timedOut;
+        std::string out;
+        std::string err;
+        // Seconds after start() that the command started, and that it ran
+        double startTime;
+        double elapsed;
+    };
+
+    size_t size() const { return m_commands.size(); }
+
+    const Result& result(size_t index) const { return m_commands[index].result; }
+
+    // Number of commands that exited zero
+    size_t succeeded() const;
+
+private:
+    enum State { QUEUED, RUNNING, DONE };
+
+    struct Command {
+        std::vector<std::string> argv;
+        int timeout;
+        State state;
+        pid_t pid;
+        int pidfd;
+        // Read ends of the stdout and stderr pipes
+        int fds[2];
+        double deadline;
+        bool killed;
+        Result result;
+    };
+
+    void launch(size_t index, double now);
+    void readOutput(size_t index, int stream);
+    void reap(size_t index, double now);
+    void finish(size_t index, int status, int error, double now);
+    void armTimer(double now);
+    double now() const;
+
+    const size_t m_maxConcurrent;
+    const int m_timeout;
+
+    std::vector<Command> m_commands;
+
+    // Queued commands start in order from here
+    size_t m_next;
+    size_t m_running;
+    size_t m_finished;
+    // Running commands without a pidfd, checked on a short poll instead
+    size_t m_unwatched;
+
+    int m_epollFd;
+    int m_timerFd;
+
+    // Monotonic time of start() and the group's deadline (0: none)
+    double m_startTime;
+    double m_deadline;
+};
+
+#endif // __cplusplus
+
+#endif /* endif HEX_PROCESS_GROUP_H */
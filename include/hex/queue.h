@@ -21,6 +21,13 @@ extern "C" {
  * shm queue(s)
  *   1. actual message data
  *   2. message format [len|data]
+ *
+ * mpsc shm queue (HexQueueAllocMpsc/HexQueueAttachMpsc)
+ *   1. any number of producers attach to the same shm queue
+ *   2. producers reserve space with a compare-and-swap on tail
+ *   3. message format [len|type|flag|data], committed by storing the header last
+ *   4. no message queue: a futex in shm wakes the consumer only when it sleeps
+ *      on an empty queue
  */
 
 struct Bookkeeping
@@ -29,6 +36,8 @@ struct Bookkeeping
     size_t tail;    // tail offset
 };
 
+struct HexQueueRing;
+
 struct HexQueue
 {
     mqd_t mqd;                          // MASTER: message queue file descriptor (synchronization purpose)
@@ -37,6 +46,7 @@ struct HexQueue
     char* buf;                          // point to queue data buffer
     size_t size;                        // queue total size (exclude header size)
     int id;                             // queue identifier
+    struct HexQueueRing* ring;          // MPSC: point to queue header (NULL for mq based queues)
 };
 
 typedef struct HexQueue *HexQueue_t;
@@ -61,14 +71,48 @@ int HexQueueRelease(HexQueue_t q, size_t size);
 
 int HexQueueWait(int mqd, int* qid, int* type, const struct timespec* abs_timeout);
 
+// Wait like HexQueueWait() then collect up to count already queued notifications without blocking
+// Return the number of notifications stored in qids/types
+int HexQueueWaitMany(int mqd, int* qids, int* types, int count, const struct timespec* abs_timeout);
+
 ssize_t HexQueueReceive(HexQueue_t q, char* msg, size_t size);
 
+// Zero-copy access to the next message without removing it from the queue
+// spans[0] and, if the message wraps around the end of the queue, spans[1] point into shared memory
+// type (optional) is set like the types of HexQueueReceiveBatch()
+// Return the number of spans (1 or 2), or HEX_QUEUE_EMPTY/HEX_QUEUE_ERROR
+int HexQueuePeek(HexQueue_t q, struct iovec spans[2], int* type);
+
+// Remove the message returned by HexQueuePeek() once it has been processed
+// The spans must not be used afterwards
+int HexQueueConsume(HexQueue_t q);
+
+// Receive up to count messages packed (aligned) into buf, at most size bytes in total
+// msgs[i] points to the i-th message in buf, types[i] (optional) is its type for mpsc queues
+// and -1 for mq based queues whose types come with the HexQueueWait/HexQueueWaitMany notifications
+// For mq based queues count must not exceed the number of notifications received for q, since a
+// message whose notification could not be sent yet is withdrawn by its sender
+// Return the number of messages received, or HEX_QUEUE_EMPTY/HEX_QUEUE_BUFFER_TOO_SMALL/HEX_QUEUE_ERROR
+int HexQueueReceiveBatch(HexQueue_t q, char* buf, size_t size, struct iovec* msgs, int* types, int count);
+
+// Same as above, except each message is received into its own vec[i] buffer and vec[i].iov_len
+// is set to the message length
+int HexQueueReceiveV(HexQueue_t q, struct iovec* vec, int* types, int count);
+
 int HexQueueFini(int mqd);
 
+// Allocate a multi-producer queue that needs no message queue
+HexQueue_t HexQueueAllocMpsc(const char* qname, size_t qsize);
+
+// Wait for the next message of a multi-producer queue and return its queue id and type
+int HexQueueWaitMpsc(HexQueue_t q, int* qid, int* type, const struct timespec* abs_timeout);
+
 // Client APIs
 
 HexQueue_t HexQueueAttach(const char* mqname, const char* qname, size_t qsize);
 
+HexQueue_t HexQueueAttachMpsc(const char* qname, size_t qsize);
+
 void HexQueueDetach(HexQueue_t q);
 
 int HexQueueSend(HexQueue_t q, const void* ev, size_t len);
@@ -21,6 +21,8 @@ struct HexTableShm
 
 typedef struct HexTableShm* HexTableShm_t;
 
+struct HexTableSeq;
+
 struct HexTable
 {
     char* shmName;
@@ -28,6 +30,7 @@ struct HexTable
     size_t size;
     sem_t* sem;
     HexTableShm_t shmPtr;
+    struct HexTableSeq* seq;    // snapshot tables only (NULL for semaphore based tables)
 };
 
 typedef struct HexTable* HexTable_t;
@@ -35,12 +38,20 @@ typedef struct HexTable* HexTable_t;
 enum {
     HEX_TABLE_SUCCESS = 0,
     HEX_TABLE_ERROR = -1,
-    HEX_TABLE_TOO_SMALL = -2
+    HEX_TABLE_TOO_SMALL = -2,
+    HEX_TABLE_UNCHANGED = -3
 };
 
 // Producer API
 HexTable_t HexTableProdInit(const char* name, size_t size);
 
+// Snapshot table: lock-free alternative to HexTableProdInit()
+// The producer publishes into two alternating buffers guarded by sequence counters
+// and never waits for consumers; consumers retry when a write overlapped their read.
+// Consumers attach with HexTableConsInit() as usual.
+// There must be only one producer per table.
+HexTable_t HexTableProdInitSnapshot(const char* name, size_t size);
+
 void HexTableProdFini(HexTable_t s);
 
 int HexTableProdWrite(HexTable_t s, const char* msg, size_t len);
@@ -54,10 +65,20 @@ void HexTableConsFini(HexTable_t s);
 
 ssize_t HexTableConsRead(HexTable_t s, char* msg, size_t size);
 
+// Generation of a snapshot table (always 0 for semaphore based tables): it grows by one with
+// each write published and starts past that of a previous producer of the table, or from the
+// time if there was none, so it does not repeat across producer restarts
+uint64_t HexTableGeneration(HexTable_t s);
+
+// Same as HexTableConsRead(), except return HEX_TABLE_UNCHANGED without copying if the table
+// is still at *generation. On success *generation is set to the generation that was read.
+ssize_t HexTableConsReadGen(HexTable_t s, char* msg, size_t size, uint64_t* generation);
+
 // Alternate "Direct" API - get direct access to shm.  Only use if
 // you treat the table area as an array of uint64_t and do atomic
 // updates on invidual counters via GCC intrinsics
 // (e.g. __sync_add_and_fetch) or similar mechanism.
+// Not available for snapshot tables (returns NULL).
 volatile uint64_t* HexTableArea(HexTable_t s);
 
 #ifdef __cplusplus
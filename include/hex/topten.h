@@ -6,14 +6,19 @@
 // Config API requires C++
 #ifdef __cplusplus
 
-#include <algorithm>
+#include <cstdint>
 #include <ctime> // time_t
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace hex_sdk {
 
 // Array of top ten most frequently occuring events
+// Keys are tracked with the Space-Saving algorithm: with more distinct keys
+// than maxEntries, a new key replaces the one with the smallest count, so
+// frequent keys stay in the list and updates take O(log maxEntries)
 class TopTen {
 public:
     TopTen(size_t maxEntries = 1024,
@@ -33,10 +38,19 @@ public:
         size_t counts[10];
     };
 
+    ~TopTen();
+
     void getResults(Results& results) const;
 
+    // The cache is a binary snapshot at path, which is mmapped when loading,
+    // and a log of changes since then at path.log0 or path.log1
+    // housekeeping() appends to the log and once it outgrows the snapshot,
+    // writes a new snapshot in the background
+
+    // Write a new snapshot now
     bool serialize(const char *path);
 
+    // Load the snapshot and replay the log (or read the older format)
     bool deserialize(const char *path);
 
 private:
@@ -49,6 +63,7 @@ private:
     const time_t m_interval;
 
     // Maximum age of entries in the list
+    // Also the half-life of counts: an event this old counts half
     const time_t m_maxAge;
 
     // True if top ten list has been modified since it was last serialized
@@ -57,109 +72,125 @@ private:
     // Time of last housekeeping
     time_t m_timeLastHousekeeping;
 
+    // Counts are kept with forward decay: an event at time t weighs
+    // 2^((t - m_landmark) / m_maxAge), so counts of different keys stay
+    // comparable without touching every entry as time passes
+    time_t m_landmark;
+
+    // Most recent event time, counts are reported as of this time
+    time_t m_latestTime;
+
+    // Cache file state
+    // Each snapshot starts a new generation of the log; the snapshot of
+    // generation g includes all changes logged by earlier generations
+    std::string m_cachePath;
+    uint64_t m_generation;
+    int m_logFd;
+    size_t m_logSize;
+    size_t m_snapshotSize;
+
+    // True if the next write must be a snapshot, e.g. after clear()
+    bool m_needSnapshot;
+
+    // Background snapshot writer, see compact()
+    struct Compaction;
+    Compaction *m_compaction;
+
+    // Space-Saving entry: weight overestimates the key's decayed count by at
+    // most error, the weight of the entry it evicted
     struct Data {
-        Data() : key(), eventTime(0), count(0) { }
-        Data(const std::string& k, time_t t, size_t c)
-            : key(k), eventTime(t), count(c) { }
+        Data() : key(), eventTime(0), weight(0), error(0), heapIndex(0),
+                 dirty(false), persisted(false) { }
         std::string key;
         time_t eventTime;
-        size_t count;
+        double weight;
+        double error;
+        size_t heapIndex;
+        bool dirty;      // changed since last written to the cache
+        bool persisted;  // key is in the cache, so its removal is logged
     };
 
-    // Array of entries in unsorted order
-    // Some holes may exist in the array as indicated by the free list
+    // Entries, some of which are free as indicated by the free pool
     typedef std::vector<Data> DataArray;
     DataArray m_dataArray;
 
-    // Array of indices into data vector sorted by keys in ascending order
-    typedef std::vector<Data *> KeyArray;
-    KeyArray m_keyArray;
+    // Entries by key
+    typedef std::unordered_map<std::string_view, Data *> KeyMap;
+    KeyMap m_keyMap;
 
-    // Array of indices into data vector sorted chronologically by event time in
-    // ascending order (oldest/smallest-value first)
-    typedef std::vector<Data *> EventTimeArray;
-    EventTimeArray m_eventTimeArray;
+    // Min-heap of entries by weight: the root is evicted when full
+    typedef std::vector<Data *> Heap;
+    Heap m_heap;
 
     // Array of indices into data vector for freed locations
     typedef std::vector<Data *> FreePool;
     FreePool m_freePool;
 
-    // Comparison functionals
+    // Entries changed and persisted keys removed since last written to the cache
+    std::vector<Data *> m_dirtyList;
+    std::vector<std::string> m_removedKeys;
 
-    // Sort by keys only in ascending order
-    struct KeyLess {
-        bool operator()(const Data *x, const Data *y) { return x->key.compare(y->key) < 0; }
-    };
-
-    // Sort by event time in descending order
-    struct EventTimeGreater {
-        // Oldest elements will have the lowest time value in seconds since the Epoch
-        bool operator()(const Data *x, const Data *y) { return (x->eventTime > y->eventTime); }
-    };
+    // Comparison functionals
 
-    // Sort by count in descending order
+    // Sort by guaranteed count in descending order
     // and then by event times in descending order (most recent first) if counts are equal
     // and then by keys in ascending order if event times are equal
     struct CountGreater {
-        bool operator()(const Data& x, const Data& y) {
-            return ((x.count == y.count) ?
-                    ((x.eventTime == y.eventTime) ?
-                     (x.key.compare(y.key) < 0) :
-                     (x.eventTime > y.eventTime)) :
-                    (x.count > y.count));
+        bool operator()(const Data *x, const Data *y) {
+            double cx = x->weight - x->error, cy = y->weight - y->error;
+            return ((cx == cy) ?
+                    ((x->eventTime == y->eventTime) ?
+                     (x->key.compare(y->key) < 0) :
+                     (x->eventTime > y->eventTime)) :
+                    (cx > cy));
         }
     };
 
     // Internal methods
 
-    // Search for location where key can be inserted to preserve sorted order
-    // or return location where key already exists
-    KeyArray::iterator findKey(const std::string& key);
+    // Decay factor of an event at eventTime
+    double decay(time_t eventTime) const;
+
+    // Move the landmark to currTime, rescaling all weights
+    void rebase(time_t currTime);
+
+    // Restore heap order for an entry whose weight decreased or increased
+    void siftUp(size_t i);
+    void siftDown(size_t i);
+
+    // Remove entry from the list and put it back onto the free pool
+    void remove(Data *pData);
+
+    // Cache changes of an entry, or the removal of its key
+    void markDirty(Data *pData);
+    void markRemoved(Data *pData);
 
-    // Search for location where event time can be inserted to preserve sorted order
-    EventTimeArray::iterator findEventTime(time_t eventTime);
+    // Set an entry as loaded from the cache, taking over the lightest entry
+    // if full and lighter
+    void restore(const std::string& key, time_t eventTime, double weight, double error);
 
-    // Search for the event time in the event time list
-    // Return location of current data element
-    EventTimeArray::iterator findEventTime(Data *pData);
+    // Write the changes to the cache, as a snapshot if the log grew too big
+    bool flush(const char *path);
 
-    // Remove oldest entry and return iterator to key removed
-    KeyArray::iterator removeOldest();
+    // Append the changes to the log
+    bool appendLog(const char *path);
+
+    // Write a snapshot of the current state and start a new log generation,
+    // in the background unless wait
+    bool compact(const char *path, bool wait);
+
+    // Wait for the background snapshot writer, false if it failed
+    bool joinCompaction();
+
+    // Replay the log of a generation, false if it does not exist
+    bool replayLog(const std::string& logPath, uint64_t generation);
+
+    // Read the format from before snapshots
+    bool deserializeLegacy(const char *path);
 
     void check();
 };
 
-// Inline methods
-
-inline
-TopTen::KeyArray::iterator TopTen::findKey(const std::string& key)
-{
-    Data data(key, 0, 0);
-    return std::lower_bound(m_keyArray.begin(), m_keyArray.end(),
-                            &data, KeyLess());
-}
-
-inline
-TopTen::EventTimeArray::iterator TopTen::findEventTime(time_t eventTime)
-{
-    Data data(std::string(), eventTime, 0);
-    return std::lower_bound(m_eventTimeArray.begin(), m_eventTimeArray.end(),
-                            &data, EventTimeGreater());
-}
-
-inline
-TopTen::EventTimeArray::iterator TopTen::findEventTime(Data *pData)
-{
-    TopTen::EventTimeArray::iterator it;
-    // Binary search for beginning of range of elements that have same event time
-    it = std::lower_bound(m_eventTimeArray.begin(), m_eventTimeArray.end(),
-                          pData, EventTimeGreater());
-    // Linear search for this specific data element
-    while (it != m_eventTimeArray.end() && *it != pData && (*it)->eventTime == pData->eventTime)
-        ++it;
-    return it;
-}
-
 } // namespace hex_sdk
 
 #endif // __cplusplus
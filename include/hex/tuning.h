@@ -17,6 +17,13 @@ typedef struct HexTuning *HexTuning_t;
 
 HexTuning_t HexTuningAlloc(FILE *stream);
 
+// Parse settings held in memory. The buffer must outlive the tuning.
+HexTuning_t HexTuningAllocBuffer(const char *buf, size_t len);
+
+// Parse settings from a read-only mapping of the file at "path"
+// Returns NULL with errno set if the file could not be opened or mapped
+HexTuning_t HexTuningAllocMapped(const char *path);
+
 void HexTuningRelease(HexTuning_t tuning);
 
 enum {
@@ -37,6 +44,18 @@ int HexTuningParseLine(HexTuning_t tuning, const char **name, const char **value
 int HexTuningParseLineWithD(HexTuning_t tuning, const char **name, const char **value, const char dlmtr);
 int HexTuningCurrLine(HexTuning_t tuning);
 
+// Byte offset of the next line to be parsed, or -1 on error
+long HexTuningCurrOffset(HexTuning_t tuning);
+
+// Zero-copy variant of HexTuningParseLine() for tunings allocated with HexTuningAllocBuffer()
+// or HexTuningAllocMapped(). Name and value are returned as (pointer, length) slices that are
+// not null terminated. They point into the buffer, except for quoted values containing escaped
+// quotes, which are unescaped into the tuning and only valid until the next call.
+int HexTuningParseSlice(HexTuning_t tuning, const char **name, size_t *nameLen,
+                        const char **value, size_t *valueLen);
+int HexTuningParseSliceWithD(HexTuning_t tuning, const char **name, size_t *nameLen,
+                             const char **value, size_t *valueLen, const char dlmtr);
+
 bool HexMatchPrefix(const char *name, const char *prefix, const char **p);
 
 #ifdef __cplusplus
@@ -0,0 +1,166 @@
+// HEX SDK
+
+#ifndef HEX_ZIP_H
+#define HEX_ZIP_H
+
+// Zip API requires C++
+#ifdef __cplusplus
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// Write a zip archive in a single pass
+//
+// Files are deflated on a pool of threads while the archive is written in the
+// order entries were added, each entry once, then the central directory, so
+// nothing in the archive is rewritten. Entries keep the mode, owner and
+// modification time of what they were added from, and symbolic links are
+// stored as links, as zip(1) and unzip(1) do.
+//
+//     HexZipWriter zip;
+//     if (!zip.open("/tmp/out.zip") ||
+//         !zip.add("/etc/policies", "etc/policies") ||
+//         !zip.close())
+//         HexLogError(...);
+class HexZipWriter {
+public:
+    // Deflate on "threads" threads (0: one per online CPU) at "level" (1-9)
+    HexZipWriter(size_t threads = 0, int level = 6);
+
+    // An archive not closed yet is left incomplete
+    ~HexZipWriter();
+
+    // Create or truncate the archive
+    bool open(const char *path);
+
+    // Add the file, symbolic link or directory with everything under it at
+    // "path", named "name" in the archive (leading slashes are dropped)
+    // An empty name adds what is in directory "path" named relative to it
+    // Names already in the archive are skipped, as are sockets, fifos and devices
+    // Return false if anything could not be read, which is left out
+    bool add(const std::string &path, const std::string &name);
+
+    // Add the paths matching "pattern" (with wildcards) under their own names
+    // Return false if anything could not be read, which is left out
+    bool addPattern(const char *pattern);
+
+    // Add "data" as a regular file named "name", owned by the caller
+    bool addData(const std::string &name, const std::string &data, mode_t mode = 0644);
+
+    // Write the rest of the entries and the central directory
+    // Return false if the archive could not be written in full, or a file
+    // added could not be read in full when its turn came
+    bool close();
+
+    // Number of entries written so far
+    size_t entries() const;
+
+private:
+    struct Entry;
+    struct Central;
+
+    // An entry ready to write as it is, with nothing to read
+    static Entry* newEntry(const std::string &name, const std::string &path, const struct stat &st);
+    static void* worker(void *arg);
+
+    void enqueue(Entry *entry);
+    void compress(Entry *entry);
+    void writeReady(bool all);
+    void writeEntry(Entry *entry);
+    void writeStreamed(Entry *entry);
+    void writeCentral();
+    void output(const void *data, size_t len);
+
+    const int m_level;
+    size_t m_numThreads;
+    std::vector<pthread_t> m_threads;
+
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_workCond;
+    pthread_cond_t m_doneCond;
+    bool m_stop;
+
+    // Entries in archive order, written from the front once compressed;
+    // m_pending is the next one for a worker to take
+    std::deque<Entry*> m_queue;
+    size_t m_pending;
+    size_t m_queuedBytes;
+
+    std::set<std::string> m_names;
+    std::vector<Central> m_central;
+
+    std::string m_path;
+    struct stat m_archive;
+    FILE *m_fp;
+    uint64_t m_offset;
+    bool m_ok;
+};
+
+// Read a zip archive and extract its entries
+//
+// Entries are listed from the central directory when the archive is opened
+// and extracted with the mode and modification time they were added with,
+// as unzip(1) does. Deflated and stored entries are checked against their
+// CRC. Names that are absolute or lead out of the directory extracted to
+// with ".." or through a symbolic link are refused.
+//
+//     HexZipReader zip;
+//     if (!zip.open("/tmp/in.zip") || !zip.extractAll("/tmp/dir"))
+//         HexLogError(...);
+class HexZipReader {
+public:
+    struct Entry {
+        // Name in the archive, with a trailing slash for directories
+        std::string name;
+        mode_t mode;
+        uid_t uid;
+        gid_t gid;
+        time_t mtime;
+        uint64_t size;
+        uint64_t csize;
+        uint32_t crc;
+        uint16_t method;
+        // Offset of the local header
+        uint64_t offset;
+    };
+
+    HexZipReader();
+    ~HexZipReader();
+
+    // Open the archive and read its central directory
+    bool open(const char *path);
+
+    const std::vector<Entry>& entries() const { return m_entries; }
+
+    // Write the contents of regular file entry "index" to "fd"
+    bool extract(size_t index, int fd);
+
+    // Create entry "index" at "path", replacing what is there, with the
+    // entry's mode and modification time
+    // Missing parent directories are created
+    bool extract(size_t index, const std::string &path);
+
+    // Extract every entry under "dir", setting directory modes and times last
+    // Return false if anything could not be extracted, which is left out
+    bool extractAll(const char *dir);
+
+private:
+    bool readCentral();
+    bool dataOffset(const Entry &entry, uint64_t &offset);
+
+    std::string m_path;
+    int m_fd;
+    std::vector<Entry> m_entries;
+};
+
+#endif // __cplusplus
+
+#endif /* endif HEX_ZIP_H */
@@ -63,7 +63,7 @@ HEX_EXPORT_VARS += HEX_PKGDIR HEX_DISTDIR HEX_REPODIR HEX_OSSDIR HEX_THIRDPARTYD
 # otherwise link statically to simplify testing
 HEX_SDK_LIB_ARCHIVE := $(HEX_LIBDIR)/libhex_sdk.a
 HEX_SDK_LIB_SO      := $(HEX_LIBDIR)/libhex_sdk.so
-HEX_SDK_LDLIBS      := -lrt -lyaml -lglib-2.0 -lreadline -lcrypt -lcrypto -lssl -lpthread
+HEX_SDK_LDLIBS      := -lrt -lyaml -lglib-2.0 -lreadline -lcrypt -lcrypto -lssl -lz -lpthread
 ifeq ($(PRODUCTION),1)
 HEX_SDK_LIB := $(HEX_SDK_LIB_SO)
 else
@@ -11,6 +11,7 @@ MINI_PKGS += coreutils dmidecode e2fsprogs e2fsprogs-libs fuse-libs glibc libblk
 # kexec-tools for kernel dump userspace component
 # basic tools: hostname, cpio, less, tree, ncurses
 # openssl-devel libyaml-devel glib2-devel for hex_config
+# zlib-devel for hex_sdk zip archives
 # openssl for hex_install
 # e2fsprogs for mkfs.ext4
 # xfsprogs for mkfs.xfs
@@ -30,7 +31,7 @@ MINI_PKGS += coreutils dmidecode e2fsprogs e2fsprogs-libs fuse-libs glibc libblk
 #     grub2-efi-modules-x64
 #     shim-x64
 #  libyaml-devel
-BASE_PKGS += kmod kexec-tools hostname cpio less tree ncurses openssl-devel glib2-devel openssl e2fsprogs xfsprogs dosfstools parted glibc-locale-source glibc-langpack-en pciutils ethtool efibootmgr mg passwd
+BASE_PKGS += kmod kexec-tools hostname cpio less tree ncurses openssl-devel glib2-devel zlib-devel openssl e2fsprogs xfsprogs dosfstools parted glibc-locale-source glibc-langpack-en pciutils ethtool efibootmgr mg passwd
 
 CENTOS_MIRROR := https://mirror.stream.centos.org/9-stream/BaseOS/x86_64/os/Packages
 DISTRO := el9
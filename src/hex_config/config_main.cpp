@@ -1,11 +1,15 @@
 // HEX SDK
 
 #include <errno.h>
+#include <limits.h>
 #include <glob.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <getopt.h> // getopt_long
 #include <time.h>
 #include <chrono>
+#include <algorithm>
 #include <arpa/inet.h>
 
 #include <hex/log.h>
@@ -22,9 +26,12 @@
 #include <hex/postscript_util.h>
 #include <hex/process_util.h>
 #include <hex/license.h>
+#include <hex/zip.h>
 
 #include "config_main.h"
 #include "snapshot.h"
+#include "snapshot_store.h"
+#include "trace.h"
 
 using std::chrono::high_resolution_clock;
 using std::chrono::duration_cast;
@@ -57,11 +64,22 @@ static const char TEMP_NEW_SETTINGS[]   = "/tmp/settings.new";
 static const char TEMP_RAW_TUNINGS[]   = "/tmp/tunings.raw";
 static const char POST_DIR[] = "/etc/hex_config/post.d";
 
+// Per-module digests and line index of boot settings from the last successful commit
+static const char SETTINGS_DIGEST[] = "/etc/settings.digest";
+
 static const bool PARSE_CURRENT = false;
 static const bool PARSE_NEW     = true;
 static const bool PARSE_SYSTEM = true;
 static const bool PARSE_NONSYSTEM = false;
 
+// Commit worker pool size defaults to twice the online CPUs, but no less than
+// MIN_COMMIT_JOBS since most modules spend their commit waiting on child processes
+static const int MIN_COMMIT_JOBS = 16;
+static const int MAX_COMMIT_JOBS = 256;
+
+// Seconds a support command may run before it is killed, unless given to create_support_info
+static const int SUPPORT_COMMAND_TIMEOUT = 5 * 60;
+
 static const std::string START_MODULE = "sys";
 static const std::string END_MODULE = "done";
 
@@ -72,6 +90,21 @@ static bool s_commit = false;
 static bool s_validateOnly = false;
 static bool s_rebootNeeded = false;
 static bool s_lmiRestartNeeded = false;
+static bool s_incremental = false;
+
+// Maximum number of modules committed concurrently
+static size_t s_commitJobs = 0;
+
+// Incremental commit state
+// Only modules in the active set are validated, prepared and committed,
+// and only settings of modules in the parsed set are fed to parse functions
+static bool s_incrementalParse = false;
+static ActiveSet s_activeModules;
+static ActiveSet s_parsedModules;
+
+// Index of the settings file that becomes the boot settings on success
+static bool s_indexed = false;
+static SettingsIndex s_newIndex;
 
 #if !defined(SHUTDOWN_DELAY)
 #define SHUTDOWN_DELAY 10
@@ -671,7 +704,9 @@ SupportFile::SupportFile(const char *pattern)
     StaticsInit();
     if (pattern == NULL)
         HexLogFatal("CONFIG_SUPPORT_FILE pattern cannot be null.");
-    s_staticsPtr->supportFileSet.insert(pattern);
+    SupportList& files = s_staticsPtr->supportFileList;
+    if (std::find(files.begin(), files.end(), pattern) == files.end())
+        files.push_back(pattern);
 }
 
 SupportCommand::SupportCommand(const char *command)
@@ -679,7 +714,9 @@ SupportCommand::SupportCommand(const char *command)
     StaticsInit();
     if (command == NULL)
         HexLogFatal("CONFIG_SUPPORT_COMMAND command cannot be null.");
-    s_staticsPtr->supportCommandSet.insert(command);
+    SupportList& cmds = s_staticsPtr->supportCommandList;
+    if (std::find(cmds.begin(), cmds.end(), command) == cmds.end())
+        cmds.push_back(command);
 }
 
 SupportCommand::SupportCommand(const char *command, const char *file)
@@ -692,8 +729,12 @@ SupportCommand::SupportCommand(const char *command, const char *file)
     std::string newCommand = command;
     newCommand += " > ";
     newCommand += file;
-    s_staticsPtr->supportCommandSet.insert(newCommand.c_str());
-    s_staticsPtr->supportFileSet.insert(file);
+    SupportList& cmds = s_staticsPtr->supportCommandList;
+    if (std::find(cmds.begin(), cmds.end(), newCommand) == cmds.end())
+        cmds.push_back(newCommand);
+    SupportList& files = s_staticsPtr->supportFileList;
+    if (std::find(files.begin(), files.end(), file) == files.end())
+        files.push_back(file);
 }
 
 Migrate::Migrate(const char *module, MigrateFunc migrate, bool is_post)
@@ -870,7 +911,11 @@ Usage()
                     "-v\n--verbose\n\tEnable verbose debug messages. Can be specified multiple times.\n"
                     "-e\n--stderr\n\tLog messages to stderr in addition to syslog.\n"
                     "-l\n--dryLevel={0,2}\n\tEnable dry run level.\n"
-                    "-P\n--pub_tuning\n\tDump published tuning parameters.\n",
+                    "-P\n--pub_tuning\n\tDump published tuning parameters.\n"
+                    "-i\n--incremental\n\tOnly parse, prepare and commit modules whose settings changed since the last commit.\n"
+                    "-j\n--jobs=N\n\tCommit at most N modules, or run at most N support commands, concurrently.\n"
+                    "--trace=FILE\n\tWrite a timeline of module init, parse, validate, prepare and commit phases\n"
+                    "\tto FILE in Chrome trace event format.\n",
                     PROGRAM);
 
     // Undocumented usage:
@@ -901,6 +946,7 @@ static bool
 InitModules()
 {
     HexLogDebugN(FWD, "Initializing modules");
+    TraceScope trace("stage", "init");
 
     ModuleMap& mm = s_staticsPtr->moduleMap;
     CommitOrderList& col = s_staticsPtr->commitOrderList;
@@ -915,6 +961,7 @@ InitModules()
 
         if (it2->second.init != NULL) {
             HexLogDebugN(RRA, "Initializing module %s", it->module.c_str());
+            TraceScope trace("init", it->module.c_str());
             if (it2->second.init() == false) {
                 HexLogError("Module %s failed to initialize", it->module.c_str());
                 return false;
@@ -925,26 +972,224 @@ InitModules()
     return true;
 }
 
+static inline bool
+IsModuleActive(const std::string& module)
+{
+    return !s_incrementalParse || s_activeModules.find(module) != s_activeModules.end();
+}
+
+static inline bool
+IsModuleParsed(const std::string& module)
+{
+    return !s_incrementalParse || s_parsedModules.find(module) != s_parsedModules.end();
+}
+
+static void
+IndexLine(SettingsIndex *index, const std::string& module, const char *name, const char *value,
+          long start, long end)
+{
+    SettingsIndexInfo& info = index->modules[module];
+    if (info.ctx == NULL) {
+        info.ctx = EVP_MD_CTX_new();
+        if (info.ctx == NULL || EVP_DigestInit_ex(info.ctx, EVP_sha1(), NULL) == 0)
+            HexLogFatal("Message digest failed to initialize");      // COV_IGNORE
+    }
+
+    if (EVP_DigestUpdate(info.ctx, name, strlen(name)) == 0 ||
+        EVP_DigestUpdate(info.ctx, value, strlen(value)) == 0) {
+        HexLogFatal("Could not update message digest");       // COV_IGNORE
+    }
+
+    // Each range starts where the previous setting ended, so a module's consecutive lines extend one range
+    if (!info.ranges.empty() && info.ranges.back().offset + info.ranges.back().length == start)
+        info.ranges.back().length += end - start;
+    else
+        info.ranges.push_back(SettingsRange{start, end - start});
+}
+
+static void
+IndexFinalize(SettingsIndex *index)
+{
+    for (SettingsIndexMap::iterator it = index->modules.begin(); it != index->modules.end(); ++it) {
+        if (it->second.ctx == NULL)
+            continue;
+
+        unsigned char value[SHA_DIGEST_LENGTH];
+        unsigned int len = 0;
+        if (EVP_DigestFinal_ex(it->second.ctx, value, &len) == 0)
+            HexLogFatal("Could not finalize message digest"); // COV_IGNORE
+        EVP_MD_CTX_free(it->second.ctx);
+        it->second.ctx = NULL;
+
+        char hex[2 * SHA_DIGEST_LENGTH + 1];
+        for (unsigned int i = 0; i < len; ++i)
+            snprintf(hex + 2 * i, 3, "%02x", value[i]);
+        it->second.digest.assign(hex, 2 * len);
+    }
+}
+
 static bool
-ParseLines(HexTuning_t tun, bool isNew, bool isSystem, MergeSet *mergeSet, FILE *mergeOutput)
+LoadSettingsIndex(SettingsIndex *index)
+{
+    FILE *fin = fopen(SETTINGS_DIGEST, "re");
+    if (!fin)
+        return false;
+
+    long size, ino, sec, nsec;
+    bool success = (fscanf(fin, "%ld %ld %ld %ld\n", &size, &ino, &sec, &nsec) == 4);
+
+    char module[256], digest[2 * SHA_DIGEST_LENGTH + 1];
+    while (success && fscanf(fin, "%255s %40s", module, digest) == 2) {
+        SettingsIndexInfo& info = index->modules[module];
+        info.digest = digest;
+
+        SettingsRange r;
+        int c;
+        while (fscanf(fin, "%ld:%ld", &r.offset, &r.length) == 2) {
+            info.ranges.push_back(r);
+            if ((c = fgetc(fin)) != ',') {
+                success = (c == '\n');
+                break;
+            }
+        }
+    }
+    fclose(fin);
+
+    // Index is only usable if boot settings haven't been touched since it was written
+    struct stat st;
+    if (!success || stat(BOOT_SETTINGS, &st) != 0 ||
+        st.st_size != size || (long)st.st_ino != ino ||
+        st.st_mtim.tv_sec != sec || st.st_mtim.tv_nsec != nsec) {
+        HexLogDebugN(FWD, "Settings digest is stale or missing");
+        return false;
+    }
+
+    for (SettingsIndexMap::iterator it = index->modules.begin(); it != index->modules.end(); ++it) {
+        for (SettingsRangeList::iterator rit = it->second.ranges.begin(); rit != it->second.ranges.end(); ++rit) {
+            if (rit->offset < 0 || rit->length <= 0 || rit->offset + rit->length > size)
+                return false;
+        }
+    }
+
+    index->size = size;
+    return true;
+}
+
+static void
+SaveSettingsIndex(bool renamed)
+{
+    if (!s_indexed)
+        return;
+
+    IndexFinalize(&s_newIndex);
+
+    // When new settings were renamed into place only the content (size) can be checked
+    struct stat st;
+    if (stat(BOOT_SETTINGS, &st) != 0 || st.st_size != s_newIndex.size ||
+        (!renamed && (st.st_ino != s_newIndex.ino ||
+                      st.st_mtim.tv_sec != s_newIndex.mtime.tv_sec ||
+                      st.st_mtim.tv_nsec != s_newIndex.mtime.tv_nsec))) {
+        HexLogWarning("Boot settings changed during commit, discarding settings digest");
+        unlink(SETTINGS_DIGEST);
+        return;
+    }
+
+    std::string tmp = std::string(SETTINGS_DIGEST) + ".tmp";
+    FILE *fout = fopen(tmp.c_str(), "we");
+    if (!fout) {
+        HexLogWarning("Could not create settings digest: %s", tmp.c_str());
+        unlink(SETTINGS_DIGEST);
+        return;
+    }
+
+    fprintf(fout, "%ld %ld %ld %ld\n", (long)st.st_size, (long)st.st_ino,
+            (long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec);
+    for (SettingsIndexMap::iterator it = s_newIndex.modules.begin(); it != s_newIndex.modules.end(); ++it) {
+        fprintf(fout, "%s %s ", it->first.c_str(), it->second.digest.c_str());
+        SettingsRangeList& rl = it->second.ranges;
+        for (SettingsRangeList::iterator rit = rl.begin(); rit != rl.end(); ++rit)
+            fprintf(fout, "%s%ld:%ld", rit == rl.begin() ? "" : ",", rit->offset, rit->length);
+        fprintf(fout, "\n");
+    }
+
+    if (fclose(fout) != 0 || rename(tmp.c_str(), SETTINGS_DIGEST) != 0) {
+        HexLogWarning("Could not save settings digest: %s", SETTINGS_DIGEST);
+        unlink(tmp.c_str());
+        unlink(SETTINGS_DIGEST);
+    }
+}
+
+static bool
+StatSettingsIndex(const char *settings, SettingsIndex *index)
+{
+    struct stat st;
+    if (stat(settings, &st) != 0)
+        return false;
+
+    index->size = st.st_size;
+    index->ino = st.st_ino;
+    index->mtime = st.st_mtim;
+    s_indexed = true;
+    return true;
+}
+
+// Update module's message digest and pass one setting to all of the interested parse functions
+static bool
+ParseLine(ModuleMap::iterator it, const char *name, const char *value, bool isNew, int line)
+{
+    if (!IsModuleParsed(it->first))
+        return true;
+
+    // Update message digest with both name and value
+    MessageDigest *digest = (isNew ? &it->second.newDigest : &it->second.currentDigest);
+    if (EVP_DigestUpdate(digest->ctx, name, strlen(name)) == 0 ||
+        EVP_DigestUpdate(digest->ctx, value, strlen(value)) == 0) {
+        HexLogFatal("Could not update message digest");       // COV_IGNORE
+    }
+
+    TraceScope trace("parse", it->first.c_str());
+    ParseList& pl = it->second.parseList;
+    for (ParseList::iterator plit = pl.begin(); plit != pl.end(); ++plit) {
+        if (!IsModuleActive(plit->module))
+            continue;
+
+        HexLogDebugN(DMP, "Module %s parse %s=%s, isNew=%s",
+                          plit->module.c_str(), name, value, isNew ? "yes" : "no");
+        if (plit->parse(name, value, isNew) == false) {
+            HexLogError("Module %s failed to parse line %d", plit->module.c_str(), line);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Tokenize settings into the image, dropping lines that no module can parse
+static bool
+LoadLines(HexTuning_t tun, long base, bool isSystem, SettingsImage *image)
 {
     ModuleMap& mm = s_staticsPtr->moduleMap;
 
     int ret;
     const char *name, *value;
+    size_t nameLen, valueLen;
     std::string prefix;
-    while ((ret = HexTuningParseLine(tun, &name, &value)) != HEX_TUNING_EOF) {
+    long start = HexTuningCurrOffset(tun), end;
+    while ((ret = HexTuningParseSlice(tun, &name, &nameLen, &value, &valueLen)) != HEX_TUNING_EOF) {
         if (ret != HEX_TUNING_SUCCESS) {
             // Malformed, exceeded buffer, etc.
             HexLogError("Malformed tuning parameter at line %d", HexTuningCurrLine(tun));
             return false;
         }
 
+        // Byte range of this setting (including any preceding comments)
+        end = HexTuningCurrOffset(tun);
+        long lineStart = start;
+        start = end;
+
         // Extract module prefix
-        prefix = name;
-        size_t n = prefix.find('.');
-        if (n != std::string::npos)
-            prefix.erase(n);
+        std::string_view nameView(name, nameLen);
+        prefix.assign(nameView.substr(0, nameView.find('.')));
 
         // System parameters cannot appear in non-system settings file
         if (prefix == "sys" && !isSystem) {
@@ -955,78 +1200,87 @@ ParseLines(HexTuning_t tun, bool isNew, bool isSystem, MergeSet *mergeSet, FILE
         ModuleMap::iterator it = mm.find(prefix);
         if (it == mm.end()) {
             // Module not found
-            HexLogWarning("Ignoring unrecognized tuning parameter at line %d: %s", HexTuningCurrLine(tun), name);
+            HexLogWarning("Ignoring unrecognized tuning parameter at line %d: %.*s",
+                          HexTuningCurrLine(tun), (int)nameLen, name);
             continue;
         }
 
-        if (mergeSet) {
-            MergeSet::iterator msit = mergeSet->find(prefix);
-            if (msit != mergeSet->end()) {
-                HexLogDebugN(DMP, "Ignoring: found in merge set");
-                continue;
-            }
+        // Values unescaped by the tuning only last until the next line
+        if (value < image->data || value >= image->data + image->size) {
+            image->unescaped.emplace_back(value, valueLen);
+            value = image->unescaped.back().data();
         }
 
-        if (mergeOutput) {
-            std::string escStr = hex_string_util::escapeDoubleQuote(std::string(value));
-            if (std::string(value) == escStr)
-                fprintf(mergeOutput, "%s = %s\n", name, value);
-            else
-                fprintf(mergeOutput, "%s = \"%s\"\n", name, escStr.c_str());
-        }
+        SettingsEntry entry;
+        entry.module = it;
+        entry.name = nameView;
+        entry.value = std::string_view(value, valueLen);
+        entry.line = HexTuningCurrLine(tun);
+        entry.offset = base + lineStart;
+        entry.length = end - lineStart;
+        image->entries.push_back(entry);
+    }
 
-        // Parse settings with module
-        if (it != mm.end()) {
-            // Update message digest with both name and value
-            MessageDigest *digest = (isNew ? &it->second.newDigest : &it->second.currentDigest);
-            if (EVP_DigestUpdate(digest->ctx, name, strlen(name)) == 0 ||
-                EVP_DigestUpdate(digest->ctx, value, strlen(value)) == 0) {
-                HexLogFatal("Could not update message digest");       // COV_IGNORE
-            }
+    return true;
+}
 
-            ParseList& pl = it->second.parseList;
-            for (ParseList::iterator plit = pl.begin(); plit != pl.end(); ++plit) {
-                HexLogDebugN(DMP, "Module %s parse %s=%s, isNew=%s",
-                                  plit->module.c_str(), name, value, isNew ? "yes" : "no");
-                if (plit->parse(name, value, isNew) == false) {
-                    HexLogError("Module %s failed to parse line %d", plit->module.c_str(), HexTuningCurrLine(tun));
-                    return false;
-                }
-            }
+// Map a settings file into the image
+static bool
+MapSettings(const char *settings, SettingsImage *image)
+{
+    int fd = open(settings, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    // Empty files cannot be mapped
+    if (st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return false;
         }
+        image->map = map;
+        image->data = (const char *)map;
+        image->size = st.st_size;
     }
+    close(fd);
 
     return true;
 }
 
+// Map and tokenize a settings file once so that every parse pass can replay it from memory
 static bool
-ParseSettings(const char *newSettings, bool isNew, bool isSystem, MergeSet *mergeSet, FILE *mergeOutput)
+LoadSettings(const char *settings, bool isSystem, SettingsImage *image)
 {
-    HexLogDebugN(FWD, "Parsing settings: %s", newSettings);
+    HexLogDebugN(FWD, "Loading settings: %s", settings);
 
-    FILE *fin = fopen(newSettings, "re");
-    if (!fin) {
-        if (strcmp(newSettings, BOOT_SETTINGS) == 0 ||
-            strcmp(newSettings, SYSTEM_SETTINGS) == 0) {
+    if (!MapSettings(settings, image)) {
+        if (strcmp(settings, BOOT_SETTINGS) == 0 ||
+            strcmp(settings, SYSTEM_SETTINGS) == 0) {
             // It's ok if the system settings file or the settings file does not exist
             HexLogDebugN(FWD, "Settings does not exist, skipping");
             return true;
         } else {
             // User supplied file must exist
-            HexLogError("Could not open settings file: %s", newSettings);
+            HexLogError("Could not open settings file: %s", settings);
             return false;
         }
     }
 
-    HexTuning_t tun = HexTuningAlloc(fin);
+    HexTuning_t tun = HexTuningAllocBuffer(image->data, image->size);
     if (!tun) {
         HexLogError("malloc failed"); // COV_IGNORE
-        return EXIT_FAILURE;
+        return false;
     }
 
-    bool success = ParseLines(tun, isNew, isSystem, mergeSet, mergeOutput);
+    bool success = LoadLines(tun, 0, isSystem, image);
     HexTuningRelease(tun);
-    fclose(fin);
 
     if (!success)
         HexLogError("Parsing failed");
@@ -1034,42 +1288,213 @@ ParseSettings(const char *newSettings, bool isNew, bool isSystem, MergeSet *merg
     return success;
 }
 
+// Write the settings file an image was loaded from to "settings"
+static bool
+WriteSettings(const SettingsImage& image, const char *settings)
+{
+    FILE *fout = fopen(settings, "we");
+    if (!fout)
+        return false;
+
+    bool success = fwrite(image.data, 1, image.size, fout) == image.size;
+    return (fclose(fout) == 0) && success;
+}
+
+// Feed the settings in an image to the interested parse functions
+static bool
+ReplaySettings(const SettingsImage& image, bool isNew, MergeSet *mergeSet, FILE *mergeOutput,
+               SettingsIndex *index)
+{
+    // Modules expect null terminated strings, so each setting is copied out as it is replayed
+    std::string nameStr, valueStr;
+    for (SettingsEntryList::const_iterator eit = image.entries.begin(); eit != image.entries.end(); ++eit) {
+        const std::string& prefix = eit->module->first;
+        nameStr.assign(eit->name);
+        valueStr.assign(eit->value);
+        const char *name = nameStr.c_str();
+        const char *value = valueStr.c_str();
+        long lineStart = eit->offset;
+        long end = eit->offset + eit->length;
+
+        if (mergeSet) {
+            MergeSet::iterator msit = mergeSet->find(prefix);
+            if (msit != mergeSet->end()) {
+                HexLogDebugN(DMP, "Ignoring: found in merge set");
+                continue;
+            }
+        }
+
+        if (mergeOutput) {
+            // Index the merged output since that is what becomes the boot settings
+            lineStart = ftell(mergeOutput);
+            std::string escStr = hex_string_util::escapeDoubleQuote(valueStr);
+            if (valueStr == escStr)
+                fprintf(mergeOutput, "%s = %s\n", name, value);
+            else
+                fprintf(mergeOutput, "%s = \"%s\"\n", name, escStr.c_str());
+            end = ftell(mergeOutput);
+        }
+
+        if (index)
+            IndexLine(index, prefix, name, value, lineStart, end);
+
+        // Parse settings with module
+        if (!ParseLine(eit->module, name, value, isNew, eit->line)) {
+            HexLogError("Parsing failed");
+            return false;
+        }
+    }
+
+    return true;
+}
+
 
 static bool
 ParseSystem()
 {
+    SettingsImage image;
+    if (!LoadSettings(SYSTEM_SETTINGS, PARSE_SYSTEM, &image))
+        return false;
+
     // In bootstrap mode, parse the system settings as if they were new
     if (s_bootstrapOnly)
-        return ParseSettings(SYSTEM_SETTINGS, PARSE_NEW, PARSE_SYSTEM, 0, 0);
+        return ReplaySettings(image, PARSE_NEW, 0, 0, 0);
 
     // Non-bootstrap mode: parse system settings twice as current and new
-    if (ParseSettings(SYSTEM_SETTINGS, PARSE_CURRENT, PARSE_SYSTEM, 0, 0))
-        return ParseSettings(SYSTEM_SETTINGS, PARSE_NEW, PARSE_SYSTEM, 0, 0);
-
-    return false;
+    return ReplaySettings(image, PARSE_CURRENT, 0, 0, 0) &&
+           ReplaySettings(image, PARSE_NEW, 0, 0, 0);
 }
 
 static bool
 ParseBoot()
 {
     // parse boot settings twice as current and new
-    if (ParseSettings(BOOT_SETTINGS, PARSE_CURRENT, PARSE_NONSYSTEM, 0, 0))
-        return ParseSettings(BOOT_SETTINGS, PARSE_NEW, PARSE_NONSYSTEM, 0, 0);
+    SettingsImage image;
+    return LoadSettings(BOOT_SETTINGS, PARSE_NONSYSTEM, &image) &&
+           ReplaySettings(image, PARSE_CURRENT, 0, 0, 0) &&
+           ReplaySettings(image, PARSE_NEW, 0, 0, 0);
+}
 
-    return false;
+
+// Re-parse the given byte ranges of a settings file, in file order
+static bool
+ParseRanges(const char *settings, SettingsRangeList& ranges, bool isNew)
+{
+    if (ranges.empty())
+        return true;
+
+    std::sort(ranges.begin(), ranges.end(),
+              [](const SettingsRange& a, const SettingsRange& b) { return a.offset < b.offset; });
+
+    SettingsImage image;
+    if (!MapSettings(settings, &image)) {
+        HexLogError("Could not open settings file: %s", settings);
+        return false;
+    }
+
+    for (SettingsRangeList::iterator it = ranges.begin(); it != ranges.end(); ++it) {
+        if (it->offset + it->length > (long)image.size) {
+            HexLogError("Settings file changed while parsing: %s", settings);
+            return false;
+        }
+
+        HexTuning_t tun = HexTuningAllocBuffer(image.data + it->offset, it->length);
+        if (!tun) {
+            HexLogError("malloc failed"); // COV_IGNORE
+            return false;
+        }
+
+        bool success = LoadLines(tun, it->offset, PARSE_NONSYSTEM, &image);
+        HexTuningRelease(tun);
+
+        if (!success) {
+            HexLogError("Parsing failed");
+            return false;
+        }
+    }
+
+    return ReplaySettings(image, isNew, 0, 0, 0);
 }
 
+// Only parse modules whose settings differ from the last successful commit, plus their observers
+static bool
+ParseIncremental(SettingsIndex& current, const SettingsImage& newImage)
+{
+    ModuleMap& mm = s_staticsPtr->moduleMap;
+
+    // Index new settings without handing anything to modules
+    s_incrementalParse = true;
+    if (!ReplaySettings(newImage, PARSE_NEW, 0, 0, &s_newIndex) ||
+        !StatSettingsIndex(TEMP_NEW_SETTINGS, &s_newIndex))
+        return false;
+    IndexFinalize(&s_newIndex);
+
+    for (ModuleMap::iterator mmit = mm.begin(); mmit != mm.end(); ++mmit) {
+        const std::string& module = mmit->first;
+        SettingsIndexMap::iterator cit = current.modules.find(module);
+        SettingsIndexMap::iterator nit = s_newIndex.modules.find(module);
+        std::string currentDigest = (cit != current.modules.end() ? cit->second.digest : "");
+        std::string newDigest = (nit != s_newIndex.modules.end() ? nit->second.digest : "");
+
+        bool tracked = false;
+        for (ParseList::iterator plit = mmit->second.parseList.begin(); plit != mmit->second.parseList.end(); ++plit)
+            tracked |= (plit->module == module);
+
+        // Modules without settings of their own cannot be tracked and always run
+        if (!tracked) {
+            s_activeModules.insert(module);
+        }
+        else if (currentDigest != newDigest) {
+            HexLogDebugN(RRA, "Module %s settings modified", module.c_str());
+            s_activeModules.insert(module);
+            for (ParseList::iterator plit = mmit->second.parseList.begin(); plit != mmit->second.parseList.end(); ++plit)
+                s_activeModules.insert(plit->module);
+            for (ModifiedList::iterator mlit = mmit->second.modifiedList.begin(); mlit != mmit->second.modifiedList.end(); ++mlit)
+                s_activeModules.insert(mlit->module);
+        }
+    }
+
+    // Active modules need the settings of every module they parse, modified or not
+    SettingsRangeList currentRanges;
+    for (ModuleMap::iterator mmit = mm.begin(); mmit != mm.end(); ++mmit) {
+        ParseList& pl = mmit->second.parseList;
+        for (ParseList::iterator plit = pl.begin(); plit != pl.end(); ++plit) {
+            if (!IsModuleActive(plit->module))
+                continue;
+
+            s_parsedModules.insert(mmit->first);
+
+            SettingsIndexMap::iterator cit = current.modules.find(mmit->first);
+            if (cit != current.modules.end())
+                currentRanges.insert(currentRanges.end(), cit->second.ranges.begin(), cit->second.ranges.end());
+            break;
+        }
+    }
+
+    HexLogInfo("Incremental commit: %zu of %zu modules active, parsing %zu",
+               s_activeModules.size(), mm.size(), s_parsedModules.size());
+
+    // New settings are already in memory and ParseLine() skips modules that are not parsed
+    return ParseRanges(BOOT_SETTINGS, currentRanges, PARSE_CURRENT) &&
+           ReplaySettings(newImage, PARSE_NEW, 0, 0, 0);
+}
 
 static bool
 ParseModules(const char *newSettings, MergeSet *mergeSet)
 {
-    // In bootstrap mode, only parse the current settings as if they were new
-    if (s_bootstrapOnly)
-        return ParseSettings(BOOT_SETTINGS, PARSE_NEW, PARSE_NONSYSTEM, 0, 0);
+    TraceScope trace("stage", "parse");
 
-    // Non-bootstrap mode: parse current settings
-    if (!ParseSettings(BOOT_SETTINGS, PARSE_CURRENT, PARSE_NONSYSTEM, 0, 0))
-        return false;
+    // Boot settings are mapped and tokenized once for all passes below
+    SettingsImage bootImage;
+
+    // In bootstrap mode, only parse the current settings as if they were new
+    if (s_bootstrapOnly) {
+        if (!LoadSettings(BOOT_SETTINGS, PARSE_NONSYSTEM, &bootImage) ||
+            !ReplaySettings(bootImage, PARSE_NEW, 0, 0, &s_newIndex))
+            return false;
+        StatSettingsIndex(BOOT_SETTINGS, &s_newIndex);
+        return true;
+    }
 
     assert(newSettings != NULL);
     unlink(TEMP_NEW_SETTINGS);
@@ -1077,6 +1502,11 @@ ParseModules(const char *newSettings, MergeSet *mergeSet)
     if (mergeSet) {
         // Merge-mode:
 
+        // Parse current settings
+        if (!LoadSettings(BOOT_SETTINGS, PARSE_NONSYSTEM, &bootImage) ||
+            !ReplaySettings(bootImage, PARSE_CURRENT, 0, 0, 0))
+            return false;
+
         FILE *fout = fopen(TEMP_NEW_SETTINGS, "we");
         if (!fout) {
             HexLogError("Could not create merge output file: %s", TEMP_NEW_SETTINGS);
@@ -1085,23 +1515,42 @@ ParseModules(const char *newSettings, MergeSet *mergeSet)
 
         // Parse all current settings (as if they were new) except for modules in the merge set
         // and write out to temp file
-        if (!ParseSettings(BOOT_SETTINGS, PARSE_NEW, PARSE_NONSYSTEM, mergeSet, fout))
+        if (!ReplaySettings(bootImage, PARSE_NEW, mergeSet, fout, &s_newIndex))
             return false;
 
         // Now parse the settings from the merge file and append to temp file
-        if (!ParseSettings(newSettings, PARSE_NEW, PARSE_NONSYSTEM, 0, fout))
+        SettingsImage mergeImage;
+        if (!LoadSettings(newSettings, PARSE_NONSYSTEM, &mergeImage) ||
+            !ReplaySettings(mergeImage, PARSE_NEW, 0, fout, &s_newIndex))
             return false;
 
         fclose(fout);
+        StatSettingsIndex(TEMP_NEW_SETTINGS, &s_newIndex);
     }
     else {
-        if (HexSpawn(0, "/bin/cp", newSettings, TEMP_NEW_SETTINGS, (const char *) 0) != 0) {
+        SettingsImage newImage;
+        if (!LoadSettings(newSettings, PARSE_NONSYSTEM, &newImage))
+            return false;
+
+        if (!WriteSettings(newImage, TEMP_NEW_SETTINGS)) {
             HexLogError("Could not create temp new settings file: %s", TEMP_NEW_SETTINGS);
             return false;
         }
-        // Non-merge mode
-        if (!ParseSettings(TEMP_NEW_SETTINGS, PARSE_NEW, PARSE_NONSYSTEM, 0, 0))
+
+        // Incremental mode: only re-parse what changed since the last successful commit
+        SettingsIndex current;
+        if (s_incremental && access(FORCE_COMMIT_ALL, F_OK) != 0 && LoadSettingsIndex(&current))
+            return ParseIncremental(current, newImage);
+
+        // Non-merge mode: parse current settings then new settings
+        if (!LoadSettings(BOOT_SETTINGS, PARSE_NONSYSTEM, &bootImage) ||
+            !ReplaySettings(bootImage, PARSE_CURRENT, 0, 0, 0))
             return false;
+
+        if (!ReplaySettings(newImage, PARSE_NEW, 0, 0, &s_newIndex))
+            return false;
+
+        StatSettingsIndex(TEMP_NEW_SETTINGS, &s_newIndex);
     }
 
     return true;
@@ -1111,6 +1560,7 @@ static bool
 ValidateModules()
 {
     HexLogDebugN(FWD, "Validating modules");
+    TraceScope trace("stage", "validate");
 
     ModuleMap& mm = s_staticsPtr->moduleMap;
     CommitOrderList& col = s_staticsPtr->commitOrderList;
@@ -1124,8 +1574,9 @@ ValidateModules()
         // CommitOrderList was built from ModuleMap so this must never occur
         assert(it2 != mm.end());
 
-        if (it2->second.validate != NULL) {
+        if (it2->second.validate != NULL && IsModuleActive(it->module)) {
             HexLogDebugN(RRA, "Validating module %s", it->module.c_str());
+            TraceScope trace("validate", it->module.c_str());
             if (it2->second.validate() == false) {
                 HexLogError("Module %s failed to validate", it->module.c_str());
                 success = false;
@@ -1150,6 +1601,7 @@ static bool
 NotifyModules()
 {
     HexLogDebugN(FWD, "Notifying observing modules");
+    TraceScope trace("stage", "modified");
 
     ModuleMap& mm = s_staticsPtr->moduleMap;
     unsigned int curlen, newlen;
@@ -1165,9 +1617,13 @@ NotifyModules()
 
         ModifiedList& ml = mmit->second.modifiedList;
         for (ModifiedList::iterator mlit = ml.begin(); mlit != ml.end(); ++mlit) {
+            if (!IsModuleActive(mlit->module))
+                continue;
+
             bool modified = IsModuleModified(mmit);
             HexLogDebugN(RRA, "Observing modified status with module %s (%s)",
                               mlit->module.c_str(), (modified ? "modified" : "unmodified"));
+            TraceScope trace("modified", mlit->module.c_str(), modified);
             mlit->modified(modified);
         }
     }
@@ -1179,6 +1635,7 @@ static bool
 PrepareModules()
 {
     HexLogDebugN(FWD, "Preparing modules");
+    TraceScope trace("stage", "prepare");
 
     ModuleMap& mm = s_staticsPtr->moduleMap;
     CommitOrderList& col = s_staticsPtr->commitOrderList;
@@ -1191,11 +1648,12 @@ PrepareModules()
         // CommitOrderList was built from ModuleMap so this must never occur
         assert(mmit != mm.end());
 
-        if (mmit->second.prepare != NULL) {
+        if (mmit->second.prepare != NULL && IsModuleActive(colit->module)) {
             bool modified = IsModuleModified(mmit);
             int dryLevel = GetDryRunLevel();
             HexLogDebugN(RRA, "Preparing module %s (%s)",
                               colit->module.c_str(), (modified ? "modified" : "unmodified"));
+            TraceScope trace("prepare", colit->module.c_str(), modified);
             if (mmit->second.prepare(modified, dryLevel) == false) {
                 HexLogError("Module %s failed to prepare", colit->module.c_str());
                 return false;
@@ -1206,12 +1664,9 @@ PrepareModules()
     return true;
 }
 
-void *
-ThreadModuleCommit(void *thargs)
+static bool
+CommitModule(ModuleMap::iterator mmit)
 {
-    ModuleMap& mm = s_staticsPtr->moduleMap;
-    auto mmit = mm.find(std::string((char *)thargs));
-
     bool modified = IsModuleModified(mmit);
     int dryLevel = GetDryRunLevel();
 
@@ -1221,20 +1676,102 @@ ThreadModuleCommit(void *thargs)
                       dryLevel);
 
     auto t1 = high_resolution_clock::now();
+    int64_t begin = TraceEnabled() ? TraceNow() : 0;
     bool result = mmit->second.commit(modified, dryLevel);
+    if (TraceEnabled())
+        TraceSpan("commit", mmit->first.c_str(), begin, TraceNow(), modified);
     auto t2 = high_resolution_clock::now();
 
     auto msInt = duration_cast<milliseconds>(t2 - t1);
 
     HexLogInfo("%s commit(%c) took %.1f secs", mmit->first.c_str(), modified ? 'o' : 'x', (float)msInt.count() / 1000.0);
 
-    if (!result) {
+    if (!result)
         HexLogError("Module %s failed to commit",  mmit->first.c_str());
-        pthread_exit((void *)-1);
+
+    return result;
+}
+
+// Must be called with scheduler lock held
+static void
+CommitProgress(CommitScheduler *cs)
+{
+    if (!s_withProgress)
+        return;
+
+    std::string modules = "";
+    for (auto m : cs->running)
+        modules += m + " ";
+
+    printf("(%02zu/%02zu) %s: %-150s\r", cs->committed, cs->runnable,
+           s_bootstrapOnly ? "bootstrapping" : "committing", modules.c_str());
+}
+
+// Mark task finished and queue dependents whose prerequisites have all finished
+// Tasks with nothing to commit finish as soon as they become ready
+// Must be called with scheduler lock held
+static void
+CommitTaskDone(CommitScheduler *cs, size_t idx)
+{
+    std::vector<size_t> done(1, idx);
+    while (!done.empty()) {
+        size_t t = done.back();
+        done.pop_back();
+        ++cs->finished;
+        for (auto d : cs->tasks[t].dependents) {
+            if (--cs->tasks[d].pending > 0)
+                continue;
+            if (cs->tasks[d].run) {
+                TraceInstant("ready", cs->tasks[d].module.c_str());
+                cs->ready.push(std::make_pair(cs->tasks[d].priority, d));
+            }
+            else
+                done.push_back(d);
+        }
     }
-    else {
-        pthread_exit(0);
+}
+
+static void *
+CommitWorker(void *arg)
+{
+    CommitScheduler *cs = (CommitScheduler *)arg;
+    ModuleMap& mm = s_staticsPtr->moduleMap;
+
+    pthread_mutex_lock(&cs->lock);
+    while (true) {
+        // Stop picking up work after the first failure, but let running modules finish
+        while (!cs->failed && cs->ready.empty() && cs->finished < cs->tasks.size())
+            pthread_cond_wait(&cs->cond, &cs->lock);
+        if (cs->failed || cs->ready.empty())
+            break;
+
+        size_t idx = cs->ready.top().second;
+        cs->ready.pop();
+        const std::string& module = cs->tasks[idx].module;
+        cs->running.insert(module);
+        CommitProgress(cs);
+        pthread_mutex_unlock(&cs->lock);
+
+        auto mmit = mm.find(module);
+        // this must never occur
+        assert(mmit != mm.end());
+        bool result = CommitModule(mmit);
+
+        pthread_mutex_lock(&cs->lock);
+        cs->running.erase(module);
+        if (result) {
+            ++cs->committed;
+            CommitTaskDone(cs, idx);
+        }
+        else {
+            cs->failed = true;
+        }
+        CommitProgress(cs);
+        pthread_cond_broadcast(&cs->cond);
     }
+    pthread_mutex_unlock(&cs->lock);
+
+    return NULL;
 }
 
 static bool
@@ -1258,68 +1795,113 @@ CommitModules(const std::string& start, const std::string& end)
     }
 
     HexLogDebugN(FWD, "Committing modules (%s-%s)", (startIt->module).c_str(), (endIt->module).c_str());
-
-    // Commit all modules in commit order
-    // Abort on first error
-    ModuleMap::iterator mmit;
-
-    // The stdout stream is line buffered by default,
-    // so will only display what's in the buffer after it reaches a newline
-    // disable stdout buffer to flush the output immediately
-    setvbuf(stdout, NULL, _IONBF, 0);
+    TraceScope trace("stage", "commit");
 
     // move end iterator one step forward
     std::advance(endIt, 1);
 
-    CommitOrderList rangedCol(startIt, endIt);
-    ModuleList ml;
+    std::set<std::string> ranged;
+    for (CommitOrderList::iterator colit = startIt; colit != endIt; ++colit)
+        ranged.insert(colit->module);
+
+    // Build the dependency graph over all modules in commit order
+    // Modules outside the commit range or without a commit function are kept
+    // as no-op tasks so that ordering through them is preserved
+    CommitScheduler cs;
+    std::map<std::string, size_t> taskIndex;
+    cs.runnable = cs.committed = cs.finished = 0;
+    cs.failed = false;
+
+    for (auto colit : col) {
+        ModuleMap::iterator mmit = mm.find(colit.module);
+        // this must never occur
+        assert(mmit != mm.end());
+
+        CommitTask task;
+        task.module = colit.module;
+        task.run = mmit->second.commit != NULL && IsModuleActive(colit.module) &&
+                   ranged.find(colit.module) != ranged.end();
+        task.pending = 0;
+        task.priority = 0;
+        if (task.run)
+            cs.runnable++;
 
-    for (auto r: rangedCol) {
-        ml.push_back(r.module);
+        taskIndex[task.module] = cs.tasks.size();
+        cs.tasks.push_back(task);
     }
 
-    CommitOrderLevel& colvl = s_staticsPtr->commitOrderLevel;
-    for (auto i = 0 ; i < (int)colvl.size() ; i++) {
-        if (colvl[i].size() == 0)
-            continue;
-
-        pthread_t thread_id[colvl.size()];
-        std::string modules = "";
-        int active = 0;
+    for (size_t i = 0; i < cs.tasks.size(); ++i) {
+        DependencyList& dl = mm.find(cs.tasks[i].module)->second.dependencyList;
+        for (auto dlit : dl) {
+            size_t d = taskIndex[dlit.module];
+            cs.tasks[d].dependents.push_back(i);
+            cs.tasks[i].pending++;
+        }
+    }
 
-        for (auto m : colvl[i]) {
-            mmit = mm.find(m);
-            // this must never occur
-            assert(mmit != mm.end());
+    // Commit order is a topological order, so walk it backwards to compute the
+    // longest remaining path of each task
+    for (size_t i = cs.tasks.size(); i-- > 0; ) {
+        size_t longest = 0;
+        for (auto d : cs.tasks[i].dependents)
+            longest = std::max(longest, cs.tasks[d].priority);
+        cs.tasks[i].priority = longest + (cs.tasks[i].run ? 1 : 0);
+    }
 
-            modules += m + " ";
+    if (cs.runnable == 0)
+        return true;
 
-            if (mmit->second.commit != NULL && std::find(ml.begin(), ml.end(), m) != ml.end()) {
-                if (pthread_create(&thread_id[active++], NULL, ThreadModuleCommit, (void *)mmit->first.c_str()) != 0) {
-                    HexLogError("Failed to start thread for module %s.", m.c_str());
-                    return -1;
-                }
-            }
+    // Collect roots before finishing no-op ones, which releases their dependents
+    std::vector<size_t> roots;
+    for (size_t i = 0; i < cs.tasks.size(); ++i) {
+        if (cs.tasks[i].pending == 0)
+            roots.push_back(i);
+    }
+    for (auto i : roots) {
+        if (cs.tasks[i].run) {
+            TraceInstant("ready", cs.tasks[i].module.c_str());
+            cs.ready.push(std::make_pair(cs.tasks[i].priority, i));
         }
+        else
+            CommitTaskDone(&cs, i);
+    }
 
-        if (s_withProgress)
-            printf("(%02d/%02lu) %s: %-150s\r", i + 1, colvl.size(), s_bootstrapOnly ? "bootstrapping" : "committing", modules.c_str());
-
-        for (int c = 0 ; c < active ; c++) {
-            void *status = 0;
-            pthread_join(thread_id[c], &status);
-            if (status != 0) {
-                if (s_withProgress)
-                    printf("\n");
-                return false;
-            }
+    // Commit modules as soon as all their prerequisites are committed
+    // Abort on first error
+    pthread_mutex_init(&cs.lock, NULL);
+    pthread_cond_init(&cs.cond, NULL);
+
+    // The stdout stream is line buffered by default,
+    // so will only display what's in the buffer after it reaches a newline
+    // disable stdout buffer to flush the output immediately
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    size_t jobs = std::min(s_commitJobs, cs.runnable);
+    std::vector<pthread_t> workers;
+    for (size_t i = 0; i < jobs; ++i) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, CommitWorker, &cs) != 0) {
+            HexLogWarning("Failed to start commit worker %zu of %zu", i + 1, jobs);
+            break;
         }
+        workers.push_back(tid);
+    }
+
+    if (workers.empty()) {
+        HexLogError("Failed to start any commit worker");
+        cs.failed = true;
     }
 
+    for (auto tid : workers)
+        pthread_join(tid, NULL);
+
+    pthread_cond_destroy(&cs.cond);
+    pthread_mutex_destroy(&cs.lock);
+
     if (s_withProgress)
         printf("\n");
 
-    return true;
+    return !cs.failed;
 }
 
 static int
@@ -1390,12 +1972,18 @@ DoWork(const char *newSettings, MergeSet *mergeSet,
         //         if (rename(BAD_SETTINGS, BOOT_SETTINGS) != 0)
         //             HexLogWarning("Failed to restore boot settings");
         //     }
+            SaveSettingsIndex(false);
         }
         else {
             HexLogDebugN(FWD, "Committing settings: %s -> %s", newSettings, BOOT_SETTINGS);
             unlink(BOOT_SETTINGS);
-            if (HexSystem(0, "mv", TEMP_NEW_SETTINGS, BOOT_SETTINGS, NULL) != 0)
+            if (HexSystem(0, "mv", TEMP_NEW_SETTINGS, BOOT_SETTINGS, NULL) != 0) {
                 HexLogError("Could not save new settings: %s", BOOT_SETTINGS);
+                unlink(SETTINGS_DIGEST);
+            }
+            else {
+                SaveSettingsIndex(true);
+            }
         }
     }
     else {
@@ -1670,6 +2258,7 @@ main(int argc, char **argv)
     bool dumpSnapshotCommandOrder = false;
     bool dumpTuning = false;
     bool pubOnly = false;
+    const char *traceFile = NULL;
     int logToStdErr = 0;
     bool silentMode = false;
 
@@ -1684,6 +2273,9 @@ main(int argc, char **argv)
         { "silent_mode", no_argument, 0, 'S' },
         { "dryLevel", required_argument, 0, 'l' },
         { "progress", no_argument, 0, 'p' },
+        { "incremental", no_argument, 0, 'i' },
+        { "jobs", required_argument, 0, 'j' },
+        { "trace", required_argument, 0, 'r' },
         { 0, 0, 0, 0 }
     };
 
@@ -1700,7 +2292,7 @@ main(int argc, char **argv)
 
     while (1) {
         int index;
-        int c = getopt_long(commandIndex, argv, "vetdsTPSl:p", long_options, &index);
+        int c = getopt_long(commandIndex, argv, "vetdsTPSl:pij:", long_options, &index);
         if (c == -1)
             break;
 
@@ -1743,6 +2335,21 @@ main(int argc, char **argv)
         case 'p':
             s_withProgress = true;
             break;
+        case 'i':
+            s_incremental = true;
+            break;
+        case 'r':
+            traceFile = optarg;
+            break;
+        case 'j':
+            if (HexValidateInt(optarg, 1, MAX_COMMIT_JOBS)) {
+                s_commitJobs = atoi(optarg);
+            }
+            else {
+                printf("must be between 1 and %d.\n", MAX_COMMIT_JOBS);
+                return EXIT_SUCCESS;
+            }
+            break;
         case '?':
         default:
             Usage();
@@ -1759,6 +2366,11 @@ main(int argc, char **argv)
             Usage();
     }
 
+    if (s_commitJobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        s_commitJobs = std::min(std::max(cpus * 2, (long)MIN_COMMIT_JOBS), (long)MAX_COMMIT_JOBS);
+    }
+
     HexLogInit(PROGRAM, logToStdErr);
     HexCrashInit(PROGRAM);
     HexDryRunInit(PROGRAM, GetDryRunLevel());
@@ -1874,9 +2486,15 @@ main(int argc, char **argv)
     if (!silentMode)
         HexLogDebugN(FWD, "Executing command: %s", fullCmd.c_str());
 
+    if (traceFile)
+        TraceEnable();
+
     // run command
     status = it->second.main(argc-optind, argv+optind);
 
+    if (traceFile)
+        TraceWrite(traceFile);
+
     if (s_rebootNeeded)
         status |= CONFIG_EXIT_NEED_REBOOT;
     else if (s_lmiRestartNeeded)
@@ -2321,17 +2939,26 @@ MainStopAllProcesses(int argc, char **argv)
 static void
 UsageSupport()
 {
-    fprintf(stderr, "Usage: %s create_support_info <temp-dir>\n", PROGRAM);
+    fprintf(stderr, "Usage: %s create_support_info <temp-dir> [ <timeout> ]\n"
+                    "Run up to --jobs support commands at once, each for at most <timeout> seconds\n"
+                    "(default %d, 0 for no limit).\n", PROGRAM, SUPPORT_COMMAND_TIMEOUT);
 }
 
 static int
 MainSupport(int argc, char **argv)
 {
-    if (argc != 2)
+    if (argc != 2 && argc != 3)
         Usage();
 
     char *tempdir = argv[1];
 
+    int timeout = SUPPORT_COMMAND_TIMEOUT;
+    if (argc == 3) {
+        if (!HexValidateInt(argv[2], 0, INT_MAX))
+            Usage();
+        timeout = atoi(argv[2]);
+    }
+
     // Support always writes to a unique temporary directory
     // A lock file is not necessary here
     HexLogInfo("Creating support info: %s", tempdir);
@@ -2350,22 +2977,16 @@ MainSupport(int argc, char **argv)
     // Export variable that can be used by support commands
     setenv("HEX_SUPPORT_DIR", tempdir, 1 /*overwrite*/);
 
-    SupportSet& cmds = s_staticsPtr->supportCommandSet;
-    for (SupportSet::iterator it = cmds.begin(); it != cmds.end(); ++it) {
-        const char *command = it->c_str();
-        if (HexSystemF(0, "( ( set -x ; %s ); echo ) >> %s 2>&1", command, commandOutput.c_str()) != 0) {
-            //TODO: HexLogEventNoArg("Failed to collect support info from command: %s", command);
-            HexLogWarning("Failed to collect support info from command: %s", command);
-        }
-    }
+    // Commands run concurrently and their output is collected in registration order,
+    // then files are copied, including those written by CONFIG_SUPPORT_COMMAND_TO_FILE commands
+    std::string timings;
+    SupportRunCommands(s_staticsPtr->supportCommandList, tempdir, s_commitJobs, timeout, timings);
+    SupportCopyFiles(s_staticsPtr->supportFileList, tempdir, timings);
 
-    SupportSet& files = s_staticsPtr->supportFileSet;
-    for (SupportSet::iterator it = files.begin(); it != files.end(); ++it) {
-        const char *pattern = it->c_str();
-        if (HexSystemF(0, "find %s ! -type s -depth -print 2>/dev/null | cpio -pudm %s >/dev/null 2>&1", pattern, tempdir) != 0) {
-            //TODO: HexLogEventNoArg("Failed to collect support info for pattern: %s", pattern);
-            HexLogWarning("Failed to collect support info for pattern: %s", pattern);
-        }
+    FILE *fp = fopen(commandOutput.c_str(), "a");
+    if (fp) {
+        fprintf(fp, "Support info collection times:\n%s", timings.c_str());
+        fclose(fp);
     }
 
     return EXIT_SUCCESS;
@@ -2374,20 +2995,37 @@ MainSupport(int argc, char **argv)
 static void
 UsageCreateSnapshot()
 {
-    fprintf(stderr, "Usage: %s create_snapshot <snapshot-file> [<comment-file>]\n", PROGRAM);
+    fprintf(stderr, "Usage: %s create_snapshot [ --store <store-dir> ] <snapshot-file> [<comment-file>]\n"
+                    "With --store, add snapshot <snapshot-file> to the snapshot store in <store-dir>,\n"
+                    "writing only the file contents it does not hold yet.\n", PROGRAM);
+}
+
+// Leading "--store <store-dir>" of snapshot commands, NULL without one
+// "arg" is set to the index of the first argument after it
+static const char*
+ParseSnapshotStore(int argc, char** argv, int &arg)
+{
+    arg = 1;
+    if (argc < 3 || strcmp(argv[1], "--store") != 0)
+        return NULL;
+
+    arg = 3;
+    return argv[2];
 }
 
 static int
 MainCreateSnapshot(int argc, char** argv)
 {
-    if (argc < 2 || argc > 3)
+    int arg;
+    const char* storeDir = ParseSnapshotStore(argc, argv, arg);
+    if (argc - arg < 1 || argc - arg > 2)
         Usage();
 
-    const char* targetFile = argv[1];
+    const char* targetFile = argv[arg];
     const char* commentFileArg = NULL;
 
-    if (argc == 3) {
-        commentFileArg = argv[2];
+    if (argc - arg == 2) {
+        commentFileArg = argv[arg + 1];
     }
 
     time_t now;
@@ -2396,7 +3034,7 @@ MainCreateSnapshot(int argc, char** argv)
 
     HexLogInfo("Creating snapshot: %s", targetFile);
 
-    if (unlink(targetFile) != 0) {
+    if (storeDir == NULL && unlink(targetFile) != 0) {
         if (errno != ENOENT) {
             HexLogError("Could not remove existing snapshot file %s: %d %s",
                         targetFile, errno, strerror(errno));
@@ -2414,15 +3052,26 @@ MainCreateSnapshot(int argc, char** argv)
     std::string warningsFile = dir;
     warningsFile += "/Warnings";
 
+    // The snapshot is written in a single pass: files matching the patterns as
+    // they are found, then what the create commands leave in the temporary directory
+    HexZipWriter zip;
+    SnapshotStoreWriter store(storeDir ? storeDir : "");
+    auto add = [&](const std::string &path, const std::string &name) {
+        return storeDir ? store.add(path, name) : zip.add(path, name);
+    };
+    auto addPattern = [&](const char* pattern) {
+        return storeDir ? store.addPattern(pattern) : zip.addPattern(pattern);
+    };
+    if (!(storeDir ? store.open(targetFile) : zip.open(targetFile))) {
+        HexLogError("Could not create snapshot.");
+        return EXIT_FAILURE;
+    }
+
     // Add files to the snapshot
     SnapshotPatternList &patternList = s_staticsPtr->snapshotPatterns;
     for (auto iter = patternList.begin(); iter != patternList.end(); ++iter) {
         const char* pattern = iter->pattern.c_str();
-        // process each directory's contents before the directory itself and
-        // print the full file name followed by a newline and
-        // finally add them (compress with zip) to the target file
-        if (HexSystemF(0, "find \"%s\" -depth -print 2>/dev/null | /usr/bin/zip %s -@ >/dev/null 2>&1",
-                          pattern, targetFile) != 0) {
+        if (!addPattern(pattern)) {
             HexLogWarning("Could not collect a snapshot for pattern: %s", pattern);
             HexSystemF(0, "echo \"Could not collect a snapshot for pattern: %s\" >> %s",
                           pattern, warningsFile.c_str());
@@ -2478,30 +3127,110 @@ MainCreateSnapshot(int argc, char** argv)
         }
     }
 
-    // Create the zip file
-    if (HexSystemF(0, "cd %s && /usr/bin/zip -r %s * >%s 2>&1", dir, targetFile, SNAPSHOT_LOG) != 0) {
+    // Finish the zip file or the manifest
+    if (!add(dir, "") || !(storeDir ? store.close() : zip.close())) {
         HexLogError("Could not create snapshot.");
         return EXIT_FAILURE;
     }
 
+    if (storeDir)
+        HexLogInfo("Snapshot %s added %zu new chunks (%llu bytes) to %s", targetFile,
+                   store.newChunks(), (unsigned long long)store.newBytes(), storeDir);
+
     return EXIT_SUCCESS;
 }
 
+static void
+UsageCreateArchive()
+{
+    fprintf(stderr, "Usage: %s create_archive <zip-file> <dir> [ <pattern> ... ]\n"
+                    "Write what is in <dir>, named relative to it, and then the files matching each\n"
+                    "<pattern> (with wildcards) to <zip-file> in a single pass.\n", PROGRAM);
+}
+
+static int
+MainCreateArchive(int argc, char** argv)
+{
+    if (argc < 3)
+        Usage();
+
+    const char* targetFile = argv[1];
+
+    HexZipWriter zip;
+    if (!zip.open(targetFile))
+        return EXIT_FAILURE;
+
+    int status = EXIT_SUCCESS;
+    if (!zip.add(argv[2], "")) {
+        HexLogWarning("Could not add all of %s to %s", argv[2], targetFile);
+        status = EXIT_FAILURE;
+    }
+    for (int i = 3; i < argc; ++i) {
+        if (!zip.addPattern(argv[i])) {
+            HexLogWarning("Could not add all of %s to %s", argv[i], targetFile);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    if (!zip.close()) {
+        HexLogError("Could not create %s", targetFile);
+        return EXIT_FAILURE;
+    }
+
+    return status;
+}
+
+static void
+UsageExportSnapshot()
+{
+    fprintf(stderr, "Usage: %s export_snapshot <store-dir> <snapshot> <snapshot-file>\n"
+                    "Write <snapshot> from the snapshot store in <store-dir> to zip file <snapshot-file>.\n", PROGRAM);
+}
+
+static int
+MainExportSnapshot(int argc, char** argv)
+{
+    if (argc != 4)
+        Usage();
+
+    return SnapshotStoreExport(argv[1], argv[2], argv[3]) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void
+UsageRemoveSnapshot()
+{
+    fprintf(stderr, "Usage: %s remove_snapshot <store-dir> <snapshot>\n"
+                    "Remove <snapshot> and the file contents no other snapshot uses from the\n"
+                    "snapshot store in <store-dir>.\n", PROGRAM);
+}
+
+static int
+MainRemoveSnapshot(int argc, char** argv)
+{
+    if (argc != 3)
+        Usage();
+
+    return SnapshotStoreRemove(argv[1], argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 static void
 UsageApplySnapshot()
 {
-    fprintf(stderr, "Usage: %s apply_snapshot <snapshot-file>\n", PROGRAM);
+    fprintf(stderr, "Usage: %s apply_snapshot [ --store <store-dir> ] <snapshot-file>\n"
+                    "With --store, apply snapshot <snapshot-file> from the snapshot store in <store-dir>.\n", PROGRAM);
 }
 
 static int
 MainApplySnapshot(int argc, char** argv)
 {
-    if (argc != 2)
+    int arg;
+    const char* storeDir = ParseSnapshotStore(argc, argv, arg);
+    if (argc - arg != 1)
         Usage();
 
-    const char* snapshotFile = argv[1];
+    const char* snapshotFile = argv[arg];
 
-    if (access(snapshotFile, R_OK) != 0) {
+    if (storeDir ? !SnapshotStoreExists(storeDir, snapshotFile) : access(snapshotFile, R_OK) != 0) {
         HexLogError("Cannot access snapshot file %s", snapshotFile);
         return EXIT_FAILURE;
     }
@@ -2518,7 +3247,7 @@ MainApplySnapshot(int argc, char** argv)
 
     SnapshotFileList managedFiles; // The list of all managed files in the snapshot
     SnapshotPatternList &patternList = s_staticsPtr->snapshotPatterns;
-    if (!StageSnapshot(snapshotFile, tmpDir, managedFiles, patternList)) {
+    if (!StageSnapshot(snapshotFile, storeDir, tmpDir, managedFiles, patternList)) {
         HexLogError("Could not stage snapshot to temporary directory.");
         return EXIT_FAILURE;
     }
@@ -2549,9 +3278,6 @@ MainApplySnapshot(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
-    // Remove the existing system files that will be replaced by the snapshot
-    SnapshotFileRemove(backupFiles);
-
     // Apply the files from the snapshot
     if (!SnapshotFileInstall("/", tmpDir, managedFiles)) {
         HexLogError("Could not restore snapshot files.");
@@ -2560,6 +3286,9 @@ MainApplySnapshot(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
+    // The snapshot replaced the files it has, those it does not have go
+    SnapshotFileRemoveStale(backupFiles, managedFiles);
+
     SnapshotCommandList& snapshotCmds = s_staticsPtr->snapshotCommands;
 
     bool withSettings = false;
@@ -2754,7 +3483,10 @@ CONFIG_COMMAND(migrate,                 MainMigrate,             UsageMigrate);
 CONFIG_COMMAND(stop_all_processes,      MainStopAllProcesses,    UsageStopAllProcesses);
 CONFIG_COMMAND(create_support_info,     MainSupport,             UsageSupport);
 CONFIG_COMMAND(create_snapshot,         MainCreateSnapshot,      UsageCreateSnapshot);
+CONFIG_COMMAND(create_archive,          MainCreateArchive,       UsageCreateArchive);
 CONFIG_COMMAND(apply_snapshot,          MainApplySnapshot,       UsageApplySnapshot);
+CONFIG_COMMAND(export_snapshot,         MainExportSnapshot,      UsageExportSnapshot);
+CONFIG_COMMAND(remove_snapshot,         MainRemoveSnapshot,      UsageRemoveSnapshot);
 CONFIG_COMMAND(trigger,                 MainTrigger,             UsageTrigger);
 CONFIG_COMMAND(strict_zeroize_files,    MainStrictZeroizeFiles,  UsageStrictZeroizeFiles);
 CONFIG_COMMAND(license_check,           MainLicenseCheck,        UsageLicenseCheck);
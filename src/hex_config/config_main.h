@@ -5,10 +5,18 @@
 
 #ifdef __cplusplus
 
+#include <deque>
 #include <list>
 #include <map>
+#include <queue>
 #include <set>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <openssl/evp.h>
 #include <openssl/sha.h>
@@ -16,6 +24,8 @@
 #include <hex/config_impl.h>
 #include <hex/config_module.h>
 
+#include "support.h"
+
 using namespace hex_config;
 
 struct CommandInfo {
@@ -108,8 +118,6 @@ typedef std::list<TuningInfo> TuningList;
 
 typedef std::unordered_map<std::string, TuningSpecInfo> TuningSpecMap;
 
-typedef std::set<std::string> SupportSet;
-
 typedef std::map<std::string /*module*/, MigrateFunc> MigrateFuncMap;
 
 typedef std::multimap<std::string /*module*/, std::string /*pattern*/> MigrateFilesMap;
@@ -163,8 +171,97 @@ typedef std::list<CommitOrderInfo> CommitOrderList;
 
 typedef std::vector<ModuleList> CommitOrderLevel;
 
+// Node of the commit dependency graph
+struct CommitTask {
+    std::string module;
+    bool run;                       // Module has a commit function and is in the commit range
+    size_t pending;                 // Number of prerequisites not yet committed
+    size_t priority;                // Number of runnable modules on the longest path to a sink
+    std::vector<size_t> dependents; // Tasks that require this module to be committed first
+};
+
+typedef std::vector<CommitTask> CommitTaskList;
+
+typedef std::pair<size_t /*priority*/, size_t /*task*/> CommitReady;
+
+// Longest remaining path first, then earliest in commit order
+struct CommitReadyOrder {
+    bool operator()(const CommitReady& x, const CommitReady& y) const {
+        return x.first != y.first ? x.first < y.first : x.second > y.second;
+    }
+};
+
+typedef std::priority_queue<CommitReady, std::vector<CommitReady>, CommitReadyOrder> CommitReadyQueue;
+
+// Shared state of the commit worker pool
+struct CommitScheduler {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    CommitTaskList tasks;
+    CommitReadyQueue ready;         // Tasks whose prerequisites have all been committed
+    std::set<std::string> running;
+    size_t runnable;                // Number of tasks with a commit function to run
+    size_t committed;               // Number of runnable tasks committed successfully
+    size_t finished;                // Number of tasks finished, runnable or not
+    bool failed;
+};
+
 typedef std::set<std::string /*moduleName*/> MergeSet;
 
+typedef std::set<std::string /*moduleName*/> ActiveSet;
+
+// Byte range of a settings file holding a run of one module's lines
+struct SettingsRange {
+    long offset;
+    long length;
+};
+
+typedef std::vector<SettingsRange> SettingsRangeList;
+
+struct SettingsIndexInfo {
+    SettingsIndexInfo() : ctx(NULL) { }
+    EVP_MD_CTX *ctx;                // Message digest context while the index is being built
+    std::string digest;             // Hex encoded message digest of the module's settings
+    SettingsRangeList ranges;       // Byte ranges of the module's lines
+};
+
+typedef std::map<std::string /*module*/, SettingsIndexInfo> SettingsIndexMap;
+
+// Per-module digests and line index of a settings file
+struct SettingsIndex {
+    off_t size;
+    ino_t ino;
+    struct timespec mtime;
+    SettingsIndexMap modules;
+};
+
+// One setting of a tokenized settings file
+struct SettingsEntry {
+    ModuleMap::iterator module;     // Module owning the setting, by name prefix
+    std::string_view name;          // Views into the image, not null terminated
+    std::string_view value;
+    int line;
+    long offset;                    // Byte range of the setting, including preceding comments
+    long length;
+};
+
+typedef std::vector<SettingsEntry> SettingsEntryList;
+
+// Settings file mapped and tokenized once, then replayed for each parse pass
+struct SettingsImage {
+    SettingsImage() : map(NULL), data(""), size(0) { }
+    ~SettingsImage() { if (map) munmap(map, size); }
+    void *map;
+    const char *data;
+    size_t size;
+    SettingsEntryList entries;      // Settings of known modules in file order
+    std::deque<std::string> unescaped;  // Quoted values that had to be unescaped out of the file
+
+private:
+    SettingsImage(const SettingsImage&);
+    SettingsImage& operator=(const SettingsImage&);
+};
+
 struct TriggerInfo {
     std::string module;
     TriggerFunc trigger;
@@ -187,8 +284,8 @@ struct Statics {
     MigrateFilesMap migrateFilesMap;
     ShutdownFuncMap shutdownFuncMap;
     ShutdownPidFilesMap shutdownPidFilesMap;
-    SupportSet supportFileSet;
-    SupportSet supportCommandSet;
+    SupportList supportFileList;
+    SupportList supportCommandList;
     CommitOrderList commitOrderList;
     CommitOrderLevel commitOrderLevel;
     SnapshotPatternList snapshotPatterns;
@@ -2,64 +2,86 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
 #include <limits.h>
 #include <sys/stat.h>
 #include <pwd.h>
 #include <grp.h>
 #include <unistd.h>
 
+#include <map>
+#include <set>
+
+#include <hex/filesystem.h>
 #include <hex/log.h>
-#include <hex/process.h>
+#include <hex/zip.h>
 
 #include "config_main.h"
 #include "snapshot.h"
+#include "snapshot_store.h"
+
+// Append "path" and, unless it is a symbolic link, everything under it,
+// each directory after its contents as find -depth lists them
+static void
+ListDepth(const std::string &path, SnapshotFileList &results)
+{
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0)
+        return;
+
+    if (S_ISDIR(st.st_mode)) {
+        std::vector<std::string> names;
+        HexListDir(path, names);
+        std::string prefix = path == "/" ? "" : path;
+        for (size_t i = 0; i < names.size(); ++i)
+            ListDepth(prefix + "/" + names[i], results);
+    }
+    results.push_back(path);
+}
 
 int
 PopulateSnapshotList(const std::string &pattern, SnapshotFileList &results)
 {
-    std::string cmd = "find \"";
-    cmd += pattern;
-    cmd += "\" -depth -print 2>/dev/null";
-
-    FILE* fp = popen(cmd.c_str(), "r");
-    int retval = 0;
-    if (fp) {
-        char path[PATH_MAX];
-        while (fgets(path, PATH_MAX, fp) != NULL) {
-            // Strip trailing newline
-            size_t n = strlen(path);
-            if (n > 0 && path[n - 1] == '\n') {
-                path[n-1] = '\0';
-            }
-            results.push_back(path);
-        }
-
-        // This function will only fail if pclose fails - it doesn't care about
-        // the return code from find.
-        if (pclose(fp) == -1) {
-            retval = (errno == 0 ? EPIPE : errno);
-            HexLogError("System error encountered during process close: %d %s",
-                         retval, strerror(retval));
+    glob_t g;
+    int rc = glob(pattern.c_str(), 0, NULL, &g);
+    if (rc == 0) {
+        for (size_t i = 0; i < g.gl_pathc; ++i) {
+            std::string path = g.gl_pathv[i];
+            while (path.size() > 1 && path[path.size() - 1] == '/')
+                path.erase(path.size() - 1);
+            ListDepth(path, results);
         }
     }
-    else {
-        retval = (errno == 0 ? ENOMEM : errno);
-        HexLogError("System error encountered during process creation: %d %s",
-                     retval, strerror(retval));
+    globfree(&g);
+
+    // Nothing matching is not an error
+    if (rc != 0 && rc != GLOB_NOMATCH) {
+        HexLogError("System error encountered matching %s: %d", pattern.c_str(), rc);
+        return 0;
     }
-    return (retval == 0);
+    return 1;
 }
 
 bool
-StageSnapshot(const char* snapshotFile, const char* tmpDir, SnapshotFileList &managedFiles, const SnapshotPatternList &patternList)
+StageSnapshot(const char* snapshotFile, const char* storeDir, const char* tmpDir,
+              SnapshotFileList &managedFiles, const SnapshotPatternList &patternList)
 {
     HexLogDebugN(FWD, "Staging snapshot %s to temporary directory %s", snapshotFile, tmpDir);
 
-    // Unzip the snapshot to the temporary directory.
-    if (HexSystemF(0, "cd %s && /usr/bin/unzip %s >%s 2>&1", tmpDir,
-                       HexBuildShellArg(snapshotFile).c_str(), SNAPSHOT_LOG) != 0) {
-        HexLogError("Could not unzip snapshot.");
-        return false;
+    // Unzip the snapshot, or extract it from the store, to the temporary directory.
+    if (storeDir) {
+        if (!SnapshotStoreExtract(storeDir, snapshotFile, tmpDir)) {
+            HexLogError("Could not extract snapshot from %s.", storeDir);
+            return false;
+        }
+    }
+    else {
+        HexZipReader zip;
+        if (!zip.open(snapshotFile) || !zip.extractAll(tmpDir)) {
+            HexLogError("Could not unzip snapshot.");
+            return false;
+        }
     }
 
     // For all the managed files, go through and chown / chgrp / chmod them as appropriate.
@@ -152,6 +174,122 @@ StageSnapshot(const char* snapshotFile, const char* tmpDir, SnapshotFileList &ma
     return true;
 }
 
+// "path" under "dir", which may be "/"
+static std::string
+JoinPath(const char* dir, const std::string &path)
+{
+    if (strcmp(dir, "/") == 0)
+        return path;
+    return dir + path;
+}
+
+// Copy regular file or symbolic link "src" with status "st" to "dst", with
+// its owner, mode and times, replacing "dst" in one rename
+static bool
+CopyEntry(const std::string &src, const std::string &dst, const struct stat &st)
+{
+    std::string tmp = dst + ".XXXXXX";
+    bool ok = false;
+
+    if (S_ISLNK(st.st_mode)) {
+        char link[PATH_MAX];
+        ssize_t len = readlink(src.c_str(), link, sizeof(link) - 1);
+        if (len < 0)
+            return false;
+        link[len] = '\0';
+        // Name the new link like mkstemp would
+        int fd = mkstemp(&tmp[0]);
+        if (fd < 0)
+            return false;
+        close(fd);
+        unlink(tmp.c_str());
+        ok = symlink(link, tmp.c_str()) == 0;
+        if (ok)
+            HexCopyOwner(tmp.c_str(), st.st_uid, st.st_gid);
+    }
+    else {
+        int in = open(src.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (in < 0)
+            return false;
+        int out = mkostemp(&tmp[0], O_CLOEXEC);
+        if (out >= 0) {
+            ok = HexCopyFd(in, out) == 0;
+            if (ok)
+                HexCopyOwner(tmp.c_str(), st.st_uid, st.st_gid);
+            if (ok)
+                ok = fchmod(out, st.st_mode & 07777) == 0;
+            if (ok) {
+                struct timespec times[2] = { st.st_atim, st.st_mtim };
+                futimens(out, times);
+            }
+            close(out);
+        }
+        close(in);
+        if (out < 0)
+            return false;
+    }
+
+    if (ok)
+        ok = rename(tmp.c_str(), dst.c_str()) == 0;
+    if (!ok)
+        unlink(tmp.c_str());
+    return ok;
+}
+
+// Create directory "dst" if need be with the owner and mode of "st"
+static bool
+CopyDir(const std::string &dst, const struct stat &st)
+{
+    if (mkdir(dst.c_str(), 0700) != 0 && errno != EEXIST)
+        return false;
+    HexCopyOwner(dst.c_str(), st.st_uid, st.st_gid);
+    return chmod(dst.c_str(), st.st_mode & 07777) == 0;
+}
+
+// Move "src" to "dst" with a rename, or a copy if they are on different file systems
+static bool
+MoveEntry(const std::string &src, const std::string &dst, const struct stat &st)
+{
+    if (rename(src.c_str(), dst.c_str()) == 0)
+        return true;
+    if (errno != EXDEV || !CopyEntry(src, dst, st))
+        return false;
+    unlink(src.c_str());
+    return true;
+}
+
+// Files written are made durable with a syncfs per file system at the end
+// rather than an fsync each
+class SnapshotSync {
+public:
+    ~SnapshotSync()
+    {
+        for (auto it = m_fds.begin(); it != m_fds.end(); ++it) {
+            if (syncfs(it->second) != 0)
+                HexLogWarning("Could not sync snapshot files: %s", strerror(errno));
+            close(it->second);
+        }
+    }
+
+    void add(const std::string &path)
+    {
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0 || m_fds.count(st.st_dev))
+            return;
+        // Any descriptor on the file system will do, links are synced
+        // through the directory they are in
+        std::string file = path;
+        if (S_ISLNK(st.st_mode))
+            file.erase(std::max<size_t>(file.rfind('/'), 1));
+        int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0)
+            m_fds[st.st_dev] = fd;
+    }
+
+private:
+    std::map<dev_t, int> m_fds;
+};
+
 bool
 SnapshotFileInstall(const char* targetDir, const char* fileBaseDir,
                     const SnapshotFileList &files)
@@ -164,68 +302,88 @@ SnapshotFileInstall(const char* targetDir, const char* fileBaseDir,
         return true;
     }
 
-    std::string cmd = "cd ";
-    cmd += fileBaseDir;
-    cmd += " && cpio -pud ";
-    cmd += targetDir;
-    cmd += " > ";
-    cmd += SNAPSHOT_LOG;
-    cmd += " 2>&1";
-
-    HexLogDebugN(FWD, "Command is %s", cmd.c_str());
-
-    FILE* fp = popen(cmd.c_str(), "w");
-    if (fp) {
-        for (auto iter = files.begin(); iter != files.end(); ++iter) {
-            const char* filePath = iter->c_str();
-            assert(filePath[0] == '/');
-            HexLogDebugN(RRA, "SnapshotFileInstall: targetDir=%s fileBaseDir=%s file=%s\n",
-                              targetDir, fileBaseDir, filePath + 1);
-            fprintf(fp, "%s\n", filePath + 1);
-        }
+    SnapshotSync sync;
+    for (auto iter = files.begin(); iter != files.end(); ++iter) {
+        assert((*iter)[0] == '/');
+        HexLogDebugN(RRA, "SnapshotFileInstall: targetDir=%s fileBaseDir=%s file=%s\n",
+                          targetDir, fileBaseDir, iter->c_str() + 1);
+
+        std::string src = JoinPath(fileBaseDir, *iter);
+        std::string dst = JoinPath(targetDir, *iter);
 
-        int status = pclose(fp);
-        if (status == -1) {
-            int errorCode = (errno == 0 ? EPIPE : errno);
-            HexLogError("System error copying snapshot files: %d %s",
-                        errorCode, strerror(errorCode));
+        struct stat st;
+        if (lstat(src.c_str(), &st) != 0) {
+            HexLogError("Snapshot file copy was not successful: %s: %s", src.c_str(), strerror(errno));
             return false;
         }
 
-        if (WIFEXITED(status)) {
-            int rc = WEXITSTATUS(status);
-            if (rc != 0) {
-                HexLogError("Snapshot file copy was not successful. Return code %d", rc);
-                return false;
-            }
-        }
-        else {
-            HexLogError("Snapshot file copy did not return.");
+        // Owner and mode are those of the source, set for managed files when
+        // the snapshot was staged
+        HexMakeParents(dst.c_str());
+        bool ok;
+        if (S_ISDIR(st.st_mode))
+            ok = CopyDir(dst, st);
+        else if (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode))
+            ok = CopyEntry(src, dst, st);
+        else
+            ok = true;
+        if (!ok) {
+            HexLogError("Snapshot file copy was not successful: %s: %s", dst.c_str(), strerror(errno));
             return false;
         }
-    }
-    else {
-        int errorCode = (errno == 0 ? ENOMEM : errno);
-        HexLogError("System error copying snapshot files: %d %s",
-                    errorCode, strerror(errorCode));
-        return false;
+        sync.add(dst);
     }
 
     return true;
-
 }
 
 bool
 SnapshotFileBackup(const char* backupDir, const SnapshotFileList &backupFiles)
 {
     HexLogDebugN(FWD, "Backing up system files to %s", backupDir);
-    if (!SnapshotFileInstall(backupDir, "/", backupFiles)) {
+
+    // Files are linked into the backup and stay in place until the snapshot
+    // replaces them, so that nothing is missing if the apply is cut short,
+    // reverting renames them back, and nothing is copied unless the backup
+    // is on another file system
+    // Directories are copied
+    bool ok = true;
+    for (auto iter = backupFiles.begin(); iter != backupFiles.end() && ok; ++iter) {
+        std::string dst = JoinPath(backupDir, *iter);
+
+        struct stat st;
+        if (lstat(iter->c_str(), &st) != 0)
+            continue;
+
+        HexMakeParents(dst.c_str());
+        if (S_ISDIR(st.st_mode))
+            ok = CopyDir(dst, st);
+        else
+            ok = link(iter->c_str(), dst.c_str()) == 0 || CopyEntry(*iter, dst, st);
+        if (!ok)
+            HexLogError("Could not back up %s: %s", iter->c_str(), strerror(errno));
+    }
+
+    if (!ok) {
         HexLogError("Could not backup system state prior to snapshot application.");
         return false;
     }
     return true;
 }
 
+void
+SnapshotFileRemoveStale(const SnapshotFileList &backupFiles, const SnapshotFileList &installedFiles)
+{
+    std::set<std::string> installed(installedFiles.begin(), installedFiles.end());
+    for (auto iter = backupFiles.begin(); iter != backupFiles.end(); ++iter) {
+        struct stat st;
+        if (installed.count(*iter) || lstat(iter->c_str(), &st) != 0 || S_ISDIR(st.st_mode))
+            continue;
+        if (unlink(iter->c_str()) != 0)
+            HexLogWarning("System error removing file %s: %d %s", iter->c_str(), errno, strerror(errno));
+    }
+}
+
 void
 SnapshotFileRemove(const SnapshotFileList &fileList)
 {
@@ -256,7 +414,24 @@ SnapshotFileRevert(const SnapshotFileList &appliedFiles,
     // Remove any applied files
     SnapshotFileRemove(appliedFiles);
 
-    // Restore the backup files
-    return SnapshotFileInstall("/", backupDir, backupFiles);
-}
+    // Move the backup files back, directories are still in place unless
+    // the snapshot removed them
+    SnapshotSync sync;
+    bool ok = true;
+    for (auto iter = backupFiles.begin(); iter != backupFiles.end(); ++iter) {
+        std::string src = JoinPath(backupDir, *iter);
+
+        struct stat st;
+        if (lstat(src.c_str(), &st) != 0)
+            continue;
 
+        HexMakeParents(iter->c_str());
+        if (S_ISDIR(st.st_mode) ? !CopyDir(*iter, st) : !MoveEntry(src, *iter, st)) {
+            HexLogError("Could not restore %s: %s", iter->c_str(), strerror(errno));
+            ok = false;
+            continue;
+        }
+        sync.add(*iter);
+    }
+    return ok;
+}
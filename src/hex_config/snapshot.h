@@ -9,39 +9,41 @@
 #include <vector>
 #include <list>
 
-// Log of errors from zip/unzip invocations
-static const char SNAPSHOT_LOG[] = "/var/log/snapshot.log";
-
 typedef std::vector<std::string> SnapshotFileList;
 
 /**
- * Populate results with the file-system objects that match the pattern specified.
+ * Populate results with the file-system objects that match the pattern specified,
+ * and everything under them, each directory after its contents.
  */
 int PopulateSnapshotList(const std::string &pattern, SnapshotFileList &results);
 
 /**
  * Stage the snapshot.
- * - extracting "snapshotFile" to the temporary directory "tmpDor"
+ * - extracting "snapshotFile" to the temporary directory "tmpDor", from the
+ *   snapshot store "storeDir" unless it is NULL,
  *   and correcting the ownership and permission settings for managed files.
  */
-bool StageSnapshot(const char* snapshotFile, const char* tmpDir,
+bool StageSnapshot(const char* snapshotFile, const char* storeDir, const char* tmpDir,
                    SnapshotFileList &managedFiles, const SnapshotPatternList &patternList);
 
 /**
- * Backup "backupFiles" files to "backupDir" so that they can be restored if
- * the snapshot fails to apply.
+ * Link "backupFiles" files into "backupDir", or copy them across file systems,
+ * so that they can be restored if the snapshot fails to apply. The files
+ * themselves are left in place.
  */
 bool SnapshotFileBackup(const char* backupDir, const SnapshotFileList &backupFiles);
 
 /**
- * Intall files in "files" from "fileBaseDir" to "targetDir"
+ * Intall files in "files" from "fileBaseDir" to "targetDir", with the owner,
+ * mode and times they have there, each replacing what is in place in one rename
  */
 bool SnapshotFileInstall(const char* targetDir, const char* fileBaseDir, const SnapshotFileList &files);
 
 /**
- * Copy files in "backupFiles" to "backupDir"
+ * Remove files in "backupFiles" that are not in "installedFiles", once the
+ * snapshot is installed; directories are left in place
  */
-bool SnapshotFileBackup(const char* backupDir, const SnapshotFileList &backupFiles);
+void SnapshotFileRemoveStale(const SnapshotFileList &backupFiles, const SnapshotFileList &installedFiles);
 
 /**
  * Remove files in "fileList" from file system
@@ -50,7 +52,7 @@ void SnapshotFileRemove(const SnapshotFileList &fileList);
 
 /**
  * Remove files in "appliedFiles" from file system and
- * copy files in "backupFiles" from "backupDir" to file system
+ * move files in "backupFiles" from "backupDir" back to file system
  */
 bool SnapshotFileRevert(const SnapshotFileList &appliedFiles, const char* backupDir, const SnapshotFileList &backupFiles);
 
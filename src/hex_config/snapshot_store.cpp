@@ -0,0 +1,831 @@
+// HEX SDK
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
+#include <zlib.h>
+
+#include <hex/filesystem.h>
+#include <hex/log.h>
+#include <hex/process.h>
+#include <hex/tempfile.h>
+#include <hex/zip.h>
+
+#include "snapshot_store.h"
+
+static const char MANIFEST_HEADER[] = "hex-snapshot-manifest 1\n";
+
+// Chunks are cut where the rolling hash of the last 64 bytes has its top
+// CHUNK_BITS bits clear, 8KB apart on average, but never less than
+// CHUNK_MIN or more than CHUNK_MAX bytes apart
+static const size_t CHUNK_MIN = 2 * 1024;
+static const size_t CHUNK_MAX = 64 * 1024;
+static const int CHUNK_BITS = 13;
+
+static const size_t READ_SIZE = 1024 * 1024;
+
+struct StoreEntry {
+    char type;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    time_t mtime;
+    uint64_t size;
+    std::string name;
+    std::vector<std::pair<std::string, size_t>> chunks;
+};
+
+// Random values for each byte, the same in every run so that the same
+// contents are always cut in the same places
+static const uint64_t*
+GearTable()
+{
+    static const std::array<uint64_t, 256> table = [] {
+        std::array<uint64_t, 256> t;
+        uint64_t x = 0;
+        for (size_t i = 0; i < t.size(); ++i) {
+            // splitmix64
+            uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            t[i] = z ^ (z >> 31);
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+// Length of the chunk at the start of the "len" bytes at "data"
+static size_t
+CutPoint(const unsigned char* data, size_t len)
+{
+    if (len <= CHUNK_MIN)
+        return len;
+    if (len > CHUNK_MAX)
+        len = CHUNK_MAX;
+
+    const uint64_t* gear = GearTable();
+    uint64_t hash = 0;
+    for (size_t i = CHUNK_MIN; i < len; ++i) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash >> (64 - CHUNK_BITS)) == 0)
+            return i + 1;
+    }
+    return len;
+}
+
+static std::string
+Digest(const void* data, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int mdLen = 0;
+    if (EVP_Digest(data, len, md, &mdLen, EVP_sha256(), NULL) == 0)
+        return "";
+
+    std::string digest;
+    for (unsigned int i = 0; i < mdLen; ++i) {
+        digest += hex[md[i] >> 4];
+        digest += hex[md[i] & 0xf];
+    }
+    return digest;
+}
+
+// Names are the rest of their manifest line, with '%', ' ' and control
+// characters written as %XX so that none is lost to the scan of the fields
+// before them
+static std::string
+EscapeName(const std::string &name)
+{
+    std::string escaped;
+    for (size_t i = 0; i < name.size(); ++i) {
+        unsigned char c = name[i];
+        if (c == '%' || c <= ' ' || c == 0x7f) {
+            char buf[4];
+            snprintf(buf, sizeof(buf), "%%%02X", c);
+            escaped += buf;
+        }
+        else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static bool
+UnescapeName(const char* escaped, std::string &name)
+{
+    name.clear();
+    for (const char* p = escaped; *p; ++p) {
+        if (*p != '%') {
+            name += *p;
+            continue;
+        }
+        unsigned int c;
+        if (sscanf(p + 1, "%2x", &c) != 1 || !isxdigit(p[1]) || !isxdigit(p[2]))
+            return false;
+        name += (char)c;
+        p += 2;
+    }
+    return !name.empty();
+}
+
+// Snapshot names are single file names, never hidden ones, which are
+// used for manifests being written
+static bool
+ValidName(const char* name)
+{
+    return name[0] != '\0' && name[0] != '.' && strchr(name, '/') == NULL;
+}
+
+static bool
+ReadAll(const std::string &path, std::string &data)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    data.clear();
+    char buffer[65536];
+    for (;;) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            close(fd);
+            return n == 0;
+        }
+        data.append(buffer, n);
+    }
+}
+
+// Write "path" under a temporary name in the same directory and rename it
+// in place, so that it is either all there or not at all
+static bool
+WriteAtomic(const std::string &path, const void* data, size_t len, bool sync)
+{
+    std::string tmp = path;
+    size_t slash = tmp.rfind('/');
+    tmp.insert(slash + 1, ".");
+    tmp += ".XXXXXX";
+
+    int fd = mkostemp(&tmp[0], O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool ok = HexWriteAll(fd, data, len) == 0 && (!sync || fsync(fd) == 0);
+    if (close(fd) != 0)
+        ok = false;
+    if (ok)
+        ok = rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok)
+        unlink(tmp.c_str());
+    return ok;
+}
+
+// Open the lock of "storeDir", creating the store first if "create", and
+// take it shared by those reading and adding snapshots or exclusively by
+// those removing chunks
+static int
+LockStore(const std::string &storeDir, bool create, int operation)
+{
+    if (create) {
+        const std::string dirs[] = { storeDir, storeDir + "/chunks", storeDir + "/manifests" };
+        for (size_t i = 0; i < 3; ++i) {
+            if (mkdir(dirs[i].c_str(), 0700) != 0 && errno != EEXIST) {
+                HexLogError("Could not create snapshot store %s: %s", dirs[i].c_str(), strerror(errno));
+                return -1;
+            }
+        }
+    }
+
+    std::string lock = storeDir + "/lock";
+    int fd = open(lock.c_str(), O_RDWR | (create ? O_CREAT : 0) | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        HexLogError("Could not open snapshot store %s: %s", storeDir.c_str(), strerror(errno));
+        return -1;
+    }
+    while (flock(fd, operation) != 0) {
+        if (errno != EINTR) {
+            HexLogError("Could not lock snapshot store %s: %s", storeDir.c_str(), strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static std::string
+ManifestPath(const std::string &storeDir, const std::string &name)
+{
+    return storeDir + "/manifests/" + name;
+}
+
+static std::string
+ChunkPath(const std::string &storeDir, const std::string &digest)
+{
+    return storeDir + "/chunks/" + digest.substr(0, 2) + "/" + digest;
+}
+
+static bool
+ReadManifest(const std::string &path, std::vector<StoreEntry> &entries)
+{
+    FILE* fp = fopen(path.c_str(), "re");
+    if (fp == NULL) {
+        HexLogError("Could not open snapshot manifest %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool ok = true;
+    char* line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    for (size_t lineNo = 1; ok && (len = getline(&line, &size, fp)) > 0; ++lineNo) {
+        if (line[len - 1] == '\n')
+            line[--len] = '\0';
+
+        if (lineNo == 1) {
+            ok = strncmp(line, MANIFEST_HEADER, sizeof(MANIFEST_HEADER) - 2) == 0 &&
+                 (size_t)len == sizeof(MANIFEST_HEADER) - 2;
+            continue;
+        }
+
+        if (line[0] == 'c' && line[1] == ' ') {
+            char digest[65];
+            size_t chunkLen;
+            ok = !entries.empty() && sscanf(line, "c %64s %zu", digest, &chunkLen) == 2 &&
+                 strlen(digest) == 64 && chunkLen > 0;
+            if (ok)
+                entries.back().chunks.push_back(std::make_pair(std::string(digest), chunkLen));
+            continue;
+        }
+
+        StoreEntry entry;
+        unsigned int mode, uid, gid;
+        long long mtime;
+        unsigned long long entrySize;
+        int nameStart = 0;
+        ok = sscanf(line, "%c %o %u %u %lld %llu %n", &entry.type, &mode, &uid, &gid,
+                    &mtime, &entrySize, &nameStart) == 6 && nameStart > 0 &&
+             strchr("dfl", entry.type) != NULL &&
+             UnescapeName(line + nameStart, entry.name);
+        if (ok) {
+            entry.mode = mode;
+            entry.uid = uid;
+            entry.gid = gid;
+            entry.mtime = mtime;
+            entry.size = entrySize;
+            entries.push_back(entry);
+        }
+    }
+    free(line);
+    if (ferror(fp))
+        ok = false;
+    fclose(fp);
+
+    if (!ok)
+        HexLogError("Snapshot manifest %s is corrupted", path.c_str());
+    return ok;
+}
+
+// Read chunk "digest" of "len" bytes and check it is what was stored
+static bool
+ReadChunk(const std::string &storeDir, const std::string &digest, size_t len, std::string &data)
+{
+    std::string path = ChunkPath(storeDir, digest);
+    std::string deflated;
+    if (!ReadAll(path, deflated)) {
+        HexLogError("Could not read snapshot chunk %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    data.resize(len);
+    uLongf dataLen = len;
+    if (uncompress((Bytef*)&data[0], &dataLen, (const Bytef*)deflated.data(), deflated.size()) != Z_OK ||
+        dataLen != len || Digest(data.data(), len) != digest) {
+        HexLogError("Snapshot chunk %s is corrupted", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Give "path" the owner, mode and modification time of "entry"
+static void
+SetAttributes(const std::string &path, const StoreEntry &entry)
+{
+    HexCopyOwner(path.c_str(), entry.uid, entry.gid);
+    if (entry.type != 'l')
+        chmod(path.c_str(), entry.mode & 07777);
+    struct timespec times[2] = { { entry.mtime, 0 }, { entry.mtime, 0 } };
+    utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW);
+}
+
+static bool
+ExtractEntry(const std::string &storeDir, const StoreEntry &entry, const std::string &path)
+{
+    std::string data;
+    if (entry.type == 'l') {
+        std::string link;
+        for (size_t i = 0; i < entry.chunks.size(); ++i) {
+            if (!ReadChunk(storeDir, entry.chunks[i].first, entry.chunks[i].second, data))
+                return false;
+            link += data;
+        }
+        unlink(path.c_str());
+        if (symlink(link.c_str(), path.c_str()) != 0) {
+            HexLogError("Could not create %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    unlink(path.c_str());
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        HexLogError("Could not create %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = true;
+    for (size_t i = 0; ok && i < entry.chunks.size(); ++i) {
+        ok = ReadChunk(storeDir, entry.chunks[i].first, entry.chunks[i].second, data);
+        if (ok && HexWriteAll(fd, data.data(), data.size()) != 0) {
+            HexLogError("Could not write %s: %s", path.c_str(), strerror(errno));
+            ok = false;
+        }
+    }
+    close(fd);
+    if (!ok)
+        unlink(path.c_str());
+    return ok;
+}
+
+SnapshotStoreWriter::SnapshotStoreWriter(const char* storeDir)
+    : m_store(storeDir), m_lockFd(-1), m_ok(false), m_newChunks(0), m_newBytes(0)
+{
+}
+
+SnapshotStoreWriter::~SnapshotStoreWriter()
+{
+    if (m_lockFd >= 0)
+        ::close(m_lockFd);
+}
+
+bool
+SnapshotStoreWriter::open(const char* name)
+{
+    if (m_lockFd >= 0)
+        return false;
+
+    if (!ValidName(name)) {
+        HexLogError("Invalid snapshot name: %s", name);
+        return false;
+    }
+
+    m_lockFd = LockStore(m_store, true, LOCK_SH);
+    if (m_lockFd < 0)
+        return false;
+    if (stat(m_store.c_str(), &m_storeStat) != 0) {
+        HexLogError("Could not open snapshot store %s: %s", m_store.c_str(), strerror(errno));
+        ::close(m_lockFd);
+        m_lockFd = -1;
+        return false;
+    }
+
+    m_name = name;
+    m_manifest = MANIFEST_HEADER;
+    m_names.clear();
+    m_newChunks = 0;
+    m_newBytes = 0;
+    m_ok = true;
+    return true;
+}
+
+bool
+SnapshotStoreWriter::add(const std::string &path, const std::string &name)
+{
+    if (m_lockFd < 0 || !m_ok)
+        return false;
+
+    size_t start = name.find_first_not_of('/');
+    size_t end = name.find_last_not_of('/');
+    if (start != std::string::npos)
+        return addEntry(path, name.substr(start, end - start + 1));
+
+    // What is in directory "path", named relative to it
+    std::vector<std::string> names;
+    if (!HexListDir(path, names)) {
+        HexLogWarning("Could not read %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (!addEntry(path + "/" + names[i], names[i]))
+            ok = false;
+    }
+    return ok;
+}
+
+bool
+SnapshotStoreWriter::addPattern(const char* pattern)
+{
+    if (m_lockFd < 0 || !m_ok)
+        return false;
+
+    glob_t g;
+    int rc = glob(pattern, 0, NULL, &g);
+    bool ok = rc == 0;
+    if (rc == 0) {
+        for (size_t i = 0; i < g.gl_pathc; ++i) {
+            std::string path = g.gl_pathv[i];
+            while (path.size() > 1 && path[path.size() - 1] == '/')
+                path.erase(path.size() - 1);
+            if (!add(path, path))
+                ok = false;
+        }
+    }
+    globfree(&g);
+    return ok;
+}
+
+bool
+SnapshotStoreWriter::addEntry(const std::string &path, const std::string &name)
+{
+    if (!m_names.insert(name).second)
+        return true;
+
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        HexLogWarning("Could not read %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    // The store never holds a copy of itself
+    if (st.st_dev == m_storeStat.st_dev && st.st_ino == m_storeStat.st_ino)
+        return true;
+
+    char type;
+    switch (st.st_mode & S_IFMT) {
+    case S_IFDIR:
+        type = 'd';
+        break;
+    case S_IFREG:
+        type = 'f';
+        break;
+    case S_IFLNK:
+        type = 'l';
+        break;
+    default:
+        return true;
+    }
+
+    // The entry is only listed once all of its contents are in the store
+    std::string chunks;
+    uint64_t size = 0;
+    bool ok = true;
+    if (type == 'f') {
+        int fd = ::open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            HexLogWarning("Could not read %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        ok = addContents(path, fd, chunks, size);
+        ::close(fd);
+    }
+    else if (type == 'l') {
+        char link[PATH_MAX];
+        ssize_t len = readlink(path.c_str(), link, sizeof(link));
+        if (len < 0) {
+            HexLogWarning("Could not read %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        ok = len == 0 || addChunk(link, len, chunks);
+        size = len;
+    }
+    if (!ok)
+        return false;
+
+    char line[128];
+    snprintf(line, sizeof(line), "%c %o %u %u %lld %llu ", type, (unsigned int)(st.st_mode & 07777),
+             (unsigned int)st.st_uid, (unsigned int)st.st_gid, (long long)st.st_mtime,
+             (unsigned long long)size);
+    m_manifest += line;
+    m_manifest += EscapeName(name);
+    m_manifest += '\n';
+    m_manifest += chunks;
+
+    if (type != 'd')
+        return true;
+
+    std::vector<std::string> names;
+    if (!HexListDir(path, names)) {
+        HexLogWarning("Could not read %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::string prefix = path == "/" ? "" : path;
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (!addEntry(prefix + "/" + names[i], name + "/" + names[i]))
+            ok = false;
+    }
+    return ok;
+}
+
+bool
+SnapshotStoreWriter::addContents(const std::string &path, int fd, std::string &chunks, uint64_t &size)
+{
+    // Read ahead far enough that every cut but the last sees a whole
+    // CHUNK_MAX bytes
+    std::string buffer;
+    size_t pos = 0;
+    bool eof = false;
+    while (!eof || pos < buffer.size()) {
+        if (!eof && buffer.size() - pos < CHUNK_MAX) {
+            buffer.erase(0, pos);
+            pos = 0;
+            size_t have = buffer.size();
+            buffer.resize(have + READ_SIZE);
+            ssize_t n = read(fd, &buffer[have], READ_SIZE);
+            if (n < 0 && errno == EINTR)
+                n = 0;
+            else if (n < 0) {
+                HexLogWarning("Could not read %s: %s", path.c_str(), strerror(errno));
+                return false;
+            }
+            else if (n == 0)
+                eof = true;
+            buffer.resize(have + n);
+            continue;
+        }
+
+        size_t len = CutPoint((const unsigned char*)buffer.data() + pos, buffer.size() - pos);
+        if (!addChunk(buffer.data() + pos, len, chunks))
+            return false;
+        pos += len;
+        size += len;
+    }
+    return true;
+}
+
+bool
+SnapshotStoreWriter::addChunk(const char* data, size_t len, std::string &chunks)
+{
+    std::string digest = Digest(data, len);
+    if (digest.empty()) {
+        HexLogError("Could not compute the digest of a snapshot chunk");
+        m_ok = false;
+        return false;
+    }
+    chunks += "c " + digest + " " + std::to_string(len) + "\n";
+
+    if (m_chunks.count(digest) != 0)
+        return true;
+
+    std::string path = ChunkPath(m_store, digest);
+    if (access(path.c_str(), F_OK) == 0) {
+        m_chunks.insert(digest);
+        return true;
+    }
+
+    std::string dir = path.substr(0, path.rfind('/'));
+    if (m_chunkDirs.insert(dir).second && mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        HexLogError("Could not create %s: %s", dir.c_str(), strerror(errno));
+        m_ok = false;
+        return false;
+    }
+
+    uLongf deflatedLen = compressBound(len);
+    std::string deflated(deflatedLen, '\0');
+    if (compress2((Bytef*)&deflated[0], &deflatedLen, (const Bytef*)data, len, Z_DEFAULT_COMPRESSION) != Z_OK ||
+        !WriteAtomic(path, deflated.data(), deflatedLen, false)) {
+        HexLogError("Could not write snapshot chunk %s: %s", path.c_str(), strerror(errno));
+        m_ok = false;
+        return false;
+    }
+
+    m_chunks.insert(digest);
+    m_newChunks++;
+    m_newBytes += len;
+    return true;
+}
+
+bool
+SnapshotStoreWriter::close()
+{
+    if (m_lockFd < 0)
+        return false;
+
+    // Chunks are made durable with one syncfs before the manifest that
+    // refers to them replaces the snapshot
+    bool ok = m_ok;
+    if (ok && syncfs(m_lockFd) != 0) {
+        HexLogError("Could not sync snapshot store %s: %s", m_store.c_str(), strerror(errno));
+        ok = false;
+    }
+
+    std::string manifest = ManifestPath(m_store, m_name);
+    if (ok && !WriteAtomic(manifest, m_manifest.data(), m_manifest.size(), true)) {
+        HexLogError("Could not write snapshot manifest %s: %s", manifest.c_str(), strerror(errno));
+        ok = false;
+    }
+    if (ok) {
+        int dirFd = ::open((m_store + "/manifests").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd >= 0) {
+            fsync(dirFd);
+            ::close(dirFd);
+        }
+        HexLogDebug("Snapshot %s added %zu new chunks (%llu bytes) to %s", m_name.c_str(),
+                    m_newChunks, (unsigned long long)m_newBytes, m_store.c_str());
+    }
+
+    ::close(m_lockFd);
+    m_lockFd = -1;
+    m_ok = false;
+    m_manifest.clear();
+    return ok;
+}
+
+bool
+SnapshotStoreExists(const char* storeDir, const char* name)
+{
+    return ValidName(name) && access(ManifestPath(storeDir, name).c_str(), R_OK) == 0;
+}
+
+bool
+SnapshotStoreExtract(const char* storeDir, const char* name, const char* dir)
+{
+    if (!ValidName(name)) {
+        HexLogError("Invalid snapshot name: %s", name);
+        return false;
+    }
+
+    int lockFd = LockStore(storeDir, false, LOCK_SH);
+    if (lockFd < 0)
+        return false;
+
+    std::vector<StoreEntry> entries;
+    if (!ReadManifest(ManifestPath(storeDir, name), entries)) {
+        close(lockFd);
+        return false;
+    }
+
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        HexLogError("Could not create %s: %s", dir, strerror(errno));
+        close(lockFd);
+        return false;
+    }
+
+    bool ok = true;
+    std::vector<size_t> dirs;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const StoreEntry &entry = entries[i];
+        if (!HexPathIsBeneath(entry.name.c_str())) {
+            HexLogError("Could not extract %s from snapshot %s: name outside of %s",
+                        entry.name.c_str(), name, dir);
+            ok = false;
+            continue;
+        }
+        // Directories are walked one at a time without following links, so a
+        // link extracted earlier cannot lead a later entry out of "dir"
+        size_t slash = entry.name.rfind('/');
+        std::string parents = entry.type == 'd' ? entry.name :
+                              slash == std::string::npos ? "" : entry.name.substr(0, slash);
+        if (!parents.empty() && HexMakeDirsBeneath(dir, parents.c_str()) != 0) {
+            HexLogError("Could not extract %s from snapshot %s: %s", entry.name.c_str(), name,
+                        errno == ELOOP ? "symbolic link in its path" : strerror(errno));
+            ok = false;
+            continue;
+        }
+        std::string path = std::string(dir) + "/" + entry.name;
+        if (entry.type == 'd') {
+            dirs.push_back(i);
+        }
+        else if (ExtractEntry(storeDir, entry, path)) {
+            SetAttributes(path, entry);
+        }
+        else {
+            ok = false;
+        }
+    }
+
+    // Directories get their own mode and time only once everything in them
+    // is written
+    for (auto i = dirs.rbegin(); i != dirs.rend(); ++i)
+        SetAttributes(std::string(dir) + "/" + entries[*i].name, entries[*i]);
+
+    close(lockFd);
+    return ok;
+}
+
+bool
+SnapshotStoreExport(const char* storeDir, const char* name, const char* zipFile)
+{
+    HexTempDir tmpDir;
+    if (tmpDir.dir() == NULL) {
+        HexLogError("Could not create temporary directory.");
+        return false;
+    }
+    if (!SnapshotStoreExtract(storeDir, name, tmpDir.dir()))
+        return false;
+
+    HexZipWriter zip;
+    if (!zip.open(zipFile) || !zip.add(tmpDir.dir(), "") || !zip.close()) {
+        HexLogError("Could not write snapshot %s to %s", name, zipFile);
+        return false;
+    }
+    return true;
+}
+
+// Names of the files in "dir", except hidden ones
+static bool
+ListDir(const std::string &dir, std::vector<std::string> &names, std::vector<std::string> *hidden)
+{
+    std::vector<std::string> all;
+    if (!HexListDir(dir, all))
+        return false;
+    for (size_t i = 0; i < all.size(); ++i) {
+        if (all[i][0] != '.')
+            names.push_back(all[i]);
+        else if (hidden)
+            hidden->push_back(all[i]);
+    }
+    return true;
+}
+
+bool
+SnapshotStoreRemove(const char* storeDir, const char* name)
+{
+    if (!ValidName(name)) {
+        HexLogError("Invalid snapshot name: %s", name);
+        return false;
+    }
+
+    // No snapshot can be added while chunks are removed, or one could
+    // refer to a chunk that is about to go
+    int lockFd = LockStore(storeDir, false, LOCK_EX);
+    if (lockFd < 0)
+        return false;
+
+    std::string manifest = ManifestPath(storeDir, name);
+    if (unlink(manifest.c_str()) != 0) {
+        HexLogError("Could not remove snapshot %s: %s", manifest.c_str(), strerror(errno));
+        close(lockFd);
+        return false;
+    }
+
+    // Chunks still used by any snapshot are kept, and none are removed at
+    // all if a manifest cannot be read. Hidden files are what interrupted
+    // writers left behind.
+    std::string manifestDir = std::string(storeDir) + "/manifests";
+    std::vector<std::string> manifests, leftovers;
+    std::set<std::string> used;
+    bool ok = ListDir(manifestDir, manifests, &leftovers);
+    for (size_t i = 0; ok && i < manifests.size(); ++i) {
+        std::vector<StoreEntry> entries;
+        ok = ReadManifest(manifestDir + "/" + manifests[i], entries);
+        for (size_t e = 0; e < entries.size(); ++e) {
+            for (size_t c = 0; c < entries[e].chunks.size(); ++c)
+                used.insert(entries[e].chunks[c].first);
+        }
+    }
+    if (!ok) {
+        HexLogError("Could not find the chunks of snapshot store %s in use", storeDir);
+        close(lockFd);
+        return false;
+    }
+    for (size_t i = 0; i < leftovers.size(); ++i)
+        unlink((manifestDir + "/" + leftovers[i]).c_str());
+
+    std::string chunkDir = std::string(storeDir) + "/chunks";
+    std::vector<std::string> subdirs;
+    ListDir(chunkDir, subdirs, NULL);
+    size_t removed = 0;
+    for (size_t i = 0; i < subdirs.size(); ++i) {
+        std::string subdir = chunkDir + "/" + subdirs[i];
+        std::vector<std::string> chunks, partial;
+        ListDir(subdir, chunks, &partial);
+        for (size_t c = 0; c < chunks.size(); ++c) {
+            if (used.count(chunks[c]) == 0 && unlink((subdir + "/" + chunks[c]).c_str()) == 0)
+                removed++;
+        }
+        for (size_t c = 0; c < partial.size(); ++c)
+            unlink((subdir + "/" + partial[c]).c_str());
+        // Only empty directories can go
+        rmdir(subdir.c_str());
+    }
+
+    HexLogDebug("Removed snapshot %s and %zu chunks no longer used from %s", name, removed, storeDir);
+    close(lockFd);
+    return true;
+}
@@ -0,0 +1,104 @@
+// HEX SDK
+
+#ifndef HEX_SNAPSHOT_STORE_H
+#define HEX_SNAPSHOT_STORE_H
+
+#ifdef __cplusplus
+
+#include <cstdint>
+#include <set>
+#include <string>
+
+#include <sys/stat.h>
+
+/**
+ * A snapshot store keeps snapshots as small manifests that share chunks of
+ * file contents, each stored once under its SHA-256 digest:
+ *
+ *   <store-dir>/chunks/<xx>/<digest>   deflated chunk
+ *   <store-dir>/manifests/<snapshot>   entries of the snapshot and the chunks of each
+ *
+ * Files are cut into chunks where their contents say, not at fixed offsets, so
+ * a change to one part of a file leaves the chunks of the rest as they were and
+ * a snapshot only writes the chunks that the store does not have yet.
+ */
+
+/**
+ * Write snapshot "name" to the store, in the same way HexZipWriter writes an
+ * archive: entries keep the mode, owner and modification time of what they
+ * were added from, symbolic links are kept as links and sockets, fifos and
+ * devices are skipped. The snapshot replaces any with the same name once it is
+ * closed, and not before.
+ */
+class SnapshotStoreWriter {
+public:
+    SnapshotStoreWriter(const char* storeDir);
+
+    // A snapshot not closed yet is left out of the store
+    ~SnapshotStoreWriter();
+
+    // Start snapshot "name", creating the store if needed
+    bool open(const char* name);
+
+    // Add the file, symbolic link or directory with everything under it at
+    // "path", named "name" in the snapshot (leading slashes are dropped)
+    // An empty name adds what is in directory "path" named relative to it
+    // Names already in the snapshot are skipped
+    // Return false if anything could not be read, which is left out
+    bool add(const std::string &path, const std::string &name);
+
+    // Add the paths matching "pattern" (with wildcards) under their own names
+    // Return false if anything could not be read, which is left out
+    bool addPattern(const char* pattern);
+
+    // Write the manifest once every chunk it refers to is on disk
+    bool close();
+
+    // Chunks written by this snapshot and their size before deflating
+    size_t newChunks() const { return m_newChunks; }
+    uint64_t newBytes() const { return m_newBytes; }
+
+private:
+    bool addEntry(const std::string &path, const std::string &name);
+    bool addContents(const std::string &path, int fd, std::string &chunks, uint64_t &size);
+    bool addChunk(const char* data, size_t len, std::string &chunks);
+
+    std::string m_store;
+    std::string m_name;
+    std::string m_manifest;
+    struct stat m_storeStat;
+    int m_lockFd;
+    bool m_ok;
+
+    std::set<std::string> m_names;
+    // Chunks known to be in the store and chunk directories created
+    std::set<std::string> m_chunks;
+    std::set<std::string> m_chunkDirs;
+    size_t m_newChunks;
+    uint64_t m_newBytes;
+};
+
+/**
+ * Return true if snapshot "name" is in the store "storeDir"
+ */
+bool SnapshotStoreExists(const char* storeDir, const char* name);
+
+/**
+ * Create every entry of snapshot "name" under "dir", with the mode, owner and
+ * modification time it was added with, as HexZipReader::extractAll does
+ */
+bool SnapshotStoreExtract(const char* storeDir, const char* name, const char* dir);
+
+/**
+ * Write snapshot "name" to "zipFile" as create_snapshot would have without a store
+ */
+bool SnapshotStoreExport(const char* storeDir, const char* name, const char* zipFile);
+
+/**
+ * Remove snapshot "name" from the store and the chunks no other snapshot uses
+ */
+bool SnapshotStoreRemove(const char* storeDir, const char* name);
+
+#endif /* __cplusplus */
+
+#endif /* HEX_SNAPSHOT_STORE_H */
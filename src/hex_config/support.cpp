@@ -0,0 +1,257 @@
+// HEX SDK
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <chrono>
+#include <set>
+
+#include <hex/filesystem.h>
+#include <hex/log.h>
+#include <hex/process.h>
+#include <hex/process_group.h>
+
+#include "support.h"
+
+// Per-command output while commands run, removed once it is in support.txt
+static const char SUPPORT_PARTS_DIR[] = "/.support";
+static const char SUPPORT_OUTPUT[] = "/support.txt";
+
+static std::string
+CommandStatus(const HexProcessGroup::Result &r)
+{
+    char buf[64];
+    if (r.timedOut)
+        snprintf(buf, sizeof(buf), "timed out");
+    else if (r.status == -1)
+        snprintf(buf, sizeof(buf), "not run (%s)", strerror(r.error));
+    else if (WIFEXITED(r.status))
+        snprintf(buf, sizeof(buf), "exit %d", WEXITSTATUS(r.status));
+    else if (WIFSIGNALED(r.status))
+        snprintf(buf, sizeof(buf), "signal %d", WTERMSIG(r.status));
+    else
+        snprintf(buf, sizeof(buf), "status %d", r.status);
+    return buf;
+}
+
+static void
+AddTiming(std::string &timings, double secs, const std::string &what, const std::string &item)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%9.3f secs  %-14s", secs, what.c_str());
+    timings += buf;
+    timings += item;
+    timings += '\n';
+}
+
+bool
+SupportRunCommands(const SupportList &commands, const char *tempDir, size_t jobs, int timeout,
+                   std::string &timings)
+{
+    std::string partsDir = tempDir;
+    partsDir += SUPPORT_PARTS_DIR;
+    if (mkdir(partsDir.c_str(), 0700) != 0 && errno != EEXIST) {
+        HexLogError("Could not create directory %s: %s", partsDir.c_str(), strerror(errno));
+        return false;
+    }
+
+    HexProcessGroup group(jobs);
+    std::vector<std::string> parts;
+    for (size_t i = 0; i < commands.size(); ++i) {
+        parts.push_back(partsDir + "/" + std::to_string(i));
+        std::string cmd = "( ( set -x ; " + commands[i] + " ); echo ) >" + HexBuildShellArg(parts[i]) + " 2>&1";
+        group.add({ "/bin/sh", "-c", cmd }, timeout);
+    }
+    group.wait();
+
+    std::string outputFile = tempDir;
+    outputFile += SUPPORT_OUTPUT;
+    int out = open(outputFile.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (out < 0)
+        HexLogError("Could not open %s: %s", outputFile.c_str(), strerror(errno));
+
+    bool success = true;
+    for (size_t i = 0; i < commands.size(); ++i) {
+        const HexProcessGroup::Result &r = group.result(i);
+        const char *command = commands[i].c_str();
+
+        int in = open(parts[i].c_str(), O_RDONLY | O_CLOEXEC);
+        if (in >= 0) {
+            if (out >= 0 && HexCopyFd(in, out) != 0)
+                HexLogError("Could not write %s: %s", outputFile.c_str(), strerror(errno));
+            close(in);
+            unlink(parts[i].c_str());
+        }
+        if (r.timedOut && out >= 0) {
+            std::string note = "+ # killed after " + std::to_string(timeout) + " seconds\n\n";
+            if (write(out, note.data(), note.size()) < 0)
+                HexLogError("Could not write %s: %s", outputFile.c_str(), strerror(errno));
+        }
+
+        if (r.timedOut || r.status != 0) {
+            //TODO: HexLogEventNoArg("Failed to collect support info from command: %s", command);
+            HexLogWarning("Failed to collect support info from command: %s (%s)", command, CommandStatus(r).c_str());
+            success = false;
+        }
+        AddTiming(timings, r.elapsed, CommandStatus(r), command);
+    }
+
+    if (out >= 0)
+        close(out);
+    rmdir(partsDir.c_str());
+    return success && out >= 0;
+}
+
+struct SupportCopy {
+    // Destination root and where it really is, so it is never copied into itself
+    std::string dest;
+    std::string destReal;
+    // Source paths already copied, directories with everything in them
+    std::set<std::string> copied;
+    size_t files;
+    size_t errors;
+};
+
+static void
+CopyError(SupportCopy &copy, const char *op, const std::string &path)
+{
+    HexLogDebug("Support info: could not %s %s: %s", op, path.c_str(), strerror(errno));
+    copy.errors++;
+}
+
+static void
+CopyPath(SupportCopy &copy, const std::string &path)
+{
+    if (path == copy.destReal || !copy.copied.insert(path).second)
+        return;
+
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0)
+        return;
+
+    // Like find ! -type s | cpio -pudm: no sockets, replace what is there,
+    // keep modification times
+    std::string target = copy.dest + path;
+    bool ok = true;
+    switch (st.st_mode & S_IFMT) {
+    case S_IFSOCK:
+        return;
+    case S_IFDIR: {
+        if (mkdir(target.c_str(), 0700) != 0 && errno != EEXIST) {
+            CopyError(copy, "create", target);
+            return;
+        }
+        std::vector<std::string> names;
+        if (!HexListDir(path, names))
+            CopyError(copy, "read", path);
+        std::string prefix = path == "/" ? "" : path;
+        for (size_t i = 0; i < names.size(); ++i)
+            CopyPath(copy, prefix + "/" + names[i]);
+        break;
+    }
+    case S_IFREG: {
+        unlink(target.c_str());
+        int in = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (in < 0) {
+            CopyError(copy, "open", path);
+            return;
+        }
+        int out = open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (out < 0) {
+            CopyError(copy, "create", target);
+            close(in);
+            return;
+        }
+        if (HexCopyFd(in, out) != 0) {
+            CopyError(copy, "copy", path);
+            ok = false;
+        }
+        close(out);
+        close(in);
+        copy.files++;
+        break;
+    }
+    case S_IFLNK: {
+        char link[PATH_MAX];
+        ssize_t len = readlink(path.c_str(), link, sizeof(link) - 1);
+        if (len < 0) {
+            CopyError(copy, "read", path);
+            return;
+        }
+        link[len] = '\0';
+        unlink(target.c_str());
+        if (symlink(link, target.c_str()) != 0) {
+            CopyError(copy, "create", target);
+            return;
+        }
+        copy.files++;
+        break;
+    }
+    default:
+        // Device and fifo nodes are recreated, never read
+        unlink(target.c_str());
+        if (mknod(target.c_str(), st.st_mode, st.st_rdev) != 0) {
+            CopyError(copy, "create", target);
+            return;
+        }
+        copy.files++;
+        break;
+    }
+
+    if (ok) {
+        HexCopyOwner(target.c_str(), st.st_uid, st.st_gid);
+        if (!S_ISLNK(st.st_mode))
+            chmod(target.c_str(), st.st_mode & 07777);
+        struct timespec times[2] = { st.st_atim, st.st_mtim };
+        utimensat(AT_FDCWD, target.c_str(), times, AT_SYMLINK_NOFOLLOW);
+    }
+}
+
+bool
+SupportCopyFiles(const SupportList &patterns, const char *tempDir, std::string &timings)
+{
+    SupportCopy copy;
+    copy.dest = tempDir;
+    char real[PATH_MAX];
+    if (realpath(tempDir, real) != NULL)
+        copy.destReal = real;
+    copy.files = 0;
+    copy.errors = 0;
+
+    bool success = true;
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        const char *pattern = patterns[i].c_str();
+        auto start = std::chrono::steady_clock::now();
+        size_t files = copy.files, errors = copy.errors;
+
+        glob_t g;
+        if (glob(pattern, 0, NULL, &g) == 0) {
+            for (size_t n = 0; n < g.gl_pathc; ++n) {
+                std::string path = g.gl_pathv[n];
+                while (path.size() > 1 && path[path.size() - 1] == '/')
+                    path.erase(path.size() - 1);
+                HexMakeParents((copy.dest + path).c_str());
+                CopyPath(copy, path);
+            }
+        }
+        globfree(&g);
+
+        if (copy.errors != errors) {
+            //TODO: HexLogEventNoArg("Failed to collect support info for pattern: %s", pattern);
+            HexLogWarning("Failed to collect support info for pattern: %s", pattern);
+            success = false;
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        AddTiming(timings, secs, std::to_string(copy.files - files) + " files", pattern);
+    }
+
+    return success;
+}
@@ -0,0 +1,36 @@
+// HEX SDK
+
+#ifndef HEX_CONFIG_SUPPORT_H
+#define HEX_CONFIG_SUPPORT_H
+
+#ifdef __cplusplus
+
+#include <string>
+#include <vector>
+
+// Support commands and file patterns in registration order, without duplicates
+typedef std::vector<std::string> SupportList;
+
+/**
+ * Run "commands" through the shell, at most "jobs" at once and each for at most
+ * "timeout" seconds (0: no limit), and append their traced output to
+ * "tempDir"/support.txt in the order given. Each command writes to its own file
+ * while they run, so a slow or hung one holds up none of the others.
+ * A line per command with its run time and status is added to "timings".
+ * Return false if any command failed or timed out.
+ */
+bool SupportRunCommands(const SupportList &commands, const char *tempDir, size_t jobs, int timeout,
+                        std::string &timings);
+
+/**
+ * Copy files and directories matching "patterns" (with wildcards) under
+ * "tempDir", keeping their path, mode, owner and times. Anything matched by
+ * more than one pattern, directly or inside a matched directory, is copied once.
+ * A line per pattern with its copy time and number of files is added to "timings".
+ * Return false if anything could not be copied.
+ */
+bool SupportCopyFiles(const SupportList &patterns, const char *tempDir, std::string &timings);
+
+#endif /* __cplusplus */
+
+#endif /* HEX_CONFIG_SUPPORT_H */
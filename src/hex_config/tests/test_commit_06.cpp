@@ -0,0 +1,92 @@
+#include <hex/test.h>
+#include <hex/config_module.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Synthetic modules that sleep in commit to check scheduling order
+//
+//   slow -> tail (100ms)
+//   a (200ms) -> b (200ms) -> c (200ms) -> d (200ms)
+//
+// With WAIT_MODULE set, slow does not finish until that module has, which only
+// happens when modules are committed as soon as their prerequisites finish
+// rather than one dependency level at a time.
+
+static long
+NowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool
+Record(const char *name, long start, const char *extra)
+{
+    char path[64], tmp[64];
+    snprintf(path, sizeof(path), "test.%s.out", name);
+    snprintf(tmp, sizeof(tmp), "test.%s.tmp", name);
+    FILE *fout = fopen(tmp, "w");
+    if (!fout)
+        return false;
+    fprintf(fout, "START=%ld\nEND=%ld\n%s", start, NowMs(), extra);
+    return fclose(fout) == 0 && rename(tmp, path) == 0;
+}
+
+static bool
+Sleep(const char *name, int ms)
+{
+    long start = NowMs();
+
+    const char *fail = getenv("FAIL_MODULE");
+    if (fail && strcmp(fail, name) == 0)
+        return false;
+
+    usleep(ms * 1000);
+    return Record(name, start, "");
+}
+
+// Wait up to 10 seconds for another module to finish its commit
+static bool
+SlowCommit(bool modified, int dryLevel)
+{
+    long start = NowMs();
+    const char *wait = getenv("WAIT_MODULE");
+    bool overlap = false;
+    if (wait) {
+        char path[64];
+        snprintf(path, sizeof(path), "test.%s.out", wait);
+        for (int i = 0; i < 1000 && !overlap; ++i) {
+            overlap = access(path, F_OK) == 0;
+            if (!overlap)
+                usleep(10000);
+        }
+    }
+    return Record("slow", start, overlap ? "OVERLAP=1\n" : "OVERLAP=0\n");
+}
+
+static bool TailCommit(bool modified, int dryLevel) { return Sleep("tail", 100); }
+static bool ACommit(bool modified, int dryLevel) { return Sleep("a", 200); }
+static bool BCommit(bool modified, int dryLevel) { return Sleep("b", 200); }
+static bool CCommit(bool modified, int dryLevel) { return Sleep("c", 200); }
+static bool DCommit(bool modified, int dryLevel) { return Sleep("d", 200); }
+
+CONFIG_MODULE(slow, 0, 0, 0, 0, SlowCommit);
+
+CONFIG_MODULE(tail, 0, 0, 0, 0, TailCommit);
+CONFIG_REQUIRES(tail, slow);
+
+CONFIG_MODULE(a, 0, 0, 0, 0, ACommit);
+
+CONFIG_MODULE(b, 0, 0, 0, 0, BCommit);
+CONFIG_REQUIRES(b, a);
+
+CONFIG_MODULE(c, 0, 0, 0, 0, CCommit);
+CONFIG_REQUIRES(c, b);
+
+CONFIG_MODULE(d, 0, 0, 0, 0, DCommit);
+CONFIG_REQUIRES(d, c);
+
@@ -0,0 +1,35 @@
+
+touch /etc/settings.txt
+
+WAIT_MODULE=d ./$TEST commit bootstrap
+
+for m in slow tail a b c d ; do
+    source test.$m.out
+    eval "${m}_start=$START ${m}_end=$END"
+done
+
+# Modules start only after their prerequisites finish
+[ $tail_start -ge $slow_end ]
+[ $b_start -ge $a_end ]
+[ $c_start -ge $b_end ]
+[ $d_start -ge $c_end ]
+
+# The chain is not held back by the slow module at the first level: the
+# whole chain finished while slow was still committing
+grep -q "^OVERLAP=1$" test.slow.out
+[ $d_end -le $slow_end ]
+
+# Dependents of a failed module are not committed and the commit fails
+rm -f test.*.out
+! FAIL_MODULE=b ./$TEST commit bootstrap
+[ -f test.a.out ]
+[ ! -f test.b.out ]
+[ ! -f test.c.out ]
+[ ! -f test.d.out ]
+
+# Limiting to a single job still commits every module
+rm -f test.*.out
+./$TEST --jobs=1 commit bootstrap
+for m in slow tail a b c d ; do
+    [ -f test.$m.out ]
+done
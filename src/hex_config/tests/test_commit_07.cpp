@@ -0,0 +1,30 @@
+#include <hex/test.h>
+#include <hex/config_module.h>
+#include <string>
+
+// Current and new settings are each parsed from one in-memory image
+// The new settings file becomes the boot settings byte for byte
+
+static std::string s_current;
+static std::string s_new;
+
+static bool
+Parse(const char *name, const char *value, bool isNew)
+{
+    std::string& s = isNew ? s_new : s_current;
+    s += std::string(name) + "=" + value + ";";
+    return true;
+}
+
+static bool
+Commit(bool modified, int dryLevel)
+{
+    FILE *fout = fopen("test.foo.out", "w");
+    if (!fout)
+        return false;
+    fprintf(fout, "CURRENT='%s'\nNEW='%s'\nMODIFIED=%s\n", s_current.c_str(), s_new.c_str(), (modified?"true":"false"));
+    fclose(fout);
+    return true;
+}
+
+CONFIG_MODULE(foo, NULL, Parse, NULL, NULL, Commit);
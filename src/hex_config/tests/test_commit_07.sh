@@ -0,0 +1,31 @@
+
+cat <<EOF >/etc/settings.txt
+foo.a = 1
+EOF
+
+cat <<EOF >test.txt
+# comment
+foo.a = 2
+  foo.b = "x ""y"""
+unknown.a = 1
+foo.c=
+EOF
+
+./$TEST commit test.txt
+source test.foo.out
+[ "$CURRENT" = "foo.a=1;" ]
+[ "$NEW" = 'foo.a=2;foo.b=x "y";foo.c=;' ]
+[ $MODIFIED = "true" ]
+cmp test.txt /etc/settings.txt
+
+# Unchanged settings
+./$TEST commit test.txt
+source test.foo.out
+[ "$CURRENT" = "$NEW" ]
+[ $MODIFIED = "false" ]
+cmp test.txt /etc/settings.txt
+
+# Malformed new settings leave boot settings untouched
+echo 'foo.d' >>test.txt
+! ./$TEST commit test.txt
+! cmp test.txt /etc/settings.txt
@@ -0,0 +1,79 @@
+#include <string>
+
+#include <hex/test.h>
+#include <hex/config_module.h>
+
+static std::string s_fooOld, s_fooNew;
+static std::string s_barNew;
+static std::string s_observedNew;
+
+static bool
+FooParse(const char *name, const char *value, bool isNew)
+{
+    if (isNew)
+        s_fooNew = value;
+    else
+        s_fooOld = value;
+    return true;
+}
+
+static bool
+FooCommit(bool modified, int dryLevel)
+{
+    FILE *fout = fopen("test.foo", "w");
+    if (!fout)
+        return false;
+    fprintf(fout, "FOO_MODIFIED=%d\nFOO_OLD=%s\nFOO_NEW=%s\n", (modified ? 1 : 0), s_fooOld.c_str(), s_fooNew.c_str());
+    fclose(fout);
+    return true;
+}
+
+static bool
+BarParse(const char *name, const char *value, bool isNew)
+{
+    if (isNew)
+        s_barNew = value;
+    return true;
+}
+
+static bool
+BarCommit(bool modified, int dryLevel)
+{
+    FILE *fout = fopen("test.bar", "w");
+    if (!fout)
+        return false;
+    fprintf(fout, "BAR_MODIFIED=%d\nBAR_NEW=%s\n", (modified ? 1 : 0), s_barNew.c_str());
+    fclose(fout);
+    return true;
+}
+
+static bool
+BazParse(const char *name, const char *value, bool isNew)
+{
+    return true;
+}
+
+static bool
+BazObserveFoo(const char *name, const char *value, bool isNew)
+{
+    if (isNew)
+        s_observedNew = value;
+    return true;
+}
+
+static bool
+BazCommit(bool modified, int dryLevel)
+{
+    FILE *fout = fopen("test.baz", "w");
+    if (!fout)
+        return false;
+    fprintf(fout, "BAZ_MODIFIED=%d\nBAZ_OBSERVED=%s\n", (modified ? 1 : 0), s_observedNew.c_str());
+    fclose(fout);
+    return true;
+}
+
+CONFIG_MODULE(foo, NULL, FooParse, NULL, NULL, FooCommit);
+CONFIG_MODULE(bar, NULL, BarParse, NULL, NULL, BarCommit);
+CONFIG_MODULE(baz, NULL, BazParse, NULL, NULL, BazCommit);
+CONFIG_OBSERVES(baz, foo, BazObserveFoo, NULL);
+
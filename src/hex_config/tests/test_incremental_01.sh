@@ -0,0 +1,44 @@
+
+cat <<EOF >/etc/settings.txt
+foo.a = 1
+bar.a = 1
+baz.a = 1
+EOF
+
+# bootstrap commits everything and records the settings digest
+./$TEST commit bootstrap
+[ -f /etc/settings.digest ]
+[ -f test.foo -a -f test.bar -a -f test.baz ]
+
+cat <<EOF >test.txt
+# comment
+foo.a = 2
+bar.a = 1
+baz.a = 1
+EOF
+
+# only foo changed: foo and its observer baz run, bar is skipped
+rm -f test.foo test.bar test.baz
+./$TEST -i commit test.txt
+[ ! -f test.bar ]
+source test.foo
+[ $FOO_MODIFIED -eq 1 -a "$FOO_OLD" = "1" -a "$FOO_NEW" = "2" ]
+source test.baz
+[ $BAZ_MODIFIED -eq 0 -a "$BAZ_OBSERVED" = "2" ]
+
+# nothing changed: no module with settings runs
+rm -f test.foo test.bar test.baz
+./$TEST -i commit test.txt
+[ ! -f test.foo -a ! -f test.bar -a ! -f test.baz ]
+
+# boot settings edited behind hex_config's back: digest is stale, everything runs
+echo "bar.b = 2" >>/etc/settings.txt
+./$TEST -i commit test.txt
+[ -f test.foo -a -f test.bar -a -f test.baz ]
+source test.bar
+[ $BAR_MODIFIED -eq 1 ]
+
+# without -i every module commits
+rm -f test.foo test.bar test.baz
+./$TEST commit test.txt
+[ -f test.foo -a -f test.bar -a -f test.baz ]
@@ -0,0 +1,28 @@
+
+#include <cstdlib>
+#include <string>
+
+#include <unistd.h>
+
+#include <hex/test.h>
+#include <hex/config_module.h>
+
+CONFIG_SNAPSHOT_FILE("/tmp/snapshot_apply_01/policies");
+CONFIG_SNAPSHOT_MANAGED_FILE("/tmp/snapshot_apply_01/state", "root", "root", 0600);
+
+static int
+Apply(const char* backupDir, const char* snapshotDir)
+{
+    // The whole snapshot is staged and the files it replaced are backed up
+    std::string policy = snapshotDir;
+    policy += "/tmp/snapshot_apply_01/policies/p1";
+    HEX_TEST_FATAL(access(policy.c_str(), R_OK) == 0);
+
+    std::string backup = backupDir;
+    backup += "/tmp/snapshot_apply_01/state/a";
+    HEX_TEST_FATAL(access(backup.c_str(), R_OK) == 0);
+
+    return getenv("SNAPSHOT_APPLY_FAIL") ? 1 : 0;
+}
+
+CONFIG_SNAPSHOT_COMMAND(component, 0, Apply, 0);
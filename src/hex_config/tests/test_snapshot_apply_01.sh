@@ -0,0 +1,45 @@
+# Validate constructors
+./$TEST --test
+
+D=/tmp/snapshot_apply_01
+rm -rf $D
+mkdir -p $D/policies $D/state/sub
+echo p1 > $D/policies/p1
+echo old > $D/state/a
+echo old > $D/state/sub/b
+ln -s a $D/state/link
+chmod 644 $D/state/a $D/state/sub/b
+
+rm -f test.zip
+./$TEST create_snapshot test.zip
+
+# Managed files are replaced with the snapshot's, with the registered owner
+# and mode, and files not in the snapshot are removed
+echo new > $D/state/a
+echo extra > $D/state/extra
+rm $D/state/sub/b
+./$TEST -ve apply_snapshot test.zip
+[ "$(cat $D/state/a)" = "old" ]
+[ "$(cat $D/state/sub/b)" = "old" ]
+[ "$(readlink $D/state/link)" = "a" ]
+[ ! -e $D/state/extra ]
+[ "$(stat -c %a:%U:%G $D/state/a)" = "600:root:root" ]
+[ "$(stat -c %a $D/state/sub)" = "700" ]
+
+# A failed snapshot command puts back the very files that were there
+echo newer > $D/state/a
+echo extra > $D/state/extra
+chmod 644 $D/state/a
+inode=$(stat -c %i $D/state/a)
+! SNAPSHOT_APPLY_FAIL=1 ./$TEST -ve apply_snapshot test.zip
+[ "$(cat $D/state/a)" = "newer" ]
+[ "$(cat $D/state/extra)" = "extra" ]
+[ "$(stat -c %i:%a $D/state/a)" = "$inode:644" ]
+[ "$(cat $D/state/sub/b)" = "old" ]
+
+# Archives that cannot be read change nothing
+echo junk > test.bad.zip
+! ./$TEST apply_snapshot test.bad.zip
+[ "$(cat $D/state/a)" = "newer" ]
+
+rm -rf $D
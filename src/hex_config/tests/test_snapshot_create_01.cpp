@@ -0,0 +1,25 @@
+
+#include <cstdio>
+#include <string>
+
+#include <hex/config_module.h>
+
+// Overlapping patterns and a missing one
+CONFIG_SNAPSHOT_FILE("/tmp/snapshot_create_01");
+CONFIG_SNAPSHOT_FILE("/tmp/snapshot_create_01/*.conf");
+CONFIG_SNAPSHOT_FILE("/tmp/snapshot_create_01/missing");
+
+static int
+Create(const char* dir)
+{
+    std::string path = dir;
+    path += "/component.txt";
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp)
+        return 1;
+    fprintf(fp, "created\n");
+    fclose(fp);
+    return 0;
+}
+
+CONFIG_SNAPSHOT_COMMAND(component, Create, 0, 0);
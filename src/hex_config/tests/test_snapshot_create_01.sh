@@ -0,0 +1,51 @@
+# Validate constructors
+./$TEST --test
+
+rm -rf /tmp/snapshot_create_01
+mkdir -p /tmp/snapshot_create_01/sub
+echo one > /tmp/snapshot_create_01/one.conf
+echo deep > /tmp/snapshot_create_01/sub/deep.txt
+ln -s one.conf /tmp/snapshot_create_01/link.conf
+touch -d 2001-01-01 /tmp/snapshot_create_01/one.conf
+
+# Files from patterns once each, then what snapshot commands created
+rm -f test.zip
+./$TEST -ve create_snapshot test.zip
+unzip -tq test.zip
+cat <<EOF >test.expected
+tmp/snapshot_create_01/
+tmp/snapshot_create_01/link.conf
+tmp/snapshot_create_01/one.conf
+tmp/snapshot_create_01/sub/
+tmp/snapshot_create_01/sub/deep.txt
+Comment
+Warnings
+component.txt
+EOF
+unzip -Z1 test.zip > test.out
+cmp test.out test.expected
+[ "$(unzip -p test.zip component.txt)" = "created" ]
+unzip -p test.zip Warnings | grep -q 'pattern: /tmp/snapshot_create_01/missing$'
+unzip -p test.zip Comment | grep -q 'Automatically generated on'
+
+# Links, times and contents as they were
+rm -rf test.x
+mkdir test.x
+(cd test.x && unzip -q ../test.zip)
+[ "$(readlink test.x/tmp/snapshot_create_01/link.conf)" = "one.conf" ]
+[ "$(cat test.x/tmp/snapshot_create_01/sub/deep.txt)" = "deep" ]
+[ test.x/tmp/snapshot_create_01/one.conf -ot test.x/tmp/snapshot_create_01/sub/deep.txt ]
+
+# A directory named relative to it, then patterns by their own names
+rm -f test.zip
+./$TEST create_archive test.zip /tmp/snapshot_create_01/sub '/tmp/snapshot_create_01/*.conf'
+cat <<EOF >test.expected
+deep.txt
+tmp/snapshot_create_01/link.conf
+tmp/snapshot_create_01/one.conf
+EOF
+unzip -Z1 test.zip > test.out
+cmp test.out test.expected
+! ./$TEST create_archive test.zip /tmp/snapshot_create_01/sub /tmp/snapshot_create_01/missing
+
+rm -rf test.x /tmp/snapshot_create_01
@@ -0,0 +1,22 @@
+#include <cstdio>
+#include <string>
+
+#include <hex/config_module.h>
+
+CONFIG_SNAPSHOT_FILE("/tmp/snapshot_store_01/policies");
+CONFIG_SNAPSHOT_MANAGED_FILE("/tmp/snapshot_store_01/state", "root", "root", 0600);
+
+static int
+Create(const char* dir)
+{
+    std::string path = dir;
+    path += "/component.txt";
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp)
+        return 1;
+    fprintf(fp, "created\n");
+    fclose(fp);
+    return 0;
+}
+
+CONFIG_SNAPSHOT_COMMAND(component, Create, 0, 0);
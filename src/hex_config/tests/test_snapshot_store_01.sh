@@ -0,0 +1,92 @@
+# Validate constructors
+./$TEST --test
+
+D=/tmp/snapshot_store_01
+S=$PWD/test.store
+rm -rf $D $S
+mkdir -p $D/policies $D/state/sub
+head -c 1000000 /dev/urandom > $D/policies/large
+echo p1 > $D/policies/p1
+echo old > $D/state/a
+ln -s a $D/state/link
+touch -d 2001-01-01 $D/policies/p1
+
+# The first snapshot writes everything, a second one with a small change
+# to a large file only a few more chunks
+./$TEST -ve create_snapshot --store $S one 2>&1 | tee test.log
+[ -f $S/manifests/one ]
+chunks=$(find $S/chunks -type f | wc -l)
+[ $chunks -gt 10 ]
+printf 'changed' | dd of=$D/policies/large bs=1 seek=500000 conv=notrunc 2>/dev/null
+./$TEST create_snapshot --store $S two
+added=$(( $(find $S/chunks -type f | wc -l) - chunks ))
+[ $added -ge 1 ] && [ $added -le 4 ]
+
+# Exported snapshots are the zip files create_snapshot would have written
+./$TEST export_snapshot $S one test.zip
+unzip -tq test.zip
+rm -f test.ref.zip
+./$TEST create_snapshot test.ref.zip
+diff <(unzip -Z1 test.zip | grep -v / ) <(unzip -Z1 test.ref.zip | grep -v /)
+rm -rf test.x && mkdir test.x && (cd test.x && unzip -q ../test.zip)
+cmp test.x/tmp/snapshot_store_01/policies/p1 $D/policies/p1
+[ "$(readlink test.x/tmp/snapshot_store_01/state/link)" = "a" ]
+[ "$(cat test.x/component.txt)" = "created" ]
+[ test.x/tmp/snapshot_store_01/policies/p1 -ot test.x/component.txt ]
+! cmp -s test.x/tmp/snapshot_store_01/policies/large $D/policies/large
+
+# Snapshots apply from the store like from a zip file
+echo new > $D/state/a
+echo extra > $D/state/extra
+./$TEST -ve apply_snapshot --store $S one
+[ "$(cat $D/state/a)" = "old" ]
+[ ! -e $D/state/extra ]
+[ "$(stat -c %a:%U:%G $D/state/a)" = "600:root:root" ]
+! ./$TEST apply_snapshot --store $S missing
+! ./$TEST create_snapshot --store $S ../escape
+
+# A link extracted from a snapshot does not lead later entries out of the
+# directory, even from a manifest that has been tampered with
+V=/tmp/snapshot_store_01.victim
+rm -rf $V && mkdir $V
+ln -s $V $D/state/out
+./$TEST create_snapshot --store $S evil
+rm $D/state/out
+grep -A1 ' tmp/snapshot_store_01/policies/p1$' $S/manifests/evil | sed 's|policies/p1$|state/out/pwned|' > test.entry
+cat test.entry >> $S/manifests/evil
+! ./$TEST export_snapshot $S evil test.zip
+[ ! -e $V/pwned ]
+./$TEST remove_snapshot $S evil
+rm -rf $V test.entry
+
+# Names keep their blanks, even leading ones
+echo blank > "$D/state/ blank "
+./$TEST create_snapshot --store $S blank
+grep -q ' tmp/snapshot_store_01/state/%20blank%20$' $S/manifests/blank
+rm "$D/state/ blank "
+./$TEST apply_snapshot --store $S blank
+[ "$(cat "$D/state/ blank ")" = "blank" ]
+grep -A1 ' tmp/snapshot_store_01/policies/p1$' $S/manifests/blank | sed 's| tmp/snapshot_store_01/policies/p1$| %20p1|' >> $S/manifests/blank
+./$TEST export_snapshot $S blank test.zip
+unzip -Z1 test.zip | grep -qx ' p1'
+./$TEST remove_snapshot $S blank
+rm "$D/state/ blank "
+
+# Removing a snapshot removes only the chunks no other snapshot uses
+./$TEST remove_snapshot $S one
+[ ! -e $S/manifests/one ]
+[ $(find $S/chunks -type f | wc -l) -eq $(awk '$1 == "c" { print $2 }' $S/manifests/two | sort -u | wc -l) ]
+./$TEST export_snapshot $S two test.zip
+unzip -tq test.zip
+./$TEST remove_snapshot $S two
+[ $(find $S/chunks -type f | wc -l) -eq 0 ]
+! ./$TEST remove_snapshot $S two
+
+# Damaged chunks are found rather than applied
+./$TEST create_snapshot --store $S three
+for chunk in $(find $S/chunks -type f); do echo junk > $chunk; done
+echo newer > $D/state/a
+! ./$TEST apply_snapshot --store $S three
+[ "$(cat $D/state/a)" = "newer" ]
+
+rm -rf $D $S test.x
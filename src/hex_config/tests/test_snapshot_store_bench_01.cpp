@@ -0,0 +1,5 @@
+#include <hex/config_module.h>
+
+// Time to take 50 snapshots of a tree that changes a little between them,
+// and the disk they use, as zip files and in a snapshot store
+CONFIG_SNAPSHOT_FILE("/tmp/snapshot_store_bench_01");
@@ -0,0 +1,55 @@
+# Validate constructors
+./$TEST --test
+
+D=/tmp/snapshot_store_bench_01
+N=50
+rm -rf $D test.zips test.store
+mkdir -p $D test.zips
+mkdir $(seq -f "$D/d%g" 20)
+awk -v D=$D 'BEGIN {
+    for (d = 1; d <= 20; d++)
+        for (f = 1; f <= 50; f++) {
+            file = D "/d" d "/f" f
+            for (s = 1; s <= 100; s++)
+                print "setting." d "." f "." s " = value " s * 7 > file
+            close(file)
+        }
+}'
+head -c 4000000 /dev/urandom > $D/firmware.bin
+
+now() { date +%s.%N; }
+elapsed() { awk "BEGIN { printf \"%.2f\", $2 - $1 }"; }
+
+# Each snapshot changes one setting and a block of the large file
+change() {
+    echo "setting.changed = $1" >> $D/d$(( $1 % 20 + 1 ))/f1
+    head -c 4096 /dev/urandom | dd of=$D/firmware.bin bs=4096 seek=$(( $1 * 7 % 900 )) conv=notrunc 2>/dev/null
+}
+
+start=$(now)
+for i in $(seq $N); do
+    change $i
+    ./$TEST create_snapshot test.zips/s$i.zip
+done
+zipTime=$(elapsed $start $(now))
+
+start=$(now)
+for i in $(seq $N); do
+    change $(( i + N ))
+    ./$TEST create_snapshot --store test.store s$i
+done
+storeTime=$(elapsed $start $(now))
+
+zipKB=$(du -sk test.zips | cut -f1)
+storeKB=$(du -sk test.store | cut -f1)
+echo "$N snapshots of $(find $D -type f | wc -l) files, $(du -sk $D | cut -f1) KB"
+echo "zip files: $zipTime secs, $zipKB KB"
+echo "store:     $storeTime secs, $storeKB KB"
+[ $storeKB -lt $(( zipKB / 5 )) ]
+
+# The last snapshot is all there
+./$TEST export_snapshot test.store s$N test.zip
+rm -rf test.x && mkdir test.x && (cd test.x && unzip -q ../test.zip)
+diff -r $D test.x$D
+
+rm -rf $D test.zips test.store test.x test.zip
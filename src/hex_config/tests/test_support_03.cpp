@@ -0,0 +1,13 @@
+
+#include <hex/config_module.h>
+
+// Registration order, not sorted order
+CONFIG_SUPPORT_COMMAND("sleep 1; echo zulu");
+CONFIG_SUPPORT_COMMAND("sleep 30; echo hung");
+CONFIG_SUPPORT_COMMAND("sleep 1; echo alpha");
+CONFIG_SUPPORT_COMMAND("sleep 1; echo zulu");
+
+// Overlapping patterns
+CONFIG_SUPPORT_FILE("/tmp/support_03");
+CONFIG_SUPPORT_FILE("/tmp/support_03/*.log");
+CONFIG_SUPPORT_FILE("/tmp/support_03/sub/deep.txt");
@@ -0,0 +1,53 @@
+
+# Validate constructors
+./$TEST --test
+
+rm -rf /tmp/support_03
+mkdir -p /tmp/support_03/sub
+echo one > /tmp/support_03/one.log
+echo two > /tmp/support_03/two.log
+echo deep > /tmp/support_03/sub/deep.txt
+ln -s one.log /tmp/support_03/link.log
+touch -d 2001-01-01 /tmp/support_03/one.log
+
+# Create support info in temp directory, killing commands after 3 seconds
+rm -rf test.tmp
+mkdir test.tmp
+start=$(date +%s)
+./$TEST -ve create_support_info test.tmp 3
+end=$(date +%s)
+
+# Commands ran at once
+[ $((end - start)) -lt 10 ]
+
+# Output in registration order, once per command, with the hung one killed
+grep -n '^zulu$\|^alpha$\|killed after 3 seconds' test.tmp/support.txt | tee test.out
+[ "$(cut -d: -f2 test.out | tr '\n' ' ')" = "zulu + # killed after 3 seconds alpha " ]
+! grep hung test.tmp/support.txt | grep -v '^+\|timed out'
+
+# Files matched by several patterns are copied once, with their times and links
+cat <<EOF >test.expected
+test.tmp
+test.tmp/support.txt
+test.tmp/tmp
+test.tmp/tmp/support_03
+test.tmp/tmp/support_03/link.log
+test.tmp/tmp/support_03/one.log
+test.tmp/tmp/support_03/sub
+test.tmp/tmp/support_03/sub/deep.txt
+test.tmp/tmp/support_03/two.log
+EOF
+find test.tmp | sort > test.out
+cmp test.out test.expected
+[ "$(readlink test.tmp/tmp/support_03/link.log)" = "one.log" ]
+[ "$(cat test.tmp/tmp/support_03/sub/deep.txt)" = "deep" ]
+[ test.tmp/tmp/support_03/one.log -ot test.tmp/tmp/support_03/two.log ]
+
+# Each item with how long it took
+grep -A7 '^Support info collection times:' test.tmp/support.txt | tee test.out
+grep -q 'secs  exit 0 .*echo alpha' test.out
+grep -q 'secs  timed out .*echo hung' test.out
+grep -q 'secs  4 files .*/tmp/support_03$' test.out
+grep -q 'secs  0 files .*/tmp/support_03/\*\.log$' test.out
+
+rm -rf /tmp/support_03
@@ -0,0 +1,37 @@
+#include <hex/test.h>
+#include <hex/config_module.h>
+
+static bool
+Init()
+{
+    return true;
+}
+
+static bool
+Parse(const char *name, const char *value, bool isNew)
+{
+    return true;
+}
+
+static bool
+Validate()
+{
+    return true;
+}
+
+static bool
+Prepare(bool modified, int dryLevel)
+{
+    return true;
+}
+
+static bool
+Commit(bool modified, int dryLevel)
+{
+    return true;
+}
+
+CONFIG_MODULE(foo, Init, Parse, Validate, Prepare, Commit);
+
+CONFIG_MODULE(bar, Init, Parse, Validate, Prepare, Commit);
+CONFIG_REQUIRES(bar, foo);
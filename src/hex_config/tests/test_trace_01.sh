@@ -0,0 +1,28 @@
+
+cat <<EOF >/etc/settings.txt
+foo.a=1
+foo.b=1
+bar.a=1
+EOF
+
+./$TEST --trace=test.json commit bootstrap
+
+# Chrome trace event JSON
+head -1 test.json | grep -q '"traceEvents":\['
+tail -1 test.json | grep -q '^\]}$'
+
+# One span per module and phase, parse lines of a module are merged
+for phase in init parse validate prepare commit ; do
+    [ $(grep -c "\"name\":\"foo\",\"cat\":\"$phase\",\"ph\":\"X\"" test.json) -eq 1 ]
+    [ $(grep -c "\"name\":\"bar\",\"cat\":\"$phase\",\"ph\":\"X\"" test.json) -eq 1 ]
+    [ $(grep -c "\"name\":\"$phase\",\"cat\":\"stage\",\"ph\":\"X\"" test.json) -eq 1 ]
+done
+grep "\"name\":\"foo\",\"cat\":\"commit\"" test.json | grep -q '"args":{"modified":true}'
+
+# Modules are marked ready once their prerequisites have committed
+grep -q "\"name\":\"bar\",\"cat\":\"ready\",\"ph\":\"i\"" test.json
+
+# No trace file unless requested
+rm -f test.json
+./$TEST commit bootstrap
+[ ! -f test.json ]
@@ -0,0 +1,166 @@
+// HEX SDK
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include <string>
+#include <vector>
+
+#include <hex/log.h>
+
+#include "trace.h"
+
+struct TraceEvent {
+    std::string phase;
+    std::string module;
+    char type;          // 'X' for complete events, 'i' for instant events
+    int64_t begin;
+    int64_t end;
+    long tid;
+    int modified;
+};
+
+static bool s_enabled = false;
+static struct timespec s_start;
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<TraceEvent> s_events;
+
+// Index of the last event recorded by each thread, used to merge adjacent spans
+static thread_local long s_last = -1;
+
+static long
+ThreadId()
+{
+    return syscall(SYS_gettid);
+}
+
+void
+TraceEnable()
+{
+    clock_gettime(CLOCK_MONOTONIC, &s_start);
+    s_enabled = true;
+}
+
+bool
+TraceEnabled()
+{
+    return s_enabled;
+}
+
+int64_t
+TraceNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)(ts.tv_sec - s_start.tv_sec) * 1000000 + (ts.tv_nsec - s_start.tv_nsec) / 1000;
+}
+
+void
+TraceSpan(const char *phase, const char *module, int64_t begin, int64_t end, int modified)
+{
+    if (!s_enabled)
+        return;
+
+    pthread_mutex_lock(&s_lock);
+    if (s_last >= 0) {
+        TraceEvent& last = s_events[s_last];
+        if (last.type == 'X' && last.modified == modified &&
+            last.phase == phase && last.module == module) {
+            last.end = end;
+            pthread_mutex_unlock(&s_lock);
+            return;
+        }
+    }
+
+    TraceEvent ev;
+    ev.phase = phase;
+    ev.module = module;
+    ev.type = 'X';
+    ev.begin = begin;
+    ev.end = end;
+    ev.tid = ThreadId();
+    ev.modified = modified;
+    s_last = s_events.size();
+    s_events.push_back(ev);
+    pthread_mutex_unlock(&s_lock);
+}
+
+void
+TraceInstant(const char *phase, const char *module)
+{
+    if (!s_enabled)
+        return;
+
+    TraceEvent ev;
+    ev.phase = phase;
+    ev.module = module;
+    ev.type = 'i';
+    ev.begin = ev.end = TraceNow();
+    ev.tid = ThreadId();
+    ev.modified = -1;
+
+    pthread_mutex_lock(&s_lock);
+    s_last = s_events.size();
+    s_events.push_back(ev);
+    pthread_mutex_unlock(&s_lock);
+}
+
+static void
+WriteString(FILE *fout, const std::string& str)
+{
+    fputc('"', fout);
+    for (auto c : str) {
+        if (c == '"' || c == '\\')
+            fprintf(fout, "\\%c", c);
+        else if ((unsigned char)c < 0x20)
+            fprintf(fout, "\\u%04x", c);
+        else
+            fputc(c, fout);
+    }
+    fputc('"', fout);
+}
+
+bool
+TraceWrite(const char *file)
+{
+    FILE *fout = fopen(file, "w");
+    if (!fout) {
+        HexLogError("Could not open trace file %s: %s", file, strerror(errno));
+        return false;
+    }
+
+    int pid = getpid();
+
+    pthread_mutex_lock(&s_lock);
+    fprintf(fout, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(fout, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"hex_config\"}}", pid);
+    for (auto& ev : s_events) {
+        fprintf(fout, ",\n{\"name\":");
+        WriteString(fout, ev.module);
+        fprintf(fout, ",\"cat\":");
+        WriteString(fout, ev.phase);
+        fprintf(fout, ",\"ph\":\"%c\",\"ts\":%lld,", ev.type, (long long)ev.begin);
+        if (ev.type == 'X')
+            fprintf(fout, "\"dur\":%lld,", (long long)(ev.end - ev.begin));
+        else
+            fprintf(fout, "\"s\":\"t\",");
+        fprintf(fout, "\"pid\":%d,\"tid\":%ld", pid, ev.tid);
+        if (ev.modified >= 0)
+            fprintf(fout, ",\"args\":{\"modified\":%s}", ev.modified ? "true" : "false");
+        fputc('}', fout);
+    }
+    fprintf(fout, "\n]}\n");
+    pthread_mutex_unlock(&s_lock);
+
+    if (fclose(fout) != 0) {
+        HexLogError("Could not write trace file %s: %s", file, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,55 @@
+// HEX SDK
+
+#ifndef HEX_CONFIG_TRACE_H
+#define HEX_CONFIG_TRACE_H
+
+#ifdef __cplusplus
+
+#include <stdint.h>
+
+// Timeline of module phases written as Chrome trace event JSON
+// Open the result with chrome://tracing or https://ui.perfetto.dev
+
+// Start recording events
+void TraceEnable();
+
+bool TraceEnabled();
+
+// Microseconds since tracing was enabled
+int64_t TraceNow();
+
+/**
+ * Record a complete event for "module" in "phase" on the calling thread.
+ * "modified" is omitted from the event arguments when negative.
+ * Back-to-back events of the same phase and module on one thread are merged,
+ * so per-line parse calls show up as one span per run of lines.
+ */
+void TraceSpan(const char *phase, const char *module, int64_t begin, int64_t end, int modified = -1);
+
+// Record an instant event for "module" on the calling thread
+void TraceInstant(const char *phase, const char *module);
+
+// Write all recorded events to "file"
+bool TraceWrite(const char *file);
+
+// Record a span from construction to destruction
+class TraceScope {
+public:
+    TraceScope(const char *phase, const char *module, int modified = -1)
+        : m_phase(phase), m_module(module), m_modified(modified),
+          m_begin(TraceEnabled() ? TraceNow() : 0) { }
+    ~TraceScope() {
+        if (TraceEnabled())
+            TraceSpan(m_phase, m_module, m_begin, TraceNow(), m_modified);
+    }
+
+private:
+    const char *m_phase;
+    const char *m_module;
+    int m_modified;
+    int64_t m_begin;
+};
+
+#endif /* __cplusplus */
+
+#endif /* HEX_CONFIG_TRACE_H */
@@ -1,35 +1,76 @@
 // HEX SDK
 
+#define _GNU_SOURCE // GNU basename
 #include <getopt.h> // should be GNU version
 #include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/inotify.h>
 #include <sys/poll.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <hex/log.h>
-#include <hex/process.h>
 #include <hex/daemon.h>
 #include <hex/watchdog.h>
 
-// Hidden SDK func
+#include "symbolize.h"
+
+// Hidden SDK funcs
 int HexCrashInfo(const char* filename, siginfo_t* info, const char** reason, void** addrs, size_t* naddrs, greg_t* regs, size_t* nregs);
+int HexCrashInfoThread(const char* filename, size_t index, pid_t* tid, void** addrs, size_t* naddrs, greg_t* regs, size_t* nregs);
 
 static const char PROGRAM[] = "hex_crashd";
 static const char DISPLAY_NAME[] = "crash logger";
 
-// Guess at inotify buffer length
-static const size_t BUF_LEN = 16 * (sizeof (struct inotify_event) + 16);
+// Room for a batch of inotify events, each with the longest name
+#define BUF_LEN (64 * (sizeof(struct inotify_event) + NAME_MAX + 1))
 
-// Main loop timeout value
+// Main loop timeout value in seconds
 static const int TIMEOUT = 10;
 
 static const char CRASH_DIR[] = "/var/support";
-static const char MAX_CORE_FILE[] = "/etc/debug.max_core_files";
+
+// Core file limits written by the debug module
+static const char LIMITS_DIR[] = "/etc";
+static const char MAX_CORE_FILE[] = "debug.max_core_files";
+static const char MAX_CORE_SIZE_FILE[] = "debug.max_core_size";
+
+// Frames and registers logged of each thread
+#define MAX_FRAMES 20
+#define MAX_REGS 23
+
+// Time allowed to resolve the stacks of one crash
+#define SYM_BUDGET_MS 500
 
 // Default number of cores before the oldest is removed.
 static const int MAX_CORES = 3;
 
+// Core files in CRASH_DIR, kept up to date from file system events
+typedef struct {
+    char name[NAME_MAX + 1];
+    struct timespec mtime;
+    // Disk space used, cores being sparse
+    off_t bytes;
+} CoreFile;
+
+static CoreFile *s_cores = NULL;
+static size_t s_numCores = 0;
+static size_t s_coresAlloc = 0;
+static off_t s_coreBytes = 0;
+
+static int s_maxCores = MAX_CORES;
+// 0: no quota
+static off_t s_maxCoreBytes = 0;
+
+static int s_crashDirFd = -1;
+
 static volatile sig_atomic_t s_term = 0;
 
 static void
@@ -49,61 +90,169 @@ Usage()
     fprintf(stderr, "Usage: %s [-f] [--foreground] [-v] [--verbose]\n", PROGRAM);
 }
 
+// Read the integer in file "name" of LIMITS_DIR, or return "dflt"
+static long
+ReadLimit(const char *name, long dflt)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", LIMITS_DIR, name);
+
+    long value = dflt;
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        HexLogDebug("Unable to open %s; using default %ld", path, dflt);
+    }
+    else {
+        char buf[32];
+        if (fgets(buf, sizeof(buf), fp))
+            value = strtol(buf, NULL, 10);
+        fclose(fp);
+    }
+    return value;
+}
+
 // When debug.enable_core_files.<process name> has been enabled we
 // need to manage how many core files end up being written to disk to prevent it
 // filling up. The maximum number of cores is configurable via advanced
-// tuning parameter debug.max_core_files
+// tuning parameter debug.max_core_dump, and the space they take in MB
+// via debug.max_core_dump_size
 static void
-coreHousekeep()
+ReadCoreLimits()
 {
-    static const char corePattern[] = "core_*.*";
-    int maxCores = MAX_CORES;
-    int numCores = 0;
-
-    // Determine the maximum number of cores from the max core file
-    FILE *maxCoreFile = fopen(MAX_CORE_FILE, "r");
-    if (!maxCoreFile) {
-        // so make it debug
-        HexLogDebug("Unable to open %s; using default %d", MAX_CORE_FILE, maxCores);
+    s_maxCores = ReadLimit(MAX_CORE_FILE, MAX_CORES);
+    s_maxCoreBytes = (off_t)ReadLimit(MAX_CORE_SIZE_FILE, 0) * 1024 * 1024;
+}
+
+// Core files are named core_<program>.<pid>
+static int
+IsCoreFile(const char *name)
+{
+    return strncmp(name, "core_", 5) == 0 && strchr(name + 5, '.') != NULL;
+}
+
+static ssize_t
+CoreFind(const char *name)
+{
+    size_t i;
+    for (i = 0; i < s_numCores; ++i) {
+        if (strcmp(s_cores[i].name, name) == 0)
+            return i;
     }
-    else {
-        int bufSize = 5; // accommodate a 5 digit number plus terminator
-        char buf[bufSize];
-        char *res = fgets(buf, bufSize, maxCoreFile);
-        if (res) {
-            maxCores = strtol(buf, NULL, 10);
+    return -1;
+}
+
+static void
+CoreRemoveAt(size_t i)
+{
+    s_coreBytes -= s_cores[i].bytes;
+    s_cores[i] = s_cores[--s_numCores];
+}
+
+// Forget core file "name" if it is in the index
+static void
+CoreForget(const char *name)
+{
+    ssize_t i = CoreFind(name);
+    if (i >= 0)
+        CoreRemoveAt(i);
+}
+
+// Add core file "name" to the index, or update its time and size
+static void
+CoreUpdate(const char *name)
+{
+    struct stat st;
+    if (fstatat(s_crashDirFd, name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) {
+        CoreForget(name);
+        return;
+    }
+    if (strlen(name) > NAME_MAX)
+        return;
+
+    ssize_t i = CoreFind(name);
+    if (i < 0) {
+        if (s_numCores == s_coresAlloc) {
+            size_t alloc = s_coresAlloc ? s_coresAlloc * 2 : 16;
+            CoreFile *cores = realloc(s_cores, alloc * sizeof(CoreFile));
+            if (!cores) {
+                HexLogError("Unable to track core file %s: out of memory", name);
+                return;
+            }
+            s_cores = cores;
+            s_coresAlloc = alloc;
         }
-        fclose(maxCoreFile);
+        i = s_numCores++;
+        strcpy(s_cores[i].name, name);
+        s_cores[i].bytes = 0;
     }
+    s_coreBytes -= s_cores[i].bytes;
+    s_cores[i].mtime = st.st_mtim;
+    s_cores[i].bytes = (off_t)st.st_blocks * 512;
+    s_coreBytes += s_cores[i].bytes;
+}
 
-    // Count existing cores
-    FILE *fp = HexPOpenF("ls %s/%s | wc -l", CRASH_DIR, corePattern);
-    if (fp) {
-        int bufSize = 5; // accommodate a 5 digit number plus terminator
-        char buf[bufSize];
-        char *res = fgets(buf, bufSize, fp);
-        if (res) {
-            numCores = strtol(buf, NULL, 10);
-        }
-        pclose(fp);
-        fp = 0;
+// Index the core files in the crash directory from scratch
+static void
+CoreScan()
+{
+    s_numCores = 0;
+    s_coreBytes = 0;
+
+    int fd = dup(s_crashDirFd);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        HexLogError("Unable to read %s: %s", CRASH_DIR, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return;
     }
-    else {
-        HexLogInfo("Failed to get number of cores");
+    rewinddir(dir);
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (IsCoreFile(ent->d_name))
+            CoreUpdate(ent->d_name);
     }
+    closedir(dir);
+}
 
-    // Remove the oldest core files from the filesystem if required
-    int numCoresToClean = 0;
-    if (numCores > maxCores) {
-        numCoresToClean = numCores - maxCores;
-        HexSystemF(0, "ls -tr %s/%s | head -%d | xargs rm -f", CRASH_DIR, corePattern, numCoresToClean);
+static int
+CoreOlder(const CoreFile *a, const CoreFile *b)
+{
+    if (a->mtime.tv_sec != b->mtime.tv_sec)
+        return a->mtime.tv_sec < b->mtime.tv_sec;
+    if (a->mtime.tv_nsec != b->mtime.tv_nsec)
+        return a->mtime.tv_nsec < b->mtime.tv_nsec;
+    return strcmp(a->name, b->name) < 0;
+}
+
+// Remove the oldest core files while there are more than the maximum or
+// they take more than the quota
+static void
+CoreHousekeep()
+{
+    size_t found = s_numCores;
+    int removed = 0;
+
+    while (s_numCores > 0 &&
+           ((int)s_numCores > s_maxCores || (s_maxCoreBytes > 0 && s_coreBytes > s_maxCoreBytes))) {
+        size_t oldest = 0;
+        size_t i;
+        for (i = 1; i < s_numCores; ++i) {
+            if (CoreOlder(&s_cores[i], &s_cores[oldest]))
+                oldest = i;
+        }
+        if (unlinkat(s_crashDirFd, s_cores[oldest].name, 0) != 0 && errno != ENOENT)
+            HexLogError("Unable to remove core file %s: %s", s_cores[oldest].name, strerror(errno));
+        else
+            removed++;
         // Crashmaps intentionally not removed to provide indication to how
         // many times a deamon has crashed
+        CoreRemoveAt(oldest);
     }
 
-    // Note: maybe off by 1 in the case where core hasn't been sync'ed to
-    // disk, however, one over our maximum isn't a bug deal
-    HexLogDebug("Core Files: found: %d, max: %d, removed: %d", numCores, maxCores, numCoresToClean);
+    if (removed > 0)
+        HexLogDebug("Core Files: found: %zu, max: %d, max bytes: %lld, removed: %d",
+                    found, s_maxCores, (long long)s_maxCoreBytes, removed);
 }
 
 // Wait until a crash file is done being written
@@ -134,6 +283,74 @@ WaitUntilFileClosed(const char* filename, int timeout)
     return r;
 }
 
+// Append to the string of "n" characters in "buf", truncating it once full
+static void
+__attribute__((format(printf, 4, 5)))
+Append(char* buf, size_t size, size_t* n, const char* fmt, ...)
+{
+    if (*n + 1 >= size)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    int r = vsnprintf(buf + *n, size - *n, fmt, ap);
+    va_end(ap);
+    if (r > 0)
+        *n += (size_t)r < size - *n ? (size_t)r : size - *n - 1;
+}
+
+// Resolve the frames of one stack into "symbols" and, if "fp" is not NULL,
+// one line each to "fp"
+static void
+SymbolizeStack(SymProcess* proc, const struct timespec* deadline, void** addrs, size_t naddrs,
+               const greg_t* regs, size_t nregs, FILE* fp, char* symbols, size_t size)
+{
+    // The frame at the interrupted instruction and the signal trampoline
+    // frame before it hold exact addresses, the rest return addresses
+    size_t exact = naddrs;
+#ifdef REG_RIP
+    if (nregs > REG_RIP) {
+        size_t j;
+        for (j = 0; j < naddrs; j++) {
+            if ((greg_t)addrs[j] == regs[REG_RIP]) {
+                exact = j;
+                break;
+            }
+        }
+    }
+#endif
+
+    size_t ns = 0;
+    symbols[0] = '\0';
+    size_t j;
+    for (j = 0; j < naddrs; j++) {
+        int returnAddress = !(j == exact || j + 1 == exact);
+        SymFrame frame;
+        SymResolve(proc, addrs[j], returnAddress, deadline, &frame);
+
+        if (j > 0)
+            Append(symbols, size, &ns, "; ");
+        if (frame.function)
+            Append(symbols, size, &ns, "%s+0x%zx", frame.function, frame.functionOffset);
+        else if (frame.module)
+            Append(symbols, size, &ns, "%s+0x%zx", basename(frame.module), frame.moduleOffset);
+        else
+            Append(symbols, size, &ns, "?");
+        if (frame.file)
+            Append(symbols, size, &ns, " %s:%u", frame.file, frame.line);
+
+        if (fp) {
+            fprintf(fp, "#%zu %p", j, addrs[j]);
+            if (frame.module)
+                fprintf(fp, " %s+0x%zx", frame.module, frame.moduleOffset);
+            if (frame.function)
+                fprintf(fp, " %s+0x%zx", frame.function, frame.functionOffset);
+            if (frame.file)
+                fprintf(fp, " %s:%u", frame.file, frame.line);
+            fprintf(fp, "\n");
+        }
+    }
+}
+
 static int
 LogCrash(const char* filename)
 {
@@ -158,38 +375,84 @@ LogCrash(const char* filename)
     // used for HexCrashInfo()
     siginfo_t info;
     const char* reason;
-    void* addrs[10];
-    size_t naddrs = 10;
-    greg_t regs[23];
-    size_t nregs = 23;
+    void* addrs[MAX_FRAMES];
+    size_t naddrs = MAX_FRAMES;
+    greg_t regs[MAX_REGS];
+    size_t nregs = MAX_REGS;
 
     memset(&info, 0, sizeof(info));
 
     int r = HexCrashInfo(filename, &info, &reason, addrs, &naddrs, regs, &nregs);
     HexLogDebug("signal=%d code=%d addr=%p naddrs=%zu", info.si_signo, info.si_code, info.si_addr, naddrs);
 
-    if (r == 0) {
-        char buffer[1024];
-        int n = snprintf(buffer, 1024, "CRASH: program=%s pid=%s reason=\"%s\" signal=%d code=%d addr=%p stack=\'",
-                         prog, pid, reason, info.si_signo, info.si_code, info.si_addr);
-        size_t j;
-        for (j = 0; j < naddrs && n < 1000; j++) { //FIXME: need a better way to check for room in buffer
-            n += snprintf(&buffer[n], 1024 - n, "%p ", addrs[j]);
-        }
+    if (r != 0)
+        return 1;
+
+    // Resolve the stacks in a bounded time, from the process map saved when
+    // the program crashed
+    char mapFile[PATH_MAX];
+    snprintf(mapFile, sizeof(mapFile), "crashmap_%s.%s", prog, pid);
+    SymProcess* proc = SymProcessLoad(mapFile);
+    if (!proc)
+        HexLogDebug("No process map %s: %s", mapFile, strerror(errno));
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += SYM_BUDGET_MS / 1000;
+    deadline.tv_nsec += (SYM_BUDGET_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    char stackFile[PATH_MAX];
+    snprintf(stackFile, sizeof(stackFile), "crashstack_%s.%s", prog, pid);
+    FILE* fp = fopen(stackFile, "we");
+    if (!fp)
+        HexLogError("Unable to create %s: %s", stackFile, strerror(errno));
+
+    // The thread that crashed comes first, then every other thread
+    size_t t;
+    pid_t tid;
+    for (t = 0; ; t++) {
+        naddrs = MAX_FRAMES;
+        nregs = MAX_REGS;
+        if (HexCrashInfoThread(filename, t, &tid, addrs, &naddrs, regs, &nregs) != 0)
+            break;
 
-        n += snprintf(&buffer[n], 1024 - n, "\' regs=\'");
-        for (j = 0; j < nregs && n < 1000; j++) { //FIXME: need a better way to check for room in buffer
-            n += snprintf(&buffer[n], 1024 - n, "0x%lx ", (unsigned long)regs[j]);
+        if (fp) {
+            if (t > 0)
+                fprintf(fp, "\n");
+            fprintf(fp, "Thread %d%s:\n", (int)tid, t == 0 ? " (crashed)" : "");
         }
+        char symbols[2048];
+        SymbolizeStack(proc, &deadline, addrs, naddrs, regs, nregs, fp, symbols, sizeof(symbols));
+
+        char buffer[3072];
+        size_t n = 0;
+        if (t == 0)
+            Append(buffer, sizeof(buffer), &n, "CRASH: program=%s pid=%s reason=\"%s\" signal=%d code=%d addr=%p",
+                   prog, pid, reason, info.si_signo, info.si_code, info.si_addr);
+        else
+            Append(buffer, sizeof(buffer), &n, "CRASH: program=%s pid=%s thread=%d", prog, pid, (int)tid);
+
+        Append(buffer, sizeof(buffer), &n, " stack=\'");
+        size_t j;
+        for (j = 0; j < naddrs; j++)
+            Append(buffer, sizeof(buffer), &n, "%p ", addrs[j]);
 
-        n += snprintf(&buffer[n], 1024 - n, "\'");
-        HexLogError("%s", buffer); // FIXME: needs to be event
+        Append(buffer, sizeof(buffer), &n, "\' regs=\'");
+        for (j = 0; j < nregs; j++)
+            Append(buffer, sizeof(buffer), &n, "0x%lx ", (unsigned long)regs[j]);
 
-        coreHousekeep();
-        return 0;
+        Append(buffer, sizeof(buffer), &n, "\' symbols=\'%s\'", symbols);
+        HexLogError("%s", buffer); // FIXME: needs to be event
     }
 
-    return 1;
+    SymProcessFree(proc);
+    if (fp && fclose(fp) != 0)
+        HexLogError("Unable to write %s: %s", stackFile, strerror(errno));
+
+    return 0;
 }
 
 int main(int argc, char *argv[])
@@ -250,24 +513,42 @@ int main(int argc, char *argv[])
     if (fd < 0)
         HexLogFatal("Failed to initialize file system monitor");
 
-    int wd = inotify_add_watch(fd, CRASH_DIR, IN_CREATE);
+    // Crash files are logged once created, and the index of core files
+    // follows whatever adds, changes or removes them
+    int wd = inotify_add_watch(fd, CRASH_DIR, IN_CREATE | IN_CLOSE_WRITE | IN_ATTRIB |
+                                              IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
     if (wd < 0)
         HexLogFatal("Failed to add watch for %s: %s", CRASH_DIR, strerror(errno));
 
+    // Limits are read again when the debug module writes them, not when they
+    // are removed: the last ones stay until new ones are written
+    int limitsWd = inotify_add_watch(fd, LIMITS_DIR, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (limitsWd < 0)
+        HexLogWarning("Failed to add watch for %s: %s", LIMITS_DIR, strerror(errno));
+
+    s_crashDirFd = open(CRASH_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (s_crashDirFd < 0)
+        HexLogFatal("Failed to open %s: %s", CRASH_DIR, strerror(errno));
+
+    ReadCoreLimits();
+    CoreScan();
+    CoreHousekeep();
+
     struct pollfd pfd;
     pfd.fd = fd;
     pfd.events = POLLIN|POLLERR|POLLHUP;
     pfd.revents = 0;
 
-    char buf[BUF_LEN];
+    char buf[BUF_LEN] __attribute__ ((aligned(__alignof__(struct inotify_event))));
 
     // Start watchdog
     HexWatchdogTimerRealSet(wdtimer, TIMEOUT * 2);
 
     while (!s_term) {
         HexWatchdogTimerRealReset(wdtimer);
-        int r = poll(&pfd, 1, TIMEOUT);
+        int r = poll(&pfd, 1, TIMEOUT * 1000);
         if (r > 0) {
+            int housekeep = 0;
             ssize_t len = read(fd, buf, BUF_LEN);
             if (len < 0) {
                 if (errno == EINTR)
@@ -283,7 +564,27 @@ int main(int argc, char *argv[])
             ssize_t i = 0;
             while (i < len) {
                 struct inotify_event *event = (struct inotify_event *) &buf[i];
-                if (event->mask & IN_CREATE && event->len) {
+                if (event->mask & IN_Q_OVERFLOW) {
+                    // Events were lost: index the core files again
+                    HexLogDebug("File system events lost");
+                    CoreScan();
+                    housekeep = 1;
+                }
+                else if (event->wd == limitsWd && event->len) {
+                    if (strcmp(event->name, MAX_CORE_FILE) == 0 ||
+                        strcmp(event->name, MAX_CORE_SIZE_FILE) == 0) {
+                        ReadCoreLimits();
+                        housekeep = 1;
+                    }
+                }
+                else if (event->wd == wd && event->len && IsCoreFile(event->name)) {
+                    if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                        CoreForget(event->name);
+                    else
+                        CoreUpdate(event->name);
+                    housekeep = 1;
+                }
+                else if (event->mask & IN_CREATE && event->len) {
                     // Ignore all files except those that start with "crash_"
                     if (strncmp(event->name, "crash_", 6) == 0) {
                         HexLogDebug("Detected new file %s", event->name);
@@ -293,27 +594,23 @@ int main(int argc, char *argv[])
                         }
                     }
                 }
-                else {
+                else if (!(event->mask & (IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))) {
                     HexLogDebug("Unexpected file system event (mask=%d)", event->mask);
                 }
                 i += sizeof(struct inotify_event) + event->len;
             }
+
+            if (housekeep)
+                CoreHousekeep();
         }
         else if (r == -1 && errno != EINTR) {
             HexLogFatal("Internal error (poll: %s)", strerror(errno));
         }
-
-        {
-            static time_t lastHousekeep = 0;
-            time_t now = time(0);
-            if (now - lastHousekeep > 1) {
-                coreHousekeep();
-                lastHousekeep = now;
-            }
-        }
     }
 
     HexLogInfo("Shutting down");
+    close(s_crashDirFd);
+    free(s_cores);
     HexWatchdogTimerRealDestroy(wdtimer);
     return 0;
 }
@@ -0,0 +1,1044 @@
+// HEX SDK
+
+#define _GNU_SOURCE
+#include <elf.h>
+#include <link.h> // ElfW
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <hex/log.h>
+
+#include "symbolize.h"
+
+// Modules kept loaded, the least recently used dropped first
+#define SYM_CACHE_SIZE 16
+
+// Larger files are never read for symbols
+#define SYM_MAX_FILE_SIZE ((off_t)1024 * 1024 * 1024)
+
+// Line table rows kept per module; the rest of a larger table is left out
+#define SYM_MAX_LINES (4 * 1024 * 1024)
+
+// Longest build-id in bytes
+#define SYM_MAX_BUILD_ID 64
+
+static const char DEBUG_DIR[] = "/usr/lib/debug/.build-id";
+
+// DWARF constants used reading .debug_line
+#define DW_LNS_copy 1
+#define DW_LNS_advance_pc 2
+#define DW_LNS_advance_line 3
+#define DW_LNS_set_file 4
+#define DW_LNS_const_add_pc 8
+#define DW_LNS_fixed_advance_pc 9
+#define DW_LNE_end_sequence 1
+#define DW_LNE_set_address 2
+#define DW_LNE_define_file 3
+#define DW_LNCT_path 1
+#define DW_FORM_block 0x09
+#define DW_FORM_data1 0x0b
+#define DW_FORM_data2 0x05
+#define DW_FORM_data4 0x06
+#define DW_FORM_data8 0x07
+#define DW_FORM_data16 0x1e
+#define DW_FORM_string 0x08
+#define DW_FORM_strp 0x0e
+#define DW_FORM_line_strp 0x1f
+#define DW_FORM_udata 0x0f
+#define DW_FORM_strx 0x1a
+#define DW_FORM_strx1 0x25
+#define DW_FORM_strx2 0x26
+#define DW_FORM_strx3 0x27
+#define DW_FORM_strx4 0x28
+
+typedef struct {
+    uintptr_t addr;
+    size_t size;
+    const char* name;
+} Symbol;
+
+// A row of the line table; line 0 ends a sequence of rows
+typedef struct {
+    uintptr_t addr;
+    const char* file;
+    unsigned int line;
+    unsigned int order; // of the row in the table, as the sort is not stable
+} LineRow;
+
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+} Mapped;
+
+typedef struct {
+    int used;
+    unsigned long lastUse;
+
+    // The module file as it was loaded, and its build-id
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    unsigned char buildId[SYM_MAX_BUILD_ID];
+    size_t buildIdLen;
+
+    // Names point into the module and its separate debug file
+    Mapped module;
+    Mapped debug;
+
+    // Loadable segments, to turn file offsets into addresses
+    ElfW(Phdr)* loads;
+    size_t nloads;
+
+    Symbol* syms;
+    size_t nsyms;
+    LineRow* lines;
+    size_t nlines;
+} SymModule;
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    size_t offset;
+    int deleted;
+    char* path;
+} MapEntry;
+
+struct SymProcess {
+    MapEntry* maps;
+    size_t nmaps;
+};
+
+static SymModule s_cache[SYM_CACHE_SIZE];
+static unsigned long s_useCount = 0;
+
+static int
+Expired(const struct timespec* deadline)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > deadline->tv_sec ||
+           (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+// Swap elements "a" and "b" of "size" bytes
+static void
+Swap(unsigned char* a, unsigned char* b, size_t size)
+{
+    unsigned char tmp[64];
+    while (size > 0) {
+        size_t n = size < sizeof(tmp) ? size : sizeof(tmp);
+        memcpy(tmp, a, n);
+        memcpy(a, b, n);
+        memcpy(b, tmp, n);
+        a += n;
+        b += n;
+        size -= n;
+    }
+}
+
+static void
+Sift(unsigned char* base, size_t root, size_t n, size_t size, int (*compare)(const void*, const void*))
+{
+    for (;;) {
+        size_t child = 2 * root + 1;
+        if (child >= n)
+            return;
+        if (child + 1 < n && compare(base + child * size, base + (child + 1) * size) < 0)
+            child++;
+        if (compare(base + root * size, base + child * size) >= 0)
+            return;
+        Swap(base + root * size, base + child * size, size);
+        root = child;
+    }
+}
+
+// Heapsort, which unlike qsort can give up once "deadline" passes
+// Return 0 if it did, leaving the elements in no particular order
+static int
+SortUntil(void* elements, size_t n, size_t size, int (*compare)(const void*, const void*),
+          const struct timespec* deadline)
+{
+    unsigned char* base = (unsigned char*)elements;
+    size_t steps = 0;
+    size_t i;
+    for (i = n / 2; i-- > 0; ) {
+        if (++steps % 4096 == 0 && Expired(deadline))
+            return 0;
+        Sift(base, i, n, size, compare);
+    }
+    for (i = n; i-- > 1; ) {
+        if (++steps % 4096 == 0 && Expired(deadline))
+            return 0;
+        Swap(base, base + i * size, size);
+        Sift(base, 0, i, size, compare);
+    }
+    return 1;
+}
+
+// Map ELF file "path" and report in "st" the file mapped
+static int
+MapFile(const char* path, Mapped* file, struct stat* st)
+{
+    file->data = NULL;
+    file->size = 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, st) != 0 || !S_ISREG(st->st_mode) ||
+        st->st_size < (off_t)sizeof(ElfW(Ehdr)) || st->st_size > SYM_MAX_FILE_SIZE) {
+        close(fd);
+        return 0;
+    }
+    void* data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return 0;
+
+    // Only ELF files of our own class with section headers in the file
+    const ElfW(Ehdr)* eh = (const ElfW(Ehdr)*)data;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+#if __WORDSIZE == 64
+        eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+#else
+        eh->e_ident[EI_CLASS] != ELFCLASS32 ||
+#endif
+        eh->e_shentsize != sizeof(ElfW(Shdr)) || eh->e_shstrndx >= eh->e_shnum ||
+        eh->e_shoff > (size_t)st->st_size ||
+        eh->e_shnum > ((size_t)st->st_size - eh->e_shoff) / sizeof(ElfW(Shdr)) ||
+        (eh->e_phnum > 0 && (eh->e_phentsize != sizeof(ElfW(Phdr)) || eh->e_phoff > (size_t)st->st_size ||
+                             eh->e_phnum > ((size_t)st->st_size - eh->e_phoff) / sizeof(ElfW(Phdr))))) {
+        munmap(data, st->st_size);
+        return 0;
+    }
+
+    file->data = data;
+    file->size = st->st_size;
+    return 1;
+}
+
+static void
+UnmapFile(Mapped* file)
+{
+    if (file->data)
+        munmap((void*)file->data, file->size);
+    file->data = NULL;
+    file->size = 0;
+}
+
+static const ElfW(Shdr)*
+Sections(const Mapped* file, size_t* n)
+{
+    const ElfW(Ehdr)* eh = (const ElfW(Ehdr)*)file->data;
+    *n = eh->e_shnum;
+    return (const ElfW(Shdr)*)(file->data + eh->e_shoff);
+}
+
+// Contents of section "sh", which must be in the file and not compressed
+static const unsigned char*
+SectionData(const Mapped* file, const ElfW(Shdr)* sh, size_t* size)
+{
+    *size = 0;
+    if (sh->sh_type == SHT_NOBITS || (sh->sh_flags & SHF_COMPRESSED) ||
+        sh->sh_offset > file->size || sh->sh_size > file->size - sh->sh_offset)
+        return NULL;
+    *size = sh->sh_size;
+    return file->data + sh->sh_offset;
+}
+
+static const ElfW(Shdr)*
+FindSection(const Mapped* file, const char* name)
+{
+    size_t n;
+    const ElfW(Shdr)* sh = Sections(file, &n);
+    size_t namesSize;
+    const char* names = (const char*)SectionData(file, &sh[((const ElfW(Ehdr)*)file->data)->e_shstrndx], &namesSize);
+    if (!names)
+        return NULL;
+    size_t len = strlen(name);
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        if (sh[i].sh_name < namesSize && namesSize - sh[i].sh_name > len &&
+            memcmp(names + sh[i].sh_name, name, len + 1) == 0)
+            return &sh[i];
+    }
+    return NULL;
+}
+
+static void
+ReadBuildId(const Mapped* file, SymModule* mod)
+{
+    size_t n;
+    const ElfW(Shdr)* sh = Sections(file, &n);
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        if (sh[i].sh_type != SHT_NOTE)
+            continue;
+        size_t size;
+        const unsigned char* p = SectionData(file, &sh[i], &size);
+        if (!p)
+            continue;
+        const unsigned char* end = p + size;
+        while ((size_t)(end - p) >= sizeof(ElfW(Nhdr))) {
+            const ElfW(Nhdr)* note = (const ElfW(Nhdr)*)p;
+            size_t nameSize = (note->n_namesz + 3) & ~3;
+            size_t descSize = (note->n_descsz + 3) & ~3;
+            p += sizeof(ElfW(Nhdr));
+            if (nameSize > (size_t)(end - p) || descSize > (size_t)(end - p - nameSize))
+                break;
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && memcmp(p, "GNU", 4) == 0 &&
+                note->n_descsz > 0 && note->n_descsz <= SYM_MAX_BUILD_ID) {
+                memcpy(mod->buildId, p + nameSize, note->n_descsz);
+                mod->buildIdLen = note->n_descsz;
+                return;
+            }
+            p += nameSize + descSize;
+        }
+    }
+}
+
+static int
+CompareSymbols(const void* a, const void* b)
+{
+    const Symbol* x = (const Symbol*)a;
+    const Symbol* y = (const Symbol*)b;
+    if (x->addr != y->addr)
+        return x->addr < y->addr ? -1 : 1;
+    // Sized symbols ahead of their aliases without a size, then in the
+    // order of their names in the string table so that the sort need not
+    // be stable
+    if ((x->size == 0) != (y->size == 0))
+        return (x->size == 0) - (y->size == 0);
+    return x->name < y->name ? -1 : x->name > y->name;
+}
+
+// Function symbols of "symtab" ("type" SHT_SYMTAB or SHT_DYNSYM), if it has
+// any and they are read before "deadline"
+static int
+LoadSymbols(SymModule* mod, const Mapped* file, unsigned int type, const struct timespec* deadline)
+{
+    size_t n;
+    const ElfW(Shdr)* sh = Sections(file, &n);
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        if (sh[i].sh_type == type && sh[i].sh_link < n)
+            break;
+    }
+    if (i == n)
+        return 0;
+
+    size_t symSize, strSize;
+    const ElfW(Sym)* syms = (const ElfW(Sym)*)SectionData(file, &sh[i], &symSize);
+    const char* strs = (const char*)SectionData(file, &sh[sh[i].sh_link], &strSize);
+    if (!syms || !strs || strSize == 0 || strs[strSize - 1] != '\0')
+        return 0;
+
+    size_t count = symSize / sizeof(ElfW(Sym));
+    Symbol* out = malloc(count * sizeof(Symbol));
+    if (!out)
+        return 0;
+    size_t nout = 0;
+    size_t s;
+    for (s = 0; s < count; ++s) {
+        if (s % 4096 == 4095 && Expired(deadline)) {
+            free(out);
+            return 0;
+        }
+        int symType = ELF64_ST_TYPE(syms[s].st_info);
+        if ((symType != STT_FUNC && symType != STT_GNU_IFUNC) || syms[s].st_shndx == SHN_UNDEF ||
+            syms[s].st_value == 0 || syms[s].st_name >= strSize)
+            continue;
+        out[nout].addr = syms[s].st_value;
+        out[nout].size = syms[s].st_size;
+        out[nout].name = strs + syms[s].st_name;
+        nout++;
+    }
+    if (nout == 0) {
+        free(out);
+        return 0;
+    }
+    if (!SortUntil(out, nout, sizeof(Symbol), CompareSymbols, deadline)) {
+        free(out);
+        return 0;
+    }
+    mod->syms = out;
+    mod->nsyms = nout;
+    return 1;
+}
+
+// Bounds-checked reading of DWARF data; reading past the end sets "error"
+typedef struct {
+    const unsigned char* p;
+    const unsigned char* end;
+    int error;
+} Reader;
+
+static uint64_t
+ReadU(Reader* r, size_t n)
+{
+    if (r->error || n > 8 || (size_t)(r->end - r->p) < n) {
+        r->error = 1;
+        return 0;
+    }
+    uint64_t v = 0;
+    size_t i;
+    for (i = 0; i < n; ++i)
+        v |= (uint64_t)r->p[i] << (8 * i);
+    r->p += n;
+    return v;
+}
+
+static void
+Skip(Reader* r, uint64_t n)
+{
+    if (r->error || (uint64_t)(r->end - r->p) < n)
+        r->error = 1;
+    else
+        r->p += n;
+}
+
+static uint64_t
+ReadUleb(Reader* r)
+{
+    uint64_t v = 0;
+    int shift = 0;
+    while (!r->error) {
+        uint64_t b = ReadU(r, 1);
+        if (shift < 64)
+            v |= (b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80))
+            break;
+    }
+    return v;
+}
+
+static int64_t
+ReadSleb(Reader* r)
+{
+    int64_t v = 0;
+    int shift = 0;
+    uint64_t b = 0x80;
+    while (!r->error && (b & 0x80)) {
+        b = ReadU(r, 1);
+        if (shift < 64)
+            v |= (int64_t)(b & 0x7f) << shift;
+        shift += 7;
+    }
+    if (shift < 64 && (b & 0x40))
+        v |= -((int64_t)1 << shift);
+    return v;
+}
+
+static const char*
+ReadStr(Reader* r)
+{
+    if (r->error)
+        return NULL;
+    const unsigned char* nul = memchr(r->p, '\0', r->end - r->p);
+    if (!nul) {
+        r->error = 1;
+        return NULL;
+    }
+    const char* s = (const char*)r->p;
+    r->p = nul + 1;
+    return s;
+}
+
+// String sections referred to from .debug_line
+typedef struct {
+    const unsigned char* str;
+    size_t strSize;
+    const unsigned char* lineStr;
+    size_t lineStrSize;
+} StrSections;
+
+// Read attribute "form" of a DWARF 5 directory or file entry, returning
+// it if it is a string we can find
+static const char*
+ReadForm(Reader* r, uint64_t form, int offsetSize, const StrSections* strs)
+{
+    uint64_t off;
+    switch (form) {
+    case DW_FORM_string:
+        return ReadStr(r);
+    case DW_FORM_line_strp:
+    case DW_FORM_strp:
+        off = ReadU(r, offsetSize);
+        if (form == DW_FORM_line_strp && strs->lineStr && off < strs->lineStrSize &&
+            memchr(strs->lineStr + off, '\0', strs->lineStrSize - off))
+            return (const char*)strs->lineStr + off;
+        if (form == DW_FORM_strp && strs->str && off < strs->strSize &&
+            memchr(strs->str + off, '\0', strs->strSize - off))
+            return (const char*)strs->str + off;
+        return NULL;
+    case DW_FORM_udata:
+    case DW_FORM_strx:
+        ReadUleb(r);
+        return NULL;
+    case DW_FORM_data1:
+    case DW_FORM_strx1:
+        Skip(r, 1);
+        return NULL;
+    case DW_FORM_data2:
+    case DW_FORM_strx2:
+        Skip(r, 2);
+        return NULL;
+    case DW_FORM_strx3:
+        Skip(r, 3);
+        return NULL;
+    case DW_FORM_data4:
+    case DW_FORM_strx4:
+        Skip(r, 4);
+        return NULL;
+    case DW_FORM_data8:
+        Skip(r, 8);
+        return NULL;
+    case DW_FORM_data16:
+        Skip(r, 16);
+        return NULL;
+    case DW_FORM_block:
+        Skip(r, ReadUleb(r));
+        return NULL;
+    default:
+        r->error = 1;
+        return NULL;
+    }
+}
+
+// Growable list of file names of a line table unit
+typedef struct {
+    const char** names;
+    size_t n;
+    size_t alloc;
+} FileList;
+
+static int
+AddFile(FileList* files, const char* name)
+{
+    if (files->n == files->alloc) {
+        size_t alloc = files->alloc ? files->alloc * 2 : 64;
+        const char** names = realloc(files->names, alloc * sizeof(const char*));
+        if (!names)
+            return 0;
+        files->names = names;
+        files->alloc = alloc;
+    }
+    files->names[files->n++] = name;
+    return 1;
+}
+
+// Read the DWARF 5 directory or file entry list at "r", adding the path
+// of each to "files" if it is not NULL
+static void
+ReadEntries(Reader* r, int offsetSize, const StrSections* strs, FileList* files)
+{
+    uint64_t formats[2 * 16];
+    size_t nformats = ReadU(r, 1);
+    if (nformats > 16) {
+        r->error = 1;
+        return;
+    }
+    size_t i;
+    for (i = 0; i < 2 * nformats; ++i)
+        formats[i] = ReadUleb(r);
+
+    uint64_t count = ReadUleb(r);
+    uint64_t e;
+    for (e = 0; e < count && !r->error; ++e) {
+        const char* path = NULL;
+        for (i = 0; i < nformats; ++i) {
+            const char* s = ReadForm(r, formats[2 * i + 1], offsetSize, strs);
+            if (formats[2 * i] == DW_LNCT_path)
+                path = s;
+        }
+        if (files && !AddFile(files, path))
+            r->error = 1;
+    }
+}
+
+static int
+AddRow(SymModule* mod, size_t* alloc, uintptr_t addr, const FileList* files, uint64_t file, unsigned int line)
+{
+    if (mod->nlines == SYM_MAX_LINES)
+        return 0;
+    if (mod->nlines == *alloc) {
+        size_t n = *alloc ? *alloc * 2 : 4096;
+        LineRow* lines = realloc(mod->lines, n * sizeof(LineRow));
+        if (!lines)
+            return 0;
+        mod->lines = lines;
+        *alloc = n;
+    }
+    LineRow* row = &mod->lines[mod->nlines++];
+    row->addr = addr;
+    row->file = file < files->n ? files->names[file] : NULL;
+    row->line = line;
+    row->order = mod->nlines - 1;
+    return 1;
+}
+
+// Run the line number program of the unit at "r", adding its rows
+// Return 0 once no more rows can be kept, with "expired" set if that is
+// because "deadline" passed
+static int
+LoadLineUnit(SymModule* mod, size_t* alloc, Reader* r, const StrSections* strs,
+             const struct timespec* deadline, int* expired)
+{
+    int offsetSize = 4;
+    uint64_t unitLength = ReadU(r, 4);
+    if (unitLength == 0xffffffff) {
+        offsetSize = 8;
+        unitLength = ReadU(r, 8);
+    }
+    if (r->error || unitLength > (uint64_t)(r->end - r->p)) {
+        r->error = 1;
+        return 1;
+    }
+    Reader unit = { r->p, r->p + unitLength, 0 };
+    r->p += unitLength;
+
+    unsigned int version = ReadU(&unit, 2);
+    if (version < 2 || version > 5)
+        return 1;
+    size_t addrSize = sizeof(void*);
+    if (version >= 5) {
+        addrSize = ReadU(&unit, 1);
+        ReadU(&unit, 1); // segment selector size
+    }
+    uint64_t headerLength = ReadU(&unit, offsetSize);
+    if (unit.error || headerLength > (uint64_t)(unit.end - unit.p))
+        return 1;
+    Reader prog = { unit.p + headerLength, unit.end, 0 };
+
+    unsigned int minInst = ReadU(&unit, 1);
+    if (version >= 4)
+        ReadU(&unit, 1); // maximum operations per instruction
+    ReadU(&unit, 1); // default is_stmt
+    int lineBase = (int8_t)ReadU(&unit, 1);
+    unsigned int lineRange = ReadU(&unit, 1);
+    unsigned int opcodeBase = ReadU(&unit, 1);
+    if (unit.error || lineRange == 0 || opcodeBase == 0)
+        return 1;
+    uint8_t opcodeLengths[256];
+    unsigned int i;
+    for (i = 1; i < opcodeBase; ++i)
+        opcodeLengths[i] = ReadU(&unit, 1);
+
+    // Files are numbered from 1 before DWARF 5 and from 0 since
+    FileList files = { NULL, 0, 0 };
+    if (version >= 5) {
+        ReadEntries(&unit, offsetSize, strs, NULL);
+        ReadEntries(&unit, offsetSize, strs, &files);
+    }
+    else {
+        const char* s;
+        while ((s = ReadStr(&unit)) != NULL && *s)
+            ; // include directories
+        AddFile(&files, NULL);
+        while ((s = ReadStr(&unit)) != NULL && *s) {
+            ReadUleb(&unit);
+            ReadUleb(&unit);
+            ReadUleb(&unit);
+            AddFile(&files, s);
+        }
+    }
+
+    int more = 1;
+    uintptr_t addr = 0;
+    uint64_t file = 1;
+    int64_t line = 1;
+    unsigned int ops = 0;
+    while (more && !unit.error && !prog.error && prog.p < prog.end) {
+        // A single unit can be large enough to need its own checks
+        if (++ops % 4096 == 0 && Expired(deadline)) {
+            *expired = 1;
+            more = 0;
+            break;
+        }
+        unsigned int op = ReadU(&prog, 1);
+        if (op >= opcodeBase) {
+            unsigned int adj = op - opcodeBase;
+            addr += (adj / lineRange) * minInst;
+            line += lineBase + (int)(adj % lineRange);
+            more = AddRow(mod, alloc, addr, &files, file, line);
+        }
+        else if (op == 0) {
+            uint64_t len = ReadUleb(&prog);
+            if (len == 0 || len > (uint64_t)(prog.end - prog.p))
+                break;
+            const unsigned char* next = prog.p + len;
+            switch (ReadU(&prog, 1)) {
+            case DW_LNE_end_sequence:
+                more = AddRow(mod, alloc, addr, &files, file, 0);
+                addr = 0;
+                file = 1;
+                line = 1;
+                break;
+            case DW_LNE_set_address:
+                if (len - 1 == addrSize)
+                    addr = ReadU(&prog, addrSize);
+                break;
+            case DW_LNE_define_file:
+                AddFile(&files, ReadStr(&prog));
+                break;
+            }
+            prog.p = next;
+        }
+        else {
+            switch (op) {
+            case DW_LNS_copy:
+                more = AddRow(mod, alloc, addr, &files, file, line);
+                break;
+            case DW_LNS_advance_pc:
+                addr += ReadUleb(&prog) * minInst;
+                break;
+            case DW_LNS_advance_line:
+                line += ReadSleb(&prog);
+                break;
+            case DW_LNS_set_file:
+                file = ReadUleb(&prog);
+                break;
+            case DW_LNS_const_add_pc:
+                addr += ((255 - opcodeBase) / lineRange) * minInst;
+                break;
+            case DW_LNS_fixed_advance_pc:
+                addr += ReadU(&prog, 2);
+                break;
+            default:
+                // Operands of the rest only need skipping
+                for (i = 0; i < opcodeLengths[op]; ++i)
+                    ReadUleb(&prog);
+                break;
+            }
+        }
+    }
+
+    free(files.names);
+    return more;
+}
+
+static int
+CompareRows(const void* a, const void* b)
+{
+    const LineRow* x = (const LineRow*)a;
+    const LineRow* y = (const LineRow*)b;
+    if (x->addr != y->addr)
+        return x->addr < y->addr ? -1 : 1;
+    // A sequence ending where the next starts goes first, otherwise rows
+    // stay in the order they were read
+    if ((x->line != 0) != (y->line != 0))
+        return (x->line != 0) - (y->line != 0);
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+// Read the line table of "file", unless "deadline" passes first
+static int
+LoadLines(SymModule* mod, const Mapped* file, const struct timespec* deadline)
+{
+    const ElfW(Shdr)* sh = FindSection(file, ".debug_line");
+    size_t size;
+    const unsigned char* data = sh ? SectionData(file, sh, &size) : NULL;
+    if (!data)
+        return 0;
+
+    StrSections strs = { NULL, 0, NULL, 0 };
+    if ((sh = FindSection(file, ".debug_str")) != NULL)
+        strs.str = SectionData(file, sh, &strs.strSize);
+    if ((sh = FindSection(file, ".debug_line_str")) != NULL)
+        strs.lineStr = SectionData(file, sh, &strs.lineStrSize);
+
+    size_t alloc = 0;
+    Reader r = { data, data + size, 0 };
+    int expired = 0;
+    while (!r.error && r.p < r.end && !expired) {
+        if (Expired(deadline))
+            expired = 1;
+        else if (!LoadLineUnit(mod, &alloc, &r, &strs, deadline, &expired))
+            break;
+    }
+    if (mod->nlines == SYM_MAX_LINES)
+        HexLogDebug("Line table too large, only %d rows kept", SYM_MAX_LINES);
+
+    if (expired || !SortUntil(mod->lines, mod->nlines, sizeof(LineRow), CompareRows, deadline)) {
+        HexLogDebug("Out of time reading line table, left out");
+        free(mod->lines);
+        mod->lines = NULL;
+        mod->nlines = 0;
+        return 0;
+    }
+    return mod->nlines > 0;
+}
+
+static void
+ModuleFree(SymModule* mod)
+{
+    UnmapFile(&mod->module);
+    UnmapFile(&mod->debug);
+    free(mod->loads);
+    free(mod->syms);
+    free(mod->lines);
+    memset(mod, 0, sizeof(*mod));
+}
+
+// Open the separate debug file of a module by its build-id
+static void
+MapDebugFile(SymModule* mod)
+{
+    if (mod->buildIdLen < 2)
+        return;
+
+    char path[sizeof(DEBUG_DIR) + 2 * SYM_MAX_BUILD_ID + 16];
+    size_t n = snprintf(path, sizeof(path), "%s/%02x/", DEBUG_DIR, mod->buildId[0]);
+    size_t i;
+    for (i = 1; i < mod->buildIdLen; ++i)
+        n += snprintf(path + n, sizeof(path) - n, "%02x", mod->buildId[i]);
+    snprintf(path + n, sizeof(path) - n, ".debug");
+
+    struct stat st;
+    if (MapFile(path, &mod->debug, &st))
+        HexLogDebug("Using debug file %s", path);
+}
+
+// Load symbols and lines for "mod", whose module file is mapped with status
+// "st" and its build-id read; what is not done by "deadline" is left out
+static int
+ModuleLoad(SymModule* mod, const char* path, const struct stat* st, const struct timespec* deadline)
+{
+    mod->dev = st->st_dev;
+    mod->ino = st->st_ino;
+    mod->size = st->st_size;
+    mod->mtime = st->st_mtime;
+
+    const ElfW(Ehdr)* eh = (const ElfW(Ehdr)*)mod->module.data;
+    const ElfW(Phdr)* ph = (const ElfW(Phdr)*)(mod->module.data + eh->e_phoff);
+    mod->loads = malloc((eh->e_phnum + 1) * sizeof(ElfW(Phdr)));
+    if (!mod->loads)
+        return 0;
+    size_t i;
+    for (i = 0; i < eh->e_phnum; ++i) {
+        if (ph[i].p_type == PT_LOAD)
+            mod->loads[mod->nloads++] = ph[i];
+    }
+
+    MapDebugFile(mod);
+    if (!(mod->debug.data && LoadSymbols(mod, &mod->debug, SHT_SYMTAB, deadline)) &&
+        !LoadSymbols(mod, &mod->module, SHT_SYMTAB, deadline))
+        LoadSymbols(mod, &mod->module, SHT_DYNSYM, deadline);
+    if (!(mod->debug.data && LoadLines(mod, &mod->debug, deadline)))
+        LoadLines(mod, &mod->module, deadline);
+
+    HexLogDebug("Loaded %zu symbols and %zu line rows for %s", mod->nsyms, mod->nlines, path);
+    return 1;
+}
+
+// The cached module for "path", loading it if there is time
+static SymModule*
+ModuleGet(const char* path, const struct timespec* deadline)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return NULL;
+
+    size_t i;
+    for (i = 0; i < SYM_CACHE_SIZE; ++i) {
+        SymModule* mod = &s_cache[i];
+        if (mod->used && mod->dev == st.st_dev && mod->ino == st.st_ino &&
+            mod->size == st.st_size && mod->mtime == st.st_mtime) {
+            mod->lastUse = ++s_useCount;
+            return mod;
+        }
+    }
+
+    if (Expired(deadline))
+        return NULL;
+
+    // The build-id and identity are those of the one mapping loaded from
+    SymModule mod;
+    memset(&mod, 0, sizeof(mod));
+    if (!MapFile(path, &mod.module, &st))
+        return NULL;
+    ReadBuildId(&mod.module, &mod);
+
+    // The same module by another name or copy
+    if (mod.buildIdLen > 0) {
+        for (i = 0; i < SYM_CACHE_SIZE; ++i) {
+            SymModule* cached = &s_cache[i];
+            if (cached->used && cached->buildIdLen == mod.buildIdLen &&
+                memcmp(cached->buildId, mod.buildId, mod.buildIdLen) == 0) {
+                UnmapFile(&mod.module);
+                cached->lastUse = ++s_useCount;
+                return cached;
+            }
+        }
+    }
+
+    // The slot of the least recently used module
+    SymModule* slot = &s_cache[0];
+    for (i = 1; i < SYM_CACHE_SIZE; ++i) {
+        if (!s_cache[i].used || (slot->used && s_cache[i].lastUse < slot->lastUse))
+            slot = &s_cache[i];
+    }
+
+    ModuleFree(slot);
+    *slot = mod;
+    if (!ModuleLoad(slot, path, &st, deadline)) {
+        ModuleFree(slot);
+        return NULL;
+    }
+    slot->used = 1;
+    slot->lastUse = ++s_useCount;
+    return slot;
+}
+
+SymProcess*
+SymProcessLoad(const char* crashmapFile)
+{
+    FILE* fp = fopen(crashmapFile, "re");
+    if (!fp)
+        return NULL;
+
+    SymProcess* proc = calloc(1, sizeof(SymProcess));
+    size_t alloc = 0;
+    char* line = NULL;
+    size_t size = 0;
+    while (proc && getline(&line, &size, fp) > 0) {
+        unsigned long start, end, offset;
+        int pathStart = 0;
+        if (sscanf(line, "%lx-%lx %*s %lx %*s %*s %n", &start, &end, &offset, &pathStart) != 3 ||
+            pathStart == 0 || line[pathStart] != '/')
+            continue;
+
+        char* path = line + pathStart;
+        path[strcspn(path, "\n")] = '\0';
+        int deleted = 0;
+        size_t len = strlen(path);
+        if (len > 10 && strcmp(path + len - 10, " (deleted)") == 0) {
+            path[len - 10] = '\0';
+            deleted = 1;
+        }
+
+        if (proc->nmaps == alloc) {
+            size_t n = alloc ? alloc * 2 : 64;
+            MapEntry* maps = realloc(proc->maps, n * sizeof(MapEntry));
+            if (!maps)
+                break;
+            proc->maps = maps;
+            alloc = n;
+        }
+        MapEntry* map = &proc->maps[proc->nmaps];
+        map->path = strdup(path);
+        if (!map->path)
+            break;
+        map->start = start;
+        map->end = end;
+        map->offset = offset;
+        map->deleted = deleted;
+        proc->nmaps++;
+    }
+    free(line);
+    fclose(fp);
+    return proc;
+}
+
+void
+SymProcessFree(SymProcess* proc)
+{
+    if (!proc)
+        return;
+    size_t i;
+    for (i = 0; i < proc->nmaps; ++i)
+        free(proc->maps[i].path);
+    free(proc->maps);
+    free(proc);
+}
+
+void
+SymResolve(SymProcess* proc, void* addr, int returnAddress,
+           const struct timespec* deadline, SymFrame* frame)
+{
+    memset(frame, 0, sizeof(*frame));
+    if (!proc)
+        return;
+
+    uintptr_t a = (uintptr_t)addr;
+    const MapEntry* map = NULL;
+    size_t i;
+    for (i = 0; i < proc->nmaps; ++i) {
+        if (proc->maps[i].start <= a && a < proc->maps[i].end) {
+            map = &proc->maps[i];
+            break;
+        }
+    }
+    if (!map)
+        return;
+
+    frame->module = map->path;
+    size_t fileOffset = a - map->start + map->offset;
+    frame->moduleOffset = fileOffset;
+
+    // A module replaced since the crash is not the one that crashed
+    SymModule* mod = map->deleted ? NULL : ModuleGet(map->path, deadline);
+    if (!mod)
+        return;
+
+    // Addresses in the module as its symbols and line table have them
+    uintptr_t vaddr = fileOffset;
+    for (i = 0; i < mod->nloads; ++i) {
+        const ElfW(Phdr)* ph = &mod->loads[i];
+        if (ph->p_offset <= fileOffset && fileOffset - ph->p_offset < ph->p_filesz) {
+            vaddr = fileOffset - ph->p_offset + ph->p_vaddr;
+            break;
+        }
+    }
+    frame->moduleOffset = vaddr;
+    uintptr_t lookup = returnAddress && vaddr > 0 ? vaddr - 1 : vaddr;
+
+    // Last symbol at or before the address, unless the address is past its end
+    size_t lo = 0, hi = mod->nsyms;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (mod->syms[mid].addr <= lookup)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0) {
+        const Symbol* sym = &mod->syms[lo - 1];
+        // Prefer a sized symbol at the same address
+        while (lo > 1 && mod->syms[lo - 2].addr == sym->addr) {
+            lo--;
+            sym = &mod->syms[lo - 1];
+        }
+        if (sym->size == 0 || lookup - sym->addr < sym->size) {
+            frame->function = sym->name;
+            frame->functionOffset = vaddr - sym->addr;
+        }
+    }
+
+    // Last row at or before the address, unless it ends a sequence
+    lo = 0;
+    hi = mod->nlines;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (mod->lines[mid].addr <= lookup)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0 && mod->lines[lo - 1].line != 0 && mod->lines[lo - 1].file) {
+        const char* file = mod->lines[lo - 1].file;
+        const char* slash = strrchr(file, '/');
+        frame->file = slash ? slash + 1 : file;
+        frame->line = mod->lines[lo - 1].line;
+    }
+}
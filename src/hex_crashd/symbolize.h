@@ -0,0 +1,49 @@
+// HEX SDK
+
+#ifndef HEX_CRASHD_SYMBOLIZE_H
+#define HEX_CRASHD_SYMBOLIZE_H
+
+#include <stddef.h>
+#include <time.h>
+
+// Resolve the code addresses of a crashed process, using the process map
+// saved as its crashmap file, to module+offset and, when the module has
+// symbols, to function+offset and source file:line.
+//
+// Symbols and line tables are read from the module or from its separate
+// debug file under /usr/lib/debug/.build-id the first time one of its
+// addresses is resolved, and are kept in a small cache keyed by build-id
+// that is shared by every crash, so repeated crashes of the same programs
+// cost little. Loading stops at a deadline, so a crash storm or a large
+// debug file cannot stall the daemon: modules not loaded by then give
+// module+offset, and one still being read then goes without the symbols or
+// line table it was reading.
+
+typedef struct SymProcess SymProcess;
+
+// Read the process map "crashmapFile", NULL if it cannot be read
+SymProcess* SymProcessLoad(const char* crashmapFile);
+void SymProcessFree(SymProcess* proc);
+
+typedef struct {
+    // Module path and its load-relative address, "module" NULL if the
+    // address is not in any mapped file
+    const char* module;
+    size_t moduleOffset;
+    // Function and offset into it, "function" NULL without symbols
+    const char* function;
+    size_t functionOffset;
+    // Source file and line, "file" NULL without line information
+    const char* file;
+    unsigned int line;
+} SymFrame;
+
+// Describe "addr" in "frame"; names stay valid until the next call
+// "returnAddress": "addr" is where a call returns to, so the line looked up
+// is that of the call
+// Modules not loaded yet are only loaded before "deadline", and keep only
+// the symbols and line table they finished reading by then
+void SymResolve(SymProcess* proc, void* addr, int returnAddress,
+                const struct timespec* deadline, SymFrame* frame);
+
+#endif /* endif HEX_CRASHD_SYMBOLIZE_H */
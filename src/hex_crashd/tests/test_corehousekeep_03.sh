@@ -0,0 +1,55 @@
+
+fn="/var/support/core_foo."
+
+echo 10 > /etc/debug.max_core_files
+echo 3 > /etc/debug.max_core_size
+
+$TESTRUNNER ../hex_crashd -f -vv 2>&1 | tee $TEST.out &
+WaitForMessage "Started" $TEST.out
+
+CountCores()
+{
+    local i=0
+    while [ "$i" -lt 10 ]; do
+        c=`ls /var/support/core_*.* 2>/dev/null | wc -l` || true
+        [ "$c" -eq "$1" ] && return 0
+        sleep 1
+        i=`expr $i + 1`
+    done
+    return 1
+}
+
+# Cores of 1 MB each: only the newest three fit in the quota
+for i in `seq 1001 1005`; do
+    head -c 1048576 /dev/urandom > $fn$i
+    touch -t 20120101$i $fn$i
+done
+CountCores 3
+[ ! -f ${fn}1002 ]
+[ -f ${fn}1003 ]
+
+# Cores removed or moved away make room, those moved in take it up
+rm ${fn}1003
+mv ${fn}1004 /var/support/old_core
+sleep 1
+head -c 1048576 /dev/urandom > ${fn}1006
+CountCores 2
+mv /var/support/old_core ${fn}1004
+head -c 1048576 /dev/urandom > ${fn}1007
+CountCores 3
+[ ! -f ${fn}1004 ]
+[ -f ${fn}1005 ]
+
+# New limits apply without waiting for another core
+echo 1 > /etc/debug.max_core_files
+CountCores 1
+[ -f ${fn}1007 ]
+
+# Removed limits leave the last ones in place rather than the defaults
+rm -f /etc/debug.max_core_files /etc/debug.max_core_size
+sleep 1
+head -c 1048576 /dev/urandom > ${fn}1008
+CountCores 1
+[ -f ${fn}1008 ]
+
+TerminateDaemon
@@ -0,0 +1,22 @@
+
+$TESTRUNNER ../hex_crashd -f -vv 2>&1 | tee $TEST.out &
+WaitForMessage "Started" $TEST.out
+
+# Crash a program built with debug info
+pid=`./dummy x && false || true`
+
+WaitForMessage "CRASH: program=dummy" $TEST.out
+
+# The stack is resolved to functions and lines of the program and to
+# offsets into the libraries without them
+grep "CRASH: program=dummy pid=$pid .* symbols='.*crash+0x[0-9a-f]* dummy.c:[0-9]*;.*foo+0x[0-9a-f]* dummy.c:[0-9]*;.*main+0x" $TEST.out
+
+# The stack is kept with the crash files
+f=/var/support/crashstack_dummy.$pid
+[ -f $f ]
+grep "^Thread $pid (crashed):$" $f
+grep "^#[0-9]* 0x[0-9a-f]* .*/dummy+0x[0-9a-f]* crash+0x[0-9a-f]* dummy.c:1[0-9]$" $f
+grep "^#[0-9]* 0x[0-9a-f]* .*/dummy+0x[0-9a-f]* main+0x[0-9a-f]* dummy.c:" $f
+
+TerminateDaemon
+
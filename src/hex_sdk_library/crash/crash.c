@@ -3,11 +3,15 @@
 #define _GNU_SOURCE // GNU asprintf
 #include <execinfo.h> // backtrace
 #include <fcntl.h> // open
+#include <errno.h> // errno
+#include <stdint.h> // UINT8_MAX
 #include <string.h> // memset
+#include <time.h> // clock_gettime, nanosleep
 #include <unistd.h> // unlink, chdir, write, read, ...
 #include <assert.h> // assert
 #include <arpa/inet.h> // htons
 #include <sys/resource.h> // setrlimit
+#include <sys/syscall.h> // SYS_gettid, SYS_tgkill, SYS_getdents64
 
 #include <hex/crash.h>
 #include <hex/process.h>
@@ -64,8 +68,149 @@ typedef struct header {
 static const uint8_t CRASH_ZERO = 0;
 static const uint16_t CRASH_MAGIC = 0x2016;
 
+// Version 1: the signal, then the stack and registers of the thread that crashed
+// Version 2: the signal, then the number of threads followed by the id, stack
+//            and registers of each, starting with the thread that crashed
+static const uint8_t CRASH_VERSION = 2;
+
 static const char* SignalOrigin(int sig, int si_code);
 
+#ifdef __GLIBC__
+
+// Frames kept of each stack
+#define CRASH_MAX_FRAMES 20
+
+// Threads other than the one that crashed whose stacks are kept
+#define CRASH_MAX_THREADS 64
+
+// Time the thread that crashed waits for the others to capture their stacks
+#define CRASH_THREAD_WAIT_MS 200
+
+// Time it then has to write the crash file before another thread that crashed
+// stops waiting for it
+#define CRASH_WRITE_WAIT_MS 1000
+
+// Frames or registers in a crash file beyond which it is taken as corrupt
+#define CRASH_MAX_ENTRIES 1024
+
+// Reserved to ask a thread to capture its own stack and registers
+static int s_threadSignal = 0;
+
+typedef struct {
+    pid_t tid;
+    int done; // set once the thread has captured its context
+    size_t nframes;
+    void* frames[CRASH_MAX_FRAMES];
+    greg_t regs[NGREG];
+} ThreadSlot;
+
+static ThreadSlot s_threads[CRASH_MAX_THREADS];
+static size_t s_numThreads = 0;
+
+// Thread writing the crash file, 0 until a thread crashes
+static pid_t s_crashTid = 0;
+
+// Capture the context of this thread when the thread that crashed asks for it
+static void
+ThreadHandler(int sig, siginfo_t* info, void* context)
+{
+    int saved = errno;
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    size_t n = __atomic_load_n(&s_numThreads, __ATOMIC_ACQUIRE);
+    size_t i;
+    for (i = 0; i < n; i++) {
+        ThreadSlot* slot = &s_threads[i];
+        if (slot->tid == tid && !__atomic_load_n(&slot->done, __ATOMIC_ACQUIRE)) {
+            slot->nframes = backtrace(slot->frames, CRASH_MAX_FRAMES);
+            ucontext_t *uc = (ucontext_t *)context;
+            size_t r;
+            for (r = 0; r < NGREG; r++)
+                slot->regs[r] = uc->uc_mcontext.gregs[r];
+            __atomic_store_n(&slot->done, 1, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    errno = saved;
+}
+
+// The kernel's directory entry returned by getdents64
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static pid_t
+ParseTid(const char* name)
+{
+    pid_t tid = 0;
+    if (!*name)
+        return 0;
+    for (; *name; name++) {
+        if (*name < '0' || *name > '9')
+            return 0;
+        tid = tid * 10 + (*name - '0');
+    }
+    return tid;
+}
+
+static long
+ElapsedMs(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+// Signal every other thread of the process to capture its own context, and
+// wait a bounded time for them, using only async-signal-safe calls
+static void
+CaptureThreads(pid_t self)
+{
+    int fd = open("/proc/self/task", O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return;
+
+    pid_t pid = getpid();
+    char buf[4096] __attribute__ ((aligned(8)));
+    long len;
+    while ((len = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        long pos = 0;
+        while (pos < len) {
+            struct linux_dirent64* ent = (struct linux_dirent64*)(buf + pos);
+            pos += ent->d_reclen;
+            pid_t tid = ParseTid(ent->d_name);
+            if (tid == 0 || tid == self || s_numThreads == CRASH_MAX_THREADS)
+                continue;
+            ThreadSlot* slot = &s_threads[s_numThreads];
+            slot->tid = tid;
+            slot->nframes = 0;
+            __atomic_store_n(&slot->done, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&s_numThreads, s_numThreads + 1, __ATOMIC_RELEASE);
+            // A thread that has exited since is left without a stack
+            syscall(SYS_tgkill, pid, tid, s_threadSignal);
+        }
+    }
+    close(fd);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (ElapsedMs(&start) < CRASH_THREAD_WAIT_MS) {
+        size_t done = 0;
+        size_t i;
+        for (i = 0; i < s_numThreads; i++)
+            done += __atomic_load_n(&s_threads[i].done, __ATOMIC_ACQUIRE);
+        if (done == s_numThreads)
+            break;
+        struct timespec ms = { 0, 1000000 };
+        nanosleep(&ms, NULL);
+    }
+}
+
+#endif
+
 // Create a crash file using only async-signal-safe functions
 static
 void CrashHandler(int sig, siginfo_t* info, void* context)
@@ -73,8 +218,37 @@ void CrashHandler(int sig, siginfo_t* info, void* context)
     if (s_func) //FIXME: prefer to do this after backtrace, but maybe backtrace has side effects?
         s_func(s_data, context);
 
-    if (chdir(CRASH_DIR) == -1)
+#ifdef __GLIBC__
+    // Only the first thread to crash writes the crash file. Any other waits a
+    // bounded time for the signal raised at the end to terminate the process,
+    // and raises its own if that has not happened.
+    pid_t self = (pid_t)syscall(SYS_gettid);
+    pid_t crashTid = 0;
+    if (__atomic_compare_exchange_n(&s_crashTid, &crashTid, self, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // Ask the other threads for their stacks before this one writes anything
+        CaptureThreads(self);
+    }
+    else if (crashTid != self) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (__atomic_load_n(&s_crashTid, __ATOMIC_ACQUIRE) != 0 &&
+               ElapsedMs(&start) < CRASH_THREAD_WAIT_MS + CRASH_WRITE_WAIT_MS) {
+            struct timespec ms = { 0, 1000000 };
+            nanosleep(&ms, NULL);
+        }
+        raise(sig);
+        return;
+    }
+#endif
+
+    if (chdir(CRASH_DIR) == -1) {
+#ifdef __GLIBC__
+        // Nothing was written, so let a later crash write its own file
+        __atomic_store_n(&s_numThreads, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&s_crashTid, 0, __ATOMIC_RELEASE);
+#endif
         return;
+    }
 
     // Save map file for help in analyzing crash dumps
     rename(s_mapFilename, s_crashmapFilename);
@@ -84,7 +258,7 @@ void CrashHandler(int sig, siginfo_t* info, void* context)
         header h;
         assert(sizeof(void*) < UINT8_MAX);
         h.ptrsize = (uint8_t)sizeof(void*);
-        h.version = 1; // THIS MUST CHANGE IF THE FORMAT EVER CHANGES
+        h.version = CRASH_VERSION; // THIS MUST CHANGE IF THE FORMAT EVER CHANGES
         h.magic = CRASH_MAGIC;
         write(fd, &h, sizeof(h));
         size_t padding = h.ptrsize - sizeof(h);
@@ -96,11 +270,14 @@ void CrashHandler(int sig, siginfo_t* info, void* context)
         CRASH_WRITE(info->si_code);
         CRASH_WRITE(info->si_addr);
 
-        //TODO: dump stack of all threads, not just the one that crashed
 #ifdef __GLIBC__
-        // stack trace
-        void *symbuf[20];
-        size_t n = backtrace(symbuf, sizeof(symbuf)/sizeof(void*));
+        size_t nthreads = 1 + s_numThreads;
+        CRASH_WRITE(nthreads);
+
+        // stack trace of the thread that crashed
+        CRASH_WRITE(self);
+        void *symbuf[CRASH_MAX_FRAMES];
+        size_t n = backtrace(symbuf, CRASH_MAX_FRAMES);
 
         CRASH_WRITE(n);
         for (i = 0; i < n; i++)
@@ -114,6 +291,23 @@ void CrashHandler(int sig, siginfo_t* info, void* context)
             greg_t reg = uc->uc_mcontext.gregs[i];
             CRASH_WRITE(reg);
         }
+
+        // then the other threads, without a stack or registers if they did
+        // not capture them in time
+        size_t t;
+        for (t = 0; t < s_numThreads; t++) {
+            ThreadSlot* slot = &s_threads[t];
+            int done = __atomic_load_n(&slot->done, __ATOMIC_ACQUIRE);
+            CRASH_WRITE(slot->tid);
+            n = done ? slot->nframes : 0;
+            CRASH_WRITE(n);
+            for (i = 0; i < n; i++)
+                CRASH_WRITE(slot->frames[i]);
+            n = done ? NGREG : 0;
+            CRASH_WRITE(n);
+            for (i = 0; i < n; i++)
+                CRASH_WRITE(slot->regs[i]);
+        }
 #endif
 
         close(fd);
@@ -176,6 +370,17 @@ int HexCrashInit(const char* name)
         sigaction(SIGRTMIN + 15, &act, 0) < 0)
         return 1;
 
+#ifdef __GLIBC__
+    // Threads capture their own stack on this signal when another crashes
+    s_threadSignal = SIGRTMIN + 14;
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = ThreadHandler;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_SIGINFO | SA_RESTART;
+    if (sigaction(s_threadSignal, &act, 0) < 0)
+        return 1;
+#endif
+
     // Enable core files if special file exists
 #ifndef NDEBUG
     // or in debug builds
@@ -199,58 +404,127 @@ int HexCrashInit(const char* name)
     return 0;
 }
 
+#define CRASH_READ(field) (read(fd, &(field), sizeof(field)) == sizeof(field))
+
+// Open a crash file and read it up to the stacks
+// Return the file descriptor, or -1 if the file cannot be read
+static int
+CrashOpen(const char* filename, siginfo_t* info, uint8_t* version)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    header h;
+    if (CRASH_READ(h)) {
+//TODO:        int swapbytes = (h.magic == ntohs(CRASH_MAGIC));
+        size_t padding = (size_t)h.ptrsize - sizeof(h);
+        uint64_t tmp;
+        if (h.ptrsize >= sizeof(h) && padding <= sizeof(tmp) &&
+            (padding == 0 || read(fd, &tmp, padding) == (ssize_t)padding) &&
+            CRASH_READ(info->si_signo) && CRASH_READ(info->si_code) && CRASH_READ(info->si_addr)) {
+            *version = h.version;
+            return fd;
+        }
+    }
+    close(fd);
+    errno = EINVAL;
+    return -1;
+}
+
+#ifdef __GLIBC__
+
+// Read the stack and registers of one thread, keeping up to "naddrs" and "nregs" of them
+static int
+CrashReadStack(int fd, void** addrs, size_t* naddrs, greg_t* regs, size_t* nregs)
+{
+    size_t nframes = 0;
+    if (!CRASH_READ(nframes) || nframes > CRASH_MAX_ENTRIES)
+        return 1;
+    if (nframes < *naddrs)
+        *naddrs = nframes;
+    size_t i;
+    for (i = 0; i < nframes; i++) {
+        void *p;
+        if (!CRASH_READ(p))
+            return 1;
+        if (i < *naddrs)
+            addrs[i] = p;
+    }
+
+    size_t nr = 0;
+    if (!CRASH_READ(nr) || nr > CRASH_MAX_ENTRIES)
+        return 1;
+    if (nr < *nregs)
+        *nregs = nr;
+    size_t r;
+    for (r = 0; r < nr; r++) {
+        greg_t reg;
+        if (!CRASH_READ(reg))
+            return 1;
+        if (r < *nregs)
+            regs[r] = reg;
+    }
+    return 0;
+}
+
+#endif
+
+// Hidden SDK func: the signal and the stack of the thread that crashed
 int HexCrashInfo(const char* filename, siginfo_t* info, const char** reason, void** addrs, size_t* naddrs, greg_t* regs, size_t* nregs)
 {
+    uint8_t version;
+    int fd = CrashOpen(filename, info, &version);
+    if (fd < 0)
+        return 1;
+
+    *reason = SignalOrigin(info->si_signo, info->si_code);
+
     int ret = 0;
-    int fd = open(filename, O_RDONLY);
-    if (fd >= 0) {
-        header h;
-        ssize_t n = read(fd, &h, sizeof(h));
-        if (n == sizeof(h)) {
-//TODO:            int swapbytes = (h.magic == ntohs(CRASH_MAGIC));
-            size_t padding = (size_t)h.ptrsize - sizeof(h);
-            int tmp;
-            if (padding)
-                read(fd, &tmp, padding);
-#define CRASH_READ(field) read(fd, &field, sizeof(field))
-            CRASH_READ(info->si_signo);
-            CRASH_READ(info->si_code);
-            CRASH_READ(info->si_addr);
-
-            *reason = SignalOrigin(info->si_signo, info->si_code);
+#ifdef __GLIBC__
+    pid_t tid;
+    size_t nthreads;
+    if (version >= 2 && (!CRASH_READ(nthreads) || nthreads == 0 || !CRASH_READ(tid)))
+        ret = 1;
+    else
+        ret = CrashReadStack(fd, addrs, naddrs, regs, nregs);
+#endif
+    close(fd);
+    return ret;
+}
+
+// Hidden SDK func: the id, stack and registers of thread "index" of the
+// crashed process, the thread that crashed being 0
+// Return non-zero past the last thread; the id is 0 in files of version 1
+int HexCrashInfoThread(const char* filename, size_t index, pid_t* tid, void** addrs, size_t* naddrs, greg_t* regs, size_t* nregs)
+{
+    siginfo_t info;
+    uint8_t version;
+    int fd = CrashOpen(filename, &info, &version);
+    if (fd < 0)
+        return 1;
 
+    int ret = 1;
 #ifdef __GLIBC__
-            // stack trace
-            size_t nframes = 0;
-            CRASH_READ(nframes);
-            if (nframes < *naddrs)
-                *naddrs = nframes;
-            size_t i;
-            for (i = 0; i < nframes; i++) {
-                void *p;
-                CRASH_READ(p);
-                if (i < *naddrs)
-                    addrs[i] = p;
+    size_t nthreads = 1;
+    if (version < 2 || CRASH_READ(nthreads)) {
+        size_t t;
+        for (t = 0; t < nthreads && t <= index; t++) {
+            *tid = 0;
+            if (version >= 2 && !CRASH_READ(*tid))
+                break;
+            size_t nskip = 0;
+            if (t < index) {
+                if (CrashReadStack(fd, NULL, &nskip, NULL, &nskip) != 0)
+                    break;
             }
-
-            // registers
-            size_t nr = 0;
-            CRASH_READ(nr);
-            if (nr < *nregs)
-                *nregs = nr;
-            size_t r;
-            for (r = 0; r < nr; r++) {
-                greg_t reg;
-                CRASH_READ(reg);
-                if (r < *nregs)
-                    regs[r] = reg;
+            else {
+                ret = CrashReadStack(fd, addrs, naddrs, regs, nregs);
             }
+        }
+    }
 #endif
-        } else
-            ret = n;
-        close(fd);
-    } else
-        ret = 1;
+    close(fd);
     return ret;
 }
 
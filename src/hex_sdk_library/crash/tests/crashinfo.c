@@ -6,10 +6,12 @@
 #include <signal.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/types.h> // pid_t
 #include <sys/ucontext.h> // greg_t
 
-// Hidden SDK func
+// Hidden SDK funcs
 int HexCrashInfo(const char* filename, siginfo_t* info, const char** reason, void** addrs, size_t* naddrs, greg_t* regs, size_t* nregs);
+int HexCrashInfoThread(const char* filename, size_t index, pid_t* tid, void** addrs, size_t* naddrs, greg_t* regs, size_t* nregs);
 
 static void
 Usage()
@@ -49,6 +51,21 @@ int main(int argc, char* argv[])
         for (j = 0; j < nr; j++)
             printf("0x%lx ", (unsigned long)regs[j]);
         printf("\n");
+
+        // every thread, the one that crashed first: its id then its stack
+        size_t t;
+        pid_t tid;
+        for (t = 0; ; t++) {
+            n = 10;
+            nr = 23;
+            if (HexCrashInfoThread(argv[i], t, &tid, addrs, &n, regs, &nr) != 0)
+                break;
+            printf("thread%zu: %d ", t, (int)tid);
+            for (j = 0; j < n; j++)
+                printf("%p ", addrs[j]);
+            printf("\n");
+        }
+        printf("threads: %zu\n", t);
     }
 
     return 0;
@@ -0,0 +1,55 @@
+// HEX SDK
+
+#include <libgen.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <hex/crash.h>
+#include <hex/test.h>
+
+#define THREADS 3
+
+static pthread_barrier_t s_started;
+
+static
+void* waiter(void* arg)
+{
+    pthread_barrier_wait(&s_started);
+    while (1)
+        pause();
+    return NULL;
+}
+
+// A thread that blocks every signal is left out after a bounded wait
+static
+void* blocked(void* arg)
+{
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+    pthread_barrier_wait(&s_started);
+    while (1)
+        pause();
+    return NULL;
+}
+
+// argc > 1 means this program will abort() once its threads are running
+int main(int argc, char* argv[])
+{
+    HEX_TEST(HexCrashInit(basename(argv[0])) == 0);
+
+    pthread_barrier_init(&s_started, NULL, THREADS + 2);
+    pthread_t threads[THREADS + 1];
+    int i;
+    for (i = 0; i < THREADS; i++)
+        HEX_TEST(pthread_create(&threads[i], NULL, waiter, NULL) == 0);
+    HEX_TEST(pthread_create(&threads[THREADS], NULL, blocked, NULL) == 0);
+    pthread_barrier_wait(&s_started);
+
+    printf("%d\n", getpid()); // display pid so wrapper script can look for crash file
+    fflush(stdout);
+    if (argc > 1)
+        abort();
+    return 0;
+}
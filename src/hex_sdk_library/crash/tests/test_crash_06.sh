@@ -0,0 +1,26 @@
+# HEX SDK
+
+fn="/var/support/crash_$TEST"
+
+# crash files go in /var/support
+[ -d /var/support ] || mkdir -p /var/support
+
+# now crash with other threads running
+pid=`./$TEST x && false || true`
+[ -f "$fn.$pid" ]
+
+$TESTRUNNER ./crashinfo $fn.$pid | tee test.out
+eval `cat test.out | awk -F : '{ sub("^[ ]+","", $2); printf "%s=\"%s\"\n",$1,$2 }'`
+
+[ "$reason" = "abort" ]
+[ "$signal" = "6" ]
+
+# the thread that crashed comes first, then the three waiting threads with
+# their stacks and the one blocking signals without
+[ "$threads" = "5" ]
+[ "${thread0%% *}" = "$pid" ]
+[ `grep -c "^thread[1-4]: [0-9]* 0x" test.out` = "3" ]
+[ `grep -c "^thread[1-4]: [0-9]* $" test.out` = "1" ]
+
+rm -f $fn.*
+rm -f /var/support/core.$pid
@@ -0,0 +1,45 @@
+// HEX SDK
+
+#include <errno.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hex/crash.h>
+#include <hex/test.h>
+
+static
+void* waiter(void* arg)
+{
+    while (1)
+        pause();
+    return NULL;
+}
+
+// argc > 1 means this program will have a thread give up on a crash file
+// and then abort(), which must still write one
+int main(int argc, char* argv[])
+{
+    HEX_TEST(HexCrashInit(basename(argv[0])) == 0);
+
+    pthread_t thread;
+    HEX_TEST(pthread_create(&thread, NULL, waiter, NULL) == 0);
+
+    printf("%d\n", getpid()); // display pid so wrapper script can look for crash file
+    fflush(stdout);
+    if (argc > 1) {
+        // Without the crash directory the handler gives up and the process
+        // carries on, as it does on SIGRTMIN+15
+        HEX_TEST(rename("/var/support", "/var/support.away") == 0);
+        pthread_kill(thread, SIGRTMIN + 15);
+        struct timespec ts = { 1, 0 };
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+            ;
+        HEX_TEST(rename("/var/support.away", "/var/support") == 0);
+        abort();
+    }
+    return 0;
+}
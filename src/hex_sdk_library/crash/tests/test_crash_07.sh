@@ -0,0 +1,20 @@
+# HEX SDK
+
+fn="/var/support/crash_$TEST"
+
+# crash files go in /var/support
+[ -d /var/support ] || mkdir -p /var/support
+
+# a thread that could not write a crash file does not hold up the next crash
+pid=`timeout 10 ./$TEST x && false || true`
+[ -f "$fn.$pid" ]
+
+$TESTRUNNER ./crashinfo $fn.$pid | tee test.out
+eval `cat test.out | awk -F : '{ sub("^[ ]+","", $2); printf "%s=\"%s\"\n",$1,$2 }'`
+
+[ "$reason" = "abort" ]
+[ "$signal" = "6" ]
+[ "${thread0%% *}" = "$pid" ]
+
+rm -f $fn.*
+rm -f /var/support/core.$pid
@@ -1,11 +1,20 @@
 // HEX SDK
 
+#define _GNU_SOURCE // copy_file_range
 #include <pwd.h>
 #include <grp.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <linux/fs.h> // FICLONE
+
+#include <limits.h>
+
+#include <hex/filesystem.h>
 
 int
 HexMakeDir(const char* dir, const char* user, const char* group, mode_t perms)
@@ -86,3 +95,162 @@ HexSetFileMode(const char* path, const char* user, const char* group, mode_t per
     return 0;
 }
 
+
+void
+HexCopyOwner(const char* path, uid_t uid, gid_t gid)
+{
+    if (lchown(path, uid, gid) != 0) {
+        // Only root keeps other owners
+    }
+}
+
+int
+HexWriteAll(int fd, const void* buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, (const char*)buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+int
+HexCopyFd(int in, int out)
+{
+    // Share the source's blocks if the file system can, have the kernel copy
+    // them if it cannot, and copy through a buffer if neither works or
+    // "out" is appended to, which neither supports. A clone is always of the
+    // whole file, so it is only tried while nothing of "in" has been read.
+    int appending = (fcntl(out, F_GETFL) & O_APPEND) != 0;
+    if (!appending && lseek(in, 0, SEEK_CUR) == 0 && ioctl(out, FICLONE, in) == 0)
+        return 0;
+
+    int copied = 0;
+    while (!appending) {
+        ssize_t n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+        if (n > 0) {
+            copied = 1;
+            continue;
+        }
+        if (n == 0 && copied)
+            return 0;
+        if (n < 0 && errno == EINTR)
+            continue;
+        // Some kernels copy nothing from pseudo files such as those of /proc
+        // and report the end at once, so the buffer decides
+        if (n < 0 && (copied || (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)))
+            return -1;
+        break;
+    }
+
+    char buffer[65536];
+    for (;;) {
+        ssize_t n = read(in, buffer, sizeof(buffer));
+        if (n == 0)
+            return 0;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (HexWriteAll(out, buffer, n) != 0)
+            return -1;
+    }
+}
+
+int
+HexMakeParents(const char* path)
+{
+    char dir[PATH_MAX];
+    size_t len = strlen(path);
+    if (len >= sizeof(dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(dir, path, len + 1);
+
+    char* slash;
+    for (slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        int r = mkdir(dir, 0755);
+        *slash = '/';
+        if (r != 0 && errno != EEXIST)
+            return -1;
+    }
+    return 0;
+}
+
+int
+HexPathIsBeneath(const char* name)
+{
+    if (name[0] == '\0' || name[0] == '/')
+        return 0;
+    const char* start = name;
+    for (;;) {
+        const char* end = strchr(start, '/');
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+        if (len == 2 && start[0] == '.' && start[1] == '.')
+            return 0;
+        if (!end)
+            return 1;
+        start = end + 1;
+    }
+}
+
+int
+HexMakeDirsBeneath(const char* dir, const char* path)
+{
+    if (!HexPathIsBeneath(path)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    char name[NAME_MAX + 1];
+    const char* start = path;
+    while (*start) {
+        const char* end = strchrnul(start, '/');
+        size_t len = end - start;
+        if (len > NAME_MAX) {
+            close(fd);
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(name, start, len);
+        name[len] = '\0';
+        start = *end ? end + 1 : end;
+        if (len == 0 || strcmp(name, ".") == 0)
+            continue;
+
+        int next = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (next < 0 && errno == ENOENT) {
+            if (mkdirat(fd, name, 0755) != 0 && errno != EEXIST) {
+                close(fd);
+                return -1;
+            }
+            next = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        }
+        if (next < 0) {
+            // O_NOFOLLOW reports a link as ELOOP, or ENOTDIR with O_DIRECTORY
+            int err = errno;
+            struct stat st;
+            if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(st.st_mode))
+                err = ELOOP;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+        close(fd);
+        fd = next;
+    }
+    close(fd);
+    return 0;
+}
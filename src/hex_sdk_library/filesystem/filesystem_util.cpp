@@ -0,0 +1,25 @@
+// HEX SDK
+
+#include <algorithm>
+#include <cstring>
+
+#include <dirent.h>
+
+#include <hex/filesystem.h>
+
+bool
+HexListDir(const std::string &dir, std::vector<std::string> &names)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return false;
+    size_t start = names.size();
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+            names.push_back(ent->d_name);
+    }
+    closedir(d);
+    std::sort(names.begin() + start, names.end());
+    return true;
+}
@@ -1,73 +1,1333 @@
 // HEX SDK
 
+#include <algorithm>
+#include <atomic>
+#include <new>
 #include <vector>
 #include <unordered_map>
 
 #include <assert.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdint.h>
 #include <string.h> // memset
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/timerfd.h>
+#include <time.h>
 #include <unistd.h>
 #include <errno.h>
 
+#include <linux/io_uring.h>
+
 #include <hex/loop.h>
 
-namespace {
+// Intrusive doubly linked list node; wheel slots are circular lists with a
+// sentinel head so arm and cancel are O(1)
+struct TimerLink {
+    TimerLink* prev;
+    TimerLink* next;
+};
+
+struct HexLoopTimer : TimerLink {
+    HexLoopCtx* loop;    // loop the timer belongs to
+    uint64_t expires;    // absolute expiry in ms (CLOCK_MONOTONIC)
+    uint64_t period;     // ms between expiries, 0 for one-shot
+    int level;           // wheel level while armed, -1 otherwise
+    bool legacy;         // added by HexLoopTimerAdd(), looked up by callback
+    bool cancelled;      // cancelled by its own callback
+    HexLoopCallback cb;
+    void* userData;
+};
+
+namespace {
+
+// Maximum number of ready events dispatched per epoll_wait(2)
+const int MAX_EVENTS = 64;
+
+// Maximum number of posted tasks run per wakeup, so that a flood of posts
+// cannot starve the loop's other callbacks
+const int MAX_TASKS = 256;
+
+// Size of the buffers data is received into for HexLoopRecvAdd()
+const size_t RECV_BUF_SIZE = 16384;
+
+// io_uring backend: submission queue size, number of provided receive
+// buffers (a power of 2) and signals read per completion
+const unsigned URING_ENTRIES = 256;
+const unsigned URING_RECV_BUFS = 64;
+const int URING_RECV_GROUP = 0;
+const int SIGNAL_BATCH = 16;
+
+// Hierarchical timer wheel: 4 levels of 256 slots with 1ms ticks at level 0,
+// so level n covers delays up to 256^(n+1) ms (about 49 days at level 3)
+const int WHEEL_BITS = 8;
+const int WHEEL_SLOTS = 1 << WHEEL_BITS;
+const uint64_t WHEEL_MASK = WHEEL_SLOTS - 1;
+const int WHEEL_LEVELS = 4;
+const uint64_t WHEEL_MAX_DELAY = (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+enum CbKind {
+    CB_FD,
+    CB_WHEEL,
+    CB_SIGNAL,
+    CB_TASKS,
+    CB_RECV,
+};
+
+// One registration per monitored file descriptor
+// A pointer to it is stored in epoll_event.data (or io_uring user_data) so
+// dispatch needs no lookup
+struct CbInfo {
+    CbKind kind;
+    int fd;
+    uint32_t events;             // epoll events, EPOLLET for edge-triggered
+    HexLoopCallback cb;
+    HexLoopRecvCallback recvCb;  // CB_RECV
+    void* userData;
+    char* buf;                   // io_uring: read target for loop owned fds
+    bool removed;
+    bool inflight;               // io_uring: operation submitted, not completed
+    bool done;                   // CB_RECV: end of file or error was delivered
+};
+
+// Registrations by file descriptor
+typedef std::unordered_map<int, CbInfo*> Handlers;
+
+// Registrations removed while dispatching; freed once the current batch is done
+// since later events of the batch may still point to them
+typedef std::vector<CbInfo*> CbInfoVec;
+
+// Timers added by HexLoopTimerAdd() by callback
+typedef std::unordered_multimap<HexLoopCallback, HexLoopTimer*> TimersByCb;
+
+// Task posted by HexLoopPost(); node of the loop's intrusive MPSC queue
+struct Task {
+    std::atomic<Task*> next;
+    HexLoopTask fn;
+    void* arg;
+};
+
+// io_uring(7) instance with its mapped rings, used without liburing
+struct Uring {
+    int fd = -1;
+
+    void* sqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    void* cqRing = MAP_FAILED;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+    size_t sqesSize = 0;
+
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned sqLocalTail;    // filled up to here, published on submit
+
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    io_uring_cqe* cqes;
+
+    // IOSQE_CQE_SKIP_SUCCESS is supported (Linux 5.17): the loop's own
+    // cancellations and buffer hand-backs complete without a CQE to reap
+    bool skipCqe = false;
+
+    // Buffers provided to the kernel for multishot receives
+    char* bufs = (char*)MAP_FAILED;
+};
+
+} // end anonymous namespace (like static declaration, local scope)
+
+struct HexLoopCtx {
+    // epoll(7) instance
+    int epollFd = -1;
+
+    Handlers handlers;
+    CbInfoVec removed;
+
+    std::atomic<bool> quit;
+
+    // Timer wheel slots, driven by a single timerfd(2)
+    TimerLink wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+    size_t wheelCount[WHEEL_LEVELS];
+
+    // Last tick (in ms) the wheel was advanced to
+    uint64_t wheelTick = 0;
+
+    // Absolute expiry the timerfd is armed for, 0 if disarmed
+    uint64_t wheelWake = 0;
+
+    int wheelFd = -1;
+
+    // Wheel is being advanced; timer callbacks are being called
+    bool advancing = false;
+
+    // Timer whose callback is being called
+    HexLoopTimer* running = NULL;
+
+    TimersByCb timersByCb;
+
+    // Posted tasks: producers push onto head, the loop pops from tail
+    std::atomic<Task*> taskHead;
+    Task* taskTail = NULL;
+    Task taskStub;
+
+    // Set once taskFd has been signaled until the loop drains the queue, so
+    // a burst of posts costs a single write(2)
+    std::atomic<bool> taskPending;
+
+    // eventfd(2) waking the loop for posted tasks and HexLoopStop()
+    int taskFd = -1;
+
+    // Loops started by HexLoopSpawn()
+    pthread_t thread;
+    int result = 0;
+
+    // io_uring backend, NULL for epoll
+    Uring* uring = NULL;
+
+    // io_uring: removed registrations waiting for their last completion
+    CbInfoVec cancelling;
+
+    // epoll: receive buffer for HexLoopRecvAdd()
+    std::vector<char> recvBuf;
+
+    HexLoopStats stats;
+};
+
+namespace {
+
+// Signal callbacks by signal number
+// Signals are only handled by the default loop
+struct SignalInfo {
+    HexLoopCallback cb;
+    void* userData;
+};
+SignalInfo s_sigHandlers[_NSIG];
+
+// Caller's original signal mask
+sigset_t s_origMask;
+
+// Set of signals to monitor (for use with signalfd(2))
+sigset_t s_signals;
+
+// Signal file descriptor for signalfd(2)
+int s_sigFd = -1;
+
+// The loop behind HexLoopInit()/HexLoop()/HexLoopFini()
+HexLoopCtx s_default;
+
+// Loop run by the calling thread, NULL for the default loop
+thread_local HexLoopCtx* t_current = NULL;
+
+
+// Helper functions
+
+HexLoopCtx* Current()
+{
+    return t_current ? t_current : &s_default;
+}
+
+// io_uring helpers
+
+// Next free submission queue entry, zeroed; NULL if the ring is full even
+// after handing the queued entries to the kernel
+io_uring_sqe* UringSqe(HexLoopCtx* loop)
+{
+    Uring* u = loop->uring;
+    if (u->sqLocalTail - __atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE) == u->sqEntries) {
+        __atomic_store_n(u->sqTail, u->sqLocalTail, __ATOMIC_RELEASE);
+        loop->stats.syscalls++;
+        syscall(__NR_io_uring_enter, u->fd, u->sqEntries, 0, 0, NULL, 0);
+        if (u->sqLocalTail - __atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE) == u->sqEntries)
+            return NULL;
+    }
+
+    io_uring_sqe* sqe = &u->sqes[u->sqLocalTail & u->sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sqLocalTail++;
+    return sqe;
+}
+
+// Submit the queued entries and wait for at least one completion, all in
+// one system call
+int UringEnter(HexLoopCtx* loop)
+{
+    Uring* u = loop->uring;
+    __atomic_store_n(u->sqTail, u->sqLocalTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = u->sqLocalTail - __atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE);
+
+    loop->stats.waits++;
+    loop->stats.syscalls++;
+    return syscall(__NR_io_uring_enter, u->fd, toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+// Start the operation reporting on a registration:
+// level-triggered fds get a one-shot poll re-armed after each callback (the
+// poll checks readiness when armed), edge-triggered fds a multishot poll,
+// received data a multishot receive into provided buffers and the loop's own
+// fds a read whose result arrives with the completion
+int UringArm(HexLoopCtx* loop, CbInfo* info)
+{
+    io_uring_sqe* sqe = UringSqe(loop);
+    if (!sqe)
+        return -1;
+
+    sqe->fd = info->fd;
+    sqe->user_data = (uint64_t)(uintptr_t)info;
+
+    switch (info->kind) {
+        case CB_FD:
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->poll32_events = POLLIN;
+            if (info->events & EPOLLET)
+                sqe->len = IORING_POLL_ADD_MULTI;
+            break;
+
+        case CB_RECV:
+            sqe->opcode = IORING_OP_RECV;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = URING_RECV_GROUP;
+            break;
+
+        case CB_SIGNAL:
+        case CB_WHEEL:
+        case CB_TASKS:
+            sqe->opcode = IORING_OP_READ;
+            sqe->addr = (uint64_t)(uintptr_t)info->buf;
+            sqe->len = info->kind == CB_SIGNAL ? SIGNAL_BATCH * sizeof(signalfd_siginfo) : sizeof(uint64_t);
+            sqe->off = (uint64_t)-1;
+            break;
+    }
+
+    info->inflight = true;
+    return 0;
+}
+
+// Cancel the operation of a removed registration; its completion frees it
+int UringCancel(HexLoopCtx* loop, CbInfo* info)
+{
+    // Not submitted yet: it must not run at all (a receive would consume data
+    // that belongs to a later registration), so it becomes a no-op that still
+    // completes
+    Uring* u = loop->uring;
+    for (unsigned i = *u->sqTail; i != u->sqLocalTail; ++i) {
+        io_uring_sqe* sqe = &u->sqes[i & u->sqMask];
+        if (sqe->user_data == (uint64_t)(uintptr_t)info) {
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = (uint64_t)(uintptr_t)info;
+            return 0;
+        }
+    }
+
+    io_uring_sqe* sqe = UringSqe(loop);
+    if (!sqe)
+        return -1;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)info;
+    sqe->user_data = 0;
+    if (u->skipCqe)
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    return 0;
+}
+
+// Hand count receive buffers starting at bid (back) to the kernel; goes out
+// with the next submission
+int UringProvide(HexLoopCtx* loop, unsigned bid, unsigned count)
+{
+    io_uring_sqe* sqe = UringSqe(loop);
+    if (!sqe)
+        return -1;
+
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (uint64_t)(uintptr_t)(loop->uring->bufs + bid * RECV_BUF_SIZE);
+    sqe->len = RECV_BUF_SIZE;
+    sqe->off = bid;
+    sqe->buf_group = URING_RECV_GROUP;
+    sqe->user_data = 0;
+    if (loop->uring->skipCqe)
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    return 0;
+}
+
+void UringFini(Uring* u)
+{
+    // Closing the ring cancels all of its operations
+    if (u->fd != -1)
+        close(u->fd);
+    if (u->bufs != MAP_FAILED)
+        munmap(u->bufs, URING_RECV_BUFS * RECV_BUF_SIZE);
+    if (u->sqes != MAP_FAILED)
+        munmap(u->sqes, u->sqesSize);
+    if (u->cqRing != MAP_FAILED && u->cqRing != u->sqRing)
+        munmap(u->cqRing, u->cqRingSize);
+    if (u->sqRing != MAP_FAILED)
+        munmap(u->sqRing, u->sqRingSize);
+    delete u;
+}
+
+// NULL if io_uring is unavailable or lacks the features used here
+// (multishot poll and receive: Linux 6.0)
+Uring* UringInit()
+{
+    Uring* u = new Uring;
+
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_COOP_TASKRUN;
+    u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (u->fd == -1 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    }
+    if (u->fd == -1)
+        goto fail;
+
+    if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_FAST_POLL))
+        goto fail;
+    u->skipCqe = (params.features & IORING_FEAT_CQE_SKIP) != 0;
+
+    u->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    u->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        u->sqRingSize = u->cqRingSize = std::max(u->sqRingSize, u->cqRingSize);
+
+    u->sqRing = mmap(0, u->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sqRing == MAP_FAILED)
+        goto fail;
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        u->cqRing = u->sqRing;
+    else
+        u->cqRing = mmap(0, u->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (u->cqRing == MAP_FAILED)
+        goto fail;
+
+    u->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    u->sqes = (io_uring_sqe*)mmap(0, u->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+        goto fail;
+
+    {
+        char* sq = (char*)u->sqRing;
+        u->sqHead = (unsigned*)(sq + params.sq_off.head);
+        u->sqTail = (unsigned*)(sq + params.sq_off.tail);
+        u->sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+        u->sqEntries = *(unsigned*)(sq + params.sq_off.ring_entries);
+        u->sqLocalTail = *u->sqTail;
+
+        // Submission queue entries are always used in ring order
+        unsigned* array = (unsigned*)(sq + params.sq_off.array);
+        for (unsigned i = 0; i < u->sqEntries; ++i)
+            array[i] = i;
+
+        char* cq = (char*)u->cqRing;
+        u->cqHead = (unsigned*)(cq + params.cq_off.head);
+        u->cqTail = (unsigned*)(cq + params.cq_off.tail);
+        u->cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+        u->cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    }
+
+    // Provided to the kernel by the loop once it is set up
+    u->bufs = (char*)mmap(0, URING_RECV_BUFS * RECV_BUF_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->bufs == MAP_FAILED)
+        goto fail;
+
+    return u;
+
+fail:
+    UringFini(u);
+    return NULL;
+}
+
+void FreeCb(CbInfo* info)
+{
+    delete[] info->buf;
+    delete info;
+}
+
+// Register callback for fd and add fd to the monitored set
+CbInfo* AddCb(HexLoopCtx* loop, CbKind kind, int fd, HexLoopCallback cb, void* userData, uint32_t events = EPOLLIN)
+{
+    if ((loop->epollFd == -1 && !loop->uring) || loop->handlers.find(fd) != loop->handlers.end())
+        return NULL;
+
+    CbInfo* info = new CbInfo;
+    info->kind = kind;
+    info->fd = fd;
+    info->events = events;
+    info->cb = cb;
+    info->recvCb = NULL;
+    info->userData = userData;
+    info->buf = NULL;
+    info->removed = false;
+    info->inflight = false;
+    info->done = false;
+
+    if (loop->uring) {
+        if (kind == CB_SIGNAL)
+            info->buf = new char[SIGNAL_BATCH * sizeof(signalfd_siginfo)];
+        else if (kind == CB_WHEEL || kind == CB_TASKS)
+            info->buf = new char[sizeof(uint64_t)];
+
+        // Submitted along with the next wait
+        if (UringArm(loop, info) == -1) {
+            FreeCb(info);
+            return NULL;
+        }
+    }
+    else {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.ptr = info;
+        loop->stats.syscalls++;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            FreeCb(info);
+            return NULL;
+        }
+    }
+
+    loop->handlers[fd] = info;
+    return info;
+}
+
+// Stop monitoring fd; the registration is freed after the current dispatch
+// batch, or once its io_uring operation is cancelled
+int RemoveCb(HexLoopCtx* loop, int fd, CbKind kind)
+{
+    Handlers::iterator it = loop->handlers.find(fd);
+    if (it == loop->handlers.end() || it->second->kind != kind)
+        return -1;
+
+    CbInfo* info = it->second;
+    loop->handlers.erase(it);
+    info->removed = true;
+
+    if (loop->uring) {
+        if (info->inflight) {
+            UringCancel(loop, info);
+            loop->cancelling.push_back(info);
+            return 0;
+        }
+    }
+    else {
+        loop->stats.syscalls++;
+        epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    loop->removed.push_back(info);
+
+    return 0;
+}
+
+void FreeRemoved(HexLoopCtx* loop)
+{
+    for (CbInfoVec::iterator it = loop->removed.begin(); it != loop->removed.end(); ++it)
+        FreeCb(*it);
+    loop->removed.clear();
+}
+
+uint64_t NowMs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void ListInit(TimerLink* head)
+{
+    head->prev = head->next = head;
+}
+
+bool ListEmpty(const TimerLink* head)
+{
+    return head->next == head;
+}
+
+void ListAppend(TimerLink* head, TimerLink* link)
+{
+    link->prev = head->prev;
+    link->next = head;
+    head->prev->next = link;
+    head->prev = link;
+}
+
+void ListUnlink(TimerLink* link)
+{
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    ListInit(link);
+}
+
+size_t WheelSize(HexLoopCtx* loop)
+{
+    size_t n = 0;
+    for (int level = 0; level < WHEEL_LEVELS; ++level)
+        n += loop->wheelCount[level];
+    return n;
+}
+
+// Put an armed timer into the slot for its expiry relative to the current tick
+void WheelInsert(HexLoopTimer* t)
+{
+    HexLoopCtx* loop = t->loop;
+    if (t->expires <= loop->wheelTick)
+        t->expires = loop->wheelTick + 1;
+    else if (t->expires - loop->wheelTick > WHEEL_MAX_DELAY)
+        t->expires = loop->wheelTick + WHEEL_MAX_DELAY;
+
+    uint64_t delta = t->expires - loop->wheelTick;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >> (WHEEL_BITS * (level + 1)))
+        level++;
+
+    int slot = (t->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    t->level = level;
+    loop->wheelCount[level]++;
+    ListAppend(&loop->wheel[level][slot], t);
+}
+
+// Take a timer off the wheel (or the list of due timers)
+void WheelRemove(HexLoopTimer* t)
+{
+    if (t->level >= 0)
+        t->loop->wheelCount[t->level]--;
+    t->level = -1;
+    ListUnlink(t);
+}
+
+// Move the timers of a slot onto list
+void WheelTake(HexLoopCtx* loop, int level, int slot, TimerLink* list)
+{
+    TimerLink* head = &loop->wheel[level][slot];
+    while (!ListEmpty(head)) {
+        HexLoopTimer* t = static_cast<HexLoopTimer*>(head->next);
+        WheelRemove(t);
+        ListAppend(list, t);
+    }
+}
+
+// Redistribute the slot of level that tick enters into the lower levels
+void WheelCascade(HexLoopCtx* loop, int level, uint64_t tick)
+{
+    int slot = (tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    if (slot == 0 && level + 1 < WHEEL_LEVELS)
+        WheelCascade(loop, level + 1, tick);
+
+    TimerLink list;
+    ListInit(&list);
+    WheelTake(loop, level, slot, &list);
+    while (!ListEmpty(&list)) {
+        HexLoopTimer* t = static_cast<HexLoopTimer*>(list.next);
+        ListUnlink(t);
+        WheelInsert(t);
+    }
+}
+
+// Arm a timer to expire ms from now
+void TimerArm(HexLoopTimer* t, uint64_t ms)
+{
+    HexLoopCtx* loop = t->loop;
+    uint64_t now = NowMs();
+    WheelRemove(t);
+
+    // Idle wheel: nothing to catch up on
+    if (!loop->advancing && WheelSize(loop) == 0)
+        loop->wheelTick = std::max(loop->wheelTick, now);
+
+    t->expires = now + ms;
+    WheelInsert(t);
+
+    // Callbacks called from the wheel are followed by WheelUpdate()
+    if (!loop->advancing && (loop->wheelWake == 0 || t->expires < loop->wheelWake)) {
+        itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.it_value.tv_sec = t->expires / 1000;
+        spec.it_value.tv_nsec = (t->expires % 1000) * 1000000;
+        loop->stats.syscalls++;
+        if (timerfd_settime(loop->wheelFd, TFD_TIMER_ABSTIME, &spec, 0) == 0)
+            loop->wheelWake = t->expires;
+    }
+}
+
+void TimerFree(HexLoopTimer* t)
+{
+    if (t->legacy) {
+        TimersByCb& timers = t->loop->timersByCb;
+        std::pair<TimersByCb::iterator, TimersByCb::iterator> range = timers.equal_range(t->cb);
+        for (TimersByCb::iterator it = range.first; it != range.second; ++it) {
+            if (it->second == t) {
+                timers.erase(it);
+                break;
+            }
+        }
+    }
+    WheelRemove(t);
+    delete t;
+}
+
+HexLoopTimer* TimerAdd(HexLoopCtx* loop, uint64_t ms, uint64_t period, bool legacy,
+                       HexLoopCallback cb, void* userData)
+{
+    if (loop->taskFd == -1)
+        return NULL;
+
+    // The wheel's timerfd is only created once timers are used
+    // io_uring reads block until expiry instead of returning EAGAIN
+    if (loop->wheelFd == -1) {
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | (loop->uring ? 0 : TFD_NONBLOCK));
+        if (fd == -1)
+            return NULL;
+        if (!AddCb(loop, CB_WHEEL, fd, 0, 0)) {
+            close(fd);
+            return NULL;
+        }
+        loop->wheelFd = fd;
+    }
+
+    HexLoopTimer* t = new HexLoopTimer;
+    ListInit(t);
+    t->loop = loop;
+    t->expires = 0;
+    t->period = period;
+    t->level = -1;
+    t->legacy = legacy;
+    t->cancelled = false;
+    t->cb = cb;
+    t->userData = userData;
+
+    if (ms)
+        TimerArm(t, ms);
+    if (legacy)
+        loop->timersByCb.insert(std::make_pair(cb, t));
+
+    return t;
+}
+
+// Find a timer added by HexLoopTimerAdd() by its callback
+HexLoopTimer* FindTimer(HexLoopCtx* loop, HexLoopCallback cb)
+{
+    TimersByCb::iterator it = loop->timersByCb.find(cb);
+    return it == loop->timersByCb.end() ? NULL : it->second;
+}
+
+// Call the callbacks of the timers in the slot of the current tick
+// All timers expiring in the same tick are handled by one wakeup
+int WheelRun(HexLoopCtx* loop, int slot)
+{
+    TimerLink due;
+    ListInit(&due);
+    WheelTake(loop, 0, slot, &due);
+
+    while (!ListEmpty(&due)) {
+        HexLoopTimer* t = static_cast<HexLoopTimer*>(due.next);
+        ListUnlink(t);
+
+        loop->running = t;
+        int r = t->cb(0, t->userData, 0);
+        loop->running = NULL;
+
+        if (t->cancelled) {
+            TimerFree(t);
+        }
+        else if (t->level >= 0) {
+            // Re-armed by its callback
+        }
+        else if (t->period) {
+            // Keep to the original schedule rather than drifting by the callback's latency
+            t->expires += t->period;
+            WheelInsert(t);
+        }
+        else if (!t->legacy) {
+            // One-shot timers are done
+            TimerFree(t);
+        }
+
+        if (r == -1) {
+            // Leave the rest for the next tick
+            while (!ListEmpty(&due)) {
+                t = static_cast<HexLoopTimer*>(due.next);
+                ListUnlink(t);
+                WheelInsert(t);
+            }
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Process every tick up to now
+int WheelAdvance(HexLoopCtx* loop, uint64_t now)
+{
+    int r = 0;
+
+    loop->advancing = true;
+    while (r == 0 && loop->wheelTick < now) {
+        if (WheelSize(loop) == 0) {
+            loop->wheelTick = now;
+            break;
+        }
+
+        uint64_t tick = loop->wheelTick + 1;
+        if (loop->wheelCount[0] == 0 && (tick & WHEEL_MASK) != 0) {
+            // Nothing can expire before level 0 wraps around
+            loop->wheelTick = std::min(now, tick | WHEEL_MASK);
+            continue;
+        }
+
+        loop->wheelTick = tick;
+        if ((tick & WHEEL_MASK) == 0)
+            WheelCascade(loop, 1, tick);
+        r = WheelRun(loop, tick & WHEEL_MASK);
+    }
+    loop->advancing = false;
+
+    return r;
+}
+
+// Earliest tick at which the wheel has work to do: the expiry of the next
+// level 0 slot or the cascade of a higher level slot; 0 if there are no timers
+uint64_t WheelNext(HexLoopCtx* loop)
+{
+    uint64_t next = 0;
+    for (int level = 0; level < WHEEL_LEVELS; ++level) {
+        if (loop->wheelCount[level] == 0)
+            continue;
+
+        int shift = WHEEL_BITS * level;
+        uint64_t pos = loop->wheelTick >> shift;
+        for (uint64_t d = 1; d <= (uint64_t)WHEEL_SLOTS; ++d) {
+            if (!ListEmpty(&loop->wheel[level][(pos + d) & WHEEL_MASK])) {
+                uint64_t tick = (pos + d) << shift;
+                if (next == 0 || tick < next)
+                    next = tick;
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+// Arm the timerfd for the next tick with work, or disarm it
+int WheelUpdate(HexLoopCtx* loop)
+{
+    uint64_t next = WheelNext(loop);
+    if (next == loop->wheelWake)
+        return 0;
+
+    itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = next / 1000;
+    spec.it_value.tv_nsec = (next % 1000) * 1000000;
+    loop->stats.syscalls++;
+    if (timerfd_settime(loop->wheelFd, TFD_TIMER_ABSTIME, &spec, 0) == -1)
+        return -1;
+
+    loop->wheelWake = next;
+    return 0;
+}
+
+// The wheel's timerfd expired (and was read)
+int WheelExpired(HexLoopCtx* loop)
+{
+    loop->wheelWake = 0;
+
+    int r = WheelAdvance(loop, NowMs());
+    if (WheelUpdate(loop) == -1)
+        return -1;
+    return r;
+}
+
+int DispatchWheel(HexLoopCtx* loop)
+{
+    // Need to read the fd so it doesn't keep showing as "ready"
+    // EAGAIN: it was re-armed after becoming ready
+    uint64_t n;
+    loop->stats.syscalls++;
+    if (read(loop->wheelFd, &n, sizeof(n)) == -1 && errno != EAGAIN)
+        return -1;
+
+    return WheelExpired(loop);
+}
+
+void WheelInit(HexLoopCtx* loop)
+{
+    for (int level = 0; level < WHEEL_LEVELS; ++level) {
+        for (int slot = 0; slot < WHEEL_SLOTS; ++slot)
+            ListInit(&loop->wheel[level][slot]);
+        loop->wheelCount[level] = 0;
+    }
+    loop->wheelTick = 0;
+    loop->wheelWake = 0;
+    loop->wheelFd = -1;
+    loop->advancing = false;
+    loop->running = NULL;
+}
+
+// Free every timer and reset the wheel
+void WheelFini(HexLoopCtx* loop)
+{
+    for (int level = 0; level < WHEEL_LEVELS; ++level) {
+        for (int slot = 0; slot < WHEEL_SLOTS; ++slot) {
+            TimerLink* head = &loop->wheel[level][slot];
+            while (!ListEmpty(head)) {
+                HexLoopTimer* t = static_cast<HexLoopTimer*>(head->next);
+                WheelRemove(t);
+                if (!t->legacy)
+                    delete t;
+            }
+        }
+    }
+
+    // Including disarmed ones
+    for (TimersByCb::iterator it = loop->timersByCb.begin(); it != loop->timersByCb.end(); ++it)
+        delete it->second;
+    loop->timersByCb.clear();
+
+    WheelInit(loop);
+}
+
+// Wake the loop up through its eventfd
+void Wake(HexLoopCtx* loop)
+{
+    uint64_t one = 1;
+    write(loop->taskFd, &one, sizeof(one));
+}
+
+// Vyukov's intrusive MPSC queue: producers only exchange head, so posting
+// is wait-free; only the loop's own thread pops
+void TaskPush(HexLoopCtx* loop, Task* task)
+{
+    task->next.store(NULL, std::memory_order_relaxed);
+    Task* prev = loop->taskHead.exchange(task, std::memory_order_acq_rel);
+    prev->next.store(task, std::memory_order_release);
+}
+
+// Wait for a producer that exchanged head but has not linked its task yet
+Task* TaskNext(Task* task)
+{
+    Task* next;
+    while (!(next = task->next.load(std::memory_order_acquire)))
+        sched_yield();
+    return next;
+}
 
-struct CbInfo {
-    bool isTimer;
-    HexLoopCallback cb;
-    void* userData;
-};
+// NULL when the queue is empty
+Task* TaskPop(HexLoopCtx* loop)
+{
+    Task* tail = loop->taskTail;
+    Task* next = tail->next.load(std::memory_order_acquire);
 
-typedef std::unordered_map<uint64_t, CbInfo> Handlers;
-Handlers s_handlers;
+    if (tail == &loop->taskStub) {
+        if (!next) {
+            if (loop->taskHead.load(std::memory_order_acquire) == tail)
+                return NULL;
+            next = TaskNext(tail);
+        }
+        loop->taskTail = next;
+        tail = next;
+        next = tail->next.load(std::memory_order_acquire);
+    }
 
-// Array of file descriptors for poll(2)
-typedef std::vector<pollfd> PollVec;
-PollVec s_fdVec;
+    if (next) {
+        loop->taskTail = next;
+        return tail;
+    }
 
-// Caller's original signal mask
-sigset_t s_origMask;
+    // tail is the last task: put the stub behind it so it can be popped
+    if (loop->taskHead.load(std::memory_order_acquire) == tail)
+        TaskPush(loop, &loop->taskStub);
+    loop->taskTail = TaskNext(tail);
+    return tail;
+}
 
-// Set of signals to monitor (for use with signalfd(2))
-sigset_t s_signals;
+// The task eventfd was signaled (and read)
+int RunTasks(HexLoopCtx* loop)
+{
+    // Posts from here on must signal again
+    loop->taskPending.store(false);
 
-// Signal file descriptor for signalfd(2)
-int s_sigFd = -1;
+    for (int i = 0; i < MAX_TASKS; ++i) {
+        Task* task = TaskPop(loop);
+        if (!task)
+            return 0;
+        task->fn(task->arg);
+        delete task;
+    }
+
+    // Come back for the rest after the other ready callbacks
+    if (!loop->taskPending.exchange(true))
+        Wake(loop);
+    return 0;
+}
 
-// Array of timer file descriptors for timerfd_create(2).  Must close these in fini.
-typedef std::vector<int> TimerFds;
-TimerFds s_timers;
+int DispatchTasks(HexLoopCtx* loop)
+{
+    uint64_t n;
+    loop->stats.syscalls++;
+    if (read(loop->taskFd, &n, sizeof(n)) == -1 && errno != EAGAIN)
+        return -1;
+
+    return RunTasks(loop);
+}
 
-bool s_quit = false;
+// Call the callback of a signal
+int RunSignal(const signalfd_siginfo& sinfo)
+{
+    int signum = sinfo.ssi_signo;
+    if (signum <= 0 || signum >= _NSIG || !s_sigHandlers[signum].cb)
+        return -1;
 
+    // value: for signals sent by sigqueue(3)
+    SignalInfo& info = s_sigHandlers[signum];
+    return info.cb(signum, info.userData, sinfo.ssi_int);
+}
 
-// Helper functions
+// Call the callbacks of all pending signals
+int DispatchSignals(HexLoopCtx* loop)
+{
+    while (1) {
+        struct signalfd_siginfo sinfo;
+        loop->stats.syscalls++;
+        ssize_t s = read(s_sigFd, &sinfo, sizeof(sinfo));
+        if (s == -1 && errno == EAGAIN) {
+            // Already handled all the signals
+            return 0;
+        }
+        else if (s != sizeof(sinfo)) {
+            // Error
+            return -1;
+        }
+
+        if (RunSignal(sinfo) == -1)
+            return -1;
+    }
+}
+
+// Receive what is available and pass it to the callback, without waiting
+// for EAGAIN after a short read
+int DispatchRecv(HexLoopCtx* loop, CbInfo* info)
+{
+    if (loop->recvBuf.empty())
+        loop->recvBuf.resize(RECV_BUF_SIZE);
+
+    while (1) {
+        loop->stats.syscalls++;
+        ssize_t n = recv(info->fd, &loop->recvBuf[0], RECV_BUF_SIZE, MSG_DONTWAIT);
+        if (n == -1 && (errno == EAGAIN || errno == EINTR))
+            return 0;
+
+        if (n <= 0) {
+            // End of file or error: reported once, then the fd is no longer monitored
+            info->done = true;
+            loop->stats.syscalls++;
+            epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, info->fd, NULL);
+            return info->recvCb(info->fd, info->userData, NULL, n == 0 ? 0 : -errno);
+        }
+
+        if (info->recvCb(info->fd, info->userData, &loop->recvBuf[0], n) == -1)
+            return -1;
+        if (info->removed || (size_t)n < RECV_BUF_SIZE)
+            return 0;
+    }
+}
+
+int Dispatch(HexLoopCtx* loop, CbInfo* info)
+{
+    switch (info->kind) {
+        case CB_SIGNAL:
+            return DispatchSignals(loop);
+
+        case CB_WHEEL:
+            return DispatchWheel(loop);
+
+        case CB_TASKS:
+            return DispatchTasks(loop);
+
+        case CB_RECV:
+            return DispatchRecv(loop, info);
+
+        case CB_FD:
+            break;
+    }
+
+    return info->cb(info->fd, info->userData, 0);
+}
+
+// Completion of a multishot receive
+int UringRecv(HexLoopCtx* loop, CbInfo* info, const io_uring_cqe& cqe)
+{
+    int r = 0;
+    const char* data = NULL;
+    unsigned bid = 0;
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        data = loop->uring->bufs + bid * RECV_BUF_SIZE;
+    }
+
+    if (cqe.res == -ENOBUFS) {
+        // Ran out of provided buffers; the ones handed back while reaping this
+        // batch are queued ahead of the re-armed receive
+    }
+    else if (!info->removed) {
+        if (cqe.res <= 0)
+            info->done = true;
+        r = info->recvCb(info->fd, info->userData, cqe.res > 0 ? data : NULL, cqe.res);
+    }
+
+    if (data && UringProvide(loop, bid, 1) != 0)
+        return -1;
+    return r;
+}
+
+// Handle one completion; the operation is re-armed unless it is multishot
+// and still armed
+int UringDispatch(HexLoopCtx* loop, const io_uring_cqe& cqe)
+{
+    CbInfo* info = (CbInfo*)(uintptr_t)cqe.user_data;
+
+    // Cancellations and provided buffers, when they report at all (failures,
+    // or kernels without IOSQE_CQE_SKIP_SUCCESS)
+    if (!info)
+        return 0;
+
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+        info->inflight = false;
+
+    int r = 0;
+    if (info->kind == CB_RECV) {
+        r = UringRecv(loop, info, cqe);
+    }
+    else if (info->removed) {
+        // Pending completion of a removed registration
+    }
+    else if (cqe.res < 0 && info->kind != CB_FD) {
+        // The loop's own fds can't fail to read
+        r = -1;
+    }
+    else {
+        switch (info->kind) {
+            case CB_SIGNAL: {
+                const signalfd_siginfo* sinfo = (const signalfd_siginfo*)info->buf;
+                for (size_t i = 0; r == 0 && i < cqe.res / sizeof(signalfd_siginfo); ++i)
+                    r = RunSignal(sinfo[i]);
+                break;
+            }
+
+            case CB_WHEEL:
+                r = WheelExpired(loop);
+                break;
+
+            case CB_TASKS:
+                r = RunTasks(loop);
+                break;
+
+            case CB_FD:
+                r = info->cb(info->fd, info->userData, 0);
+                break;
+
+            case CB_RECV:
+                break;
+        }
+    }
+
+    if (info->removed) {
+        // Last completion: the registration can go now
+        if (!info->inflight) {
+            CbInfoVec& cancelling = loop->cancelling;
+            CbInfoVec::iterator it = std::find(cancelling.begin(), cancelling.end(), info);
+            if (it != cancelling.end()) {
+                cancelling.erase(it);
+                loop->removed.push_back(info);
+            }
+        }
+    }
+    else if (!info->inflight && !info->done && UringArm(loop, info) == -1) {
+        r = -1;
+    }
+
+    return r;
+}
+
+int LoopInit(HexLoopCtx* loop, int flags)
+{
+    loop->quit = false;
+    WheelInit(loop);
+
+    loop->taskStub.next.store(NULL);
+    loop->taskHead.store(&loop->taskStub);
+    loop->taskTail = &loop->taskStub;
+    loop->taskPending.store(false);
+    memset(&loop->stats, 0, sizeof(loop->stats));
+
+    // Falls back to epoll when io_uring is not available
+    if (flags & HEX_LOOP_URING) {
+        loop->uring = UringInit();
+        if (loop->uring && UringProvide(loop, 0, URING_RECV_BUFS) != 0) {
+            UringFini(loop->uring);
+            loop->uring = NULL;
+        }
+    }
+
+    if (!loop->uring) {
+        loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epollFd == -1)
+            return -1;
+    }
+
+    loop->taskFd = eventfd(0, EFD_CLOEXEC | (loop->uring ? 0 : EFD_NONBLOCK));
+    if (loop->taskFd == -1 || !AddCb(loop, CB_TASKS, loop->taskFd, 0, 0)) {
+        if (loop->taskFd != -1)
+            close(loop->taskFd);
+        loop->taskFd = -1;
+        if (loop->uring)
+            UringFini(loop->uring);
+        loop->uring = NULL;
+        close(loop->epollFd);
+        loop->epollFd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+int UringRun(HexLoopCtx* loop)
+{
+    int r = 0;
+    Uring* u = loop->uring;
+
+    while (!loop->quit && r >= 0) {
+        // Submit the operations (re-)armed since the last wait and wait
+        if (UringEnter(loop) < 0) {
+            // EBUSY: completions must be reaped first
+            if (errno == EINTR || errno == EBUSY || errno == EAGAIN)
+                continue;
+            r = -1;
+            break;
+        }
+
+        // Completions arriving while these are handled are picked up as well
+        unsigned head = *u->cqHead;
+        while (head != __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE)) {
+            io_uring_cqe cqe = u->cqes[head & u->cqMask];
+            __atomic_store_n(u->cqHead, ++head, __ATOMIC_RELEASE);
+
+            if (UringDispatch(loop, cqe) == -1) {
+                r = -1;
+                break;
+            }
+        }
+
+        FreeRemoved(loop);
+
+        if (loop->quit) {
+            r = 0;
+            break;
+        }
+    }
+
+    return r;
+}
+
+int LoopRun(HexLoopCtx* loop)
+{
+    if (loop->uring)
+        return UringRun(loop);
+
+    int r = 0;
+    epoll_event events[MAX_EVENTS];
 
-// Register callback in handler map
-// For normal or timer file descriptor, key is just the fd.
-// For signals, the key is the signum in the high 32 bits and fd in the low.
-void AddCb(uint64_t key, HexLoopCallback cb, void* userData, bool isTimer = false)
+    while (!loop->quit && r >= 0) {
+        // wait infinitely
+        loop->stats.waits++;
+        loop->stats.syscalls++;
+        int n = epoll_wait(loop->epollFd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            r = -1;
+            break;
+        }
+
+        // Only the ready registrations are visited
+        for (int i = 0; i < n; ++i) {
+            CbInfo* info = (CbInfo*)events[i].data.ptr;
+
+            // Removed by an earlier callback of this batch
+            if (info->removed)
+                continue;
+
+            // Finally, call the user's callback.
+            if (Dispatch(loop, info) == -1) {
+                r = -1;
+                break;
+            }
+        }
+
+        FreeRemoved(loop);
+
+        if (loop->quit) {
+            r = 0;
+            break;
+        }
+    }
+
+    return r;
+}
+
+void LoopFini(HexLoopCtx* loop)
 {
-    CbInfo info;
-    info.isTimer = isTimer;
-    info.cb = cb;
-    info.userData = userData;
+    // Nothing refers to the registrations any more
+    if (loop->uring)
+        UringFini(loop->uring);
+    loop->uring = NULL;
+    loop->removed.insert(loop->removed.end(), loop->cancelling.begin(), loop->cancelling.end());
+    loop->cancelling.clear();
+
+    for (Handlers::iterator it = loop->handlers.begin(); it != loop->handlers.end(); ++it) {
+        // The timer wheel's and task file descriptors are owned by the loop
+        if (it->second->kind == CB_WHEEL || it->second->kind == CB_TASKS)
+            close(it->first);
+        FreeCb(it->second);
+    }
+    loop->handlers.clear();
+    FreeRemoved(loop);
+    WheelFini(loop);
+
+    // Tasks that never ran
+    if (loop->taskTail) {
+        Task* task;
+        while ((task = TaskPop(loop)))
+            delete task;
+    }
+    loop->taskFd = -1;
 
-    s_handlers[key] = info;
+    if (loop->epollFd != -1)
+        close(loop->epollFd);
+    loop->epollFd = -1;
 }
 
-// Add file descriptor to list of monitored fds
-void AddFd(int fd)
+void* LoopThread(void* arg)
 {
-    pollfd pfd;
-    pfd.fd = fd;
-    pfd.events = POLLIN | POLLERR;
-    pfd.revents = 0;
-    s_fdVec.push_back(pfd);
+    HexLoopCtx* loop = (HexLoopCtx*)arg;
+    t_current = loop;
+    loop->result = LoopRun(loop);
+    t_current = NULL;
+    return NULL;
 }
 
 } // end anonymous namespace (like static declaration, local scope)
@@ -75,12 +1335,16 @@ void AddFd(int fd)
 
 void HexLoopQuit()
 {
-    s_quit = true;
+    Current()->quit = true;
 }
 
 int HexLoopInit(int flags)
 {
     sigemptyset(&s_signals);
+    memset(s_sigHandlers, 0, sizeof(s_sigHandlers));
+
+    if (LoopInit(&s_default, flags) == -1)
+        return -1;
 
     // Save the original signal mask
     sigprocmask(SIG_BLOCK, 0, &s_origMask);
@@ -90,18 +1354,53 @@ int HexLoopInit(int flags)
 
 int HexLoopFdAdd(int fd, HexLoopCallback cb, void* userData)
 {
-    int r = 0;
+    return HexLoopFdAddFlags(fd, 0, cb, userData);
+}
 
-    AddCb(fd, cb, userData);
-    AddFd(fd);
+int HexLoopFdAddFlags(int fd, int flags, HexLoopCallback cb, void* userData)
+{
+    uint32_t events = EPOLLIN;
+    if (flags & HEX_LOOP_EDGE)
+        events |= EPOLLET;
 
-    return r;
+    return AddCb(Current(), CB_FD, fd, cb, userData, events) ? 0 : -1;
+}
+
+int HexLoopFdRemove(int fd)
+{
+    return RemoveCb(Current(), fd, CB_FD);
+}
+
+int HexLoopRecvAdd(int fd, HexLoopRecvCallback cb, void* userData)
+{
+    if (!cb)
+        return -1;
+
+    // Nothing is dispatched before the callback is set: operations are
+    // submitted and events waited for by the loop
+    CbInfo* info = AddCb(Current(), CB_RECV, fd, 0, userData);
+    if (!info)
+        return -1;
+    info->recvCb = cb;
+    return 0;
+}
+
+int HexLoopRecvRemove(int fd)
+{
+    return RemoveCb(Current(), fd, CB_RECV);
 }
 
 int HexLoopSignalAdd(int signum, HexLoopCallback cb, void* userData)
 {
     int r = 0;
 
+    if (signum <= 0 || signum >= _NSIG)
+        return -1;
+
+    // Signals belong to the default loop; other loops' threads block them all
+    if (Current() != &s_default)
+        return -1;
+
     // Block signal; will check for delivery later inside HexLoop()
     sigset_t s;
     sigemptyset(&s);
@@ -113,19 +1412,21 @@ int HexLoopSignalAdd(int signum, HexLoopCallback cb, void* userData)
     // create a file descriptor for accepting signals
     // fd is automatically (and atomically) closed when any of the exec-family functions succeed
     // useful to avoid fd leakage occupied by children processes
-    int sigFd = signalfd(s_sigFd, &s_signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    // io_uring reads block until a signal arrives instead of returning EAGAIN
+    int sigFd = signalfd(s_sigFd, &s_signals, SFD_CLOEXEC | (s_default.uring ? 0 : SFD_NONBLOCK));
     if (sigFd == -1) {
         r = -1;
     }
     else {
         // create (s_sigFd == -1) and update (sigFd == s_sigFd)
         assert(s_sigFd == -1 || (sigFd == s_sigFd));
+        if (s_sigFd == -1 && !AddCb(&s_default, CB_SIGNAL, sigFd, 0, 0)) {
+            close(sigFd);
+            return -1;
+        }
         s_sigFd = sigFd;
-        uint64_t key = signum;
-        key <<= 32;
-        key |= s_sigFd;
-        // key: [signum|sigfd]
-        AddCb(key, cb, userData);
+        s_sigHandlers[signum].cb = cb;
+        s_sigHandlers[signum].userData = userData;
     }
 
     return r;
@@ -133,145 +1434,182 @@ int HexLoopSignalAdd(int signum, HexLoopCallback cb, void* userData)
 
 int HexLoopTimerAdd(int interval, HexLoopCallback cb, void* userData)
 {
-    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
-    if (fd == -1)
-        return -1;
+    // A non-positive interval leaves the timer disarmed, as with timerfd_settime(2)
+    uint64_t ms = interval > 0 ? (uint64_t)interval * 1000 : 0;
+    return TimerAdd(Current(), ms, ms, true, cb, userData) ? 0 : -1;
+}
 
-    itimerspec spec;
-    memset(&spec, 0, sizeof(spec));
-    spec.it_interval.tv_sec = interval;
-    spec.it_value.tv_sec = interval;
+int HexLoopTimerChangeInterval(int interval, HexLoopCallback cb)
+{
+    HexLoopTimer* t = FindTimer(Current(), cb);
+    if (!t)
+        return 0;
+
+    t->period = interval > 0 ? (uint64_t)interval * 1000 : 0;
+    if (t->period)
+        TimerArm(t, t->period);
+    else
+        WheelRemove(t);
+    return 0;
+}
 
-    if (timerfd_settime(fd, 0, &spec, 0) == -1)
+int HexLoopTimerRemove(HexLoopCallback cb)
+{
+    HexLoopTimer* t = FindTimer(Current(), cb);
+    if (!t)
         return -1;
 
-    AddCb(fd, cb, userData, true);
-    AddFd(fd);
+    return HexLoopTimerCancel(t);
+}
+
+HexLoopTimer_t HexLoopTimerAddMs(int ms, int flags, HexLoopCallback cb, void* userData)
+{
+    if (ms <= 0 || !cb)
+        return NULL;
+
+    return TimerAdd(Current(), ms, (flags & HEX_LOOP_PERIODIC) ? ms : 0, false, cb, userData);
+}
+
+int HexLoopTimerRearm(HexLoopTimer_t timer, int ms)
+{
+    if (!timer || ms <= 0 || timer->cancelled)
+        return -1;
 
+    if (timer->period)
+        timer->period = ms;
+    TimerArm(timer, ms);
     return 0;
 }
 
-int HexLoopTimerChangeInterval(int interval, HexLoopCallback cb)
+int HexLoopTimerCancel(HexLoopTimer_t timer)
 {
-    Handlers::const_iterator it;
-    for (it = s_handlers.begin(); it != s_handlers.end(); ++it) {
-        if (it->second.cb == cb) {
-            int fd = it->first;
-            itimerspec spec;
-            memset(&spec, 0, sizeof(spec));
-            spec.it_interval.tv_sec = interval;
-            spec.it_value.tv_sec = interval;
-
-            if (timerfd_settime(fd, 0, &spec, 0) == -1)
-                return -1;
-            break;
-        }
+    if (!timer || timer->cancelled)
+        return -1;
+
+    if (timer == timer->loop->running) {
+        // Freed once its callback returns
+        timer->cancelled = true;
+        WheelRemove(timer);
+        return 0;
     }
+
+    TimerFree(timer);
     return 0;
 }
 
-
 int HexLoop()
 {
-    int r = 0;
+    return LoopRun(&s_default);
+}
 
-    AddFd(s_sigFd);
+int HexLoopFini()
+{
+    LoopFini(&s_default);
 
-    while (!s_quit && r >= 0) {
-        // wait infinitely
-        r = poll(&s_fdVec[0], s_fdVec.size(), -1);
-        if (r < 0 && errno == EINTR) {
-            r = 0;
-            continue;
-        }
+    sigemptyset(&s_signals);
+    memset(s_sigHandlers, 0, sizeof(s_sigHandlers));
+    close(s_sigFd);
+    s_sigFd = -1;
 
-        // Figure out which fds have events
-        for (size_t i = 0; i < s_fdVec.size(); ++i) {
-            if (s_fdVec[i].revents) {
-                r--;
-
-                uint64_t key = s_fdVec[i].fd;
-                int value = 0; // only used for signals right now
-                int arg = key;
-                if (s_fdVec[i].fd == s_sigFd) {
-                    // Need to OR in the signal number
-                    struct signalfd_siginfo sinfo;
-                    ssize_t s = read(s_sigFd, &sinfo, sizeof(sinfo));
-                    if (s == sizeof(sinfo)) {
-                        // We got a signal
-                        arg = sinfo.ssi_signo;  // Signal number
-                        key = arg;
-                        key <<= 32;
-                        key |= s_sigFd;
-                        value = sinfo.ssi_int; // For signals sent by sigqueue(3)
-
-                        // The signal fd might still be readable, so make sure we hit it again in the next loop
-                        r++;
-                        i--; // This will wraparound if sigFd is 0, but the i++ at the end of the loop should put it back to 0
-                    }
-                    else if (s == -1 && errno == EAGAIN) {
-                        // Already handled all the signals; go to next entry in fdVec
-                        continue;
-                    }
-                    else {
-                        // Error
-                        r = -1;
-                        break;
-                    }
-                }
-
-                // Now look up the actual callback
-                Handlers::iterator it = s_handlers.find(key);
-                if (it != s_handlers.end()) {
-                    CbInfo& info = it->second;
-                    if (info.isTimer) {
-                        // Need to read the fd so it doesn't keep showing as "ready"
-                        uint64_t n;
-                        ssize_t s = read(s_fdVec[i].fd, &n, sizeof(n));
-                        if (s == -1) {
-                            r = -1;
-                            break;
-                        }
-                    }
-
-                    // Finally, call the user's callback.
-                    if (info.cb(arg, info.userData, value) == -1) {
-                        r = -1;
-                        break;
-                    }
-                }
-                else {
-                    r = -1;
-                    break;
-                }
-            } // end if revents
-        } // end for
-
-        if (s_quit) {
-            r = 0;
-            break;
-        }
+    // Restore the original signal mask
+    sigprocmask(SIG_SETMASK, &s_origMask, 0);
+
+    return 0;
+}
+
+HexLoop_t HexLoopDefault()
+{
+    return &s_default;
+}
+
+HexLoop_t HexLoopCurrent()
+{
+    return Current();
+}
+
+HexLoop_t HexLoopSpawn(int cpu, int flags)
+{
+    HexLoopCtx* loop = new HexLoopCtx;
+    if (LoopInit(loop, flags) == -1) {
+        delete loop;
+        return NULL;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+
+    // The thread inherits a mask blocking every signal so that they are
+    // left to the default loop
+    sigset_t all, orig;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &orig);
+    int r = pthread_create(&loop->thread, &attr, LoopThread, loop);
+    pthread_sigmask(SIG_SETMASK, &orig, 0);
+    pthread_attr_destroy(&attr);
+
+    if (r != 0) {
+        LoopFini(loop);
+        delete loop;
+        return NULL;
     }
 
+    return loop;
+}
+
+int HexLoopJoin(HexLoop_t loop)
+{
+    if (!loop || loop == &s_default || loop == t_current)
+        return -1;
+
+    HexLoopStop(loop);
+    if (pthread_join(loop->thread, NULL) != 0)
+        return -1;
+
+    int r = loop->result;
+    LoopFini(loop);
+    delete loop;
     return r;
 }
 
-int HexLoopFini()
+void HexLoopStop(HexLoop_t loop)
 {
-    s_handlers.clear();
-    s_fdVec.clear();
+    loop->quit = true;
+    Wake(loop);
+}
 
-    sigemptyset(&s_signals);
-    close(s_sigFd);
-    s_sigFd = -1;
+int HexLoopPost(HexLoop_t loop, HexLoopTask fn, void* arg)
+{
+    if (!loop || !fn || loop->taskFd == -1)
+        return -1;
 
-    for (TimerFds::iterator it = s_timers.begin(); it != s_timers.end(); ++it) {
-        close(*it);
-    }
-    s_timers.clear();
+    Task* task = new (std::nothrow) Task;
+    if (!task)
+        return -1;
+    task->fn = fn;
+    task->arg = arg;
 
-    // Restore the original signal mask
-    sigprocmask(SIG_SETMASK, &s_origMask, 0);
+    TaskPush(loop, task);
+    if (!loop->taskPending.exchange(true))
+        Wake(loop);
+    return 0;
+}
+
+int HexLoopBackend(HexLoop_t loop)
+{
+    return loop->uring ? HEX_LOOP_URING : 0;
+}
+
+int HexLoopGetStats(HexLoop_t loop, HexLoopStats* stats)
+{
+    if (!loop || !stats)
+        return -1;
 
+    *stats = loop->stats;
     return 0;
 }
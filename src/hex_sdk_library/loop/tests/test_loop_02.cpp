@@ -0,0 +1,115 @@
+// HEX SDK
+
+// Test removing file descriptors and timers, and edge-triggered file descriptors
+
+#include "hex/loop.h"
+#include "hex/test.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+static int efd[3];
+static int efdCbCalled[3] = { 0, 0, 0 };
+
+static void
+Signal(int fd)
+{
+    uint64_t one = 1;
+    HEX_TEST_FATAL(write(fd, &one, sizeof(one)) == sizeof(one));
+}
+
+// Whichever of efd[0]/efd[1] comes first removes the other one even though
+// both are ready in the same iteration
+int pairCb(int fd, void* userData, int value)
+{
+    int i = (fd == efd[0]) ? 0 : 1;
+    HEX_TEST(userData == &efd[i]);
+    efdCbCalled[i]++;
+    HEX_TEST(HexLoopFdRemove(efd[1 - i]) == 0);
+    HEX_TEST(HexLoopFdRemove(efd[1 - i]) == -1);
+
+    // Level-triggered: stop it from firing again
+    HEX_TEST(HexLoopFdRemove(fd) == 0);
+    return 0;
+}
+
+// Edge-triggered: not drained, but only called again when signaled again
+int edgeCb(int fd, void* userData, int value)
+{
+    HEX_TEST(fd == efd[2]);
+    if (++efdCbCalled[2] < 3)
+        Signal(efd[2]);
+    return 0;
+}
+
+static int selfTimerCalled = 0;
+static int removedTimerCalled = 0;
+static int quitTimerCalled = 0;
+
+int removedTimerCb(int, void* userData, int value)
+{
+    removedTimerCalled++;
+    return 0;
+}
+
+// Removes itself the first time it fires
+int selfTimerCb(int, void* userData, int value)
+{
+    selfTimerCalled++;
+    HEX_TEST(HexLoopTimerRemove(selfTimerCb) == 0);
+    return 0;
+}
+
+int quitTimerCb(int, void* userData, int value)
+{
+    quitTimerCalled++;
+    HexLoopQuit();
+    return 0;
+}
+
+int main()
+{
+    alarm(10);
+
+    HEX_TEST_FATAL(HexLoopInit(0) == 0);
+
+    int i;
+    for (i = 0; i < 3; ++i)
+        HEX_TEST_FATAL((efd[i] = eventfd(0, EFD_NONBLOCK)) != -1);
+
+    HEX_TEST(HexLoopFdRemove(efd[0]) == -1);
+    HEX_TEST_FATAL(HexLoopFdAdd(efd[0], pairCb, &efd[0]) == 0);
+    HEX_TEST(HexLoopFdAdd(efd[0], pairCb, &efd[0]) == -1);
+    HEX_TEST_FATAL(HexLoopFdAddFlags(efd[1], 0, pairCb, &efd[1]) == 0);
+    HEX_TEST_FATAL(HexLoopFdAddFlags(efd[2], HEX_LOOP_EDGE, edgeCb, 0) == 0);
+    Signal(efd[0]);
+    Signal(efd[1]);
+    Signal(efd[2]);
+
+    HEX_TEST(HexLoopTimerRemove(removedTimerCb) == -1);
+    HEX_TEST_FATAL(HexLoopTimerAdd(1, removedTimerCb, 0) == 0);
+    HEX_TEST(HexLoopTimerRemove(removedTimerCb) == 0);
+    HEX_TEST_FATAL(HexLoopTimerAdd(1, selfTimerCb, 0) == 0);
+    HEX_TEST_FATAL(HexLoopTimerAdd(3, quitTimerCb, 0) == 0);
+
+    HEX_TEST(HexLoop() == 0);
+
+    HEX_TEST(HexLoopFini() == 0);
+
+    HEX_TEST(efdCbCalled[0] + efdCbCalled[1] == 1);
+    HEX_TEST(efdCbCalled[2] == 3);
+    HEX_TEST(removedTimerCalled == 0);
+    HEX_TEST(selfTimerCalled == 1);
+    HEX_TEST(quitTimerCalled == 1);
+
+    // The loop can be set up again
+    HEX_TEST_FATAL(HexLoopInit(0) == 0);
+    HEX_TEST_FATAL(HexLoopFdAdd(efd[0], pairCb, &efd[0]) == 0);
+    HEX_TEST(HexLoopFini() == 0);
+
+    for (i = 0; i < 3; ++i)
+        close(efd[i]);
+
+    return HexTestResult;
+}
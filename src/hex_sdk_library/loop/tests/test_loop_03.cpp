@@ -0,0 +1,173 @@
+// HEX SDK
+
+// Test millisecond timers: one-shot, periodic, re-arm, cancel and many timers
+
+#include "hex/loop.h"
+#include "hex/test.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NUM_TIMERS 5000
+#define MAX_DELAY 1000  // ms
+#define FUZZ 50         // ms
+
+static uint64_t
+NowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t s_start = 0;
+
+// Fires within FUZZ of its expiry, never early
+static void
+CheckDue(uint64_t due)
+{
+    uint64_t now = NowMs();
+    HEX_TEST(now >= due);
+    HEX_TEST(now <= due + FUZZ);
+}
+
+static int oneShotCalled = 0;
+
+int oneShotCb(int arg, void* userData, int value)
+{
+    CheckDue(s_start + 10);
+    HEX_TEST(arg == 0);
+    HEX_TEST(userData == &oneShotCalled);
+    oneShotCalled++;
+    return 0;
+}
+
+static int periodicCalled = 0;
+static HexLoopTimer_t periodic = NULL;
+
+// Cancels itself after 5 periods
+int periodicCb(int, void* userData, int value)
+{
+    periodicCalled++;
+    CheckDue(s_start + 20 * periodicCalled);
+    if (periodicCalled == 5)
+        HEX_TEST(HexLoopTimerCancel(periodic) == 0);
+    return 0;
+}
+
+static int rearmCalled = 0;
+
+// One-shot that re-arms itself twice with increasing delays
+int rearmCb(int, void* userData, int value)
+{
+    HexLoopTimer_t self = *(HexLoopTimer_t*)userData;
+    rearmCalled++;
+    if (rearmCalled < 3)
+        HEX_TEST(HexLoopTimerRearm(self, 100 * rearmCalled) == 0);
+    return 0;
+}
+
+static int cancelledCalled = 0;
+
+int cancelledCb(int, void* userData, int value)
+{
+    cancelledCalled++;
+    return 0;
+}
+
+// Two timers expiring in the same tick: whichever runs first cancels the other
+static HexLoopTimer_t pair[2];
+static int pairCalled = 0;
+
+int pairCb(int, void* userData, int value)
+{
+    int i = (int)(intptr_t)userData;
+    pairCalled++;
+    HEX_TEST(HexLoopTimerCancel(pair[1 - i]) == 0);
+    return 0;
+}
+
+static uint64_t due[NUM_TIMERS];
+static int manyCalled = 0;
+
+int manyCb(int, void* userData, int value)
+{
+    uint64_t* d = (uint64_t*)userData;
+    CheckDue(*d);
+    *d = 0;
+    manyCalled++;
+    return 0;
+}
+
+static int longCalled = 0;
+
+// Long enough to be cascaded down from the second level of the wheel
+int longCb(int, void* userData, int value)
+{
+    CheckDue(s_start + 1500);
+    longCalled++;
+    HexLoopQuit();
+    return 0;
+}
+
+int main()
+{
+    alarm(10);
+
+    HEX_TEST_FATAL(HexLoopInit(0) == 0);
+
+    HEX_TEST(HexLoopTimerAddMs(0, 0, oneShotCb, 0) == NULL);
+    HEX_TEST(HexLoopTimerAddMs(10, 0, NULL, 0) == NULL);
+    HEX_TEST(HexLoopTimerCancel(NULL) == -1);
+    HEX_TEST(HexLoopTimerRearm(NULL, 10) == -1);
+
+    s_start = NowMs();
+    HEX_TEST_FATAL(HexLoopTimerAddMs(10, 0, oneShotCb, &oneShotCalled) != NULL);
+    HEX_TEST_FATAL((periodic = HexLoopTimerAddMs(20, HEX_LOOP_PERIODIC, periodicCb, 0)) != NULL);
+
+    static HexLoopTimer_t rearm;
+    HEX_TEST_FATAL((rearm = HexLoopTimerAddMs(30, 0, rearmCb, &rearm)) != NULL);
+
+    HexLoopTimer_t cancelled;
+    HEX_TEST_FATAL((cancelled = HexLoopTimerAddMs(5, 0, cancelledCb, 0)) != NULL);
+    HEX_TEST(HexLoopTimerRearm(cancelled, 50) == 0);
+    HEX_TEST(HexLoopTimerCancel(cancelled) == 0);
+
+    for (int i = 0; i < 2; ++i)
+        HEX_TEST_FATAL((pair[i] = HexLoopTimerAddMs(40, 0, pairCb, (void*)(intptr_t)i)) != NULL);
+
+    srand(time(0));
+    for (int i = 0; i < NUM_TIMERS; ++i) {
+        int ms = 1 + rand() % MAX_DELAY;
+        due[i] = NowMs() + ms;
+        HEX_TEST_FATAL(HexLoopTimerAddMs(ms, 0, manyCb, &due[i]) != NULL);
+    }
+
+    // A second batch spread over the same slots is cancelled before firing
+    static HexLoopTimer_t batch[NUM_TIMERS];
+    for (int i = 0; i < NUM_TIMERS; ++i)
+        HEX_TEST_FATAL((batch[i] = HexLoopTimerAddMs(1 + rand() % MAX_DELAY, 0, cancelledCb, 0)) != NULL);
+    for (int i = 0; i < NUM_TIMERS; ++i)
+        HEX_TEST(HexLoopTimerCancel(batch[i]) == 0);
+
+    HEX_TEST_FATAL(HexLoopTimerAddMs(1500, 0, longCb, 0) != NULL);
+
+    HEX_TEST(HexLoop() == 0);
+
+    HEX_TEST(oneShotCalled == 1);
+    HEX_TEST(periodicCalled == 5);
+    HEX_TEST(rearmCalled == 3);
+    HEX_TEST(cancelledCalled == 0);
+    HEX_TEST(pairCalled == 1);
+    HEX_TEST(manyCalled == NUM_TIMERS);
+    for (int i = 0; i < NUM_TIMERS; ++i)
+        HEX_TEST(due[i] == 0);
+    HEX_TEST(longCalled == 1);
+
+    // Timers still armed are freed
+    HEX_TEST_FATAL(HexLoopTimerAddMs(1000, HEX_LOOP_PERIODIC, cancelledCb, 0) != NULL);
+    HEX_TEST(HexLoopFini() == 0);
+
+    return HexTestResult;
+}
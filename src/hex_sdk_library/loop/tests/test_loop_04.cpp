@@ -0,0 +1,182 @@
+// HEX SDK
+
+// Test loops in their own threads and posting tasks across loops
+
+#include "hex/loop.h"
+#include "hex/test.h"
+
+#include <atomic>
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+#define NUM_LOOPS 4
+#define NUM_PRODUCERS 4
+#define NUM_POSTS 100000  // per producer and loop
+
+struct LoopState {
+    HexLoop_t loop;
+    int efd;
+    int fdCbCalled;
+    int timerCalled;
+    long tasks;
+    long last[NUM_PRODUCERS];
+};
+
+static LoopState s_loops[NUM_LOOPS];
+
+// Only touched by the default loop's thread
+static int s_done = 0;
+static pthread_t s_threads[NUM_PRODUCERS];
+
+static std::atomic<int> s_producing(NUM_PRODUCERS);
+
+void* producer(void* arg);
+
+static LoopState*
+Self()
+{
+    for (int i = 0; i < NUM_LOOPS; ++i) {
+        if (s_loops[i].loop == HexLoopCurrent())
+            return &s_loops[i];
+    }
+    HEX_TEST_FATAL(false);
+    return NULL;
+}
+
+// Runs in the default loop: once every loop is set up the producers are
+// started, once every loop drained their tasks the test is done
+void doneTask(void* arg)
+{
+    HEX_TEST(HexLoopCurrent() == HexLoopDefault());
+    ++s_done;
+    if (s_done == NUM_LOOPS) {
+        for (int p = 0; p < NUM_PRODUCERS; ++p)
+            HEX_TEST_FATAL(pthread_create(&s_threads[p], NULL, producer, (void*)(intptr_t)p) == 0);
+    }
+    else if (s_done == 2 * NUM_LOOPS) {
+        HexLoopQuit();
+    }
+}
+
+int fdCb(int fd, void* userData, int value)
+{
+    LoopState* state = (LoopState*)userData;
+    HEX_TEST(state == Self());
+    uint64_t n;
+    HEX_TEST(read(fd, &n, sizeof(n)) == sizeof(n));
+    state->fdCbCalled++;
+    HEX_TEST(HexLoopFdRemove(fd) == 0);
+    return 0;
+}
+
+int timerCb(int, void* userData, int value)
+{
+    LoopState* state = (LoopState*)userData;
+    HEX_TEST(state == Self());
+    state->timerCalled++;
+    HEX_TEST(HexLoopPost(HexLoopDefault(), doneTask, NULL) == 0);
+    return 0;
+}
+
+int usr1Cb(int signum, void* userData, int value)
+{
+    HEX_TEST(false);
+    return 0;
+}
+
+// Registers callbacks on the loop it runs in
+void setupTask(void* arg)
+{
+    LoopState* state = (LoopState*)arg;
+    HEX_TEST(HexLoopCurrent() == state->loop);
+    HEX_TEST(HexLoopCurrent() != HexLoopDefault());
+
+    // Signals stay with the default loop
+    HEX_TEST(HexLoopSignalAdd(SIGUSR1, usr1Cb, NULL) == -1);
+
+    HEX_TEST(HexLoopFdAdd(state->efd, fdCb, state) == 0);
+    uint64_t one = 1;
+    HEX_TEST(write(state->efd, &one, sizeof(one)) == sizeof(one));
+
+    HEX_TEST(HexLoopTimerAddMs(10, 0, timerCb, state) != NULL);
+}
+
+// Tasks from each producer run in the order they were posted
+void countTask(void* arg)
+{
+    uintptr_t value = (uintptr_t)arg;
+    int producer = value % NUM_PRODUCERS;
+    long seq = value / NUM_PRODUCERS;
+
+    LoopState* state = Self();
+    HEX_TEST(seq == state->last[producer] + 1);
+    state->last[producer] = seq;
+    state->tasks++;
+}
+
+void drainedTask(void* arg)
+{
+    HEX_TEST(HexLoopPost(HexLoopDefault(), doneTask, NULL) == 0);
+}
+
+void* producer(void* arg)
+{
+    int id = (int)(intptr_t)arg;
+    for (long seq = 0; seq < NUM_POSTS; ++seq) {
+        for (int i = 0; i < NUM_LOOPS; ++i) {
+            uintptr_t value = seq * NUM_PRODUCERS + id;
+            HEX_TEST(HexLoopPost(s_loops[i].loop, countTask, (void*)value) == 0);
+        }
+    }
+
+    // The last producer's post comes after all the others' tasks, so it runs last
+    if (--s_producing == 0) {
+        for (int i = 0; i < NUM_LOOPS; ++i)
+            HEX_TEST(HexLoopPost(s_loops[i].loop, drainedTask, NULL) == 0);
+    }
+    return NULL;
+}
+
+int main()
+{
+    alarm(30);
+
+    HEX_TEST_FATAL(HexLoopInit(0) == 0);
+    HEX_TEST(HexLoopCurrent() == HexLoopDefault());
+    HEX_TEST(HexLoopPost(NULL, doneTask, NULL) == -1);
+    HEX_TEST(HexLoopJoin(HexLoopDefault()) == -1);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < NUM_LOOPS; ++i) {
+        LoopState& state = s_loops[i];
+        HEX_TEST_FATAL((state.efd = eventfd(0, EFD_NONBLOCK)) != -1);
+        for (int p = 0; p < NUM_PRODUCERS; ++p)
+            state.last[p] = -1;
+        HEX_TEST_FATAL((state.loop = HexLoopSpawn(i % cpus, 0)) != NULL);
+        HEX_TEST(HexLoopPost(state.loop, setupTask, &state) == 0);
+    }
+
+    // Until the loops are set up and drained the producers' tasks
+    HEX_TEST(HexLoop() == 0);
+    HEX_TEST(s_done == 2 * NUM_LOOPS);
+    for (int p = 0; p < NUM_PRODUCERS; ++p)
+        pthread_join(s_threads[p], NULL);
+
+    for (int i = 0; i < NUM_LOOPS; ++i) {
+        LoopState& state = s_loops[i];
+        HEX_TEST(HexLoopJoin(state.loop) == 0);
+        HEX_TEST(state.fdCbCalled == 1);
+        HEX_TEST(state.timerCalled == 1);
+        HEX_TEST(state.tasks == (long)NUM_PRODUCERS * NUM_POSTS);
+        for (int p = 0; p < NUM_PRODUCERS; ++p)
+            HEX_TEST(state.last[p] == NUM_POSTS - 1);
+        close(state.efd);
+    }
+
+    HEX_TEST(HexLoopFini() == 0);
+
+    return HexTestResult;
+}
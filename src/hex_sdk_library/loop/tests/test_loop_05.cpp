@@ -0,0 +1,198 @@
+// HEX SDK
+
+// Test the epoll and io_uring backends with the same callbacks: level and
+// edge-triggered fds, removal, received data, timers, signals and tasks
+
+#include "hex/loop.h"
+#include "hex/test.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+static int levelFd, edgeFd, pairFd[2], sock[2];
+static int levelCalled, edgeCalled, pairCalled, recvEof, signalCalled, timerCalled, taskCalled;
+static std::string received;
+
+static void
+Signal(int fd)
+{
+    uint64_t one = 1;
+    HEX_TEST_FATAL(write(fd, &one, sizeof(one)) == sizeof(one));
+}
+
+// Quit once everything happened
+static void
+CheckDone()
+{
+    if (levelCalled == 2 && edgeCalled == 3 && pairCalled == 1 && recvEof &&
+        signalCalled && timerCalled && taskCalled)
+        HexLoopQuit();
+}
+
+// Level-triggered: not drained the first time, so called again
+int levelCb(int fd, void* userData, int value)
+{
+    HEX_TEST(fd == levelFd);
+    if (++levelCalled == 2) {
+        uint64_t n;
+        HEX_TEST(read(fd, &n, sizeof(n)) == sizeof(n));
+        HEX_TEST(HexLoopFdRemove(fd) == 0);
+    }
+    CheckDone();
+    return 0;
+}
+
+// Edge-triggered: not drained, but only called again when signaled again
+int edgeCb(int fd, void* userData, int value)
+{
+    HEX_TEST(fd == edgeFd);
+    if (++edgeCalled < 3)
+        Signal(edgeFd);
+    else
+        HEX_TEST(HexLoopFdRemove(fd) == 0);
+    CheckDone();
+    return 0;
+}
+
+// Whichever comes first removes the other one
+int pairCb(int fd, void* userData, int value)
+{
+    int i = (fd == pairFd[0]) ? 0 : 1;
+    pairCalled++;
+    HEX_TEST(HexLoopFdRemove(pairFd[1 - i]) == 0);
+    HEX_TEST(HexLoopFdRemove(fd) == 0);
+    CheckDone();
+    return 0;
+}
+
+int recvCb(int fd, void* userData, const char* data, ssize_t len)
+{
+    HEX_TEST(fd == sock[0]);
+    HEX_TEST(userData == &received);
+    HEX_TEST(!recvEof);
+    if (len > 0) {
+        received.append(data, len);
+        if (received == "hello")
+            HEX_TEST(write(sock[1], " world", 6) == 6);
+        else if (received == "hello world")
+            HEX_TEST(shutdown(sock[1], SHUT_WR) == 0);
+    }
+    else {
+        HEX_TEST(len == 0);
+        HEX_TEST(data == NULL);
+        recvEof = 1;
+        HEX_TEST(HexLoopRecvRemove(fd) == 0);
+    }
+    CheckDone();
+    return 0;
+}
+
+int usr1Cb(int signum, void* userData, int value)
+{
+    HEX_TEST(signum == SIGUSR1);
+    signalCalled++;
+    CheckDone();
+    return 0;
+}
+
+int timerCb(int, void* userData, int value)
+{
+    timerCalled++;
+    HEX_TEST(kill(getpid(), SIGUSR1) == 0);
+    CheckDone();
+    return 0;
+}
+
+void task(void* arg)
+{
+    HEX_TEST(arg == &taskCalled);
+    taskCalled++;
+    CheckDone();
+}
+
+void* poster(void* arg)
+{
+    HEX_TEST(HexLoopPost(HexLoopDefault(), task, &taskCalled) == 0);
+    return NULL;
+}
+
+static void
+Run(int flags)
+{
+    levelCalled = edgeCalled = pairCalled = recvEof = signalCalled = timerCalled = taskCalled = 0;
+    received.clear();
+
+    HEX_TEST_FATAL(HexLoopInit(flags) == 0);
+    int backend = HexLoopBackend(HexLoopDefault());
+    HEX_TEST(backend == 0 || backend == (flags & HEX_LOOP_URING));
+    printf("requested %s, running %s\n", (flags & HEX_LOOP_URING) ? "io_uring" : "epoll",
+           backend == HEX_LOOP_URING ? "io_uring" : "epoll");
+
+    HEX_TEST_FATAL((levelFd = eventfd(0, EFD_NONBLOCK)) != -1);
+    HEX_TEST_FATAL((edgeFd = eventfd(0, EFD_NONBLOCK)) != -1);
+    HEX_TEST_FATAL((pairFd[0] = eventfd(0, EFD_NONBLOCK)) != -1);
+    HEX_TEST_FATAL((pairFd[1] = eventfd(0, EFD_NONBLOCK)) != -1);
+    HEX_TEST_FATAL(socketpair(AF_UNIX, SOCK_STREAM, 0, sock) == 0);
+
+    HEX_TEST_FATAL(HexLoopFdAdd(levelFd, levelCb, 0) == 0);
+    HEX_TEST_FATAL(HexLoopFdAddFlags(edgeFd, HEX_LOOP_EDGE, edgeCb, 0) == 0);
+    HEX_TEST_FATAL(HexLoopFdAdd(pairFd[0], pairCb, 0) == 0);
+    HEX_TEST_FATAL(HexLoopFdAdd(pairFd[1], pairCb, 0) == 0);
+    HEX_TEST(HexLoopRecvAdd(sock[0], recvCb, NULL) == 0);
+    HEX_TEST(HexLoopRecvRemove(sock[0]) == 0);
+    HEX_TEST(HexLoopRecvRemove(sock[0]) == -1);
+    HEX_TEST_FATAL(HexLoopRecvAdd(sock[0], recvCb, &received) == 0);
+    HEX_TEST(HexLoopRecvAdd(sock[0], recvCb, &received) == -1);
+    HEX_TEST(HexLoopFdRemove(sock[0]) == -1);
+    HEX_TEST_FATAL(HexLoopSignalAdd(SIGUSR1, usr1Cb, 0) == 0);
+    HEX_TEST_FATAL(HexLoopTimerAddMs(10, 0, timerCb, 0) != NULL);
+
+    Signal(levelFd);
+    Signal(edgeFd);
+    Signal(pairFd[0]);
+    Signal(pairFd[1]);
+    HEX_TEST(write(sock[1], "hello", 5) == 5);
+
+    pthread_t thread;
+    HEX_TEST_FATAL(pthread_create(&thread, NULL, poster, NULL) == 0);
+
+    HEX_TEST(HexLoop() == 0);
+    pthread_join(thread, NULL);
+
+    HexLoopStats stats;
+    HEX_TEST(HexLoopGetStats(HexLoopDefault(), &stats) == 0);
+    HEX_TEST(stats.waits > 0);
+    HEX_TEST(stats.syscalls >= stats.waits);
+
+    HEX_TEST(HexLoopFini() == 0);
+
+    HEX_TEST(levelCalled == 2);
+    HEX_TEST(edgeCalled == 3);
+    HEX_TEST(pairCalled == 1);
+    HEX_TEST(received == "hello world");
+    HEX_TEST(recvEof == 1);
+    HEX_TEST(signalCalled == 1);
+    HEX_TEST(timerCalled == 1);
+    HEX_TEST(taskCalled == 1);
+
+    close(levelFd);
+    close(edgeFd);
+    close(pairFd[0]);
+    close(pairFd[1]);
+    close(sock[0]);
+    close(sock[1]);
+}
+
+int main()
+{
+    alarm(10);
+
+    Run(0);
+    Run(HEX_LOOP_URING);
+
+    return HexTestResult;
+}
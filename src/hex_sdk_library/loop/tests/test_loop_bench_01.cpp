@@ -0,0 +1,114 @@
+// HEX SDK
+
+// Dispatch cost with many idle file descriptors and a few busy ones
+
+#include "hex/loop.h"
+#include "hex/test.h"
+
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#define IDLE_FDS 10000
+#define HOT_FDS 4
+#define NUM_EVENTS 20000
+
+static int s_events = 0;
+
+// Consume the event and make the fd ready again for the next iteration
+int hotCb(int fd, void* userData, int value)
+{
+    uint64_t n;
+    HEX_TEST(read(fd, &n, sizeof(n)) == sizeof(n));
+    if (++s_events >= NUM_EVENTS)
+        HexLoopQuit();
+    n = 1;
+    HEX_TEST(write(fd, &n, sizeof(n)) == sizeof(n));
+    return 0;
+}
+
+int idleCb(int fd, void* userData, int value)
+{
+    HEX_TEST(false);
+    return -1;
+}
+
+// Reference implementation: the poll(2) scan and fd lookup HexLoop() used
+// before the epoll backend
+static void
+LegacyLoop(const std::vector<int>& fds)
+{
+    struct CbInfo {
+        HexLoopCallback cb;
+        void* userData;
+    };
+    std::unordered_map<uint64_t, CbInfo> handlers;
+    std::vector<pollfd> fdVec;
+
+    for (size_t i = 0; i < fds.size(); ++i) {
+        CbInfo info = { i < HOT_FDS ? hotCb : idleCb, NULL };
+        handlers[fds[i]] = info;
+        pollfd pfd = { fds[i], POLLIN | POLLERR, 0 };
+        fdVec.push_back(pfd);
+    }
+
+    s_events = 0;
+    while (s_events < NUM_EVENTS) {
+        int r = poll(&fdVec[0], fdVec.size(), -1);
+        HEX_TEST_FATAL(r > 0);
+        for (size_t i = 0; i < fdVec.size() && s_events < NUM_EVENTS; ++i) {
+            if (fdVec[i].revents) {
+                CbInfo& info = handlers.find(fdVec[i].fd)->second;
+                info.cb(fdVec[i].fd, info.userData, 0);
+            }
+        }
+    }
+}
+
+int main()
+{
+    std::vector<int> fds;
+    uint64_t one = 1;
+
+    // Hot fds first
+    for (int i = 0; i < HOT_FDS + IDLE_FDS; ++i) {
+        int fd = eventfd(0, EFD_NONBLOCK);
+        HEX_TEST_FATAL(fd != -1);
+        fds.push_back(fd);
+        if (i < HOT_FDS)
+            HEX_TEST(write(fd, &one, sizeof(one)) == sizeof(one));
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    LegacyLoop(fds);
+    auto mid = std::chrono::high_resolution_clock::now();
+
+    HEX_TEST_FATAL(HexLoopInit(0) == 0);
+    for (size_t i = 0; i < fds.size(); ++i)
+        HEX_TEST_FATAL(HexLoopFdAdd(fds[i], i < HOT_FDS ? hotCb : idleCb, NULL) == 0);
+
+    s_events = 0;
+    auto mid2 = std::chrono::high_resolution_clock::now();
+    HEX_TEST(HexLoop() == 0);
+    auto end = std::chrono::high_resolution_clock::now();
+    HEX_TEST(s_events == NUM_EVENTS);
+
+    // Removing all but the hot fds
+    for (size_t i = HOT_FDS; i < fds.size(); ++i)
+        HEX_TEST(HexLoopFdRemove(fds[i]) == 0);
+    HEX_TEST(HexLoopFini() == 0);
+
+    for (size_t i = 0; i < fds.size(); ++i)
+        close(fds[i]);
+
+    double legacy = std::chrono::duration<double>(mid - start).count();
+    double epoll = std::chrono::duration<double>(end - mid2).count();
+    printf("%d idle fds, %d hot fds, %d events\n", IDLE_FDS, HOT_FDS, NUM_EVENTS);
+    printf("poll scan:      %.3f secs, %.0f events/sec\n", legacy, NUM_EVENTS / legacy);
+    printf("epoll dispatch: %.3f secs, %.0f events/sec\n", epoll, NUM_EVENTS / epoll);
+
+    return HexTestResult;
+}
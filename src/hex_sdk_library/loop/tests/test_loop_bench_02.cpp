@@ -0,0 +1,139 @@
+// HEX SDK
+
+// System calls per event on loopback TCP connections: epoll or io_uring,
+// with the callback receiving or the loop receiving for it
+
+#include "hex/loop.h"
+#include "hex/test.h"
+
+#include <chrono>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#define NUM_CONNS 8
+#define MSG_SIZE 64
+#define NUM_MSGS 200000  // in all, spread over the connections
+
+static int s_clients[NUM_CONNS];
+static int s_servers[NUM_CONNS];
+static long s_bytes = 0;
+static unsigned long s_events = 0;
+static unsigned long s_recvs = 0;
+
+static void
+Received(ssize_t len)
+{
+    s_events++;
+    s_bytes += len;
+    if (s_bytes == (long)NUM_MSGS * MSG_SIZE)
+        HexLoopQuit();
+}
+
+// Level-triggered callback receiving the data itself: one recv per event
+int fdCb(int fd, void* userData, int value)
+{
+    char buf[16384];
+    ssize_t len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    s_recvs++;
+    HEX_TEST_FATAL(len > 0);
+    Received(len);
+    return 0;
+}
+
+int recvCb(int fd, void* userData, const char* data, ssize_t len)
+{
+    HEX_TEST_FATAL(len > 0);
+    Received(len);
+    return 0;
+}
+
+void* writer(void* arg)
+{
+    char msg[MSG_SIZE] = { 0 };
+    for (int i = 0; i < NUM_MSGS; ++i)
+        HEX_TEST_FATAL(send(s_clients[i % NUM_CONNS], msg, sizeof(msg), 0) == sizeof(msg));
+    return NULL;
+}
+
+static void
+Connect()
+{
+    int lsock = socket(AF_INET, SOCK_STREAM, 0);
+    HEX_TEST_FATAL(lsock != -1);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen = sizeof(addr);
+    HEX_TEST_FATAL(bind(lsock, (sockaddr*)&addr, sizeof(addr)) == 0);
+    HEX_TEST_FATAL(getsockname(lsock, (sockaddr*)&addr, &addrLen) == 0);
+    HEX_TEST_FATAL(listen(lsock, NUM_CONNS) == 0);
+
+    for (int i = 0; i < NUM_CONNS; ++i) {
+        HEX_TEST_FATAL((s_clients[i] = socket(AF_INET, SOCK_STREAM, 0)) != -1);
+        int one = 1;
+        HEX_TEST(setsockopt(s_clients[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == 0);
+        HEX_TEST_FATAL(connect(s_clients[i], (sockaddr*)&addr, sizeof(addr)) == 0);
+        HEX_TEST_FATAL((s_servers[i] = accept(lsock, NULL, NULL)) != -1);
+    }
+    close(lsock);
+}
+
+static void
+Run(const char* name, int flags, bool loopRecv)
+{
+    Connect();
+
+    HEX_TEST_FATAL(HexLoopInit(flags) == 0);
+    if ((flags & HEX_LOOP_URING) && HexLoopBackend(HexLoopDefault()) != HEX_LOOP_URING) {
+        printf("%-16s io_uring not available\n", name);
+        HEX_TEST(HexLoopFini() == 0);
+    }
+    else {
+        for (int i = 0; i < NUM_CONNS; ++i) {
+            if (loopRecv)
+                HEX_TEST_FATAL(HexLoopRecvAdd(s_servers[i], recvCb, NULL) == 0);
+            else
+                HEX_TEST_FATAL(HexLoopFdAdd(s_servers[i], fdCb, NULL) == 0);
+        }
+
+        s_bytes = 0;
+        s_events = 0;
+        s_recvs = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        pthread_t thread;
+        HEX_TEST_FATAL(pthread_create(&thread, NULL, writer, NULL) == 0);
+        HEX_TEST(HexLoop() == 0);
+        auto end = std::chrono::high_resolution_clock::now();
+        pthread_join(thread, NULL);
+
+        HexLoopStats stats;
+        HEX_TEST(HexLoopGetStats(HexLoopDefault(), &stats) == 0);
+        HEX_TEST(HexLoopFini() == 0);
+
+        // Messages coalesce in the socket buffers, so an event is a receive
+        // of one or more messages
+        double secs = std::chrono::duration<double>(end - start).count();
+        unsigned long syscalls = stats.syscalls + s_recvs;
+        printf("%-16s %.3f secs, %.0f msgs/sec, %.0f events/sec, %.0f syscalls/sec, %.2f syscalls per event\n",
+               name, secs, NUM_MSGS / secs, s_events / secs, syscalls / secs, (double)syscalls / s_events);
+    }
+
+    for (int i = 0; i < NUM_CONNS; ++i) {
+        close(s_clients[i]);
+        close(s_servers[i]);
+    }
+}
+
+int main()
+{
+    printf("%d connections, %d messages of %d bytes\n", NUM_CONNS, NUM_MSGS, MSG_SIZE);
+    Run("epoll, fd:", 0, false);
+    Run("epoll, recv:", 0, true);
+    Run("io_uring, fd:", HEX_LOOP_URING, false);
+    Run("io_uring, recv:", HEX_LOOP_URING, true);
+
+    return HexTestResult;
+}
@@ -2,11 +2,16 @@
 
 #define _GNU_SOURCE // GNU vasprintf
 #include <string.h>
-#include <unistd.h> // fork, daemon, alarm, getpid, ...
+#include <unistd.h> // setsid, getpid, ...
 #include <stdarg.h> // va_...
 #include <errno.h> // errno, E... defines
-#include <time.h> // nanosleep
+#include <time.h> // nanosleep, clock_gettime
+#include <poll.h>
+#include <sched.h> // clone
+#include <signal.h>
+#include <sys/mman.h> // mmap
 #include <sys/stat.h> // open
+#include <sys/syscall.h> // SYS_pidfd_open
 #include <fcntl.h>
 
 #include <hex/process.h>
@@ -238,13 +243,160 @@ HexSpawnNoSig(shandler sighandlerfunc, int isChildLeader, int timeout, const cha
     return HexSpawnNoSigV(sighandlerfunc, isChildLeader, timeout, argv);
 }
 
+// Stack for the child between clone and exec, and as much again for the
+// grandchild of a detached spawn
+#define SPAWN_STACK_SIZE (64 * 1024)
+
+struct SpawnArgs {
+    shandler sighandlerfunc;
+    int isChildLeader;
+    int timeout;
+    char *const *argv;
+    const struct sigaction *intsa;
+    const struct sigaction *quitsa;
+    char *grandchildStack;
+};
+
+// The child shares the parent's memory until it execs, so none of the
+// parent's handlers may run in it: anything not ignored becomes the default
+// disposition, which exec would have reset it to anyway
+static void
+SpawnSetSignal(int sig, int ignore)
+{
+    struct sigaction sa;
+    sa.sa_handler = ignore ? SIG_IGN : SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(sig, &sa, (struct sigaction *)0);
+}
+
+static int
+SpawnExec(void *arg)
+{
+    struct SpawnArgs *args = (struct SpawnArgs *)arg;
+
+    //Make child the process group leader to avoid session signals reaching it
+    if (args->isChildLeader != 0 && getpid() != getpgrp())
+        setpgid(0, 0);
+
+    // Clear signal mask to avoid child process starts with some signal blocked unexpectedly.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, (sigset_t *)0);
+
+    execv(args->argv[0], args->argv);
+    _exit(127);
+}
+
+// Detached grandchild: a new session with standard streams on /dev/null, as
+// daemon(1, 0) would leave it
+static int
+SpawnDetached(void *arg)
+{
+    setsid();
+    int fd = open("/dev/null", O_RDWR);
+    if (fd != -1) {
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        if (fd > STDERR_FILENO)
+            close(fd);
+    }
+    return SpawnExec(arg);
+}
+
+static int
+SpawnChild(void *arg)
+{
+    struct SpawnArgs *args = (struct SpawnArgs *)arg;
+
+    struct sigaction sa;
+    for (int sig = 1; sig < _NSIG; ++sig) {
+        if (sig != SIGKILL && sig != SIGSTOP &&
+            sigaction(sig, (struct sigaction *)0, &sa) == 0 &&
+            sa.sa_handler != SIG_IGN && sa.sa_handler != SIG_DFL)
+            SpawnSetSignal(sig, 0);
+    }
+
+    // SIGINT and SIGQUIT as the parent had them, or as sighandlerfunc sets
+    // them unless that ignores them
+    int restore = args->sighandlerfunc == SIG_IGN;
+    SpawnSetSignal(SIGINT, restore && args->intsa->sa_handler == SIG_IGN);
+    SpawnSetSignal(SIGQUIT, restore && args->quitsa->sa_handler == SIG_IGN);
+
+    if (args->timeout > 0) {
+        // Terminated by SIGALRM if it runs longer than timeout seconds
+        SpawnSetSignal(SIGALRM, 0);
+    }
+    else if (args->timeout < 0) {
+        // Detach child from original parent process (e.g. daemonize): the
+        // grandchild is left to init once this child exits
+        if (clone(SpawnDetached, args->grandchildStack,
+                  CLONE_VM | CLONE_VFORK | SIGCHLD, args) == -1)
+            _exit(127);
+        _exit(0);
+    }
+
+    return SpawnExec(arg);
+}
+
+// Wait until the child exits or timeout seconds have passed, then send it
+// SIGALRM. The caller reaps it.
+static void
+SpawnTimeout(pid_t pid, int timeout)
+{
+#ifdef SYS_pidfd_open
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+#else
+    int pidfd = -1;
+#endif
+
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout;
+
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long ms = (deadline.tv_sec - now.tv_sec) * 1000 +
+                  (deadline.tv_nsec - now.tv_nsec + 999999) / 1000000;
+        if (ms <= 0) {
+            Trace("parent: child pid=%d timed out\n", pid);
+            kill(pid, SIGALRM);
+            break;
+        }
+
+        if (pidfd != -1) {
+            struct pollfd pfd = { pidfd, POLLIN, 0 };
+            int n = poll(&pfd, 1, ms);
+            if (n > 0)
+                break;
+            if (n < 0 && errno != EINTR) {
+                close(pidfd);
+                pidfd = -1;
+            }
+        }
+        else {
+            // No pidfds before Linux 5.3: check every 10 milliseconds
+            siginfo_t info;
+            info.si_pid = 0;
+            if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == -1 || info.si_pid != 0)
+                break;
+            struct timespec tick = { 0, 10 * 1000000 };
+            nanosleep(&tick, (struct timespec *)0);
+        }
+    }
+
+    if (pidfd != -1)
+        close(pidfd);
+}
+
 int
 HexSpawnNoSigV(shandler sighandlerfunc, int isChildLeader, int timeout, char *const argv[])
 {
     int status = 0;
 
     struct sigaction intsa, quitsa, sa;
-    sigset_t omask;
+    sigset_t omask, all, spawnmask;
 
     // Configure SIGINT(ctrl-c) and SIGQUIT(dump core)
     sa.sa_handler = sighandlerfunc;
@@ -260,60 +412,35 @@ HexSpawnNoSigV(shandler sighandlerfunc, int isChildLeader, int timeout, char *co
     sigaddset(&sa.sa_mask, SIGCHLD);
     sigprocmask(SIG_BLOCK, &sa.sa_mask, &omask);
 
-    Trace("parent: forking child\n");
-    pid_t pid = fork();
+    struct SpawnArgs args = { sighandlerfunc, isChildLeader, timeout, argv, &intsa, &quitsa, NULL };
+
+    // The child shares the parent's memory and the parent is suspended until
+    // it execs, so unlike fork nothing is copied however large the parent is
+    char *stack = mmap(NULL, 2 * SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    pid_t pid = -1;
+    if (stack != MAP_FAILED) {
+        args.grandchildStack = stack + SPAWN_STACK_SIZE;
+
+        // Nor may a handler run in the child before it resets them
+        sigfillset(&all);
+        sigprocmask(SIG_SETMASK, &all, &spawnmask);
+        Trace("parent: spawning child\n");
+        pid = clone(SpawnChild, stack + 2 * SPAWN_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+        int err = errno;
+        sigprocmask(SIG_SETMASK, &spawnmask, (sigset_t *)0);
+        munmap(stack, 2 * SPAWN_STACK_SIZE);
+        errno = err;
+    }
+
     if (pid < 0) {
-        Trace("parent: fork failed\n");
+        Trace("parent: spawn failed\n");
         status = -1;
     }
-    else if (pid == 0) {
-        // Child
-        Trace("child: timeout=%d\n", timeout);
-        if (timeout < 0) {
-            // Detach child from original parent process (e.g. daemonize)
-            // Don't chdir
-            daemon(1, 0);
-        }
-        else if (timeout > 0) {
-            // Set uncaught alarm that will terminate child if it runs longer than timeout seconds
-            struct sigaction sa;
-            sa.sa_handler = SIG_DFL;
-            sigemptyset(&sa.sa_mask);
-            sa.sa_flags = 0;
-            sigaction(SIGALRM, &sa, (struct sigaction *)0);
-            alarm(timeout);
-        }
-        sa.sa_handler = sighandlerfunc;
-        if(SIG_IGN==sa.sa_handler) {
-            // Restore signals
-            sigaction(SIGINT, &intsa, (struct sigaction *)0);
-            sigaction(SIGQUIT, &quitsa, (struct sigaction *)0);
-        }
-        else {
-            sigaction(SIGINT, &sa, (struct sigaction *)0);
-            sigaction(SIGQUIT, &sa, (struct sigaction *)0);
-        }
-        // Clear signal mask to avoid child process starts with some signal blocked unexpectedly.
-        sigemptyset(&omask);
-        sigprocmask(SIG_SETMASK, &omask, (sigset_t *)0);
-
-        //Make child the process group leader to avaoid session signals reaching it
-        if(isChildLeader != 0) {
-            pid_t mypid = getpid();
-            if(mypid != getpgrp()) {
-                if(setpgid(0, 0)==-1) {
-                    int err = errno;
-                    err = err;
-                    Trace("System error %d while running setpgid: %s", err, strerror(err));
-                }
-            }
-        }
-        Trace("child: execing new process\n");
-        if (execv(argv[0], argv) == -1)
-            _exit(127);
-    }
     else {
-        // pid > 0, Parent
+        if (timeout > 0)
+            SpawnTimeout(pid, timeout);
+
         // Reap child (or second parent of daemonized child) process
         Trace("parent: waiting on child pid=%d\n", pid);
         while (waitpid(pid, &status, 0) == -1) {
@@ -322,7 +449,6 @@ HexSpawnNoSigV(shandler sighandlerfunc, int isChildLeader, int timeout, char *co
             }
             status=0;
         }
-
     }
 
     // Restore signals
@@ -0,0 +1,392 @@
+// HEX SDK
+
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <ctime>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#include <hex/process_group.h>
+
+// epoll data of the timer, commands use index * 4 + STREAM_* or PIDFD
+#define TIMER_EVENT UINT64_MAX
+#define PIDFD 2
+
+// Read ends of the pipes
+#define STREAM_OUT 0
+#define STREAM_ERR 1
+
+// Poll interval for commands without a pidfd (Linux before 5.3)
+#define UNWATCHED_POLL_MS 10
+
+HexProcessGroup::HexProcessGroup(size_t maxConcurrent, int timeout)
+    : m_maxConcurrent(maxConcurrent), m_timeout(timeout),
+      m_next(0), m_running(0), m_finished(0), m_unwatched(0),
+      m_epollFd(-1), m_timerFd(-1), m_startTime(0), m_deadline(0)
+{
+}
+
+HexProcessGroup::~HexProcessGroup()
+{
+    for (size_t i = 0; i < m_commands.size(); ++i) {
+        Command& cmd = m_commands[i];
+        if (cmd.state != RUNNING)
+            continue;
+        kill(-cmd.pid, SIGKILL);
+        while (waitpid(cmd.pid, NULL, 0) == -1 && errno == EINTR)
+            continue;
+        for (int s = 0; s < 2; ++s) {
+            if (cmd.fds[s] != -1)
+                close(cmd.fds[s]);
+        }
+        if (cmd.pidfd != -1)
+            close(cmd.pidfd);
+    }
+    if (m_timerFd != -1)
+        close(m_timerFd);
+    if (m_epollFd != -1)
+        close(m_epollFd);
+}
+
+size_t
+HexProcessGroup::add(const std::vector<std::string>& argv, int timeout)
+{
+    Command cmd;
+    cmd.argv = argv;
+    cmd.timeout = timeout;
+    cmd.state = QUEUED;
+    cmd.pid = -1;
+    cmd.pidfd = -1;
+    cmd.fds[STREAM_OUT] = cmd.fds[STREAM_ERR] = -1;
+    cmd.deadline = 0;
+    cmd.killed = false;
+    cmd.result.status = -1;
+    cmd.result.error = 0;
+    cmd.result.timedOut = false;
+    cmd.result.startTime = 0;
+    cmd.result.elapsed = 0;
+    m_commands.push_back(cmd);
+    return m_commands.size() - 1;
+}
+
+double
+HexProcessGroup::now() const
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool
+HexProcessGroup::start()
+{
+    if (m_epollFd != -1)
+        return true;
+
+    double t = now();
+    m_startTime = t;
+    if (m_timeout > 0)
+        m_deadline = t + m_timeout;
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd != -1) {
+        m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = TIMER_EVENT;
+        if (m_timerFd == -1 || epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_timerFd, &ev) == -1) {
+            int err = errno;
+            if (m_timerFd != -1)
+                close(m_timerFd);
+            close(m_epollFd);
+            m_timerFd = m_epollFd = -1;
+            errno = err;
+        }
+    }
+
+    if (m_epollFd == -1) {
+        int err = errno;
+        for (; m_next < m_commands.size(); ++m_next)
+            finish(m_next, -1, err, t);
+        return false;
+    }
+
+    while (m_next < m_commands.size() &&
+           (m_maxConcurrent == 0 || m_running < m_maxConcurrent))
+        launch(m_next++, t);
+    armTimer(t);
+    return true;
+}
+
+void
+HexProcessGroup::launch(size_t index, double now)
+{
+    Command& cmd = m_commands[index];
+
+    if (cmd.argv.empty()) {
+        finish(index, -1, EINVAL, now);
+        return;
+    }
+
+    std::vector<char*> argv;
+    for (size_t i = 0; i < cmd.argv.size(); ++i)
+        argv.push_back(const_cast<char*>(cmd.argv[i].c_str()));
+    argv.push_back(NULL);
+
+    int out[2] = { -1, -1 }, err[2] = { -1, -1 };
+    if (pipe2(out, O_CLOEXEC) == -1 || pipe2(err, O_CLOEXEC) == -1) {
+        int e = errno;
+        for (int i = 0; i < 2; ++i) {
+            if (out[i] != -1)
+                close(out[i]);
+        }
+        finish(index, -1, e, now);
+        return;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+
+    // Own process group, so that a timeout kills whatever the command started,
+    // and no signals blocked
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, 0);
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+
+    pid_t pid;
+    int rc = posix_spawn(&pid, argv[0], &actions, &attr, &argv[0], environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(out[1]);
+    close(err[1]);
+
+    if (rc != 0) {
+        close(out[0]);
+        close(err[0]);
+        finish(index, -1, rc, now);
+        return;
+    }
+
+    cmd.state = RUNNING;
+    cmd.pid = pid;
+    cmd.fds[STREAM_OUT] = out[0];
+    cmd.fds[STREAM_ERR] = err[0];
+    cmd.result.startTime = now - m_startTime;
+    if (cmd.timeout > 0)
+        cmd.deadline = now + cmd.timeout;
+    ++m_running;
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    for (int s = 0; s < 2; ++s) {
+        fcntl(cmd.fds[s], F_SETFL, O_NONBLOCK);
+        ev.data.u64 = index * 4 + s;
+        epoll_ctl(m_epollFd, EPOLL_CTL_ADD, cmd.fds[s], &ev);
+    }
+
+#ifdef SYS_pidfd_open
+    cmd.pidfd = syscall(SYS_pidfd_open, pid, 0);
+#endif
+    ev.data.u64 = index * 4 + PIDFD;
+    if (cmd.pidfd != -1 && epoll_ctl(m_epollFd, EPOLL_CTL_ADD, cmd.pidfd, &ev) == -1) {
+        close(cmd.pidfd);
+        cmd.pidfd = -1;
+    }
+    if (cmd.pidfd == -1)
+        ++m_unwatched;
+}
+
+void
+HexProcessGroup::readOutput(size_t index, int stream)
+{
+    Command& cmd = m_commands[index];
+    std::string& output = stream == STREAM_OUT ? cmd.result.out : cmd.result.err;
+    char buffer[65536];
+
+    for (;;) {
+        ssize_t n = read(cmd.fds[stream], buffer, sizeof(buffer));
+        if (n > 0) {
+            output.append(buffer, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0 || errno != EAGAIN) {
+            // End of output; closing also removes it from the epoll set
+            close(cmd.fds[stream]);
+            cmd.fds[stream] = -1;
+        }
+        return;
+    }
+}
+
+void
+HexProcessGroup::reap(size_t index, double now)
+{
+    Command& cmd = m_commands[index];
+
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(cmd.pid, &status, WNOHANG)) == -1 && errno == EINTR)
+        continue;
+    if (pid == 0)
+        return;
+    int error = pid == -1 ? errno : 0;
+
+    // Whatever the command wrote is in the pipes by now; anything it left
+    // running that still holds them open is not waited for
+    for (int s = 0; s < 2; ++s) {
+        if (cmd.fds[s] != -1) {
+            readOutput(index, s);
+            if (cmd.fds[s] != -1) {
+                close(cmd.fds[s]);
+                cmd.fds[s] = -1;
+            }
+        }
+    }
+    if (cmd.pidfd != -1) {
+        close(cmd.pidfd);
+        cmd.pidfd = -1;
+    }
+    else {
+        --m_unwatched;
+    }
+    --m_running;
+    finish(index, pid == -1 ? -1 : status, error, now);
+}
+
+void
+HexProcessGroup::finish(size_t index, int status, int error, double now)
+{
+    Command& cmd = m_commands[index];
+    cmd.state = DONE;
+    cmd.result.status = status;
+    cmd.result.error = error;
+    if (cmd.pid != -1)
+        cmd.result.elapsed = now - m_startTime - cmd.result.startTime;
+    ++m_finished;
+}
+
+// Wake fd() at the nearest deadline, or soon if an exit may go unnoticed
+void
+HexProcessGroup::armTimer(double now)
+{
+    double next = m_deadline;
+    if (m_unwatched > 0 && (next == 0 || now + UNWATCHED_POLL_MS / 1e3 < next))
+        next = now + UNWATCHED_POLL_MS / 1e3;
+    for (size_t i = 0; i < m_commands.size(); ++i) {
+        const Command& cmd = m_commands[i];
+        if (cmd.state == RUNNING && !cmd.killed && cmd.deadline > 0 && (next == 0 || cmd.deadline < next))
+            next = cmd.deadline;
+    }
+
+    struct itimerspec its = {};
+    if (next > 0 && m_finished < m_commands.size()) {
+        its.it_value.tv_sec = (time_t)next;
+        its.it_value.tv_nsec = (long)((next - floor(next)) * 1e9);
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+            its.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+bool
+HexProcessGroup::poll(int timeoutMs)
+{
+    start();
+    if (m_finished == m_commands.size())
+        return true;
+
+    // Sleep no later than the nearest deadline, which the timer covers
+    int waitMs = timeoutMs;
+    if (m_unwatched > 0 && (waitMs < 0 || waitMs > UNWATCHED_POLL_MS))
+        waitMs = UNWATCHED_POLL_MS;
+
+    struct epoll_event events[32];
+    int n = epoll_wait(m_epollFd, events, sizeof(events) / sizeof(events[0]), waitMs);
+    double t = now();
+
+    for (int i = 0; i < n; ++i) {
+        uint64_t data = events[i].data.u64;
+        if (data == TIMER_EVENT) {
+            uint64_t expirations;
+            if (read(m_timerFd, &expirations, sizeof(expirations)) < 0) {
+                // Not expired yet
+            }
+            continue;
+        }
+        size_t index = data / 4;
+        int kind = data % 4;
+        if (m_commands[index].state != RUNNING)
+            continue;
+        if (kind == PIDFD)
+            reap(index, t);
+        else if (m_commands[index].fds[kind] != -1)
+            readOutput(index, kind);
+    }
+
+    bool groupExpired = m_deadline > 0 && t >= m_deadline;
+    for (size_t i = 0; i < m_commands.size(); ++i) {
+        Command& cmd = m_commands[i];
+        if (cmd.state != RUNNING)
+            continue;
+        if (cmd.pidfd == -1)
+            reap(i, t);
+        if (cmd.state == RUNNING && !cmd.killed &&
+            (groupExpired || (cmd.deadline > 0 && t >= cmd.deadline))) {
+            // Reaped once its pidfd says it has exited
+            kill(-cmd.pid, SIGKILL);
+            cmd.killed = true;
+            cmd.result.timedOut = true;
+        }
+    }
+
+    if (groupExpired) {
+        for (; m_next < m_commands.size(); ++m_next) {
+            m_commands[m_next].result.timedOut = true;
+            finish(m_next, -1, 0, t);
+        }
+    }
+
+    while (m_next < m_commands.size() &&
+           (m_maxConcurrent == 0 || m_running < m_maxConcurrent))
+        launch(m_next++, t);
+
+    armTimer(t);
+    return m_finished == m_commands.size();
+}
+
+void
+HexProcessGroup::wait()
+{
+    while (!poll(-1))
+        continue;
+}
+
+size_t
+HexProcessGroup::succeeded() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i < m_commands.size(); ++i) {
+        const Result& r = m_commands[i].result;
+        if (r.status != -1 && WIFEXITED(r.status) && WEXITSTATUS(r.status) == 0)
+            ++count;
+    }
+    return count;
+}
@@ -2,33 +2,33 @@
 
 #define _GNU_SOURCE 1
 #include <dlfcn.h>
+#include <errno.h>
 
 #include <hex/process.h>
 #include <hex/test.h>
 
-bool fork_enabled = true;
+bool clone_enabled = true;
 
-int fork (void) 
+int clone(int (*fn)(void *), void *stack, int flags, void *arg, ...)
 {
-    static int (*libc_fork)(void) = NULL;
-    if(!libc_fork)
-        libc_fork = (typeof(libc_fork))dlsym (RTLD_NEXT, "fork");
-
-    if (fork_enabled)
-        return (*libc_fork)();
-    else 
+    static int (*libc_clone)(int (*)(void *), void *, int, void *, ...) = NULL;
+    if(!libc_clone)
+        libc_clone = (typeof(libc_clone))dlsym (RTLD_NEXT, "clone");
+
+    if (clone_enabled)
+        return (*libc_clone)(fn, stack, flags, arg);
+    else {
+        errno = EAGAIN;
         return -1;
+    }
 }
 
 int main() {
-    // fork fails, returns -1
-    fork_enabled = 0;
+    // spawning fails, returns -1
+    clone_enabled = 0;
     HEX_TEST(HexSpawn(0, "/bin/true", ZEROCHAR_PTR) == -1);
-    fork_enabled = 1;
+    clone_enabled = 1;
+    HEX_TEST(HexSpawn(0, "/bin/true", ZEROCHAR_PTR) == 0);
 
     return HexTestResult;
 }
-
-
-
-
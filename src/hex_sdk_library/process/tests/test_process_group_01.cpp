@@ -0,0 +1,138 @@
+// HEX SDK
+
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <string>
+
+#include <poll.h>
+#include <sys/wait.h>
+
+#include <hex/process_group.h>
+#include <hex/test.h>
+
+static double
+Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static std::vector<std::string>
+Shell(const std::string& cmd)
+{
+    return { "/bin/sh", "-c", cmd };
+}
+
+int main()
+{
+    // TEST - commands run at once, with output and status of each
+    {
+        HexProcessGroup group;
+        for (int i = 0; i < 4; ++i) {
+            std::string n = std::to_string(i);
+            group.add(Shell("sleep 1; echo out" + n + "; echo err" + n + " >&2; exit " + n));
+        }
+        double start = Now();
+        group.wait();
+        HEX_TEST(Now() - start < 2);
+        for (size_t i = 0; i < group.size(); ++i) {
+            const HexProcessGroup::Result& r = group.result(i);
+            std::string n = std::to_string(i);
+            HEX_TEST(WIFEXITED(r.status) && WEXITSTATUS(r.status) == (int)i);
+            HEX_TEST(r.out == "out" + n + "\n");
+            HEX_TEST(r.err == "err" + n + "\n");
+            HEX_TEST(!r.timedOut);
+            HEX_TEST(r.elapsed >= 0.9 && r.elapsed < 2);
+        }
+        HEX_TEST(group.succeeded() == 1);
+    }
+
+    // TEST - no more than the limit at once
+    {
+        HexProcessGroup group(2);
+        for (int i = 0; i < 4; ++i)
+            group.add({ "/bin/sleep", "1" });
+        double start = Now();
+        group.wait();
+        double secs = Now() - start;
+        HEX_TEST(secs >= 1.9 && secs < 3);
+        HEX_TEST(group.result(1).startTime < 0.5);
+        HEX_TEST(group.result(2).startTime >= 0.9);
+        HEX_TEST(group.succeeded() == 4);
+    }
+
+    // TEST - a command past its timeout is killed with what it started, and
+    // one that fails to start is reported
+    {
+        HexProcessGroup group;
+        size_t slow = group.add(Shell("echo started; /bin/sleep 10; echo finished"), 1);
+        size_t fast = group.add({ "/bin/echo", "fast" }, 1);
+        size_t missing = group.add({ "/bin/fakeproggie" });
+        double start = Now();
+        group.wait();
+        HEX_TEST(Now() - start < 3);
+        HEX_TEST(group.result(slow).timedOut);
+        HEX_TEST(WIFSIGNALED(group.result(slow).status) && WTERMSIG(group.result(slow).status) == SIGKILL);
+        HEX_TEST(group.result(slow).out == "started\n");
+        HEX_TEST(!group.result(fast).timedOut && group.result(fast).status == 0);
+        HEX_TEST(group.result(fast).out == "fast\n");
+        HEX_TEST(group.result(missing).status == -1);
+        HEX_TEST(group.result(missing).error == ENOENT);
+    }
+
+    // TEST - the group's timeout kills what runs and skips what is queued
+    {
+        HexProcessGroup group(1, 1);
+        group.add({ "/bin/sleep", "5" });
+        group.add({ "/bin/sleep", "5" });
+        double start = Now();
+        group.wait();
+        HEX_TEST(Now() - start < 3);
+        HEX_TEST(group.result(0).timedOut && WIFSIGNALED(group.result(0).status));
+        HEX_TEST(group.result(1).timedOut && group.result(1).status == -1);
+    }
+
+    // TEST - output larger than the pipes, and a command leaving something
+    // behind that holds its output open
+    {
+        HexProcessGroup group;
+        size_t big = group.add({ "/usr/bin/head", "-c", "1000000", "/dev/zero" });
+        size_t daemon = group.add(Shell("/bin/sleep 5 & echo done"));
+        double start = Now();
+        group.wait();
+        HEX_TEST(Now() - start < 2);
+        HEX_TEST(group.result(big).status == 0);
+        HEX_TEST(group.result(big).out.size() == 1000000);
+        HEX_TEST(group.result(daemon).status == 0);
+        HEX_TEST(group.result(daemon).out == "done\n");
+    }
+
+    // TEST - driven from another loop through fd()
+    {
+        HexProcessGroup group;
+        HEX_TEST(group.fd() == -1);
+        group.add({ "/bin/echo", "looped" });
+        group.add({ "/bin/sleep", "5" }, 1);
+        HEX_TEST_FATAL(group.start());
+        HEX_TEST(group.fd() != -1);
+        bool done = false;
+        for (int i = 0; i < 100 && !done; ++i) {
+            struct pollfd pfd = { group.fd(), POLLIN, 0 };
+            if (::poll(&pfd, 1, 100) > 0)
+                done = group.poll(0);
+        }
+        HEX_TEST(done);
+        HEX_TEST(group.result(0).out == "looped\n");
+        HEX_TEST(group.result(1).timedOut);
+    }
+
+    // TEST - an empty group is done at once
+    {
+        HexProcessGroup group;
+        HEX_TEST(group.poll(-1));
+    }
+
+    return HexTestResult;
+}
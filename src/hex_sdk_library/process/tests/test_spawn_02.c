@@ -0,0 +1,93 @@
+// HEX SDK
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include <hex/process.h>
+#include <hex/test.h>
+
+static int s_caught = 0;
+
+static void
+Handler(int sig)
+{
+    s_caught = sig;
+}
+
+static double
+Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main() {
+
+    int status = 0;
+
+    // TEST - child starts with no signals blocked though the parent blocks some
+    sigset_t mask, omask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &mask, &omask);
+    status = HexSpawn(0, "/bin/grep", "-q", "^SigBlk:[[:space:]]*0*$", "/proc/self/status", NULL);
+    HEX_TEST(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    sigprocmask(SIG_SETMASK, &omask, NULL);
+
+    // TEST - handlers of the parent are not inherited and it still gets them
+    struct sigaction sa, osa;
+    sa.sa_handler = Handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGUSR1, &sa, &osa);
+    status = HexSpawn(0, "/bin/sh", "-c", "kill -USR1 $$", NULL);
+    HEX_TEST(WIFSIGNALED(status) && WTERMSIG(status) == SIGUSR1);
+    HEX_TEST(s_caught == 0);
+    kill(getpid(), SIGUSR1);
+    HEX_TEST(s_caught == SIGUSR1);
+    sigaction(SIGUSR1, &osa, NULL);
+
+    // TEST - child is its own process group leader when asked to be
+    static const char *pgrp = "read -r pid comm state ppid pgrp rest < /proc/$$/stat; [ \"$pgrp\" = \"$$\" ]";
+    status = HexSpawnNoSig(SIG_IGN, 1, 0, "/bin/sh", "-c", pgrp, NULL);
+    HEX_TEST(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    status = HexSpawnNoSig(SIG_IGN, 0, 0, "/bin/sh", "-c", pgrp, NULL);
+    HEX_TEST(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+
+    // TEST - ignored SIGINT stays ignored with SIG_IGN and not otherwise
+    signal(SIGINT, SIG_IGN);
+    status = HexSpawnNoSig(SIG_IGN, 0, 0, "/bin/sh", "-c", "kill -INT $$; exit 3", NULL);
+    HEX_TEST(WIFEXITED(status) && WEXITSTATUS(status) == 3);
+    status = HexSpawnNoSig(SIG_DFL, 0, 0, "/bin/sh", "-c", "kill -INT $$; exit 3", NULL);
+    HEX_TEST(WIFSIGNALED(status) && WTERMSIG(status) == SIGINT);
+    signal(SIGINT, SIG_DFL);
+
+    // TEST - timeout terminates with SIGALRM even if the parent ignores it
+    signal(SIGALRM, SIG_IGN);
+    double start = Now();
+    status = HexSpawn(1, "/bin/sleep", "5", NULL);
+    HEX_TEST(WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM);
+    HEX_TEST(Now() - start < 3);
+    signal(SIGALRM, SIG_DFL);
+
+    // TEST - a timeout does not delay a child that exits early
+    start = Now();
+    status = HexSpawn(5, "/bin/true", NULL);
+    HEX_TEST(status == 0);
+    HEX_TEST(Now() - start < 1);
+
+    // TEST - detached child runs in its own session, no longer our child
+    unlink("test.out");
+    status = HexSpawn(-1, "/bin/sh", "-c", "read -r pid comm state ppid pgrp sid rest < /proc/$$/stat; [ \"$sid\" = \"$$\" ] && touch test.out", NULL);
+    HEX_TEST(status == 0);
+    for (int i = 0; i < 50 && access("test.out", F_OK) != 0; ++i)
+        usleep(100000);
+    HEX_TEST(access("test.out", F_OK) == 0);
+    HEX_TEST(waitpid(-1, NULL, WNOHANG) == -1 && errno == ECHILD);
+    unlink("test.out");
+
+    return HexTestResult;
+}
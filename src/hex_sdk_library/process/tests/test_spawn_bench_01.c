@@ -0,0 +1,75 @@
+// HEX SDK
+
+// Spawn latency of /bin/true against fork and exec as HexSpawnV used to,
+// with the parent holding more and more resident memory
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include <hex/process.h>
+#include <hex/test.h>
+
+#define NUM_SPAWNS 100
+
+static double
+Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Reference implementation: fork, which copies the parent's page tables
+static int
+ForkSpawnV(char *const argv[])
+{
+    int status = 0;
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    while (waitpid(pid, &status, 0) == -1)
+        ;
+    return status;
+}
+
+int main() {
+
+    static const size_t rssMB[] = { 0, 256, 1024, 2048 };
+    char *argv[] = { "/bin/true", NULL };
+
+    printf("%d spawns of %s\n", NUM_SPAWNS, argv[0]);
+    for (size_t i = 0; i < sizeof(rssMB) / sizeof(rssMB[0]); ++i) {
+        size_t len = rssMB[i] << 20;
+        char *rss = NULL;
+        if (len > 0) {
+            rss = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (rss == MAP_FAILED) {
+                printf("rss %5zu MB: not enough memory\n", rssMB[i]);
+                continue;
+            }
+            memset(rss, 1, len);
+        }
+
+        double start = Now();
+        for (int n = 0; n < NUM_SPAWNS; ++n)
+            HEX_TEST(ForkSpawnV(argv) == 0);
+        double mid = Now();
+        for (int n = 0; n < NUM_SPAWNS; ++n)
+            HEX_TEST(HexSpawnV(0, argv) == 0);
+        double end = Now();
+
+        printf("rss %5zu MB: fork %7.1f usecs/spawn, HexSpawnV %7.1f usecs/spawn\n",
+               rssMB[i], (mid - start) * 1e6 / NUM_SPAWNS, (end - mid) * 1e6 / NUM_SPAWNS);
+
+        if (rss)
+            munmap(rss, len);
+    }
+
+    return HexTestResult;
+}
@@ -6,9 +6,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
 
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include <hex/hash.h>
 #include <hex/queue.h>
@@ -21,6 +26,22 @@
 #define SHM_PATH "/dev/shm"
 #define SHM_PREFIX "/queue_"
 
+#define RING_MAGIC 0x48514d50   // "HQMP"
+#define RING_HDR_SIZE sizeof(uint64_t)
+#define RING_COMMITTED 1
+
+// Header of a multi-producer queue
+// head, tail and doorbell live on separate cache lines since the consumer
+// writes head while producers race on tail
+struct HexQueueRing
+{
+    uint32_t magic;
+    uint64_t size;                                          // usable data size
+    _Atomic uint64_t head __attribute__((aligned(64)));     // consumer offset (monotonic)
+    _Atomic uint64_t tail __attribute__((aligned(64)));     // reservation offset (monotonic)
+    _Atomic uint32_t doorbell __attribute__((aligned(64))); // futex: 1 while the consumer sleeps
+};
+
 // Server APIs
 static char*
 alloc_name(const char* name)
@@ -50,6 +71,223 @@ shm_file_exists(const char* name)
     return shm_exists;
 }
 
+// Multi-producer queue helpers
+// Offsets are monotonic byte counts; the ring position is offset % size.
+// A message is [header|data] where the 64-bit header packs the data length,
+// the message type and the committed flag. The consumer zeroes every message
+// it consumes so that a header slot reads 0 until its producer commits it.
+static int
+futex(_Atomic uint32_t* addr, int op, uint32_t val, const struct timespec* timeout)
+{
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static void
+ring_copy_in(struct HexQueueRing* r, char* buf, uint64_t off, const void* src, size_t n)
+{
+    size_t pos = off % r->size;
+    size_t chunk = min(n, r->size - pos);
+    memcpy(buf + pos, src, chunk);
+    if (chunk < n)
+        memcpy(buf, (const char*)src + chunk, n - chunk);
+}
+
+static void
+ring_copy_out(struct HexQueueRing* r, const char* buf, uint64_t off, void* dst, size_t n)
+{
+    size_t pos = off % r->size;
+    size_t chunk = min(n, r->size - pos);
+    memcpy(dst, buf + pos, chunk);
+    if (chunk < n)
+        memcpy((char*)dst + chunk, buf, n - chunk);
+}
+
+static void
+ring_zero(struct HexQueueRing* r, char* buf, uint64_t off, size_t n)
+{
+    size_t pos = off % r->size;
+    size_t chunk = min(n, r->size - pos);
+    memset(buf + pos, 0, chunk);
+    if (chunk < n)
+        memset(buf, 0, n - chunk);
+}
+
+static inline _Atomic uint64_t*
+ring_header(HexQueue_t q, uint64_t off)
+{
+    return (_Atomic uint64_t*)&q->buf[off % q->size];
+}
+
+static HexQueue_t
+ring_map(const char* qname, size_t qsize, int create)
+{
+    if (qname == NULL)
+        return NULL;
+
+    qsize = align(qsize);
+    if (qsize <= sizeof(struct HexQueueRing) + RING_HDR_SIZE)
+        return NULL;
+
+    HexQueue_t q = (HexQueue_t)malloc(sizeof(struct HexQueue));
+    if (!q)
+        return NULL;
+
+    q->mqd = -1;
+    q->name = alloc_name(qname);
+    q->bookkeeping = 0;
+    q->size = 0;
+    q->id = HexHash16(qname, strlen(qname));
+    q->ring = NULL;
+
+    int fd = shm_open(q->name, create ? O_CREAT|O_RDWR : O_RDWR, S_IRUSR|S_IWUSR);
+    if (fd == -1 || (create && ftruncate(fd, qsize) == -1)) {
+        if (fd != -1)
+            close(fd);
+        free(q->name);
+        free(q);
+        return NULL;
+    }
+
+    struct HexQueueRing* r = (struct HexQueueRing*)mmap(NULL, qsize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    // Close the file descriptor after the mmap call
+    close(fd);
+
+    if (r == MAP_FAILED) {
+        free(q->name);
+        free(q);
+        return NULL;
+    }
+
+    q->ring = r;
+    q->buf = (char*)(r + 1);
+    q->size = qsize - sizeof(struct HexQueueRing);
+    return q;
+}
+
+static int
+ring_valid(HexQueue_t q)
+{
+    struct HexQueueRing* r = q->ring;
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    return r->magic == RING_MAGIC &&
+           r->size == q->size &&
+           head <= tail &&
+           tail - head <= q->size &&
+           head % RING_HDR_SIZE == 0 &&
+           tail % RING_HDR_SIZE == 0;
+}
+
+static int
+ring_send(HexQueue_t q, const struct iovec *vec, int count, int type)
+{
+    struct HexQueueRing* r = q->ring;
+
+    size_t size = 0;
+    int vecIdx;
+    for (vecIdx = 0; vecIdx < count; ++vecIdx)
+         size += vec[vecIdx].iov_len;
+
+    if (size > UINT32_MAX)
+        return HEX_QUEUE_ERROR;
+
+    uint64_t need = align(RING_HDR_SIZE + size);
+    if (need > q->size)
+        return HEX_QUEUE_FULL; // message won't fit
+
+    // Reserve [tail, tail + need) against other producers
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    do {
+        uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (tail + need - head > q->size)
+            return HEX_QUEUE_FULL;
+    } while (!atomic_compare_exchange_weak_explicit(&r->tail, &tail, tail + need,
+                                                    memory_order_relaxed, memory_order_relaxed));
+
+    uint64_t dest = tail + RING_HDR_SIZE;
+    for (vecIdx = 0; vecIdx < count; ++vecIdx) {
+        ring_copy_in(r, q->buf, dest, vec[vecIdx].iov_base, vec[vecIdx].iov_len);
+        dest += vec[vecIdx].iov_len;
+    }
+
+    // MUST write message data first, then header!!!
+    uint64_t header = ((uint64_t)size << 32) | ((uint64_t)(type & 0xffff) << 16) | RING_COMMITTED;
+    atomic_store_explicit(ring_header(q, tail), header, memory_order_release);
+
+    // Ring the doorbell only if the consumer went to sleep on an empty queue
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&r->doorbell, memory_order_relaxed) &&
+        atomic_exchange_explicit(&r->doorbell, 0, memory_order_relaxed)) {
+        if (futex(&r->doorbell, FUTEX_WAKE, 1, NULL) == -1)
+            return HEX_QUEUE_ERROR;
+    }
+
+    return HEX_QUEUE_SUCCESS;
+}
+
+// Validate the message header at head
+static int
+ring_peek_at(HexQueue_t q, uint64_t head, size_t* msgSize, int* type)
+{
+    uint64_t header = atomic_load_explicit(ring_header(q, head), memory_order_acquire);
+
+    // Either empty or the producer holding the reservation has not committed yet
+    if (header == 0)
+        return HEX_QUEUE_EMPTY;
+
+    *msgSize = header >> 32;
+    if (!(header & RING_COMMITTED) || *msgSize > q->size - RING_HDR_SIZE) {
+        // Invalid message header - something has gone terribly wrong
+        return HEX_QUEUE_ERROR;
+    }
+
+    if (type)
+        *type = (header >> 16) & 0xffff;
+
+    return HEX_QUEUE_SUCCESS;
+}
+
+// Advance *head past a message
+// The caller publishes the new head so that a batch releases space only once
+static void
+ring_consume_at(HexQueue_t q, uint64_t* head, size_t msgSize)
+{
+    // Zero out the message so that its slots read as uncommitted on the next lap
+    size_t need = align(RING_HDR_SIZE + msgSize);
+    ring_zero(q->ring, q->buf, *head, need);
+    *head += need;
+}
+
+// Copy the message at *head out of the ring and advance *head past it
+static ssize_t
+ring_receive_at(HexQueue_t q, uint64_t* head, char* msg, size_t size, int* type)
+{
+    size_t msgSize = 0;
+    int rc = ring_peek_at(q, *head, &msgSize, type);
+    if (rc != HEX_QUEUE_SUCCESS)
+        return rc;
+
+    // output buffer too small, notify caller so it might increase buffer and try again.
+    if (size < msgSize)
+        return HEX_QUEUE_BUFFER_TOO_SMALL;
+
+    ring_copy_out(q->ring, q->buf, *head + RING_HDR_SIZE, msg, msgSize);
+    ring_consume_at(q, head, msgSize);
+
+    return msgSize;
+}
+
+static ssize_t
+ring_receive(HexQueue_t q, char* msg, size_t size)
+{
+    // Only the consumer moves head
+    uint64_t head = atomic_load_explicit(&q->ring->head, memory_order_relaxed);
+    ssize_t rc = ring_receive_at(q, &head, msg, size, NULL);
+    if (rc >= 0)
+        atomic_store_explicit(&q->ring->head, head, memory_order_release);
+    return rc;
+}
+
 int
 HexQueueInit(const char* mqname, size_t maxmsgs)
 {
@@ -80,6 +318,7 @@ HexQueueAlloc(const char* qname, size_t qsize)
     q->bookkeeping = 0;
     q->size = 0;
     q->id = HexHash16(qname, strlen(qname));
+    q->ring = NULL;
 
     int shm_existed = shm_file_exists(q->name);   //check if shm already exists.
 
@@ -138,7 +377,10 @@ HexQueueRelease(HexQueue_t q, size_t size)
 {
     int rc = 0;
     if (q) {
-        rc = munmap(q->bookkeeping, size);
+        if (q->ring)
+            rc = munmap(q->ring, size);
+        else
+            rc = munmap(q->bookkeeping, size);
         free(q->name);
         free(q);
     }
@@ -168,12 +410,36 @@ HexQueueWait(int mqd, int* id, int* type, const struct timespec* timeout)
     return rc;
 }
 
+int
+HexQueueWaitMany(int mqd, int* ids, int* types, int count, const struct timespec* timeout)
+{
+    if (count <= 0)
+        return HEX_QUEUE_ERROR;
+
+    int rc = HexQueueWait(mqd, &ids[0], &types[0], timeout);
+    if (rc != HEX_QUEUE_SUCCESS)
+        return rc;
+
+    // Collapse whatever else is already queued without blocking again
+    static const struct timespec expired = { 0, 0 };
+    int n;
+    for (n = 1; n < count; ++n) {
+        if (HexQueueWait(mqd, &ids[n], &types[n], &expired) != HEX_QUEUE_SUCCESS)
+            break;
+    }
+
+    return n;
+}
+
 ssize_t
 HexQueueReceive(HexQueue_t q, char* msg, size_t size)
 {
     if (!q)
         return -1;
 
+    if (q->ring)
+        return ring_receive(q, msg, size);
+
     ssize_t rc = HEX_QUEUE_SUCCESS;
     size_t head = q->bookkeeping->head;
     char* msgPtr = &q->buf[head];
@@ -232,6 +498,200 @@ HexQueueReceive(HexQueue_t q, char* msg, size_t size)
     return rc;
 }
 
+int
+HexQueuePeek(HexQueue_t q, struct iovec spans[2], int* type)
+{
+    if (!q)
+        return HEX_QUEUE_ERROR;
+
+    size_t msgSize = 0;
+    size_t data = 0;
+
+    if (q->ring) {
+        uint64_t head = atomic_load_explicit(&q->ring->head, memory_order_relaxed);
+        int rc = ring_peek_at(q, head, &msgSize, type);
+        if (rc != HEX_QUEUE_SUCCESS)
+            return rc;
+        data = (head + RING_HDR_SIZE) % q->size;
+    }
+    else {
+        size_t head = q->bookkeeping->head;
+        msgSize = *((size_t*)&q->buf[head]);
+
+        if (msgSize >= q->size) {
+            // Invalid message size - something has gone terribly wrong
+            q->bookkeeping->head = q->bookkeeping->tail;
+            return HEX_QUEUE_ERROR;
+        }
+
+        if (msgSize == 0) {
+            if (head != q->bookkeeping->tail) {
+                // Error condition!  Indices show non-empty, but current size field is 0.  Re-sync.
+                q->bookkeeping->head = q->bookkeeping->tail;
+                return HEX_QUEUE_ERROR;
+            }
+            return HEX_QUEUE_EMPTY;
+        }
+
+        if (type)
+            *type = -1;  // carried by the mq notification instead
+        data = (head + sizeof(size_t)) % q->size;
+    }
+
+    // Point into the queue; the second span covers the part that wrapped around
+    spans[0].iov_base = q->buf + data;
+    spans[0].iov_len = min(msgSize, q->size - data);
+    if (spans[0].iov_len == msgSize)
+        return 1;
+
+    spans[1].iov_base = q->buf;
+    spans[1].iov_len = msgSize - spans[0].iov_len;
+    return 2;
+}
+
+int
+HexQueueConsume(HexQueue_t q)
+{
+    if (!q)
+        return HEX_QUEUE_ERROR;
+
+    if (q->ring) {
+        uint64_t head = atomic_load_explicit(&q->ring->head, memory_order_relaxed);
+        size_t msgSize = 0;
+        int rc = ring_peek_at(q, head, &msgSize, NULL);
+        if (rc != HEX_QUEUE_SUCCESS)
+            return rc;
+        ring_consume_at(q, &head, msgSize);
+        atomic_store_explicit(&q->ring->head, head, memory_order_release);
+        return HEX_QUEUE_SUCCESS;
+    }
+
+    size_t head = q->bookkeeping->head;
+    char* msgPtr = &q->buf[head];
+    size_t msgSize = *((size_t*)msgPtr);
+    if (msgSize == 0)
+        return HEX_QUEUE_EMPTY;
+    if (msgSize >= q->size)
+        return HEX_QUEUE_ERROR;
+
+    // Zero out size of message we just processed
+    *((size_t*)msgPtr) = 0;
+    q->bookkeeping->head = align(head + sizeof(size_t) + msgSize) % q->size;
+
+    return HEX_QUEUE_SUCCESS;
+}
+
+static int
+receive_batch(HexQueue_t q, char* buf, size_t size, struct iovec* msgs, int* types, int count)
+{
+    if (!q || count <= 0)
+        return HEX_QUEUE_ERROR;
+
+    uint64_t head = 0;
+    if (q->ring)
+        head = atomic_load_explicit(&q->ring->head, memory_order_relaxed);
+
+    ssize_t rc = HEX_QUEUE_EMPTY;
+    size_t used = 0;
+    int n;
+    for (n = 0; n < count; ++n) {
+        // Pack messages into buf (keeping them aligned) or fill each iovec
+        char* dest = buf ? buf + used : (char*)msgs[n].iov_base;
+        size_t room = buf ? size - used : msgs[n].iov_len;
+
+        if (q->ring)
+            rc = ring_receive_at(q, &head, dest, room, types ? &types[n] : NULL);
+        else {
+            rc = HexQueueReceive(q, dest, room);
+            if (types)
+                types[n] = -1;  // carried by the mq notification instead
+        }
+        if (rc < 0)
+            break;
+
+        msgs[n].iov_base = dest;
+        msgs[n].iov_len = rc;
+        if (buf)
+            used = min(size, align(used + rc));
+    }
+
+    // Release the space of the whole batch at once
+    if (q->ring && n > 0)
+        atomic_store_explicit(&q->ring->head, head, memory_order_release);
+
+    return n > 0 ? n : rc;
+}
+
+int
+HexQueueReceiveBatch(HexQueue_t q, char* buf, size_t size, struct iovec* msgs, int* types, int count)
+{
+    if (!buf)
+        return HEX_QUEUE_ERROR;
+    return receive_batch(q, buf, size, msgs, types, count);
+}
+
+int
+HexQueueReceiveV(HexQueue_t q, struct iovec* vec, int* types, int count)
+{
+    return receive_batch(q, NULL, 0, vec, types, count);
+}
+
+HexQueue_t
+HexQueueAllocMpsc(const char* qname, size_t qsize)
+{
+    HexQueue_t q = ring_map(qname, qsize, 1);
+    if (!q)
+        return NULL;
+
+    // If shm was just created or its header is not sane, start over with an empty queue
+    if (!ring_valid(q)) {
+        memset(q->buf, 0, q->size);
+        q->ring->size = q->size;
+        atomic_store_explicit(&q->ring->head, 0, memory_order_relaxed);
+        atomic_store_explicit(&q->ring->tail, 0, memory_order_relaxed);
+        atomic_store_explicit(&q->ring->doorbell, 0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        q->ring->magic = RING_MAGIC;
+    }
+
+    return q;
+}
+
+int
+HexQueueWaitMpsc(HexQueue_t q, int* qid, int* type, const struct timespec* abs_timeout)
+{
+    if (!q || !q->ring)
+        return HEX_QUEUE_ERROR;
+
+    struct HexQueueRing* r = q->ring;
+
+    while (1) {
+        uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        uint64_t header = atomic_load_explicit(ring_header(q, head), memory_order_acquire);
+        if (header != 0) {
+            atomic_store_explicit(&r->doorbell, 0, memory_order_relaxed);
+            *qid = q->id;
+            *type = (header >> 16) & 0xffff;
+            return HEX_QUEUE_SUCCESS;
+        }
+
+        // Arm the doorbell and check again before going to sleep so that a
+        // message committed in between is not missed
+        if (!atomic_load_explicit(&r->doorbell, memory_order_relaxed)) {
+            atomic_store_explicit(&r->doorbell, 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            continue;
+        }
+
+        if (futex(&r->doorbell, FUTEX_WAIT_BITSET|FUTEX_CLOCK_REALTIME, 1, abs_timeout) == -1) {
+            if (errno == ETIMEDOUT || errno == EINTR)
+                return HEX_QUEUE_EMPTY;
+            else if (errno != EAGAIN)
+                return HEX_QUEUE_ERROR;
+        }
+    }
+}
+
 // Client APIs
 
 HexQueue_t
@@ -254,6 +714,7 @@ HexQueueAttach(const char* mqname, const char* qname, size_t qsize)
     q->bookkeeping = 0;
     q->size = 0;
     q->id = HexHash16(qname, strlen(qname));
+    q->ring = NULL;
 
     int fd = shm_open(q->name, O_RDWR, S_IRUSR|S_IWUSR);
     if (fd == -1) {
@@ -287,11 +748,29 @@ HexQueueAttach(const char* mqname, const char* qname, size_t qsize)
     return q;
 }
 
+HexQueue_t
+HexQueueAttachMpsc(const char* qname, size_t qsize)
+{
+    HexQueue_t q = ring_map(qname, qsize, 0);
+    if (!q)
+        return NULL;
+
+    if (!ring_valid(q)) {
+        HexQueueDetach(q);
+        return NULL;
+    }
+
+    return q;
+}
+
 void
 HexQueueDetach(HexQueue_t q)
 {
     if (q) {
-        mq_close(q->mqd);
+        if (q->ring)
+            munmap(q->ring, sizeof(struct HexQueueRing) + q->size);
+        else
+            mq_close(q->mqd);
         free(q->name);
         free(q);
     }
@@ -300,6 +779,10 @@ HexQueueDetach(HexQueue_t q)
 size_t
 HexQueueAvail(HexQueue_t q)
 {
+    if (q->ring)
+        return q->size - (atomic_load_explicit(&q->ring->tail, memory_order_acquire) -
+                          atomic_load_explicit(&q->ring->head, memory_order_acquire));
+
     size_t space = q->size;
     int head = q->bookkeeping->head;
     int tail = q->bookkeeping->tail;
@@ -348,6 +831,9 @@ HexQueueSendVId(HexQueue_t q, const struct iovec *vec, int count, int type)
     if (!q)
         return HEX_QUEUE_ERROR;
 
+    if (q->ring)
+        return ring_send(q, vec, count, type);
+
     int rc = HEX_QUEUE_SUCCESS;
 
     size_t size = 0;
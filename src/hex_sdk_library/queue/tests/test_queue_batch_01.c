@@ -0,0 +1,180 @@
+// HEX SDK
+#define _GNU_SOURCE
+#include <dlfcn.h>
+
+#include <hex/queue.h>
+
+#include <hex/test.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// Test batched receive on both queue modes and doorbell collapsing
+
+#define MQNAME "/test_mqueue_name"
+#define MAXMSGS 10
+#define QNAME "test_queue_name"
+#define QNAME2 "test_queue_name2"
+#define MPSC_QNAME "test_mpsc_queue_name"
+#define QSIZE 1024
+
+#define align(i) (((i)+sizeof(size_t)-1) & ~(sizeof(size_t)-1))
+
+void set_timeout(struct timespec* t, int ms)
+{
+    clock_gettime(CLOCK_REALTIME, t);
+    t->tv_nsec += ms*1000000;
+    while (t->tv_nsec >= 1000000000)
+    {
+        t->tv_nsec -= 1000000000;
+        t->tv_sec++;
+    }
+}
+
+static void
+send_numbers(HexQueue_t client, int first, int count)
+{
+    int i;
+    for (i = first; i < first + count; ++i) {
+        char msg[32];
+        int len = snprintf(msg, sizeof(msg), "message %d", i) + 1;
+        HEX_TEST(HexQueueSendId(client, msg, len, i) == HEX_QUEUE_SUCCESS);
+    }
+}
+
+static void
+test_mpsc()
+{
+    HexQueue_t server = NULL;
+    HexQueue_t client = NULL;
+    char buf[256];
+    struct iovec msgs[8];
+    int types[8];
+    char expected[32];
+    int i, n;
+
+    HEX_TEST_FATAL((server = HexQueueAllocMpsc(MPSC_QNAME, QSIZE)) != NULL);
+    HEX_TEST_FATAL((client = HexQueueAttachMpsc(MPSC_QNAME, QSIZE)) != NULL);
+
+    HEX_TEST(HexQueueReceiveBatch(server, buf, sizeof(buf), msgs, types, 8) == HEX_QUEUE_EMPTY);
+
+    // Limited by message count
+    send_numbers(client, 0, 12);
+    HEX_TEST((n = HexQueueReceiveBatch(server, buf, sizeof(buf), msgs, types, 8)) == 8);
+    for (i = 0; i < n; ++i) {
+        snprintf(expected, sizeof(expected), "message %d", i);
+        HEX_TEST(msgs[i].iov_len == strlen(expected) + 1);
+        HEX_TEST(strcmp((char*)msgs[i].iov_base, expected) == 0);
+        HEX_TEST(((char*)msgs[i].iov_base - buf) % sizeof(size_t) == 0);
+        HEX_TEST(types[i] == i);
+    }
+
+    // Limited by buffer size: "message N" takes 16 bytes once aligned
+    HEX_TEST((n = HexQueueReceiveBatch(server, buf, 40, msgs, NULL, 8)) == 2);
+    HEX_TEST(strcmp((char*)msgs[0].iov_base, "message 8") == 0);
+    HEX_TEST(strcmp((char*)msgs[1].iov_base, "message 9") == 0);
+
+    // First message does not fit at all
+    HEX_TEST(HexQueueReceiveBatch(server, buf, 4, msgs, types, 8) == HEX_QUEUE_BUFFER_TOO_SMALL);
+
+    // Separate buffers
+    char a[32], b[32], c[4];
+    struct iovec vec[3] = { { a, sizeof(a) }, { b, sizeof(b) }, { c, sizeof(c) } };
+    HEX_TEST(HexQueueReceiveV(server, vec, types, 3) == 2);
+    HEX_TEST(strcmp(a, "message 10") == 0 && vec[0].iov_len == 11);
+    HEX_TEST(strcmp(b, "message 11") == 0 && vec[1].iov_len == 11);
+    HEX_TEST(types[0] == 10 && types[1] == 11);
+    HEX_TEST(vec[2].iov_len == sizeof(c));
+
+    HexQueueDetach(client);
+    HexQueueRelease(server, QSIZE);
+}
+
+static void
+test_mq()
+{
+    mqd_t fd = -1;
+    HexQueue_t server = NULL;
+    HexQueue_t server2 = NULL;
+    HexQueue_t client = NULL;
+    HexQueue_t client2 = NULL;
+    struct timespec ts;
+    char buf[256];
+    struct iovec msgs[8];
+    int ids[MAXMSGS], types[MAXMSGS];
+    int i, n;
+
+    HEX_TEST_FATAL((fd = HexQueueInit(MQNAME, MAXMSGS)) != -1);
+    HEX_TEST_FATAL((server = HexQueueAlloc(QNAME, QSIZE)) != NULL);
+    HEX_TEST_FATAL((server2 = HexQueueAlloc(QNAME2, QSIZE)) != NULL);
+    HEX_TEST_FATAL((client = HexQueueAttach(MQNAME, QNAME, QSIZE)) != NULL);
+    HEX_TEST_FATAL((client2 = HexQueueAttach(MQNAME, QNAME2, QSIZE)) != NULL);
+
+    set_timeout(&ts, 100);
+    HEX_TEST(HexQueueWaitMany(fd, ids, types, MAXMSGS, &ts) == HEX_QUEUE_EMPTY);
+
+    // Notifications of both queues are collapsed in order with their ids and types
+    send_numbers(client, 0, 3);
+    send_numbers(client2, 3, 2);
+    set_timeout(&ts, 100);
+    HEX_TEST((n = HexQueueWaitMany(fd, ids, types, MAXMSGS, &ts)) == 5);
+    for (i = 0; i < n; ++i) {
+        HEX_TEST(ids[i] == (i < 3 ? server->id : server2->id));
+        HEX_TEST(types[i] == i);
+    }
+
+    // Drain each queue with one call; mq based queues store aligned sizes
+    HEX_TEST((n = HexQueueReceiveBatch(server, buf, sizeof(buf), msgs, types, 8)) == 3);
+    for (i = 0; i < n; ++i) {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "message %d", i);
+        HEX_TEST(msgs[i].iov_len == align(strlen(expected) + 1));
+        HEX_TEST(strcmp((char*)msgs[i].iov_base, expected) == 0);
+        HEX_TEST(types[i] == -1);
+    }
+    HEX_TEST(HexQueueReceiveBatch(server, buf, sizeof(buf), msgs, types, 8) == HEX_QUEUE_EMPTY);
+
+    char a[32], b[32];
+    struct iovec vec[2] = { { a, sizeof(a) }, { b, sizeof(b) } };
+    HEX_TEST(HexQueueReceiveV(server2, vec, NULL, 2) == 2);
+    HEX_TEST(strcmp(a, "message 3") == 0);
+    HEX_TEST(strcmp(b, "message 4") == 0);
+
+    // Count limits the collapsed notifications
+    send_numbers(client, 5, 4);
+    set_timeout(&ts, 100);
+    HEX_TEST(HexQueueWaitMany(fd, ids, types, 3, &ts) == 3);
+    HEX_TEST(HexQueueWaitMany(fd, ids, types, 3, &ts) == 1);
+    HEX_TEST(ids[0] == server->id && types[0] == 8);
+    HEX_TEST(HexQueueReceiveBatch(server, buf, sizeof(buf), msgs, NULL, 8) == 4);
+
+    HexQueueDetach(client);
+    HexQueueDetach(client2);
+    HexQueueRelease(server, QSIZE);
+    HexQueueRelease(server2, QSIZE);
+    HexQueueFini(fd);
+}
+
+int main()
+{
+    int (*shm_unlink)(const char*) = (int (*)(const char*)) dlsym(RTLD_NEXT, "shm_unlink");
+    char name[50], name2[50], mpscName[50];
+    snprintf(name, sizeof(name), "%s%s", "/queue_", QNAME);
+    snprintf(name2, sizeof(name2), "%s%s", "/queue_", QNAME2);
+    snprintf(mpscName, sizeof(mpscName), "%s%s", "/queue_", MPSC_QNAME);
+    shm_unlink(name);
+    shm_unlink(name2);
+    shm_unlink(mpscName);
+    mq_unlink(MQNAME);
+
+    test_mpsc();
+    test_mq();
+
+    shm_unlink(name);
+    shm_unlink(name2);
+    shm_unlink(mpscName);
+    mq_unlink(MQNAME);
+
+    return HexTestResult;
+}
@@ -0,0 +1,213 @@
+// HEX SDK
+#define _GNU_SOURCE
+#include <dlfcn.h>
+
+#include <hex/queue.h>
+
+#include <hex/test.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/wait.h>
+
+// Compare throughput of the mq based queue and the multi-producer queue
+// Producers run in separate processes like real clients do
+
+#define MQNAME "/test_mqueue_name"
+#define QNAME "test_queue_name"
+#define MPSC_QNAME "test_mpsc_queue_name"
+#define MAXMSGS 10      // default fs.mqueue.msg_max
+#define QSIZE 65536
+#define MSG_SIZE 64
+#define NUM_EVENTS 200000
+
+typedef HexQueue_t (*AttachFunc)(int producer);
+
+static HexQueue_t
+attach_mq(int producer)
+{
+    return HexQueueAttach(MQNAME, QNAME, QSIZE);
+}
+
+static HexQueue_t
+attach_mpsc(int producer)
+{
+    return HexQueueAttachMpsc(MPSC_QNAME, QSIZE);
+}
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void set_timeout(struct timespec* t, int ms)
+{
+    clock_gettime(CLOCK_REALTIME, t);
+    t->tv_nsec += ms*1000000;
+    while (t->tv_nsec >= 1000000000)
+    {
+        t->tv_nsec -= 1000000000;
+        t->tv_sec++;
+    }
+}
+
+static int
+producer(AttachFunc attach, int id, int count)
+{
+    HexQueue_t client = NULL;
+    HEX_TEST_FATAL((client = attach(id)) != NULL);
+
+    char msg[MSG_SIZE];
+    memset(msg, 'a' + id, sizeof(msg));
+
+    int i;
+    for (i = 0; i < count; ++i) {
+        int r;
+        memcpy(msg, &i, sizeof(i));
+        while ((r = HexQueueSend(client, msg, sizeof(msg))) == HEX_QUEUE_FULL)
+            sched_yield();
+        HEX_TEST(r == HEX_QUEUE_SUCCESS);
+    }
+
+    HexQueueDetach(client);
+    return HexTestResult;
+}
+
+static void
+start_producers(AttachFunc attach, int producers, pid_t* pids)
+{
+    int i;
+    for (i = 0; i < producers; ++i) {
+        pids[i] = fork();
+        HEX_TEST_FATAL(pids[i] != -1);
+        if (pids[i] == 0)
+            exit(producer(attach, i, NUM_EVENTS / producers));
+    }
+}
+
+static void
+wait_producers(int producers, pid_t* pids)
+{
+    int i;
+    for (i = 0; i < producers; ++i) {
+        int status = -1;
+        HEX_TEST(waitpid(pids[i], &status, 0) == pids[i]);
+        HEX_TEST(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+}
+
+static double
+bench_mq(int fd, HexQueue_t server)
+{
+    pid_t pids[1];
+    char buf[MSG_SIZE];
+    struct timespec ts;
+    int source, type;
+    int received = 0;
+
+    double start = now();
+    start_producers(attach_mq, 1, pids);
+    while (received < NUM_EVENTS) {
+        set_timeout(&ts, 5000);
+        HEX_TEST_FATAL(HexQueueWait(fd, &source, &type, &ts) == HEX_QUEUE_SUCCESS);
+        HEX_TEST(source == server->id);
+        if (HexQueueReceive(server, buf, sizeof(buf)) == MSG_SIZE)
+            received++;
+    }
+    double secs = now() - start;
+    wait_producers(1, pids);
+    return secs;
+}
+
+static double
+bench_mq_batch(int fd, HexQueue_t server)
+{
+    pid_t pids[1];
+    char buf[MAXMSGS * MSG_SIZE];
+    struct iovec msgs[MAXMSGS];
+    struct timespec ts;
+    int ids[MAXMSGS], types[MAXMSGS];
+    int received = 0;
+    int n;
+
+    double start = now();
+    start_producers(attach_mq, 1, pids);
+    while (received < NUM_EVENTS) {
+        set_timeout(&ts, 5000);
+        HEX_TEST_FATAL((n = HexQueueWaitMany(fd, ids, types, MAXMSGS, &ts)) > 0);
+        HEX_TEST(ids[n - 1] == server->id);
+        if ((n = HexQueueReceiveBatch(server, buf, sizeof(buf), msgs, NULL, n)) > 0)
+            received += n;
+    }
+    double secs = now() - start;
+    wait_producers(1, pids);
+    return secs;
+}
+
+static double
+bench_mpsc(HexQueue_t server, int producers)
+{
+    pid_t pids[producers];
+    char buf[MSG_SIZE];
+    struct timespec ts;
+    int source, type;
+    int received = 0;
+    ssize_t n;
+
+    double start = now();
+    start_producers(attach_mpsc, producers, pids);
+    while (received < NUM_EVENTS) {
+        set_timeout(&ts, 5000);
+        HEX_TEST_FATAL(HexQueueWaitMpsc(server, &source, &type, &ts) == HEX_QUEUE_SUCCESS);
+        HEX_TEST(source == server->id);
+        while ((n = HexQueueReceive(server, buf, sizeof(buf))) == MSG_SIZE)
+            received++;
+        HEX_TEST(n == HEX_QUEUE_EMPTY);
+    }
+    double secs = now() - start;
+    wait_producers(producers, pids);
+    return secs;
+}
+
+int main()
+{
+    int (*shm_unlink)(const char*) = (int (*)(const char*)) dlsym(RTLD_NEXT, "shm_unlink");
+    char name[50], mpscName[50];
+    snprintf(name, sizeof(name), "%s%s", "/queue_", QNAME);
+    snprintf(mpscName, sizeof(mpscName), "%s%s", "/queue_", MPSC_QNAME);
+    shm_unlink(name);
+    shm_unlink(mpscName);
+    mq_unlink(MQNAME);
+
+    mqd_t fd = -1;
+    HexQueue_t server = NULL;
+
+    HEX_TEST_FATAL((fd = HexQueueInit(MQNAME, MAXMSGS)) != -1);
+    HEX_TEST_FATAL((server = HexQueueAlloc(QNAME, QSIZE)) != NULL);
+    double mq = bench_mq(fd, server);
+    double mqBatch = bench_mq_batch(fd, server);
+    HexQueueRelease(server, QSIZE);
+    HexQueueFini(fd);
+
+    HEX_TEST_FATAL((server = HexQueueAllocMpsc(MPSC_QNAME, QSIZE)) != NULL);
+    double mpsc1 = bench_mpsc(server, 1);
+    double mpsc4 = bench_mpsc(server, 4);
+    HexQueueRelease(server, QSIZE);
+
+    printf("%d messages of %d bytes\n", NUM_EVENTS, MSG_SIZE);
+    printf("mq doorbell, 1 producer:  %.3f secs, %.0f msgs/sec\n", mq, NUM_EVENTS / mq);
+    printf("mq batched, 1 producer:   %.3f secs, %.0f msgs/sec\n", mqBatch, NUM_EVENTS / mqBatch);
+    printf("mpsc futex, 1 producer:   %.3f secs, %.0f msgs/sec\n", mpsc1, NUM_EVENTS / mpsc1);
+    printf("mpsc futex, 4 producers:  %.3f secs, %.0f msgs/sec\n", mpsc4, NUM_EVENTS / mpsc4);
+
+    shm_unlink(name);
+    shm_unlink(mpscName);
+    mq_unlink(MQNAME);
+
+    return HexTestResult;
+}
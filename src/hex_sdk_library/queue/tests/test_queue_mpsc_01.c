@@ -0,0 +1,190 @@
+// HEX SDK
+#define _GNU_SOURCE
+#include <dlfcn.h>
+
+#include <hex/queue.h>
+
+#include <hex/test.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/wait.h>
+
+// Test that several producer processes can share one multi-producer queue
+// without losing, reordering or tearing messages
+
+#define QNAME "test_mpsc_queue_name"
+#define QSIZE 4096      // small enough to wrap and fill up many times
+#define PRODUCERS 4
+#define NUM_EVENTS 20000
+
+size_t HexQueueAvail(HexQueue_t e); //TODO: export this?
+
+struct Event
+{
+    uint32_t producer;
+    uint32_t seq_no;
+    uint32_t len;
+    char data[200];
+};
+
+static size_t
+event_size(uint32_t seq_no)
+{
+    // Vary the payload length so messages straddle the end of the ring
+    return offsetof(struct Event, data) + seq_no % 200;
+}
+
+static void
+event_fill(struct Event* e, uint32_t producer, uint32_t seq_no)
+{
+    e->producer = producer;
+    e->seq_no = seq_no;
+    e->len = seq_no % 200;
+    memset(e->data, 'a' + (seq_no + producer) % 26, e->len);
+}
+
+void set_timeout(struct timespec* t, int ms)
+{
+    clock_gettime(CLOCK_REALTIME, t);
+    t->tv_nsec += ms*1000000;
+    while (t->tv_nsec >= 1000000000)
+    {
+        t->tv_nsec -= 1000000000;
+        t->tv_sec++;
+    }
+}
+
+static int
+producer(uint32_t id)
+{
+    HexQueue_t client = NULL;
+    HEX_TEST_FATAL((client = HexQueueAttachMpsc(QNAME, QSIZE)) != NULL);
+
+    uint32_t seq_no;
+    for (seq_no = 1; seq_no <= NUM_EVENTS; ++seq_no) {
+        struct Event e;
+        event_fill(&e, id, seq_no);
+
+        int r;
+        while ((r = HexQueueSendId(client, &e, event_size(seq_no), id + 1)) == HEX_QUEUE_FULL)
+            sched_yield();
+        HEX_TEST(r == HEX_QUEUE_SUCCESS);
+    }
+
+    HexQueueDetach(client);
+    return HexTestResult;
+}
+
+int main()
+{
+    int (*shm_unlink)(const char*) = (int (*)(const char*)) dlsym(RTLD_NEXT, "shm_unlink");
+    char name[50];
+    snprintf(name, sizeof(name), "%s%s", "/queue_", QNAME);
+    shm_unlink(name);
+
+    HexQueue_t server = NULL;
+    HexQueue_t client = NULL;
+    struct timespec ts;
+    char buf[sizeof(struct Event)];
+    int source = 0;
+    int event_type = 0;
+    ssize_t n;
+
+    // Producers can't attach before the server allocated the queue
+    HEX_TEST(HexQueueAttachMpsc(QNAME, QSIZE) == NULL);
+
+    HEX_TEST_FATAL((server = HexQueueAllocMpsc(QNAME, QSIZE)) != NULL);
+    HEX_TEST(server->ring != NULL);
+    size_t capacity = HexQueueAvail(server);
+    HEX_TEST(capacity < QSIZE);
+
+    // Waiting on an empty queue times out
+    set_timeout(&ts, 100);
+    HEX_TEST(HexQueueWaitMpsc(server, &source, &event_type, &ts) == HEX_QUEUE_EMPTY);
+    HEX_TEST(HexQueueReceive(server, buf, sizeof(buf)) == HEX_QUEUE_EMPTY);
+
+    // Round trip a single message and its type
+    HEX_TEST_FATAL((client = HexQueueAttachMpsc(QNAME, QSIZE)) != NULL);
+    HEX_TEST(HexQueueSendId(client, "hello", 6, 42) == HEX_QUEUE_SUCCESS);
+    HEX_TEST(HexQueueAvail(server) < capacity);
+    set_timeout(&ts, 100);
+    HEX_TEST(HexQueueWaitMpsc(server, &source, &event_type, &ts) == HEX_QUEUE_SUCCESS);
+    HEX_TEST(source == server->id);
+    HEX_TEST(event_type == 42);
+    HEX_TEST(HexQueueReceive(server, buf, 2) == HEX_QUEUE_BUFFER_TOO_SMALL);
+    HEX_TEST(HexQueueReceive(server, buf, sizeof(buf)) == 6);
+    HEX_TEST(strcmp(buf, "hello") == 0);
+    HEX_TEST(HexQueueAvail(server) == capacity);
+
+    // Default type is the queue id, same as the mq based queues
+    HEX_TEST(HexQueueSend(client, "x", 2) == HEX_QUEUE_SUCCESS);
+    HEX_TEST(HexQueueWaitMpsc(server, &source, &event_type, NULL) == HEX_QUEUE_SUCCESS);
+    HEX_TEST(event_type == (server->id & 0xffff));
+    HEX_TEST(HexQueueReceive(server, buf, sizeof(buf)) == 2);
+
+    // A message larger than the whole queue never fits
+    static char big[QSIZE];
+    HEX_TEST(HexQueueSend(client, big, sizeof(big)) == HEX_QUEUE_FULL);
+    HexQueueDetach(client);
+
+    // Concurrent producers in separate processes
+    pid_t pids[PRODUCERS];
+    uint32_t i;
+    for (i = 0; i < PRODUCERS; ++i) {
+        pids[i] = fork();
+        HEX_TEST_FATAL(pids[i] != -1);
+        if (pids[i] == 0)
+            exit(producer(i));
+    }
+
+    uint32_t expected[PRODUCERS];
+    for (i = 0; i < PRODUCERS; ++i)
+        expected[i] = 1;
+
+    uint32_t received = 0;
+    while (received < PRODUCERS * NUM_EVENTS) {
+        set_timeout(&ts, 5000);
+        int r = HexQueueWaitMpsc(server, &source, &event_type, &ts);
+        HEX_TEST_FATAL(r == HEX_QUEUE_SUCCESS);
+
+        // Drain everything that is available before waiting again
+        while ((n = HexQueueReceive(server, buf, sizeof(buf))) > 0) {
+            struct Event* e = (struct Event*)buf;
+            HEX_TEST_FATAL(e->producer < PRODUCERS);
+            HEX_TEST(e->seq_no == expected[e->producer]);
+            HEX_TEST((size_t)n == event_size(e->seq_no));
+            HEX_TEST(e->len == e->seq_no % 200);
+
+            struct Event check;
+            event_fill(&check, e->producer, e->seq_no);
+            HEX_TEST(memcmp(e->data, check.data, e->len) == 0);
+
+            expected[e->producer] = e->seq_no + 1;
+            received++;
+        }
+        HEX_TEST(n == HEX_QUEUE_EMPTY);
+    }
+
+    for (i = 0; i < PRODUCERS; ++i) {
+        int status = -1;
+        HEX_TEST(waitpid(pids[i], &status, 0) == pids[i]);
+        HEX_TEST(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        HEX_TEST(expected[i] == NUM_EVENTS + 1);
+    }
+
+    HEX_TEST(HexQueueAvail(server) == capacity);
+
+    // Re-allocating keeps a sane queue
+    HEX_TEST(HexQueueRelease(server, QSIZE) == 0);
+    HEX_TEST_FATAL((server = HexQueueAllocMpsc(QNAME, QSIZE)) != NULL);
+    HEX_TEST(HexQueueAvail(server) == capacity);
+    HexQueueRelease(server, QSIZE);
+
+    shm_unlink(name);
+
+    return HexTestResult;
+}
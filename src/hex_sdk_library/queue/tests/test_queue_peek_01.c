@@ -0,0 +1,142 @@
+// HEX SDK
+#define _GNU_SOURCE
+#include <dlfcn.h>
+
+#include <hex/queue.h>
+
+#include <hex/test.h>
+
+#include <string.h>
+#include <time.h>
+
+// Test zero-copy peek/consume on both queue modes, including messages that
+// wrap around the end of the queue
+
+#define MQNAME "/test_mqueue_name"
+#define MAXMSGS 10
+#define QNAME "test_queue_name"
+#define MPSC_QNAME "test_mpsc_queue_name"
+#define DATA_SIZE 256
+#define QSIZE (2*sizeof(size_t) + DATA_SIZE)
+#define MPSC_QSIZE (256 + DATA_SIZE)    // multi-producer queue header takes 4 cache lines
+#define MSG_SIZE 100
+
+void set_timeout(struct timespec* t, int ms)
+{
+    clock_gettime(CLOCK_REALTIME, t);
+    t->tv_nsec += ms*1000000;
+    while (t->tv_nsec >= 1000000000)
+    {
+        t->tv_nsec -= 1000000000;
+        t->tv_sec++;
+    }
+}
+
+// Check a peeked message against its pattern and return its total length
+// mq based queues pad messages to an aligned size so only check MSG_SIZE bytes
+static size_t
+check_spans(struct iovec* spans, int n, char c)
+{
+    size_t len = 0;
+    int i;
+    for (i = 0; i < n; ++i) {
+        size_t j;
+        for (j = 0; j < spans[i].iov_len; ++j) {
+            if (len + j < MSG_SIZE && ((char*)spans[i].iov_base)[j] != c)
+                return 0;
+        }
+        len += spans[i].iov_len;
+    }
+    return len;
+}
+
+static void
+test_queue(HexQueue_t server, HexQueue_t client, int mpsc)
+{
+    struct iovec spans[2];
+    char msg[MSG_SIZE];
+    int type = 0;
+    int i;
+
+    HEX_TEST(HexQueuePeek(server, spans, &type) == HEX_QUEUE_EMPTY);
+    HEX_TEST(HexQueueConsume(server) == HEX_QUEUE_EMPTY);
+
+    // Two messages that fit before the end of the queue
+    for (i = 0; i < 2; ++i) {
+        memset(msg, 'a' + i, sizeof(msg));
+        HEX_TEST(HexQueueSendId(client, msg, sizeof(msg), 10 + i) == HEX_QUEUE_SUCCESS);
+    }
+    for (i = 0; i < 2; ++i) {
+        HEX_TEST(HexQueuePeek(server, spans, &type) == 1);
+        HEX_TEST(spans[0].iov_base >= (void*)server->buf);
+        HEX_TEST((char*)spans[0].iov_base + spans[0].iov_len <= server->buf + server->size);
+        HEX_TEST(check_spans(spans, 1, 'a' + i) >= MSG_SIZE);
+        HEX_TEST(type == (mpsc ? 10 + i : -1));
+
+        // Peeking again returns the same message
+        HEX_TEST(HexQueuePeek(server, spans, NULL) == 1);
+        HEX_TEST(check_spans(spans, 1, 'a' + i) >= MSG_SIZE);
+        HEX_TEST(HexQueueConsume(server) == HEX_QUEUE_SUCCESS);
+    }
+
+    // Third message wraps around the end of the queue
+    memset(msg, 'z', sizeof(msg));
+    HEX_TEST(HexQueueSendId(client, msg, sizeof(msg), 12) == HEX_QUEUE_SUCCESS);
+    HEX_TEST(HexQueuePeek(server, spans, &type) == 2);
+    HEX_TEST(spans[1].iov_base == (void*)server->buf);
+    HEX_TEST((char*)spans[0].iov_base + spans[0].iov_len == server->buf + server->size);
+    HEX_TEST(check_spans(spans, 2, 'z') == (mpsc ? MSG_SIZE : 104));
+    HEX_TEST(HexQueueConsume(server) == HEX_QUEUE_SUCCESS);
+
+    // Receive and peek interleave
+    memset(msg, 'q', sizeof(msg));
+    HEX_TEST(HexQueueSend(client, msg, sizeof(msg)) == HEX_QUEUE_SUCCESS);
+    HEX_TEST(HexQueueSend(client, msg, sizeof(msg)) == HEX_QUEUE_SUCCESS);
+    HEX_TEST(HexQueuePeek(server, spans, NULL) == 1);
+    HEX_TEST(HexQueueConsume(server) == HEX_QUEUE_SUCCESS);
+    char buf[DATA_SIZE];
+    HEX_TEST(HexQueueReceive(server, buf, sizeof(buf)) >= MSG_SIZE);
+    HEX_TEST(buf[0] == 'q' && buf[MSG_SIZE - 1] == 'q');
+    HEX_TEST(HexQueuePeek(server, spans, NULL) == HEX_QUEUE_EMPTY);
+}
+
+int main()
+{
+    int (*shm_unlink)(const char*) = (int (*)(const char*)) dlsym(RTLD_NEXT, "shm_unlink");
+    char name[50], mpscName[50];
+    snprintf(name, sizeof(name), "%s%s", "/queue_", QNAME);
+    snprintf(mpscName, sizeof(mpscName), "%s%s", "/queue_", MPSC_QNAME);
+    shm_unlink(name);
+    shm_unlink(mpscName);
+    mq_unlink(MQNAME);
+
+    mqd_t fd = -1;
+    HexQueue_t server = NULL;
+    HexQueue_t client = NULL;
+    struct timespec ts;
+    int ids[MAXMSGS], types[MAXMSGS];
+
+    HEX_TEST_FATAL((server = HexQueueAllocMpsc(MPSC_QNAME, MPSC_QSIZE)) != NULL);
+    HEX_TEST_FATAL((client = HexQueueAttachMpsc(MPSC_QNAME, MPSC_QSIZE)) != NULL);
+    HEX_TEST(server->size == DATA_SIZE);
+    test_queue(server, client, 1);
+    HexQueueDetach(client);
+    HexQueueRelease(server, MPSC_QSIZE);
+
+    HEX_TEST_FATAL((fd = HexQueueInit(MQNAME, MAXMSGS)) != -1);
+    HEX_TEST_FATAL((server = HexQueueAlloc(QNAME, QSIZE)) != NULL);
+    HEX_TEST_FATAL((client = HexQueueAttach(MQNAME, QNAME, QSIZE)) != NULL);
+    HEX_TEST(server->size == DATA_SIZE);
+    test_queue(server, client, 0);
+    set_timeout(&ts, 100);
+    HEX_TEST(HexQueueWaitMany(fd, ids, types, MAXMSGS, &ts) == 5);
+    HexQueueDetach(client);
+    HexQueueRelease(server, QSIZE);
+    HexQueueFini(fd);
+
+    shm_unlink(name);
+    shm_unlink(mpscName);
+    mq_unlink(MQNAME);
+
+    return HexTestResult;
+}
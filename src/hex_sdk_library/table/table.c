@@ -9,12 +9,46 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 #include <hex/table.h>
 
 static const char shm_prefix[] = "/tbl_shm_";
 static const char sem_prefix[] = "/tbl_sem_";
 
+#define SNAPSHOT_MAGIC 0x48545351   // "HTSQ"
+#define SNAPSHOT_RETRIES 100
+
+// Align a size to a multiple of 8
+#define align(i) (((i) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1))
+
+/* snapshot table layout: [HexTableShm|HexTableSeq|buffer 0|buffer 1]
+ * : the producer writes the buffer that is not current, bumping its sequence
+ *   counter to odd before and back to even after the write, then publishes
+ *   it by incrementing the generation (buffer = generation % 2)
+ * : consumers copy the current buffer and retry if its sequence counter
+ *   was odd or changed meanwhile
+ */
+struct HexTableSlot
+{
+    _Atomic uint64_t seq;
+    uint64_t storedDataSize;
+};
+
+struct HexTableSeq
+{
+    uint64_t magic;
+    _Atomic uint64_t generation;
+    struct HexTableSlot slot[2];
+};
+
+static char*
+slot_data(HexTable_t s, int slot)
+{
+    return (char*)(s->seq + 1) + slot * align(s->shmPtr->size);
+}
+
 /* producer allows to unlink shmName and semName
  * : restart of producer would clean up the memory region
  */
@@ -106,10 +140,97 @@ prod_cleanup:
     return NULL;
 }
 
+HexTable_t
+HexTableProdInitSnapshot(const char *name, size_t size)
+{
+    if (!name)
+        return NULL;
+
+    HexTable_t s = (HexTable_t)malloc(sizeof(struct HexTable));
+    if (!s)
+        return NULL;
+
+    memset(s, 0, sizeof(struct HexTable));
+
+    // Remove the semaphore of a previous semaphore based producer so that
+    // consumers attach in snapshot mode
+    s->semName = alloc_name(sem_prefix, name);
+    if (!s->semName) {
+        free(s);
+        return NULL;
+    }
+
+    if (sem_unlink(s->semName) == -1 && errno != ENOENT) {
+        free_name(s->semName);
+        free(s);
+        return NULL;
+    }
+
+    s->shmName = alloc_name(shm_prefix, name);
+    int fd = shm_open(s->shmName, O_CREAT|O_RDWR, S_IRUSR|S_IWUSR);
+    if (fd == -1) {
+        free_name(s->semName);
+        free_name(s->shmName);
+        free(s);
+        return NULL;
+    }
+
+    size_t total = sizeof(struct HexTableShm) + sizeof(struct HexTableSeq) + 2 * align(size);
+
+    if (ftruncate(fd, total) == -1) {
+        close(fd);
+        goto snapshot_cleanup;
+    }
+
+    s->shmPtr = (struct HexTableShm*)mmap(NULL, total, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (s->shmPtr == MAP_FAILED) {
+        goto snapshot_cleanup;
+    }
+
+    s->size = total;
+    s->seq = (struct HexTableSeq*)(s->shmPtr + 1);
+
+    // Generations carry on from a previous producer of the table, or start
+    // from the time, so that a consumer still holding one from an earlier
+    // run never takes the new contents for unchanged
+    uint64_t generation;
+    if (s->seq->magic == SNAPSHOT_MAGIC) {
+        generation = atomic_load_explicit(&s->seq->generation, memory_order_relaxed) + 1;
+    }
+    else {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        generation = (uint64_t)now.tv_sec << 32;
+    }
+
+    memset(s->shmPtr, 0, sizeof(struct HexTableShm) + sizeof(struct HexTableSeq));
+    s->shmPtr->storedDataSize = 0; // Nothing is stored yet.
+    s->shmPtr->size = size;
+    atomic_store_explicit(&s->seq->generation, generation, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    s->seq->magic = SNAPSHOT_MAGIC;
+
+    return s;
+
+snapshot_cleanup:
+    free_name(s->semName);
+    shm_unlink(s->shmName);
+    free_name(s->shmName);
+    free(s);
+    return NULL;
+}
+
 void
 HexTableProdFini(HexTable_t s)
 {
-    if (s) {
+    if (s && s->seq) {
+        free_name(s->semName);
+        shm_unlink(s->shmName);
+        free_name(s->shmName);
+        free(s);
+    }
+    else if (s) {
         sem_close(s->sem);
         sem_unlink(s->semName);
         free_name(s->semName);
@@ -128,12 +249,49 @@ HexTableProdWrite(HexTable_t s, const char* entry, size_t len)
     return HexTableProdWriteV(s, &vec, 1);
 }
 
+static int
+snapshot_write(HexTable_t s, const struct iovec *vec, int count)
+{
+    size_t dataSize = 0;
+    int vecIdx;
+    for (vecIdx = 0; vecIdx < count; ++vecIdx)
+         dataSize += vec[vecIdx].iov_len;
+
+    if (dataSize > s->shmPtr->size)
+        return HEX_TABLE_TOO_SMALL;
+
+    // Only the producer moves the generation
+    uint64_t generation = atomic_load_explicit(&s->seq->generation, memory_order_relaxed) + 1;
+    int slot = generation % 2;
+    struct HexTableSlot* sl = &s->seq->slot[slot];
+    uint64_t seq = atomic_load_explicit(&sl->seq, memory_order_relaxed);
+
+    // odd: write in progress
+    atomic_store_explicit(&sl->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    char* destPtr = slot_data(s, slot);
+    for (vecIdx = 0; vecIdx < count; ++vecIdx) {
+        memcpy(destPtr, vec[vecIdx].iov_base, vec[vecIdx].iov_len);
+        destPtr += vec[vecIdx].iov_len;
+    }
+    sl->storedDataSize = dataSize;
+
+    atomic_store_explicit(&sl->seq, seq + 2, memory_order_release);
+    atomic_store_explicit(&s->seq->generation, generation, memory_order_release);
+
+    return HEX_TABLE_SUCCESS;
+}
+
 int
 HexTableProdWriteV(HexTable_t s, const struct iovec *vec, int count)
 {
     if (!s)
         return HEX_TABLE_ERROR;
 
+    if (s->seq)
+        return snapshot_write(s, vec, count);
+
     // Wait until table buffer is available.
     time_t start_time = time(0);
     while (sem_wait(s->sem) < 0) {
@@ -178,6 +336,51 @@ HexTableProdWriteV(HexTable_t s, const struct iovec *vec, int count)
 }
 
 // Consumer APIs.
+
+// Attach to a snapshot table, which has no semaphore
+static HexTable_t
+snapshot_attach(HexTable_t s, const char* name, size_t* size)
+{
+    s->shmName = alloc_name(shm_prefix, name);
+    if (!s->shmName)
+        return NULL;
+
+    int fd = shm_open(s->shmName, O_RDWR, S_IRUSR|S_IWUSR);
+    if (fd == -1) {
+        free_name(s->shmName);
+        return NULL;
+    }
+
+    struct stat stat;
+    fstat(fd, &stat);
+    if ((size_t)stat.st_size < sizeof(struct HexTableShm) + sizeof(struct HexTableSeq)) {
+        close(fd);
+        free_name(s->shmName);
+        return NULL;
+    }
+
+    s->shmPtr = (struct HexTableShm*)mmap(NULL, stat.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (s->shmPtr == MAP_FAILED) {
+        free_name(s->shmName);
+        return NULL;
+    }
+
+    s->seq = (struct HexTableSeq*)(s->shmPtr + 1);
+    if (s->seq->magic != SNAPSHOT_MAGIC ||
+        sizeof(struct HexTableShm) + sizeof(struct HexTableSeq) + 2 * align(s->shmPtr->size) > (size_t)stat.st_size) {
+        munmap(s->shmPtr, stat.st_size);
+        free_name(s->shmName);
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    s->size = stat.st_size;
+    *size = s->shmPtr->size;
+
+    return s;
+}
+
 HexTable_t
 HexTableConsInit(const char* name, size_t* size)
 {
@@ -198,6 +401,10 @@ HexTableConsInit(const char* name, size_t* size)
 
     s->sem = sem_open(s->semName, 0);
     if (s->sem == SEM_FAILED) {
+        s->sem = NULL;
+        if (snapshot_attach(s, name, size))
+            return s;
+
         free_name(s->semName);
         free(s);
         return NULL;
@@ -232,7 +439,10 @@ void
 HexTableConsFini(HexTable_t s)
 {
     if (s) {
-        sem_close(s->sem);
+        if (s->seq)
+            munmap(s->shmPtr, s->size);
+        else
+            sem_close(s->sem);
         free_name(s->semName);
         // consumer: dont unlink shmName
         free_name(s->shmName);
@@ -240,12 +450,51 @@ HexTableConsFini(HexTable_t s)
     }
 }
 
+static ssize_t
+snapshot_read(HexTable_t s, char* msg, size_t size, uint64_t* generation)
+{
+    int retry;
+    for (retry = 0; retry < SNAPSHOT_RETRIES; ++retry) {
+        uint64_t current = atomic_load_explicit(&s->seq->generation, memory_order_acquire);
+        if (generation && *generation == current)
+            return HEX_TABLE_UNCHANGED;
+
+        int slot = current % 2;
+        struct HexTableSlot* sl = &s->seq->slot[slot];
+        uint64_t seq = atomic_load_explicit(&sl->seq, memory_order_acquire);
+        if (seq % 2 == 0) {
+            size_t dataSize = sl->storedDataSize;
+            ssize_t rc = HEX_TABLE_TOO_SMALL;
+            if (dataSize <= s->shmPtr->size && dataSize <= size) {
+                memcpy(msg, slot_data(s, slot), dataSize);
+                rc = dataSize;
+            }
+
+            // The copy is good only if no write started on this buffer meanwhile
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&sl->seq, memory_order_relaxed) == seq) {
+                if (generation && rc >= 0)
+                    *generation = current;
+                return rc;
+            }
+        }
+
+        // Torn read: the producer lapped us
+        sched_yield();
+    }
+
+    return HEX_TABLE_ERROR;
+}
+
 ssize_t
 HexTableConsRead(HexTable_t s, char* msg, size_t size)
 {
     if (!s)
         return HEX_TABLE_ERROR;
 
+    if (s->seq)
+        return snapshot_read(s, msg, size, NULL);
+
     ssize_t rc = HEX_TABLE_SUCCESS;
 
     // Wait for buffer and then lock it.
@@ -270,9 +519,33 @@ HexTableConsRead(HexTable_t s, char* msg, size_t size)
     return rc;
 }
 
+uint64_t
+HexTableGeneration(HexTable_t s)
+{
+    if (!s || !s->seq)
+        return 0;
+    return atomic_load_explicit(&s->seq->generation, memory_order_acquire);
+}
+
+ssize_t
+HexTableConsReadGen(HexTable_t s, char* msg, size_t size, uint64_t* generation)
+{
+    if (!s || !generation)
+        return HEX_TABLE_ERROR;
+
+    if (s->seq)
+        return snapshot_read(s, msg, size, generation);
+
+    // Semaphore based tables have no generation: always read
+    return HexTableConsRead(s, msg, size);
+}
+
 volatile uint64_t*
 HexTableArea(HexTable_t s)
 {
+    if (s->seq)
+        return NULL;
+
     // skip the header
     return (uint64_t*)(s->shmPtr + 1);
 }
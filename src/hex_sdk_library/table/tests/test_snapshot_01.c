@@ -0,0 +1,170 @@
+// HEX SDK
+// Test snapshot tables: generations, consumer attach and torn read detection
+#include <hex/table.h>
+
+#include <hex/test.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define NAME "test_name"
+#define STATS_SIZE 4096
+#define NUM_WRITES 200000
+
+// Every word of a record holds the same value so that torn reads show up
+static void
+fill(uint64_t* buf, size_t words, uint64_t value)
+{
+    size_t i;
+    for (i = 0; i < words; ++i)
+        buf[i] = value;
+}
+
+static int
+consistent(const uint64_t* buf, size_t words)
+{
+    size_t i;
+    for (i = 1; i < words; ++i) {
+        if (buf[i] != buf[0])
+            return 0;
+    }
+    return 1;
+}
+
+static int
+writer()
+{
+    HexTable_t prod = NULL;
+    HEX_TEST_FATAL((prod = HexTableProdInitSnapshot(NAME, STATS_SIZE)) != NULL);
+
+    uint64_t buf[STATS_SIZE / sizeof(uint64_t)];
+    uint64_t i;
+    for (i = 1; i <= NUM_WRITES; ++i) {
+        // Vary the size too
+        size_t words = 1 + i % (STATS_SIZE / sizeof(uint64_t));
+        fill(buf, words, i);
+        HEX_TEST(HexTableProdWrite(prod, (char*)buf, words * sizeof(uint64_t)) == HEX_TABLE_SUCCESS);
+    }
+
+    // Keep the table around until the reader saw the last write
+    sleep(1);
+    HexTableProdFini(prod);
+    return HexTestResult;
+}
+
+int main()
+{
+    HexTable_t prod = NULL;
+    HexTable_t cons = NULL;
+    size_t size = 0;
+    char buf[STATS_SIZE];
+    uint64_t generation = 0;
+
+    HEX_TEST(HexTableProdInitSnapshot(NULL, STATS_SIZE) == NULL);
+
+    HEX_TEST_FATAL((prod = HexTableProdInitSnapshot(NAME, STATS_SIZE)) != NULL);
+    HEX_TEST(HexTableArea(prod) == NULL);
+    uint64_t start = HexTableGeneration(prod);
+    HEX_TEST(start != 0);
+
+    // Consumers find the snapshot table through the usual init
+    HEX_TEST_FATAL((cons = HexTableConsInit(NAME, &size)) != NULL);
+    HEX_TEST(size == STATS_SIZE);
+    HEX_TEST(HexTableConsRead(cons, buf, sizeof(buf)) == 0);
+    HEX_TEST(HexTableConsReadGen(cons, buf, sizeof(buf), &generation) == 0);
+    HEX_TEST(generation == start);
+    HEX_TEST(HexTableConsReadGen(cons, buf, sizeof(buf), &generation) == HEX_TABLE_UNCHANGED);
+
+    HEX_TEST(HexTableProdWrite(prod, "first", 6) == HEX_TABLE_SUCCESS);
+    HEX_TEST(HexTableGeneration(cons) == start + 1);
+    HEX_TEST(HexTableConsReadGen(cons, buf, sizeof(buf), &generation) == 6);
+    HEX_TEST(generation == start + 1);
+    HEX_TEST(strcmp(buf, "first") == 0);
+
+    // Unchanged table is not copied again
+    memset(buf, 0, sizeof(buf));
+    HEX_TEST(HexTableConsReadGen(cons, buf, sizeof(buf), &generation) == HEX_TABLE_UNCHANGED);
+    HEX_TEST(buf[0] == 0);
+
+    HEX_TEST(HexTableProdWrite(prod, "second", 7) == HEX_TABLE_SUCCESS);
+    HEX_TEST(HexTableConsRead(cons, buf, 2) == HEX_TABLE_TOO_SMALL);
+    HEX_TEST(HexTableConsReadGen(cons, buf, 2, &generation) == HEX_TABLE_TOO_SMALL);
+    HEX_TEST(generation == start + 1);
+    HEX_TEST(HexTableConsReadGen(cons, buf, sizeof(buf), &generation) == 7);
+    HEX_TEST(generation == start + 2);
+    HEX_TEST(strcmp(buf, "second") == 0);
+
+    static char big[STATS_SIZE + 1];
+    HEX_TEST(HexTableProdWrite(prod, big, sizeof(big)) == HEX_TABLE_TOO_SMALL);
+    HEX_TEST(HexTableGeneration(prod) == start + 2);
+
+    // A producer restarted without cleaning up carries on from the last
+    // generation, so consumers see its empty table as a change
+    HexTable_t restarted = NULL;
+    HEX_TEST_FATAL((restarted = HexTableProdInitSnapshot(NAME, STATS_SIZE)) != NULL);
+    HEX_TEST(HexTableGeneration(cons) == start + 3);
+    HEX_TEST(HexTableConsReadGen(cons, buf, sizeof(buf), &generation) == 0);
+    HEX_TEST(generation == start + 3);
+    HEX_TEST(HexTableProdWrite(restarted, "third", 6) == HEX_TABLE_SUCCESS);
+    HEX_TEST(HexTableConsReadGen(cons, buf, sizeof(buf), &generation) == 6);
+    HEX_TEST(strcmp(buf, "third") == 0);
+    HexTableProdFini(restarted);
+    HexTableProdFini(prod);
+    HexTableConsFini(cons);
+
+    // A semaphore based producer can replace a snapshot one and vice versa
+    HEX_TEST_FATAL((prod = HexTableProdInit(NAME, STATS_SIZE)) != NULL);
+    HEX_TEST_FATAL((cons = HexTableConsInit(NAME, &size)) != NULL);
+    HEX_TEST(cons->seq == NULL);
+    HEX_TEST(HexTableProdWrite(prod, "sem", 4) == HEX_TABLE_SUCCESS);
+    HEX_TEST(HexTableConsReadGen(cons, buf, sizeof(buf), &generation) == 4);
+    HexTableConsFini(cons);
+    HexTableProdFini(prod);
+
+    HEX_TEST_FATAL((prod = HexTableProdInitSnapshot(NAME, STATS_SIZE)) != NULL);
+    HEX_TEST_FATAL((cons = HexTableConsInit(NAME, &size)) != NULL);
+    HEX_TEST(cons->seq != NULL);
+    HexTableConsFini(cons);
+    HexTableProdFini(prod);
+
+    // Concurrent writer in another process: every read must be consistent and
+    // generations must never go backwards
+    pid_t pid = fork();
+    HEX_TEST_FATAL(pid != -1);
+    if (pid == 0)
+        exit(writer());
+
+    while ((cons = HexTableConsInit(NAME, &size)) == NULL) {
+        usleep(1000);
+    }
+
+    uint64_t last = 0;
+    size_t reads = 0;
+    generation = 0;
+    start = 0;
+    while (last < NUM_WRITES) {
+        ssize_t n = HexTableConsReadGen(cons, buf, sizeof(buf), &generation);
+        if (n == HEX_TABLE_UNCHANGED || n == HEX_TABLE_ERROR || n == 0)
+            continue;
+        HEX_TEST_FATAL(n > 0 && n % sizeof(uint64_t) == 0);
+        uint64_t* words = (uint64_t*)buf;
+        HEX_TEST(consistent(words, n / sizeof(uint64_t)));
+        HEX_TEST((size_t)n == (1 + words[0] % (STATS_SIZE / sizeof(uint64_t))) * sizeof(uint64_t));
+        HEX_TEST(words[0] >= last);
+        if (start == 0)
+            start = generation - words[0];
+        HEX_TEST(generation == start + words[0]);
+        last = words[0];
+        reads++;
+    }
+    HEX_TEST(reads > 1);
+    HexTableConsFini(cons);
+
+    int status = -1;
+    HEX_TEST(waitpid(pid, &status, 0) == pid);
+    HEX_TEST(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    return HexTestResult;
+}
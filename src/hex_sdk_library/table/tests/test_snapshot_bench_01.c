@@ -0,0 +1,117 @@
+// HEX SDK
+// Compare one producer and several concurrent consumers on semaphore based
+// and snapshot tables
+#include <hex/table.h>
+
+#include <hex/test.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NAME "test_name"
+#define STATS_SIZE 4096
+#define READERS 4
+#define DURATION 1  // secs per mode
+
+static atomic_int s_running;
+static atomic_long s_reads;
+static atomic_long s_failed;
+static atomic_long s_unchanged;
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void*
+reader(void* arg)
+{
+    int useGeneration = *(int*)arg;
+    HexTable_t cons = NULL;
+    size_t size = 0;
+    char buf[STATS_SIZE];
+    uint64_t generation = 0;
+    long reads = 0, failed = 0, unchanged = 0;
+
+    HEX_TEST_FATAL((cons = HexTableConsInit(NAME, &size)) != NULL);
+    while (atomic_load(&s_running)) {
+        ssize_t n;
+        if (useGeneration)
+            n = HexTableConsReadGen(cons, buf, sizeof(buf), &generation);
+        else
+            n = HexTableConsRead(cons, buf, sizeof(buf));
+
+        if (n >= 0)
+            reads++;
+        else if (n == HEX_TABLE_UNCHANGED)
+            unchanged++;
+        else
+            failed++;
+    }
+    HexTableConsFini(cons);
+
+    atomic_fetch_add(&s_reads, reads);
+    atomic_fetch_add(&s_failed, failed);
+    atomic_fetch_add(&s_unchanged, unchanged);
+    return NULL;
+}
+
+static void
+bench(const char* label, HexTable_t prod, int useGeneration)
+{
+    pthread_t threads[READERS];
+    char buf[STATS_SIZE];
+    long writes = 0, writeFailed = 0;
+    int i;
+
+    memset(buf, 'x', sizeof(buf));
+    HEX_TEST(HexTableProdWrite(prod, buf, sizeof(buf)) == HEX_TABLE_SUCCESS);
+
+    atomic_store(&s_running, 1);
+    atomic_store(&s_reads, 0);
+    atomic_store(&s_failed, 0);
+    atomic_store(&s_unchanged, 0);
+    for (i = 0; i < READERS; ++i)
+        HEX_TEST_FATAL(pthread_create(&threads[i], NULL, reader, &useGeneration) == 0);
+
+    double start = now();
+    double secs = 0;
+    while ((secs = now() - start) < DURATION) {
+        if (HexTableProdWrite(prod, buf, sizeof(buf)) == HEX_TABLE_SUCCESS)
+            writes++;
+        else
+            writeFailed++;
+    }
+
+    atomic_store(&s_running, 0);
+    for (i = 0; i < READERS; ++i)
+        pthread_join(threads[i], NULL);
+
+    printf("%-26s writes/sec %9.0f (failed %ld)  reads/sec %9.0f (failed %ld, unchanged %ld)\n",
+           label, writes / secs, writeFailed, atomic_load(&s_reads) / secs,
+           atomic_load(&s_failed), atomic_load(&s_unchanged));
+}
+
+int main()
+{
+    HexTable_t prod = NULL;
+
+    printf("1 producer, %d consumers, %d byte table\n", READERS, STATS_SIZE);
+
+    HEX_TEST_FATAL((prod = HexTableProdInit(NAME, STATS_SIZE)) != NULL);
+    bench("semaphore:", prod, 0);
+    HexTableProdFini(prod);
+
+    HEX_TEST_FATAL((prod = HexTableProdInitSnapshot(NAME, STATS_SIZE)) != NULL);
+    bench("snapshot:", prod, 0);
+    bench("snapshot with generation:", prod, 1);
+    HexTableProdFini(prod);
+
+    return HexTestResult;
+}
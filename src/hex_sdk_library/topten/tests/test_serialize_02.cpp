@@ -0,0 +1,209 @@
+// HEX SDK
+
+#include <hex/test.h>
+#include <hex/topten.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alphabet.h"
+
+using namespace hex_sdk;
+
+#define CACHE "test.out"
+#define LOG0 "test.out.log0"
+#define LOG1 "test.out.log1"
+
+static void
+CheckSame(const TopTen& a, const TopTen& b)
+{
+    TopTen::Results ra, rb;
+    a.getResults(ra);
+    b.getResults(rb);
+    HEX_TEST(ra.numEntries == rb.numEntries);
+    for (size_t i = 0; i < 10; ++i) {
+        HEX_TEST(ra.keys[i] == rb.keys[i]);
+        HEX_TEST(ra.counts[i] == rb.counts[i]);
+        HEX_TEST(ra.eventTimes[i] == rb.eventTimes[i]);
+    }
+}
+
+static ino_t
+Inode(const char *path)
+{
+    struct stat st;
+    HEX_TEST_FATAL(stat(path, &st) == 0);
+    return st.st_ino;
+}
+
+static off_t
+Size(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+// Log of the snapshot's generation, which follows the magic, version and
+// number of records
+static std::string
+LogPath()
+{
+    uint64_t generation = 0;
+    int fd = open(CACHE, O_RDONLY);
+    HEX_TEST_FATAL(fd != -1);
+    HEX_TEST(pread(fd, &generation, sizeof(generation), 16) == sizeof(generation));
+    close(fd);
+    return std::string(CACHE) + ".log" + std::to_string(generation % 2);
+}
+
+int main()
+{
+    unlink(CACHE);
+    unlink(LOG0);
+    unlink(LOG1);
+
+    // The format from before snapshots is read and rewritten as a snapshot
+    {
+        FILE *f = fopen(CACHE, "wb");
+        HEX_TEST_FATAL(f != NULL);
+        HEX_TEST_FATAL(fwrite("provtten", 1, 8, f) == 8);
+        size_t numKeys = 3;
+        HEX_TEST_FATAL(fwrite(&numKeys, sizeof(numKeys), 1, f) == 1);
+        for (size_t i = 0; i < numKeys; ++i) {
+            size_t len = strlen(ALPHABET[i]);
+            time_t eventTime = 100;
+            size_t count = i + 1;
+            HEX_TEST_FATAL(fwrite(&len, sizeof(len), 1, f) == 1);
+            HEX_TEST_FATAL(fwrite(ALPHABET[i], 1, len, f) == len);
+            HEX_TEST_FATAL(fwrite(&eventTime, sizeof(eventTime), 1, f) == 1);
+            HEX_TEST_FATAL(fwrite(&count, sizeof(count), 1, f) == 1);
+        }
+        fclose(f);
+
+        TopTen topten(20);
+        HEX_TEST_FATAL(topten.deserialize(CACHE));
+        TopTen::Results results;
+        topten.getResults(results);
+        HEX_TEST_FATAL(results.numEntries == 3);
+        for (size_t i = 0; i < 3; ++i) {
+            HEX_TEST(results.keys[i] == ALPHABET[2 - i]);
+            HEX_TEST(results.counts[i] == 3 - i);
+        }
+
+        char magic[8];
+        f = fopen(CACHE, "rb");
+        HEX_TEST_FATAL(f != NULL);
+        HEX_TEST(fread(magic, 1, 8, f) == 8 && memcmp(magic, "hexttsnp", 8) == 0);
+        fclose(f);
+    }
+
+    unlink(CACHE);
+
+    // Changes after the snapshot are appended to the log
+    TopTen a(20, 1 /* interval */);
+    time_t t = 1000;
+    for (size_t i = 0; i < 26; ++i)
+        a.update(ALPHABET[i], i + 1, t++, CACHE);
+    HEX_TEST(a.serialize(CACHE));
+    ino_t snapshot = Inode(CACHE);
+    std::string log = LogPath();
+    HEX_TEST(Size(log) <= 0);
+    for (size_t i = 0; i < 26; i += 2)
+        a.update(ALPHABET[i], 10, t++, CACHE);
+    a.housekeeping(t += 2, CACHE);
+    HEX_TEST(Inode(CACHE) == snapshot);
+    HEX_TEST(Size(log) > 0);
+
+    TopTen b(20);
+    HEX_TEST_FATAL(b.deserialize(CACHE));
+    CheckSame(a, b);
+
+    // A torn record at the end of the log is ignored, and appended after
+    off_t logSize = Size(log);
+    int fd = open(log.c_str(), O_WRONLY | O_APPEND);
+    HEX_TEST_FATAL(fd != -1);
+    HEX_TEST(write(fd, "\x01\0\0\0\xff", 5) == 5);
+    close(fd);
+
+    TopTen c(20, 1);
+    HEX_TEST_FATAL(c.deserialize(CACHE));
+    CheckSame(a, c);
+    HEX_TEST(Size(log) == logSize);
+    c.update("extra", 1000, t, CACHE);
+    c.housekeeping(t += 2, CACHE);
+    HEX_TEST(Size(log) > logSize);
+
+    TopTen d(20);
+    HEX_TEST_FATAL(d.deserialize(CACHE));
+    CheckSame(c, d);
+    TopTen::Results results;
+    d.getResults(results);
+    HEX_TEST(results.keys[0] == "extra");
+
+    // Once the log outgrows the snapshot a new snapshot is written in the
+    // background and the log starts over
+    for (size_t round = 0; round < 5000 && Inode(CACHE) == snapshot; ++round) {
+        for (size_t i = 0; i < 26; ++i)
+            c.update(ALPHABET[i], 1, t, CACHE);
+        c.housekeeping(t += 2, CACHE);
+    }
+    HEX_TEST(Inode(CACHE) != snapshot);
+    HEX_TEST(c.serialize(CACHE));
+    HEX_TEST(Size(LogPath()) <= 0);
+
+    TopTen e(20);
+    HEX_TEST_FATAL(e.deserialize(CACHE));
+    CheckSame(c, e);
+
+    // Loading into a smaller list keeps the heaviest entries
+    TopTen g(20);
+    for (size_t i = 0; i < 10; ++i)
+        g.update(ALPHABET[i], i + 1, 1000);
+    HEX_TEST(g.serialize(CACHE));
+    TopTen small(5);
+    HEX_TEST_FATAL(small.deserialize(CACHE));
+    small.getResults(results);
+    HEX_TEST(results.numEntries == 5);
+    for (size_t i = 0; i < 5; ++i)
+        HEX_TEST(results.keys[i] == ALPHABET[9 - i]);
+
+    // A truncated snapshot is rejected
+    HEX_TEST(g.serialize(CACHE));
+    off_t full = Size(CACHE);
+    HEX_TEST(truncate(CACHE, full - 1) == 0);
+    TopTen truncated(20);
+    HEX_TEST(!truncated.deserialize(CACHE));
+
+    // So is one claiming more records than it holds, with a blob size that
+    // makes the 64-bit layout size wrap around to the file size. The
+    // 48-byte header ends with the blob size and records are 32 bytes.
+    HEX_TEST(g.serialize(CACHE));
+    full = Size(CACHE);
+    uint32_t numRecords = UINT32_MAX;
+    uint64_t blobSize = (uint64_t)full - 48 - (uint64_t)numRecords * 32;
+    fd = open(CACHE, O_WRONLY);
+    HEX_TEST_FATAL(fd != -1);
+    HEX_TEST(pwrite(fd, &numRecords, sizeof(numRecords), 12) == sizeof(numRecords));
+    HEX_TEST(pwrite(fd, &blobSize, sizeof(blobSize), 40) == sizeof(blobSize));
+    close(fd);
+    TopTen overflow(20);
+    HEX_TEST(!overflow.deserialize(CACHE));
+
+    // A corrupt snapshot is rejected
+    fd = open(CACHE, O_WRONLY | O_TRUNC);
+    HEX_TEST_FATAL(fd != -1);
+    HEX_TEST(write(fd, "hexttsnp\x01\0\0\0", 12) == 12);
+    close(fd);
+    TopTen f(20);
+    HEX_TEST(!f.deserialize(CACHE));
+
+    unlink(CACHE);
+    unlink(LOG0);
+    unlink(LOG1);
+
+    return HexTestResult;
+}
@@ -0,0 +1,63 @@
+// HEX SDK
+
+#include <hex/test.h>
+#include <hex/topten.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+using namespace hex_sdk;
+
+// Accuracy against an exact counter: many more distinct keys than entries,
+// drawn from a Zipf distribution as events from busy sources are
+#define NUM_KEYS 200000
+#define NUM_EVENTS 1000000
+#define MAX_ENTRIES 1024
+
+int main()
+{
+    // Zipf(1.1) cumulative distribution over the keys
+    std::vector<double> cdf(NUM_KEYS);
+    double sum = 0;
+    for (size_t i = 0; i < NUM_KEYS; ++i) {
+        sum += 1 / pow(i + 1, 1.1);
+        cdf[i] = sum;
+    }
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> uniform(0, sum);
+
+    // Events spread over a minute, so decay barely matters with the default
+    // one week max age
+    TopTen topten(MAX_ENTRIES);
+    std::unordered_map<std::string, size_t> exact;
+    for (size_t i = 0; i < NUM_EVENTS; ++i) {
+        size_t k = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+        // Shuffle ranks so that frequent keys are not the alphabetically first ones
+        std::string key = "key" + std::to_string((k * 7919) % NUM_KEYS);
+        topten.update(key, 1, 1000 + i * 60 / NUM_EVENTS);
+        exact[key]++;
+    }
+
+    std::vector<std::pair<size_t, std::string> > sorted;
+    for (auto& it : exact)
+        sorted.push_back(std::make_pair(it.second, it.first));
+    std::sort(sorted.rbegin(), sorted.rend());
+
+    TopTen::Results results;
+    topten.getResults(results);
+    HEX_TEST_FATAL(results.numEntries == 10);
+
+    // Same keys in the same order, within 1% of their exact counts
+    for (size_t i = 0; i < 10; ++i) {
+        HEX_TEST(results.keys[i] == sorted[i].second);
+        size_t count = exact[results.keys[i]];
+        HEX_TEST(results.counts[i] <= count);
+        HEX_TEST(results.counts[i] >= count * 0.99);
+    }
+
+    return HexTestResult;
+}
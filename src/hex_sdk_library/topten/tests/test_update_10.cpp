@@ -0,0 +1,57 @@
+// HEX SDK
+
+#include <hex/test.h>
+#include <hex/topten.h>
+
+#include "alphabet.h"
+
+using namespace hex_sdk;
+
+int main()
+{
+    // Counts halve every max age, which is long enough for entries not to expire
+#define MAX_AGE 1000
+    TopTen topten(20, 60, MAX_AGE);
+
+    // A frequent key early on
+    time_t t = 0;
+    for (size_t i = 0; i < 100; ++i)
+        topten.update("alpha", 1, t);
+
+    // Many keys seen once since then do not push it out
+    t = MAX_AGE / 2;
+    for (size_t i = 0; i < 1000; ++i)
+        topten.update("key" + std::to_string(i), 1, t);
+
+    // A key more frequent than half of it, one max age later
+    t = MAX_AGE;
+    for (size_t i = 0; i < 60; ++i)
+        topten.update("bravo", 1, t);
+
+    TopTen::Results results;
+    topten.getResults(results);
+
+    HEX_TEST_FATAL(results.numEntries == 10);
+    HEX_TEST(results.keys[0] == "bravo");
+    HEX_TEST(results.counts[0] == 60);
+    HEX_TEST(results.eventTimes[0] == MAX_AGE);
+    HEX_TEST(results.keys[1] == "alpha");
+    HEX_TEST(results.counts[1] == 50);
+    HEX_TEST(results.eventTimes[1] == 0);
+
+    // Jumping thousands of half-lives ahead rescales the counts instead of
+    // overflowing them; housekeeping is too rare to expire the old keys
+    TopTen longJump(20, 100000, 1);
+    for (size_t i = 0; i < 4; ++i)
+        longJump.update(ALPHABET[i], 10 - i, 1);
+    longJump.update(ALPHABET[4], 1, 2000);
+    longJump.update(ALPHABET[5], 3, 2000);
+    longJump.getResults(results);
+    HEX_TEST_FATAL(results.numEntries == 2);
+    HEX_TEST(results.keys[0] == ALPHABET[5]);
+    HEX_TEST(results.counts[0] == 3);
+    HEX_TEST(results.keys[1] == ALPHABET[4]);
+    HEX_TEST(results.counts[1] == 1);
+
+    return HexTestResult;
+}
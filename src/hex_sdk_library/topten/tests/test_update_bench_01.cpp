@@ -0,0 +1,184 @@
+// HEX SDK
+
+// Update throughput and top ten accuracy with many more distinct keys than
+// entries, against the sorted arrays TopTen used before
+
+#include <hex/test.h>
+#include <hex/topten.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+using namespace hex_sdk;
+
+#define NUM_KEYS 200000
+#define NUM_EVENTS 1000000
+#define NUM_BURSTS 5
+#define BURST_EVENTS 30000
+
+// Reference implementation: key and event time arrays kept sorted, evicting
+// the oldest entry when full
+class LegacyTopTen {
+public:
+    LegacyTopTen(size_t maxEntries) : m_maxEntries(maxEntries) { }
+
+    void update(const std::string& key, size_t count, time_t eventTime)
+    {
+        Data probe = { key, 0, 0 };
+        KeyArray::iterator keyIter = std::lower_bound(m_keys.begin(), m_keys.end(), &probe, KeyLess());
+        if (keyIter != m_keys.end() && (*keyIter)->key == key) {
+            Data *pData = *keyIter;
+            pData->count += count;
+            if (eventTime > pData->eventTime) {
+                m_times.erase(findTime(pData));
+                pData->eventTime = eventTime;
+                m_times.insert(findTime(pData), pData);
+            }
+            return;
+        }
+
+        if (m_keys.size() == m_maxEntries) {
+            // Remove the oldest entry
+            Data *pOld = m_times.back();
+            m_times.pop_back();
+            KeyArray::iterator oldIter = std::lower_bound(m_keys.begin(), m_keys.end(), pOld, KeyLess());
+            if (oldIter < keyIter)
+                --keyIter;
+            m_keys.erase(oldIter);
+            delete pOld;
+        }
+
+        Data *pData = new Data { key, eventTime, count };
+        m_keys.insert(keyIter, pData);
+        m_times.insert(findTime(pData), pData);
+    }
+
+    void getResults(std::vector<std::string>& keys)
+    {
+        std::vector<Data> copy;
+        for (size_t i = 0; i < m_keys.size(); ++i)
+            copy.push_back(*m_keys[i]);
+        std::sort(copy.begin(), copy.end(), [](const Data& x, const Data& y) { return x.count > y.count; });
+        keys.clear();
+        for (size_t i = 0; i < copy.size() && i < 10; ++i)
+            keys.push_back(copy[i].key);
+    }
+
+    ~LegacyTopTen()
+    {
+        for (size_t i = 0; i < m_keys.size(); ++i)
+            delete m_keys[i];
+    }
+
+private:
+    struct Data {
+        std::string key;
+        time_t eventTime;
+        size_t count;
+    };
+    typedef std::vector<Data *> KeyArray;
+
+    struct KeyLess {
+        bool operator()(const Data *x, const Data *y) { return x->key < y->key; }
+    };
+    struct EventTimeGreater {
+        bool operator()(const Data *x, const Data *y) { return x->eventTime > y->eventTime; }
+    };
+
+    KeyArray::iterator findTime(Data *pData)
+    {
+        KeyArray::iterator it = std::lower_bound(m_times.begin(), m_times.end(), pData, EventTimeGreater());
+        while (it != m_times.end() && *it != pData && (*it)->eventTime == pData->eventTime)
+            ++it;
+        return it;
+    }
+
+    size_t m_maxEntries;
+    KeyArray m_keys;
+    KeyArray m_times;
+};
+
+// Top ten keys also in the exact top ten
+static size_t
+Hits(const std::vector<std::string>& keys, const std::vector<std::string>& exact)
+{
+    size_t hits = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (std::find(exact.begin(), exact.end(), keys[i]) != exact.end())
+            ++hits;
+    }
+    return hits;
+}
+
+int main()
+{
+    // Zipf(1.1) over shuffled key ranks, one second of events per 1000, with
+    // bursts of a few keys early on that go quiet afterwards
+    std::vector<double> cdf(NUM_KEYS);
+    double sum = 0;
+    for (size_t i = 0; i < NUM_KEYS; ++i) {
+        sum += 1 / pow(i + 1, 1.1);
+        cdf[i] = sum;
+    }
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> uniform(0, sum);
+    std::vector<std::string> events(NUM_EVENTS);
+    std::unordered_map<std::string, size_t> exact;
+    for (size_t i = 0; i < NUM_EVENTS; ++i) {
+        if (i < NUM_BURSTS * BURST_EVENTS * 2 && i % 2 == 0) {
+            events[i] = "burst" + std::to_string(i / (BURST_EVENTS * 2));
+        }
+        else {
+            size_t k = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+            events[i] = "key" + std::to_string((k * 7919) % NUM_KEYS);
+        }
+        exact[events[i]]++;
+    }
+
+    std::vector<std::pair<size_t, std::string> > sorted;
+    for (auto& it : exact)
+        sorted.push_back(std::make_pair(it.second, it.first));
+    std::sort(sorted.rbegin(), sorted.rend());
+    std::vector<std::string> exactTop;
+    for (size_t i = 0; i < 10; ++i)
+        exactTop.push_back(sorted[i].second);
+
+    printf("%d events, %zu distinct keys\n", NUM_EVENTS, exact.size());
+
+    static const size_t maxEntries[] = { 1024, 16384 };
+    for (size_t m = 0; m < sizeof(maxEntries) / sizeof(maxEntries[0]); ++m) {
+        std::vector<std::string> keys;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        LegacyTopTen legacy(maxEntries[m]);
+        for (size_t i = 0; i < NUM_EVENTS; ++i)
+            legacy.update(events[i], 1, 1000 + i / 1000);
+        legacy.getResults(keys);
+        auto mid = std::chrono::high_resolution_clock::now();
+        size_t legacyHits = Hits(keys, exactTop);
+
+        TopTen topten(maxEntries[m]);
+        for (size_t i = 0; i < NUM_EVENTS; ++i)
+            topten.update(events[i], 1, 1000 + i / 1000);
+        TopTen::Results results;
+        topten.getResults(results);
+        auto end = std::chrono::high_resolution_clock::now();
+        keys.assign(results.keys, results.keys + results.numEntries);
+        size_t hits = Hits(keys, exactTop);
+        HEX_TEST(hits >= legacyHits);
+
+        double legacySecs = std::chrono::duration<double>(mid - start).count();
+        double secs = std::chrono::duration<double>(end - mid).count();
+        printf("max entries %zu\n", maxEntries[m]);
+        printf("  sorted arrays:  %.3f secs, %.0f updates/sec, %zu/10 of the top ten\n",
+               legacySecs, NUM_EVENTS / legacySecs, legacyHits);
+        printf("  space-saving:   %.3f secs, %.0f updates/sec, %zu/10 of the top ten\n",
+               secs, NUM_EVENTS / secs, hits);
+    }
+
+    return HexTestResult;
+}
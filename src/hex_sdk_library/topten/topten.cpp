@@ -1,11 +1,21 @@
 // HEX SDK
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
 #include <cstdio>
+#include <memory>
 #include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <hex/filesystem.h>
 #include <hex/hex_impl.h>
 #include <hex/topten.h>
 
@@ -15,6 +25,10 @@
 
 namespace hex_sdk {
 
+// Rebase once the newest weights reach 2^REBASE_HALF_LIVES, well within
+// the range of a double
+static const double REBASE_HALF_LIVES = 256;
+
 #ifdef HEX_PROD
 
 inline
@@ -25,56 +39,35 @@ void TopTen::check() { }
 void TopTen::check()
 {
     assert(m_dataArray.size() == m_maxEntries);
-    assert(m_keyArray.size() == m_eventTimeArray.size());
-    assert(m_keyArray.size() + m_freePool.size() == m_maxEntries);
+    assert(m_heap.size() == m_keyMap.size());
+    assert(m_heap.size() + m_freePool.size() == m_maxEntries);
 
 #ifdef TOPTEN_DEBUG
     printf("TopTen::check()\n");
-    printf("  m_maxEntries = %zu\n", m_maxEntries);
-    printf("  m_dataArray (size = %zu) =\n", m_dataArray.size());
-    for (size_t i = 0; i < m_dataArray.size(); ++i) {
-        printf("  %zu (%p) k=\"%s\" t=%lu c=%zu\n",
-            i, &m_dataArray[i], m_dataArray[i].key.c_str(), m_dataArray[i].eventTime, m_dataArray[i].count);
-    }
-    printf("  m_keyArray (size = %zu) =\n", m_keyArray.size());
-    for (size_t i = 0; i < m_keyArray.size(); ++i) {
-        printf("  %zu (%p) k=\"%s\" t=%lu c=%zu\n",
-            i, m_keyArray[i], m_keyArray[i]->key.c_str(), m_keyArray[i]->eventTime, m_keyArray[i]->count);
-    }
-    printf("  m_eventTimeArray (size = %zu) =\n", m_eventTimeArray.size());
-    for (size_t i = 0; i < m_eventTimeArray.size(); ++i) {
-        printf("  %zu (%p) k=\"%s\" t=%lu c=%zu\n",
-            i, m_eventTimeArray[i], m_eventTimeArray[i]->key.c_str(), m_eventTimeArray[i]->eventTime, m_eventTimeArray[i]->count);
+    printf("  m_maxEntries = %zu, m_landmark = %lu\n", m_maxEntries, m_landmark);
+    printf("  m_heap (size = %zu) =\n", m_heap.size());
+    for (size_t i = 0; i < m_heap.size(); ++i) {
+        printf("  %zu (%p) k=\"%s\" t=%lu w=%g e=%g\n",
+            i, m_heap[i], m_heap[i]->key.c_str(), m_heap[i]->eventTime, m_heap[i]->weight, m_heap[i]->error);
     }
-#endif
-
-    for (size_t i = 0; i < m_keyArray.size(); ++i) {
-        // Data pointers must be valid
-        assert(m_keyArray[i] >= &m_dataArray[0] && m_keyArray[i] <= &m_dataArray[m_maxEntries - 1]);
-
-        // Keys must be sorted in ascending order and unique
-        if (i + 1 < m_keyArray.size())
-            assert(m_keyArray[i]->key < m_keyArray[i + 1]->key);
 
-        // Data elements must be unique
-        for (size_t j = i + 1; j < m_keyArray.size(); ++j)
-            assert(m_keyArray[i] != m_keyArray[j]);
-    }
+    // Walking the heap makes every update O(n), so only when debugging
+    for (size_t i = 0; i < m_heap.size(); ++i) {
+        Data *pData = m_heap[i];
 
-    for (size_t i = 0; i < m_eventTimeArray.size(); ++i) {
         // Data pointers must be valid
-        assert(m_eventTimeArray[i] >= &m_dataArray[0] && m_eventTimeArray[i] <= &m_dataArray[m_maxEntries - 1]);
+        assert(pData >= &m_dataArray[0] && pData <= &m_dataArray[m_maxEntries - 1]);
+        assert(pData->heapIndex == i);
 
-        // Event times must be sorted in descending order
-        // (but not necessarily unique)
-        if (i + 1 < m_eventTimeArray.size())
-            assert(m_eventTimeArray[i]->eventTime >=
-                   m_eventTimeArray[i + 1]->eventTime);
+        // Parents must not weigh more than their children
+        if (i > 0)
+            assert(m_heap[(i - 1) / 2]->weight <= pData->weight);
 
-        // Data elements must be unique
-        for (size_t j = i + 1; j < m_eventTimeArray.size(); ++j)
-            assert(m_eventTimeArray[i] != m_eventTimeArray[j]);
+        // Keys must map to their entry
+        KeyMap::const_iterator it = m_keyMap.find(pData->key);
+        assert(it != m_keyMap.end() && it->second == pData);
     }
+#endif
 }
 
 #endif
@@ -84,28 +77,48 @@ TopTen::TopTen(size_t maxEntries, time_t interval, time_t maxAge)
       m_interval(interval),
       m_maxAge(maxAge)
 {
-    m_dataArray.reserve(m_maxEntries);
-    m_keyArray.reserve(m_maxEntries);
-    m_eventTimeArray.reserve(m_maxEntries);
+    m_keyMap.reserve(m_maxEntries);
+    m_heap.reserve(m_maxEntries);
     m_freePool.reserve(m_maxEntries);
 
     m_dirty = true;
 
     m_timeLastHousekeeping = 0;
 
+    m_generation = 0;
+    m_logFd = -1;
+    m_logSize = 0;
+    m_snapshotSize = 0;
+    m_compaction = NULL;
+
     clear();
 }
 
+TopTen::~TopTen()
+{
+    joinCompaction();
+    if (m_logFd != -1)
+        close(m_logFd);
+}
+
 void TopTen::clear()
 {
     m_dirty = true;
 
-    m_dataArray.clear();
-    m_keyArray.clear();
-    m_eventTimeArray.clear();
+    m_landmark = 0;
+    m_latestTime = 0;
+
+    m_keyMap.clear();
+    m_heap.clear();
     m_freePool.clear();
 
+    // Whatever is cached is replaced as a whole
+    m_dirtyList.clear();
+    m_removedKeys.clear();
+    m_needSnapshot = true;
+
     // Populate free list
+    m_dataArray.clear();
     m_dataArray.resize(m_maxEntries);
     for (size_t i = m_maxEntries; i > 0; --i)
         m_freePool.push_back(&m_dataArray[i - 1]);
@@ -121,57 +134,74 @@ void TopTen::update(const std::string& key, size_t count, time_t eventTime, cons
 
     housekeeping(eventTime, cachePath);
 
-    if (key.empty() || count == 0)
+    if (key.empty() || count == 0 || m_maxEntries == 0)
         return;
 
+    // Nothing to rescale while empty, so start decaying from here
+    if (m_heap.empty()) {
+        if (m_landmark != eventTime)
+            m_needSnapshot = true;
+        m_landmark = m_latestTime = eventTime;
+    }
+    else if (eventTime > m_latestTime) {
+        m_latestTime = eventTime;
+    }
+
+    if (m_maxAge > 0 && (double)(eventTime - m_landmark) / m_maxAge > REBASE_HALF_LIVES)
+        rebase(eventTime);
+
+    double weight = count * decay(eventTime);
+
     // Does key already exist?
-    KeyArray::iterator keyIter = findKey(key);
-    if (keyIter != m_keyArray.end() && key == (*keyIter)->key) {
+    KeyMap::iterator keyIter = m_keyMap.find(key);
+    if (keyIter != m_keyMap.end()) {
         // Key exists, update it's count
-        Data *pData = *keyIter;
-        pData->count += count;
+        Data *pData = keyIter->second;
+        pData->weight += weight;
 
         // If this event is more recent we need to update it's time too
-        if (eventTime > pData->eventTime) {
-            // Search for corresponding entry in event time array
-            // Remove it
-            EventTimeArray::iterator eventTimeIter = findEventTime(pData);
-             assert(eventTimeIter != m_eventTimeArray.end() && *eventTimeIter == pData);
-            m_eventTimeArray.erase(eventTimeIter);
-
-            // Add new entry with updated time
+        if (eventTime > pData->eventTime)
             pData->eventTime = eventTime;
-            m_eventTimeArray.insert(findEventTime(eventTime), pData);
-        }
-    } else {
-        // Key not found, we'll need to add it
-        // Is there room?
-        if (m_keyArray.size() == m_maxEntries) {
-            // All full, let's make some room by removing the oldest entry
-            KeyArray::iterator removedIter = removeOldest();
-            // If removed key was before our insert position, we need to adjust our iterator
-            if (removedIter < keyIter)
-                --keyIter;
-#ifdef HEX_DEV
-            // Verify that our iterator is pointing in the correct location
-            KeyArray::iterator testIter = findKey(key);
-            assert(testIter == keyIter);
-#endif
-        }
 
-        // Get new data element from free pool
-        assert(!m_freePool.empty());
+        markDirty(pData);
+        siftDown(pData->heapIndex);
+    } else if (m_heap.size() < m_maxEntries) {
+        // Key not found and there is room: get new data element from free pool
         Data *pData = m_freePool.back();
         m_freePool.pop_back();
 
         // Initialize our new element
         pData->key = key;
         pData->eventTime = eventTime;
-        pData->count = count;
+        pData->weight = weight;
+        pData->error = 0;
+        m_keyMap[pData->key] = pData;
+        markDirty(pData);
+
+        // Insert into heap
+        pData->heapIndex = m_heap.size();
+        m_heap.push_back(pData);
+        siftUp(pData->heapIndex);
+    } else {
+        // All full, the new key takes over the entry with the smallest count
+        // which becomes the new key's possible overestimate
+        Data *pData = m_heap.front();
 
-        // Insert into key and event time arrays
-        m_keyArray.insert(keyIter, pData);
-        m_eventTimeArray.insert(findEventTime(eventTime), pData);
+#ifdef TOPTEN_DEBUG
+        printf("TopTen::update(): replacing (%p) k=\"%s\", t=%lu, w=%g\n",
+            pData, pData->key.c_str(), pData->eventTime, pData->weight);
+#endif
+
+        markRemoved(pData);
+        m_keyMap.erase(pData->key);
+        pData->key = key;
+        pData->eventTime = eventTime;
+        pData->error = pData->weight;
+        pData->weight += weight;
+        m_keyMap[pData->key] = pData;
+        markDirty(pData);
+
+        siftDown(0);
     }
 
     m_dirty = true;
@@ -187,30 +217,39 @@ void TopTen::housekeeping(time_t currTime, const char *cachePath)
 
         time_t minEventTime = currTime - m_maxAge;
 
-        while (!m_eventTimeArray.empty() &&
-               m_eventTimeArray.front()->eventTime < minEventTime)
-            (void)removeOldest();
+        // Remove entries not seen for maxAge
+        std::vector<Data *> expired;
+        for (size_t i = 0; i < m_heap.size(); ++i) {
+            if (m_heap[i]->eventTime < minEventTime)
+                expired.push_back(m_heap[i]);
+        }
+        for (size_t i = 0; i < expired.size(); ++i)
+            remove(expired[i]);
+        if (!expired.empty())
+            check();
 
         if (cachePath != NULL)
-            serialize(cachePath);
+            flush(cachePath);
     }
 }
 
 void TopTen::getResults(Results &results) const
 {
-    DataArray dataCopy(m_dataArray);
-    std::sort(dataCopy.begin(), dataCopy.end(), CountGreater());
+    // Only the ten largest are sorted
+    std::vector<const Data *> top(std::min(m_heap.size(), (size_t)10));
+    std::partial_sort_copy(m_heap.begin(), m_heap.end(), top.begin(), top.end(), CountGreater());
 
     results.numEntries = 0;
 
-    size_t n = (m_dataArray.size() < 10) ? m_dataArray.size() : 10;
+    double scale = decay(m_latestTime);
 
-    for (size_t i = 0; i < n; ++i) {
-        if (dataCopy[i].count == 0)
+    for (size_t i = 0; i < top.size(); ++i) {
+        size_t count = (size_t)llround((top[i]->weight - top[i]->error) / scale);
+        if (count == 0)
             break;
-        results.keys[i] = dataCopy[i].key;
-        results.eventTimes[i] = dataCopy[i].eventTime;
-        results.counts[i] = dataCopy[i].count;
+        results.keys[i] = top[i]->key;
+        results.eventTimes[i] = top[i]->eventTime;
+        results.counts[i] = count;
         ++results.numEntries;
     }
 
@@ -231,162 +270,638 @@ void TopTen::getResults(Results &results) const
 #endif
 }
 
+// Format from before snapshots: a full rewrite of the list every time
 static const char s_magic[8] = { 'p', 'r', 'o', 'v', 't', 't', 'e', 'n' };
 
+// Snapshot: header, fixed records in heap order, then a blob of the keys
+// they point into; native byte order, 8-byte aligned so that it is read
+// in place from a read-only mapping
+static const char s_snapshotMagic[8] = { 'h', 'e', 'x', 't', 't', 's', 'n', 'p' };
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numRecords;
+    uint64_t generation;
+    int64_t landmark;
+    int64_t latestTime;
+    uint64_t blobSize;
+};
+
+struct SnapshotRecord {
+    uint32_t keyOffset;
+    uint32_t keyLen;
+    int64_t eventTime;
+    double weight;
+    double error;
+};
+
+// Log: header naming the generation it follows, then records each followed
+// by their key; a torn record at the end is ignored
+static const char s_logMagic[8] = { 'h', 'e', 'x', 't', 't', 'l', 'o', 'g' };
+static const uint32_t LOG_VERSION = 1;
+
+struct LogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t generation;
+};
+
+enum { LOG_SET = 1, LOG_REMOVE = 2 };
+
+struct LogRecord {
+    uint32_t type;
+    uint32_t keyLen;
+    int64_t eventTime;
+    double weight;
+    double error;
+};
+
+// Don't compact logs smaller than this, however small the snapshot
+static const size_t MIN_COMPACT_SIZE = 64 * 1024;
+
+struct TopTen::Compaction {
+    pthread_t thread;
+    bool threaded;
+    std::string path;
+    std::string image;
+    uint64_t generation;
+    std::atomic<bool> done;
+    bool ok;
+
+    static void* run(void *arg);
+};
+
+static std::string
+LogPath(const std::string& path, uint64_t generation)
+{
+    return path + ".log" + std::to_string(generation % 2);
+}
+
+// Replace path with data so that it is either the old or the new file
+static bool
+WriteFileAtomic(const std::string& path, const std::string& data)
+{
+    std::string tmpPath = path + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = HexWriteAll(fd, data.data(), data.size()) == 0 && fsync(fd) == 0;
+    if (close(fd) != 0)
+        ok = false;
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    // The rename must be durable before the logs it replaces are removed
+    std::string dir = path.substr(0, path.find_last_of('/') + 1);
+    fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+void* TopTen::Compaction::run(void *arg)
+{
+    Compaction *compaction = (Compaction *)arg;
+    compaction->ok = WriteFileAtomic(compaction->path, compaction->image);
+    compaction->done = true;
+    return NULL;
+}
+
 bool TopTen::serialize(const char *path)
 {
-    if (m_dirty) {
-        unlink(path);
+    if (!joinCompaction())
+        m_needSnapshot = true;
 
-        FILE *fout = fopen(path, "wb");
-        if (!fout)
-            return false;
+    // Also folds the log into the snapshot
+    if (m_dirty || m_needSnapshot || m_logSize > 0 || m_cachePath != path)
+        return compact(path, true);
+
+    return true;
+}
+
+bool TopTen::deserialize(const char *path)
+{
+    joinCompaction();
+
+    if (access(path, F_OK) != 0)
+        return true;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(s_magic)) {
+        close(fd);
+        return false;
+    }
 
-        if (fwrite(s_magic, 1, sizeof(s_magic), fout) != sizeof(s_magic)) {
-            fclose(fout);
+    size_t size = st.st_size;
+    const char *base = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return false;
+
+    if (memcmp(base, s_magic, sizeof(s_magic)) == 0) {
+        munmap((void *)base, size);
+        return deserializeLegacy(path);
+    }
+
+    clear();
+
+    // Validate the whole layout before using any of it. The record count is
+    // bounded by the file first so that no size computed from it can wrap.
+    const SnapshotHeader *header = (const SnapshotHeader *)base;
+    if (size < sizeof(*header) ||
+        memcmp(header->magic, s_snapshotMagic, sizeof(s_snapshotMagic)) != 0 ||
+        header->version != SNAPSHOT_VERSION ||
+        header->numRecords > (size - sizeof(*header)) / sizeof(SnapshotRecord) ||
+        header->blobSize != size - sizeof(*header) - header->numRecords * sizeof(SnapshotRecord)) {
+        munmap((void *)base, size);
+        return false;
+    }
+    const SnapshotRecord *records = (const SnapshotRecord *)(header + 1);
+    const char *blob = (const char *)(records + header->numRecords);
+    for (uint32_t i = 0; i < header->numRecords; ++i) {
+        if ((uint64_t)records[i].keyOffset + records[i].keyLen > header->blobSize) {
+            munmap((void *)base, size);
             return false;
         }
+    }
 
-        // Number of keys
-        size_t numKeys = m_keyArray.size();
-        if (fwrite((char *)&numKeys, 1, sizeof(numKeys), fout) != sizeof(numKeys)) {
-            fclose(fout);
-            return false;
+    m_landmark = header->landmark;
+    m_latestTime = header->latestTime;
+    m_needSnapshot = false;
+    for (uint32_t i = 0; i < header->numRecords; ++i) {
+        const SnapshotRecord& r = records[i];
+        restore(std::string(blob + r.keyOffset, r.keyLen), r.eventTime, r.weight, r.error);
+    }
+
+    m_cachePath = path;
+    m_generation = header->generation;
+    m_snapshotSize = size;
+    munmap((void *)base, size);
+
+    // Changes since the snapshot
+    if (m_logFd != -1) {
+        close(m_logFd);
+        m_logFd = -1;
+    }
+    m_logSize = 0;
+    replayLog(LogPath(m_cachePath, m_generation), m_generation);
+
+    // All of it is cached
+    for (size_t i = 0; i < m_heap.size(); ++i) {
+        m_heap[i]->dirty = false;
+        m_heap[i]->persisted = true;
+    }
+    m_dirtyList.clear();
+    m_removedKeys.clear();
+    m_dirty = false;
+
+    check();
+
+    return true;
+}
+
+bool TopTen::replayLog(const std::string& logPath, uint64_t generation)
+{
+    int fd = open(logPath.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    std::string data;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        data.append(buf, n);
+
+    // A log of another generation is left over from an earlier snapshot
+    const LogHeader *header = (const LogHeader *)data.data();
+    if (n < 0 || data.size() < sizeof(*header) ||
+        memcmp(header->magic, s_logMagic, sizeof(s_logMagic)) != 0 ||
+        header->version != LOG_VERSION || header->generation != generation) {
+        close(fd);
+        return false;
+    }
+
+    size_t pos = sizeof(*header);
+    while (pos + sizeof(LogRecord) <= data.size()) {
+        LogRecord r;
+        memcpy(&r, data.data() + pos, sizeof(r));
+        if (pos + sizeof(r) + r.keyLen > data.size())
+            break;
+        std::string key(data.data() + pos + sizeof(r), r.keyLen);
+        if (r.type == LOG_SET) {
+            restore(key, r.eventTime, r.weight, r.error);
+        }
+        else if (r.type == LOG_REMOVE) {
+            KeyMap::iterator it = m_keyMap.find(key);
+            if (it != m_keyMap.end())
+                remove(it->second);
         }
+        else {
+            break;
+        }
+        pos += sizeof(r) + r.keyLen;
+    }
 
-        for (size_t i = 0; i < numKeys; ++i) {
-            // Length of key name
-            size_t len = m_keyArray[i]->key.length();
-            if (fwrite((char *)&len, 1, sizeof(len), fout) != sizeof(len)) {
-                fclose(fout);
-                return false;
-            }
-            // Key name
-            const char *p = m_keyArray[i]->key.data();
-            if (fwrite((char *)p, 1, len, fout) != len) {
-                fclose(fout);
-                return false;
-            }
-            // Event time
-            time_t eventTime = m_keyArray[i]->eventTime;
-            if (fwrite((char *)&eventTime, 1, sizeof(eventTime), fout) != sizeof(eventTime)) {
-                fclose(fout);
-                return false;
-            }
-            // Event count
-            size_t count = m_keyArray[i]->count;
-            if (fwrite((char *)&count, 1, sizeof(count), fout) != sizeof(count)) {
-                fclose(fout);
-                return false;
-            }
+    // Keep appending after the last complete record
+    if (pos != data.size() && ftruncate(fd, pos) != 0) {
+        close(fd);
+        m_needSnapshot = true;
+        return true;
+    }
+    m_logFd = fd;
+    m_logSize = pos;
+    return true;
+}
+
+void TopTen::restore(const std::string& key, time_t eventTime, double weight, double error)
+{
+    if (m_maxEntries == 0)
+        return;
+
+    Data *pData;
+    KeyMap::iterator keyIter = m_keyMap.find(key);
+    if (keyIter != m_keyMap.end()) {
+        pData = keyIter->second;
+    }
+    else if (m_heap.size() < m_maxEntries) {
+        pData = m_freePool.back();
+        m_freePool.pop_back();
+        pData->key = key;
+        m_keyMap[pData->key] = pData;
+        pData->heapIndex = m_heap.size();
+        m_heap.push_back(pData);
+    }
+    else if (weight > m_heap.front()->weight) {
+        // The cache was written with more entries, drop the lightest
+        pData = m_heap.front();
+        m_keyMap.erase(pData->key);
+        pData->key = key;
+        m_keyMap[pData->key] = pData;
+        m_needSnapshot = true;
+    }
+    else {
+        m_needSnapshot = true;
+        return;
+    }
+
+    pData->eventTime = eventTime;
+    pData->weight = weight;
+    pData->error = error;
+    pData->persisted = true;
+    siftUp(pData->heapIndex);
+    siftDown(pData->heapIndex);
+}
+
+void TopTen::markDirty(Data *pData)
+{
+    if (!pData->dirty) {
+        pData->dirty = true;
+        m_dirtyList.push_back(pData);
+    }
+}
+
+void TopTen::markRemoved(Data *pData)
+{
+    if (pData->persisted) {
+        m_removedKeys.push_back(pData->key);
+        pData->persisted = false;
+    }
+}
+
+bool TopTen::flush(const char *path)
+{
+    // Changes stay pending while a snapshot is being written
+    if (m_compaction) {
+        if (!m_compaction->done)
+            return true;
+        if (!joinCompaction())
+            m_needSnapshot = true;
+    }
+
+    if (m_cachePath != path)
+        m_needSnapshot = true;
+
+    if (m_needSnapshot || m_logSize > std::max(m_snapshotSize, MIN_COMPACT_SIZE))
+        return compact(path, false);
+
+    if (!m_dirty)
+        return true;
+
+    return appendLog(path);
+}
+
+bool TopTen::appendLog(const char *path)
+{
+    std::string buf;
+
+    if (m_logFd == -1) {
+        m_logFd = open(LogPath(path, m_generation).c_str(),
+                       O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (m_logFd < 0) {
+            m_needSnapshot = true;
+            return false;
         }
+        LogHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, s_logMagic, sizeof(s_logMagic));
+        header.version = LOG_VERSION;
+        header.generation = m_generation;
+        buf.append((const char *)&header, sizeof(header));
+    }
 
-        fclose(fout);
+    // Removals first: a key removed and added again is in both
+    for (size_t i = 0; i < m_removedKeys.size(); ++i) {
+        LogRecord r;
+        memset(&r, 0, sizeof(r));
+        r.type = LOG_REMOVE;
+        r.keyLen = m_removedKeys[i].length();
+        buf.append((const char *)&r, sizeof(r));
+        buf.append(m_removedKeys[i]);
+    }
 
-        m_dirty = false;
+    for (size_t i = 0; i < m_dirtyList.size(); ++i) {
+        Data *pData = m_dirtyList[i];
+        if (!pData->dirty)
+            continue;
+        LogRecord r;
+        r.type = LOG_SET;
+        r.keyLen = pData->key.length();
+        r.eventTime = pData->eventTime;
+        r.weight = pData->weight;
+        r.error = pData->error;
+        buf.append((const char *)&r, sizeof(r));
+        buf.append(pData->key);
+        pData->dirty = false;
+        pData->persisted = true;
     }
 
+    m_removedKeys.clear();
+    m_dirtyList.clear();
+    m_dirty = false;
+
+    // In a single write, so that a failure at most tears the last record
+    if (HexWriteAll(m_logFd, buf.data(), buf.size()) != 0) {
+        m_needSnapshot = true;
+        return false;
+    }
+    m_logSize += buf.size();
     return true;
 }
 
-bool TopTen::deserialize(const char *path)
+bool TopTen::compact(const char *path, bool wait)
 {
-    if (access(path, F_OK) == 0) {
-        clear();
+    if (!joinCompaction())
+        m_needSnapshot = true;
+
+    std::unique_ptr<Compaction> compaction(new Compaction);
+    compaction->path = path;
+    compaction->generation = m_generation + 1;
+    compaction->threaded = false;
+    compaction->done = false;
+    compaction->ok = false;
+
+    // Build the image now, so the state can change while it is written
+    std::string& image = compaction->image;
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, s_snapshotMagic, sizeof(s_snapshotMagic));
+    header.version = SNAPSHOT_VERSION;
+    header.numRecords = m_heap.size();
+    header.generation = compaction->generation;
+    header.landmark = m_landmark;
+    header.latestTime = m_latestTime;
+
+    std::vector<SnapshotRecord> records(m_heap.size());
+    std::string blob;
+    for (size_t i = 0; i < m_heap.size(); ++i) {
+        Data *pData = m_heap[i];
+        records[i].keyOffset = blob.size();
+        records[i].keyLen = pData->key.length();
+        records[i].eventTime = pData->eventTime;
+        records[i].weight = pData->weight;
+        records[i].error = pData->error;
+        blob.append(pData->key);
+        pData->dirty = false;
+        pData->persisted = true;
+    }
+    blob.resize((blob.size() + 7) & ~(size_t)7);
+    header.blobSize = blob.size();
+
+    image.reserve(sizeof(header) + records.size() * sizeof(SnapshotRecord) + blob.size());
+    image.append((const char *)&header, sizeof(header));
+    image.append((const char *)records.data(), records.size() * sizeof(SnapshotRecord));
+    image.append(blob);
+
+    m_dirtyList.clear();
+    m_removedKeys.clear();
+    m_dirty = false;
+    m_needSnapshot = false;
+
+    m_compaction = compaction.release();
+    if (!wait && pthread_create(&m_compaction->thread, NULL, Compaction::run, m_compaction) == 0)
+        m_compaction->threaded = true;
+    else
+        Compaction::run(m_compaction);
+
+    if (wait)
+        return joinCompaction();
+    return true;
+}
 
-        // Rename input file in case deserialization crashes current process
-        std::string newPath(path);
-        newPath += ".tmp";
-        unlink(newPath.c_str());
-        rename(path, newPath.c_str());
+bool TopTen::joinCompaction()
+{
+    if (!m_compaction)
+        return true;
+
+    if (m_compaction->threaded)
+        pthread_join(m_compaction->thread, NULL);
+
+    bool ok = m_compaction->ok;
+    if (ok) {
+        // The new snapshot includes everything logged so far, start its log
+        m_cachePath = m_compaction->path;
+        m_generation = m_compaction->generation;
+        m_snapshotSize = m_compaction->image.size();
+        if (m_logFd != -1)
+            close(m_logFd);
+        m_logFd = -1;
+        m_logSize = 0;
+        unlink(LogPath(m_cachePath, m_generation - 1).c_str());
+        unlink(LogPath(m_cachePath, m_generation).c_str());
+    }
 
-        FILE *fin = fopen(newPath.c_str(), "rb");
-        if (!fin)
-            return false;
+    delete m_compaction;
+    m_compaction = NULL;
+    return ok;
+}
 
-        char magic[sizeof(s_magic)];
-        if (fread(magic, 1, sizeof(s_magic), fin) != sizeof(s_magic) ||
-            memcmp(magic, s_magic, sizeof(s_magic)) != 0) {
+bool TopTen::deserializeLegacy(const char *path)
+{
+    clear();
+
+    // Rename input file in case deserialization crashes current process
+    std::string newPath(path);
+    newPath += ".tmp";
+    unlink(newPath.c_str());
+    rename(path, newPath.c_str());
+
+    FILE *fin = fopen(newPath.c_str(), "rb");
+    if (!fin)
+        return false;
+
+    char magic[sizeof(s_magic)];
+    if (fread(magic, 1, sizeof(s_magic), fin) != sizeof(s_magic) ||
+        memcmp(magic, s_magic, sizeof(s_magic)) != 0) {
+        fclose(fin);
+        return false;
+    }
+    // Number of keys
+    size_t numKeys;
+    if (fread((char *)&numKeys, 1, sizeof(numKeys), fin) != sizeof(numKeys)) {
+        fclose(fin);
+        return false;
+    }
+
+    std::vector<char> buf;
+    for (size_t i = 0; i < numKeys; ++i) {
+        // Length of key name
+        size_t len;
+        if (fread((char *)&len, 1, sizeof(len), fin) != sizeof(len)) {
             fclose(fin);
             return false;
         }
-        // Number of keys
-        size_t numKeys;
-        if (fread((char *)&numKeys, 1, sizeof(numKeys), fin) != sizeof(numKeys)) {
+        // Key name
+        buf.resize(len+1);
+        if (fread((char *)&buf[0], 1, len, fin) != len) {
             fclose(fin);
             return false;
         }
-
-        std::vector<char> buf;
-        for (size_t i = 0; i < numKeys; ++i) {
-            // Length of key name
-            size_t len;
-            if (fread((char *)&len, 1, sizeof(len), fin) != sizeof(len)) {
-                fclose(fin);
-                return false;
-            }
-            // Key name
-            buf.resize(len+1);
-            if (fread((char *)&buf[0], 1, len, fin) != len) {
-                fclose(fin);
-                return false;
-            }
-            buf[len] = '\0';
-            // Event time
-            time_t eventTime;
-            if (fread((char *)&eventTime, 1, sizeof(eventTime), fin) != sizeof(eventTime)) {
-                fclose(fin);
-                return false;
-            }
-            // Event count
-            size_t count;
-            if (fread((char *)&count, 1, sizeof(count), fin) != sizeof(count)) {
-                fclose(fin);
-                return false;
-            }
-
-            update(&buf[0], count, eventTime);
+        buf[len] = '\0';
+        // Event time
+        time_t eventTime;
+        if (fread((char *)&eventTime, 1, sizeof(eventTime), fin) != sizeof(eventTime)) {
+            fclose(fin);
+            return false;
+        }
+        // Event count
+        size_t count;
+        if (fread((char *)&count, 1, sizeof(count), fin) != sizeof(count)) {
+            fclose(fin);
+            return false;
         }
 
-        fclose(fin);
+        update(&buf[0], count, eventTime);
+    }
 
-        unlink(newPath.c_str());
+    fclose(fin);
 
-        check();
+    unlink(newPath.c_str());
 
-        // Rewrite file after deserialization is successful
-        serialize(path);
-    }
+    check();
+
+    // Rewrite file in the current format after deserialization is successful
+    m_needSnapshot = true;
+    serialize(path);
 
     return true;
 }
 
-TopTen::KeyArray::iterator TopTen::removeOldest()
+double TopTen::decay(time_t eventTime) const
 {
-    // Remove oldest entry from event time array
-    Data *pData = m_eventTimeArray.back();
-    m_eventTimeArray.pop_back();
+    if (m_maxAge <= 0)
+        return 1;
+    return exp2((double)(eventTime - m_landmark) / m_maxAge);
+}
 
+void TopTen::rebase(time_t currTime)
+{
+    // Scaling every weight by the same factor keeps the heap order
+    double scale = 1 / decay(currTime);
+    for (size_t i = 0; i < m_heap.size(); ++i) {
+        m_heap[i]->weight *= scale;
+        m_heap[i]->error *= scale;
+    }
+    m_landmark = currTime;
+
+    // Logged weights are relative to the landmark of the snapshot
+    m_needSnapshot = true;
+}
+
+void TopTen::siftUp(size_t i)
+{
+    Data *pData = m_heap[i];
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (m_heap[parent]->weight <= pData->weight)
+            break;
+        m_heap[i] = m_heap[parent];
+        m_heap[i]->heapIndex = i;
+        i = parent;
+    }
+    m_heap[i] = pData;
+    pData->heapIndex = i;
+}
+
+void TopTen::siftDown(size_t i)
+{
+    Data *pData = m_heap[i];
+    size_t n = m_heap.size();
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && m_heap[child + 1]->weight < m_heap[child]->weight)
+            ++child;
+        if (pData->weight <= m_heap[child]->weight)
+            break;
+        m_heap[i] = m_heap[child];
+        m_heap[i]->heapIndex = i;
+        i = child;
+    }
+    m_heap[i] = pData;
+    pData->heapIndex = i;
+}
+
+void TopTen::remove(Data *pData)
+{
 #ifdef TOPTEN_DEBUG
-    printf("TopTen::removeOldest(): (%p) k=\"%s\", c=%zu, t=%lu\n",
-        pData, pData->key.c_str(), pData->count, pData->eventTime);
+    printf("TopTen::remove(): (%p) k=\"%s\", w=%g, t=%lu\n",
+        pData, pData->key.c_str(), pData->weight, pData->eventTime);
 #endif
 
-    // Remove corresponding entry from key array
-    KeyArray::iterator keyIter = findKey(pData->key);
-    assert(keyIter != m_keyArray.end());
-    m_keyArray.erase(keyIter);
+    markRemoved(pData);
+    m_keyMap.erase(pData->key);
+
+    // Fill the hole with the last entry
+    size_t i = pData->heapIndex;
+    Data *pLast = m_heap.back();
+    m_heap.pop_back();
+    if (pLast != pData) {
+        m_heap[i] = pLast;
+        pLast->heapIndex = i;
+        siftUp(i);
+        siftDown(pLast->heapIndex);
+    }
 
     // Clear data and put back onto the free pool
     pData->key.erase();
     pData->eventTime = 0;
-    pData->count = 0;
+    pData->weight = 0;
+    pData->error = 0;
+    pData->dirty = false;
     m_freePool.push_back(pData);
     m_dirty = true;
-
-    check();
-
-    return keyIter;
 }
 
 } // namespace hex_sdk
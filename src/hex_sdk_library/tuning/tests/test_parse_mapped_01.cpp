@@ -0,0 +1,223 @@
+// HEX SDK
+
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include <hex/tuning.h>
+#include <hex/test.h>
+
+#define TESTFILE "test.dat"
+#define NUM_LINES 20000
+#define NUM_ROUNDS 10
+
+struct Result {
+    int ret;
+    std::string name;
+    std::string value;
+    int line;
+    long offset;
+
+    bool operator==(const Result& r) const {
+        return ret == r.ret && name == r.name && value == r.value && line == r.line && offset == r.offset;
+    }
+};
+
+static void
+WriteFile(const std::string& content)
+{
+    FILE *f = fopen(TESTFILE, "w");
+    HEX_TEST_FATAL(f != NULL);
+    fwrite(content.data(), 1, content.size(), f);
+    fclose(f);
+}
+
+// Parse until EOF or error, collecting every result
+static std::vector<Result>
+ParseAll(HexTuning_t tun, bool slice)
+{
+    std::vector<Result> results;
+    while (true) {
+        Result r;
+        const char *n, *v;
+        if (slice) {
+            size_t nlen, vlen;
+            r.ret = HexTuningParseSlice(tun, &n, &nlen, &v, &vlen);
+            if (r.ret == HEX_TUNING_SUCCESS) {
+                r.name.assign(n, nlen);
+                r.value.assign(v, vlen);
+            }
+        }
+        else {
+            r.ret = HexTuningParseLine(tun, &n, &v);
+            if (r.ret == HEX_TUNING_SUCCESS) {
+                r.name = n;
+                r.value = v;
+            }
+        }
+        r.line = HexTuningCurrLine(tun);
+        r.offset = r.ret == HEX_TUNING_SUCCESS ? HexTuningCurrOffset(tun) : 0;
+        results.push_back(r);
+        if (r.ret != HEX_TUNING_SUCCESS && r.ret != HEX_TUNING_MALFORMED)
+            break;
+        if (results.size() > 1000)
+            break;
+    }
+    return results;
+}
+
+static std::vector<Result>
+ParseStream()
+{
+    FILE *f = fopen(TESTFILE, "r");
+    HEX_TEST_FATAL(f != NULL);
+    HexTuning_t tun = HexTuningAlloc(f);
+    HEX_TEST_FATAL(tun != NULL);
+    std::vector<Result> results = ParseAll(tun, false);
+    HexTuningRelease(tun);
+    fclose(f);
+    return results;
+}
+
+static std::vector<Result>
+ParseMapped(bool slice)
+{
+    HexTuning_t tun = HexTuningAllocMapped(TESTFILE);
+    HEX_TEST_FATAL(tun != NULL);
+    std::vector<Result> results = ParseAll(tun, slice);
+    HexTuningRelease(tun);
+    return results;
+}
+
+int main()
+{
+    std::vector<std::string> inputs = {
+        "",
+        "\n\n  \n",
+        "# comment only",
+        "# comment\nname0=value0\n  # indented comment\nname1 = value1",
+        "name0=value0\nname1 =  value1  \nname2=\nname3 =\n",
+        "name0=value0 value0   value0\t \n",
+        "name0=\"value0\"\nname1= \" value1 \"\nname2=\"\"\"value2\"\"\"\nname3=\"value3a\nvalue3b\nvalue3c\"\n",
+        "name0=\"a\"\"\"\n",
+        "name=\"value",
+        "name=\"value\" foo\n",
+        "name\nname0=value0\n",
+        "=value\n",
+        "name value\n",
+        "name",
+        "name ",
+        "name=",
+        std::string(HEX_TUNING_NAME_MAXLEN, 'n') + "=v\n",
+        std::string(HEX_TUNING_NAME_MAXLEN + 1, 'n') + "=v\n",
+        std::string(HEX_TUNING_NAME_MAXLEN + 2, 'n') + "=v\n",
+        "name=" + std::string(HEX_TUNING_VALUE_MAXLEN, 'v') + "\n",
+        "name=" + std::string(HEX_TUNING_VALUE_MAXLEN, 'v') + " \n",
+        "name=" + std::string(HEX_TUNING_VALUE_MAXLEN + 1, 'v') + "\n",
+        "name=\"" + std::string(HEX_TUNING_VALUE_MAXLEN, 'v') + "\"\n",
+        "name=\"" + std::string(HEX_TUNING_VALUE_MAXLEN + 1, 'v') + "\"\n",
+        "name=\"\"\"" + std::string(HEX_TUNING_VALUE_MAXLEN - 1, 'v') + "\"\n",
+    };
+
+    // Stream, mapped and zero-copy parsing must agree on every input
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        WriteFile(inputs[i]);
+        std::vector<Result> stream = ParseStream();
+        std::vector<Result> mapped = ParseMapped(false);
+        std::vector<Result> slices = ParseMapped(true);
+        char msg[64];
+        snprintf(msg, sizeof(msg), "input %zu", i);
+        HEX_TEST_STR(stream == mapped, msg);
+        HEX_TEST_STR(stream == slices, msg);
+    }
+
+    // Parsing stops after errors
+    WriteFile("name=\"value");
+    HexTuning_t tun = HexTuningAllocMapped(TESTFILE);
+    HEX_TEST_FATAL(tun != NULL);
+    const char *n, *v;
+    size_t nlen, vlen;
+    HEX_TEST(HexTuningParseSlice(tun, &n, &nlen, &v, &vlen) == HEX_TUNING_MALFORMED);
+    HEX_TEST(HexTuningParseSlice(tun, &n, &nlen, &v, &vlen) == HEX_TUNING_ERROR);
+    HEX_TEST(HexTuningParseLine(tun, &n, &v) == HEX_TUNING_ERROR);
+    HEX_TEST(HexTuningCurrOffset(tun) == -1);
+    HexTuningRelease(tun);
+
+    // Unquoted values are slices of the mapping
+    const char buf[] = "name0 = value0\nname1=\"value1\"\n";
+    HEX_TEST_FATAL((tun = HexTuningAllocBuffer(buf, sizeof(buf) - 1)) != NULL);
+    HEX_TEST(HexTuningParseSlice(tun, &n, &nlen, &v, &vlen) == HEX_TUNING_SUCCESS);
+    HEX_TEST(n == buf && nlen == 5 && v == buf + 8 && vlen == 6);
+    HEX_TEST(HexTuningCurrOffset(tun) == 15);
+    HEX_TEST(HexTuningParseSlice(tun, &n, &nlen, &v, &vlen) == HEX_TUNING_SUCCESS);
+    HEX_TEST(n == buf + 15 && v == buf + 22 && vlen == 6);
+    HEX_TEST(HexTuningParseSlice(tun, &n, &nlen, &v, &vlen) == HEX_TUNING_EOF);
+    HexTuningRelease(tun);
+
+    // Zero-copy slices are not available from streams
+    FILE *f = fopen(TESTFILE, "r");
+    HEX_TEST_FATAL(f != NULL);
+    HEX_TEST_FATAL((tun = HexTuningAlloc(f)) != NULL);
+    HEX_TEST(HexTuningParseSlice(tun, &n, &nlen, &v, &vlen) == HEX_TUNING_ERROR);
+    HexTuningRelease(tun);
+    fclose(f);
+
+    unlink(TESTFILE);
+    errno = 0;
+    HEX_TEST(HexTuningAllocMapped(TESTFILE) == NULL && errno == ENOENT);
+
+    // Throughput on a large settings file
+    std::string content;
+    for (int i = 0; i < NUM_LINES; ++i) {
+        char line[128];
+        snprintf(line, sizeof(line), "# setting %d\nmodule%d.name%d = value %d\nmodule%d.quoted%d = \"a \"\"b\"\"\"\n",
+                 i, i % 100, i, i, i % 100, i);
+        content += line;
+    }
+    WriteFile(content);
+
+    size_t count[3] = { 0, 0, 0 };
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < NUM_ROUNDS; ++r) {
+        FILE *f = fopen(TESTFILE, "r");
+        HexTuning_t tun = HexTuningAlloc(f);
+        while (HexTuningParseLine(tun, &n, &v) == HEX_TUNING_SUCCESS)
+            count[0]++;
+        HexTuningRelease(tun);
+        fclose(f);
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < NUM_ROUNDS; ++r) {
+        HexTuning_t tun = HexTuningAllocMapped(TESTFILE);
+        while (HexTuningParseLine(tun, &n, &v) == HEX_TUNING_SUCCESS)
+            count[1]++;
+        HexTuningRelease(tun);
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < NUM_ROUNDS; ++r) {
+        HexTuning_t tun = HexTuningAllocMapped(TESTFILE);
+        while (HexTuningParseSlice(tun, &n, &nlen, &v, &vlen) == HEX_TUNING_SUCCESS)
+            count[2]++;
+        HexTuningRelease(tun);
+    }
+    auto t3 = std::chrono::high_resolution_clock::now();
+    unlink(TESTFILE);
+
+    HEX_TEST(count[0] == (size_t)NUM_ROUNDS * NUM_LINES * 2);
+    HEX_TEST(count[0] == count[1] && count[0] == count[2]);
+
+    double secs[3] = {
+        std::chrono::duration<double>(t1 - t0).count(),
+        std::chrono::duration<double>(t2 - t1).count(),
+        std::chrono::duration<double>(t3 - t2).count(),
+    };
+    printf("%zu settings parsed per method\n", count[0]);
+    printf("stream getc:   %.3f secs, %.0f settings/sec\n", secs[0], count[0] / secs[0]);
+    printf("mapped copy:   %.3f secs, %.0f settings/sec\n", secs[1], count[1] / secs[1]);
+    printf("mapped slices: %.3f secs, %.0f settings/sec\n", secs[2], count[2] / secs[2]);
+
+    return HexTestResult;
+}
@@ -0,0 +1,166 @@
+// HEX SDK
+
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <hex/config_tuning.h>
+#include <hex/test.h>
+
+#define NUM_FORMATS 500
+#define NUM_ROUNDS  5
+
+// Reference implementation: the linear snprintf + sscanf scan ParseTune() used
+// before the formats were compiled into TuneMatcher
+static Tune*
+LegacyLookup(const char* n, int* ni, std::string* ns)
+{
+    for (auto it = s_tunes[0].begin(); it != s_tunes[0].end(); ++it) {
+        Tune* t = it->second;
+        const char* format = it->first.c_str();
+        char fmt[1024];
+        int pos = 0;
+        snprintf(fmt, sizeof(fmt), "%s%%n", format);
+        switch (t->nameType) {
+            case Tune::TUNE_P:
+                if (strcmp(n, format) == 0)
+                    return t;
+                break;
+            case Tune::TUNE_I: {
+                int arg;
+                if (sscanf(n, fmt, &arg, &pos) == 1 && pos == (int)strlen(n)) {
+                    *ni = arg;
+                    return t;
+                }
+                break;
+            }
+            case Tune::TUNE_M: {
+                int first, second;
+                if (sscanf(n, fmt, &first, &second, &pos) == 2 && pos == (int)strlen(n)) {
+                    *ns = std::to_string(first) + "," + std::to_string(second);
+                    return t;
+                }
+                break;
+            }
+            case Tune::TUNE_S: {
+                char arg[80];
+                if (sscanf(n, fmt, arg, &pos) == 1 && pos == (int)strlen(n)) {
+                    *ns = arg;
+                    return t;
+                }
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+static Tune*
+CompiledLookup(const char* n, int* ni, std::string* ns)
+{
+    TuneMatcher::Match m;
+    if (!s_tuneMatchers[0].find(n, &m))
+        return NULL;
+    if (m.tune->nameType == Tune::TUNE_I)
+        *ni = m.ints[0];
+    else if (m.tune->nameType == Tune::TUNE_M)
+        *ns = std::to_string(m.ints[0]) + "," + std::to_string(m.ints[1]);
+    else if (m.tune->nameType == Tune::TUNE_S)
+        *ns = m.str;
+    return m.tune;
+}
+
+int main()
+{
+    // Tune objects and their formats must outlive the mappings
+    std::deque<std::string> formats;
+    std::deque<TuningInt> ints;
+    std::deque<TuningIntArray> arrays;
+    std::deque<TuningStringMap> maps;
+    std::deque<TuningStringMatrix> matrices;
+    std::vector<std::string> names;
+
+    for (int i = 0; i < NUM_FORMATS; ++i) {
+        char buf[128];
+
+        snprintf(buf, sizeof(buf), "net.if.plain%d.mtu", i);
+        formats.push_back(buf);
+        ints.emplace_back(0, 0, 100000, formats.back().c_str());
+        TuneMapping(s_tunes, formats.back().c_str(), &ints.back());
+        names.push_back(buf);
+
+        snprintf(buf, sizeof(buf), "net.if.array%d.%%d.enabled", i);
+        formats.push_back(buf);
+        arrays.emplace_back(0, 0, 1, formats.back().c_str());
+        TuneMapping(s_tunes, formats.back().c_str(), &arrays.back());
+        snprintf(buf, sizeof(buf), "net.if.array%d.%d.enabled", i, i % 7);
+        names.push_back(buf);
+
+        snprintf(buf, sizeof(buf), "net.if.map%d.%%s", i);
+        formats.push_back(buf);
+        maps.emplace_back("", formats.back().c_str(), ValidateNone);
+        TuneMapping(s_tunes, formats.back().c_str(), &maps.back());
+        snprintf(buf, sizeof(buf), "net.if.map%d.eth%d", i, i);
+        names.push_back(buf);
+
+        snprintf(buf, sizeof(buf), "net.route%d.%%d.hop.%%d", i);
+        formats.push_back(buf);
+        matrices.emplace_back("", formats.back().c_str(), ValidateNone);
+        TuneMapping(s_tunes, formats.back().c_str(), &matrices.back());
+        snprintf(buf, sizeof(buf), "net.route%d.%d.hop.%d", i, i % 3, i % 5);
+        names.push_back(buf);
+    }
+    names.push_back("net.if.unknown");
+    names.push_back("net.if.array0.x.enabled");
+    names.push_back("net.route0.1.hop");
+
+    // Both lookups must resolve every name to the same tuning and arguments
+    for (auto it = names.begin(); it != names.end(); ++it) {
+        int ni1 = -1, ni2 = -1;
+        std::string ns1, ns2;
+        Tune* t1 = LegacyLookup(it->c_str(), &ni1, &ns1);
+        Tune* t2 = CompiledLookup(it->c_str(), &ni2, &ns2);
+        HEX_TEST_STR(t1 == t2 && ni1 == ni2 && ns1 == ns2, it->c_str());
+    }
+
+    // End-to-end parse through the public entry point
+    HEX_TEST(ParseTune("net.if.plain3.mtu", "1500", true) == TUNE_OK);
+    HEX_TEST(ints[3].newValue() == 1500);
+    HEX_TEST(ParseTune("net.if.array4.2.enabled", "1", true) == TUNE_OK);
+    HEX_TEST(arrays[4].newValue(2) == 1);
+    HEX_TEST(ParseTune("net.if.map5.eth5", "up", true) == TUNE_OK);
+    HEX_TEST(maps[5].newValue("eth5") == "up");
+    HEX_TEST(ParseTune("net.route6.1.hop.2", "10.0.0.1", true) == TUNE_OK);
+    HEX_TEST(matrices[6].newValue(1, 2) == "10.0.0.1");
+    HEX_TEST(ParseTune("net.if.unknown", "1", true) == TUNE_INVALID_NAME);
+    HEX_TEST(ParseTune("net.if.plain3.mtu", "1", true, MAX_TUNING_MAP) == TUNE_INVALID_IDX);
+
+    size_t found1 = 0, found2 = 0;
+    int ni;
+    std::string ns;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < NUM_ROUNDS; ++r) {
+        for (auto it = names.begin(); it != names.end(); ++it)
+            found1 += (LegacyLookup(it->c_str(), &ni, &ns) != NULL);
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < NUM_ROUNDS; ++r) {
+        for (auto it = names.begin(); it != names.end(); ++it)
+            found2 += (CompiledLookup(it->c_str(), &ni, &ns) != NULL);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    HEX_TEST(found1 == found2);
+
+    double lookups = (double)NUM_ROUNDS * names.size();
+    double legacy = std::chrono::duration<double>(mid - start).count();
+    double compiled = std::chrono::duration<double>(end - mid).count();
+    printf("%zu formats, %.0f lookups\n", s_tunes[0].size(), lookups);
+    printf("legacy sscanf scan: %.3f secs, %.0f lookups/sec\n", legacy, lookups / legacy);
+    printf("compiled matcher:   %.3f secs, %.0f lookups/sec\n", compiled, lookups / compiled);
+
+    return HexTestResult;
+}
@@ -2,13 +2,23 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <hex/tuning.h>
 
 struct HexTuning {
     FILE *stream;
+    const char *buf;    // Settings in memory, or NULL when reading from stream
+    size_t len;
+    size_t pos;
+    void *map;          // Mapping owned by the tuning, if any
+    size_t mapLen;
     int line;
     char nameBuf[HEX_TUNING_NAME_MAXLEN + 1];
     char valueBuf[HEX_TUNING_VALUE_MAXLEN + 1];
@@ -25,17 +35,90 @@ HexTuningAlloc(FILE *stream)
         return NULL;
 
     tuning->stream = stream;
+    tuning->buf = NULL;
+    tuning->len = 0;
+    tuning->pos = 0;
+    tuning->map = NULL;
+    tuning->mapLen = 0;
     tuning->line = 0;
     memset(tuning->nameBuf, 0, sizeof(tuning->nameBuf));
     memset(tuning->valueBuf, 0, sizeof(tuning->valueBuf));
     return tuning;
 }
 
+HexTuning_t
+HexTuningAllocBuffer(const char *buf, size_t len)
+{
+    if (buf == NULL)
+        return NULL;
+
+    HexTuning_t tuning = (HexTuning_t) malloc(sizeof(struct HexTuning));
+    if (!tuning)
+        return NULL;
+
+    tuning->stream = NULL;
+    tuning->buf = buf;
+    tuning->len = len;
+    tuning->pos = 0;
+    tuning->map = NULL;
+    tuning->mapLen = 0;
+    tuning->line = 0;
+    tuning->nameBuf[0] = '\0';
+    tuning->valueBuf[0] = '\0';
+    return tuning;
+}
+
+HexTuning_t
+HexTuningAllocMapped(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    // Empty files cannot be mapped
+    void *map = NULL;
+    size_t len = st.st_size;
+    if (len > 0) {
+        map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return NULL;
+        }
+        madvise(map, len, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    HexTuning_t tuning = HexTuningAllocBuffer(map ? (const char *)map : "", len);
+    if (!tuning) {
+        if (map)
+            munmap(map, len);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    tuning->map = map;
+    tuning->mapLen = len;
+    return tuning;
+}
+
 void
 HexTuningRelease(HexTuning_t tuning)
 {
-    if (tuning)
+    if (tuning) {
+        if (tuning->map)
+            munmap(tuning->map, tuning->mapLen);
         free(tuning);
+    }
 }
 
 // getc() with line counting
@@ -62,13 +145,252 @@ static inline int
 Error(HexTuning_t tuning, int error)
 {
     tuning->stream = NULL;
+    tuning->buf = NULL;
     return error;
 }
 
+// Getc() for settings in memory
+static inline int
+BufGetc(HexTuning_t tuning)
+{
+    if (tuning->pos >= tuning->len) {
+        ++tuning->line;
+        return EOF;
+    }
+    int c = (unsigned char)tuning->buf[tuning->pos++];
+    if (c == '\n')
+        ++tuning->line;
+    return c;
+}
+
+// Ungetc() for settings in memory
+static inline void
+BufUngetc(HexTuning_t tuning, int c)
+{
+    if (c == '\n' || c == EOF)
+        --tuning->line; // COV_IGNORE: not reachable with current parser, but can't hurt
+    if (c != EOF)
+        --tuning->pos;
+}
+
+// Skip to the start of the next line
+static inline int
+SkipLine(HexTuning_t tuning)
+{
+    const char *eol = memchr(tuning->buf + tuning->pos, '\n', tuning->len - tuning->pos);
+    if (eol == NULL) {
+        tuning->pos = tuning->len;
+        ++tuning->line;
+        return EOF;
+    }
+    tuning->pos = eol - tuning->buf + 1;
+    ++tuning->line;
+    return '\n';
+}
+
+// Same grammar and limits as HexTuningParseLineWithD(), but name and value are
+// returned as slices of the buffer and only quoted values with embedded quotes are copied
+static int
+ParseSlice(HexTuning_t tuning, const char **name, size_t *nameLen,
+           const char **value, size_t *valueLen, const char d)
+{
+    *name = *value = "";
+    *nameLen = *valueLen = 0;
+
+    // Skip over blank lines, leading whitespace, and comments
+    int c;
+    while ((c = BufGetc(tuning)) != EOF) {
+        if (c == '#') {
+            if (SkipLine(tuning) == EOF)
+                return Error(tuning, HEX_TUNING_EOF);
+        } else if (!isspace(c)) {
+            BufUngetc(tuning, c);
+            break;
+        }
+    }
+    if (c == EOF)
+        return Error(tuning, HEX_TUNING_EOF);
+
+    // Parse name
+    size_t n = 0;
+    const char *start = tuning->buf + tuning->pos;
+    while ((c = BufGetc(tuning)) != EOF) {
+        if (c == '\n')
+            // don't nullify buffer for caller to parse themselves
+            return HEX_TUNING_MALFORMED;
+        else if (isspace(c) || c == d) {
+            BufUngetc(tuning, c);
+            break;
+        }
+        if (n++ >= HEX_TUNING_NAME_MAXLEN + 1)
+            return Error(tuning, HEX_TUNING_EXCEEDED);
+    }
+    if (c == EOF)
+        return Error(tuning, HEX_TUNING_MALFORMED);
+
+    // Check for only delimiter with no name
+    if (n == 0)
+        return Error(tuning, HEX_TUNING_MALFORMED);
+
+    // Leave room for null terminator in HexTuningParseLineWithD()
+    if (n >= HEX_TUNING_NAME_MAXLEN + 1)
+        return Error(tuning, HEX_TUNING_EXCEEDED);
+
+    *name = start;
+    *nameLen = n;
+
+    // Skip over spaces up to and including delimiter
+    while ((c = BufGetc(tuning)) != EOF) {
+        if (c == d)
+            break;
+        else if (c == '\n' || !isspace(c))
+            return Error(tuning, HEX_TUNING_MALFORMED);
+    }
+    if (c == EOF)
+        return Error(tuning, HEX_TUNING_MALFORMED);
+
+    // Skip over spaces before value
+    while ((c = BufGetc(tuning)) != EOF) {
+        if (c == '\n')
+            break;
+        if (!isspace(c)) {
+            BufUngetc(tuning, c);
+            break;
+        }
+    }
+    if (c == '\n' || c == EOF) {
+        // End of line or EOF reached, value is empty
+        return HEX_TUNING_SUCCESS;
+    }
+
+    // Parse value
+    n = 0;
+
+    // Check if value is surrounded by quotes
+    if ((c = BufGetc(tuning)) == '"') {
+
+        // Value is a slice until the first embedded quote, then it is unescaped into valueBuf
+        start = tuning->buf + tuning->pos;
+        char *p = NULL;
+        while ((c = BufGetc(tuning)) != EOF) {
+            // A single quote (") terminates the value
+            // Two quotes ("") inserts a single quote into the value
+            if (c == '"') {
+                if ((c = BufGetc(tuning)) != '"') {
+                    BufUngetc(tuning, c);
+                    break;
+                }
+                if (!p) {
+                    memcpy(tuning->valueBuf, start, n);
+                    p = tuning->valueBuf + n;
+                }
+            }
+            if (n++ >= HEX_TUNING_VALUE_MAXLEN + 1)
+                return Error(tuning, HEX_TUNING_EXCEEDED);
+            if (p)
+                *p++ = c;
+        }
+        if (c == EOF)
+            return Error(tuning, HEX_TUNING_MALFORMED);
+
+        // Skip over spaces after quoted value
+        while ((c = BufGetc(tuning)) != EOF) {
+            if (c == '\n')
+                break;
+            if (!isspace(c))
+                return Error(tuning, HEX_TUNING_MALFORMED);
+        }
+
+        // Leave room for null terminator in HexTuningParseLineWithD()
+        if (n >= HEX_TUNING_VALUE_MAXLEN + 1)
+            return Error(tuning, HEX_TUNING_EXCEEDED);
+
+        *value = p ? tuning->valueBuf : start;
+        *valueLen = n;
+
+    } else {
+
+        BufUngetc(tuning, c);
+
+        // Value runs to end of line, then strip trailing space
+        start = tuning->buf + tuning->pos;
+        const char *eol = memchr(start, '\n', tuning->len - tuning->pos);
+        n = eol ? (size_t)(eol - start) : tuning->len - tuning->pos;
+        if (n > HEX_TUNING_VALUE_MAXLEN + 1) {
+            tuning->pos += HEX_TUNING_VALUE_MAXLEN + 1;
+            return Error(tuning, HEX_TUNING_EXCEEDED);
+        }
+        tuning->pos += n;
+        BufGetc(tuning);
+
+        size_t lastNonSpace = n;
+        while (isspace((unsigned char)start[lastNonSpace - 1]))
+            --lastNonSpace;
+
+        // Stripped value must leave room for null terminator
+        if (lastNonSpace >= n && n >= HEX_TUNING_VALUE_MAXLEN + 1)
+            return Error(tuning, HEX_TUNING_EXCEEDED);
+
+        *value = start;
+        *valueLen = lastNonSpace;
+    }
+
+    return HEX_TUNING_SUCCESS;
+}
+
+int
+HexTuningParseSliceWithD(HexTuning_t tuning, const char **name, size_t *nameLen,
+                         const char **value, size_t *valueLen, const char d)
+{
+    if (tuning == NULL || tuning->buf == NULL)
+        return HEX_TUNING_ERROR;
+
+    return ParseSlice(tuning, name, nameLen, value, valueLen, d);
+}
+
+int
+HexTuningParseSlice(HexTuning_t tuning, const char **name, size_t *nameLen,
+                    const char **value, size_t *valueLen)
+{
+    return HexTuningParseSliceWithD(tuning, name, nameLen, value, valueLen, '=');
+}
+
+// Parse settings in memory into the null terminated name and value buffers
+static int
+ParseBuffer(HexTuning_t tuning, const char **name, const char **value, const char d)
+{
+    const char *n, *v;
+    size_t nlen, vlen;
+
+    *name = tuning->nameBuf;
+    tuning->nameBuf[0] = '\0';
+
+    *value = tuning->valueBuf;
+
+    int ret = ParseSlice(tuning, &n, &nlen, &v, &vlen, d);
+    if (ret == HEX_TUNING_SUCCESS) {
+        memcpy(tuning->nameBuf, n, nlen);
+        tuning->nameBuf[nlen] = '\0';
+        if (v != tuning->valueBuf)
+            memcpy(tuning->valueBuf, v, vlen);
+        tuning->valueBuf[vlen] = '\0';
+    } else {
+        tuning->valueBuf[0] = '\0';
+    }
+
+    return ret;
+}
+
 int
 HexTuningParseLineWithD(HexTuning_t tuning, const char **name, const char **value, const char d)
 {
-    if (tuning == NULL || tuning->stream == NULL)
+    if (tuning == NULL)
+        return HEX_TUNING_ERROR;
+
+    if (tuning->buf != NULL)
+        return ParseBuffer(tuning, name, value, d);
+
+    if (tuning->stream == NULL)
         return HEX_TUNING_ERROR;
 
     *name = tuning->nameBuf;
@@ -225,3 +547,18 @@ HexTuningCurrLine(HexTuning_t tuning)
     return tuning->line;
 }
 
+long
+HexTuningCurrOffset(HexTuning_t tuning)
+{
+    if (!tuning)
+        return -1;
+
+    if (tuning->buf != NULL)
+        return tuning->pos;
+
+    if (tuning->stream != NULL)
+        return ftell(tuning->stream);
+
+    return -1;
+}
+
@@ -0,0 +1,132 @@
+// HEX SDK
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <hex/test.h>
+#include <hex/zip.h>
+
+static void
+WriteFile(const char *path, const std::string &data)
+{
+    FILE *fp = fopen(path, "w");
+    HEX_TEST_FATAL(fp != NULL);
+    HEX_TEST_FATAL(fwrite(data.data(), 1, data.size(), fp) == data.size());
+    fclose(fp);
+}
+
+static int
+Run(const char *cmd)
+{
+    int status = system(cmd);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main()
+{
+    HEX_TEST_FATAL(Run("rm -rf test.dir test.zip test.x && mkdir -p test.dir/sub/deeper") == 0);
+
+    std::string text;
+    for (int i = 0; i < 10000; ++i)
+        text += "line " + std::to_string(i % 100) + " of some text that compresses\n";
+    std::string random;
+    srand(1);
+    for (int i = 0; i < 100000; ++i)
+        random += (char)rand();
+    // Large enough to be deflated as it is read
+    std::string large;
+    while (large.size() < 40 * 1024 * 1024)
+        large += text;
+
+    WriteFile("test.dir/text", text);
+    WriteFile("test.dir/random", random);
+    WriteFile("test.dir/empty", "");
+    WriteFile("test.dir/sub/large", large);
+    WriteFile("test.dir/sub/deeper/script", "#!/bin/sh\n");
+    HEX_TEST_FATAL(chmod("test.dir/sub/deeper/script", 0751) == 0);
+    HEX_TEST_FATAL(symlink("../text", "test.dir/sub/link") == 0);
+    HEX_TEST_FATAL(mkfifo("test.dir/fifo", 0644) == 0);
+    struct timespec times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+    HEX_TEST_FATAL(utimensat(AT_FDCWD, "test.dir/text", times, 0) == 0);
+
+    // TEST - a tree with every kind of entry, deflated on several threads
+    {
+        HexZipWriter zip(4);
+        HEX_TEST_FATAL(zip.open("test.zip"));
+        HEX_TEST(zip.add("test.dir", "/top/"));
+        // Names already added are skipped
+        HEX_TEST(zip.add("test.dir/text", "top/text"));
+        HEX_TEST(zip.addData("Comment", "a comment\n"));
+        HEX_TEST(!zip.addData("Comment", "another\n"));
+        HEX_TEST(!zip.add("test.dir/missing", "missing"));
+        HEX_TEST(!zip.addPattern("test.dir/missing*"));
+        HEX_TEST(zip.close());
+        // top/ top/sub/ top/sub/deeper/, 6 files and links and the comment
+        HEX_TEST(zip.entries() == 10);
+
+        HEX_TEST(Run("unzip -tq test.zip >/dev/null") == 0);
+        HEX_TEST(Run("test $(unzip -Z1 test.zip | wc -l) -eq 10") == 0);
+        HEX_TEST_FATAL(Run("mkdir test.x && cd test.x && unzip -q ../test.zip") == 0);
+        HEX_TEST(Run("diff -r --no-dereference test.dir test.x/top 2>&1 | grep -qv fifo") != 0);
+        HEX_TEST(Run("grep -qx 'a comment' test.x/Comment") == 0);
+
+        char link[64];
+        ssize_t len = readlink("test.x/top/sub/link", link, sizeof(link));
+        HEX_TEST(len == 7 && std::string(link, len) == "../text");
+
+        struct stat st;
+        HEX_TEST(stat("test.x/top/sub/deeper/script", &st) == 0 && (st.st_mode & 07777) == 0751);
+        HEX_TEST(stat("test.x/top/text", &st) == 0 && st.st_mtime == 1000000000);
+        HEX_TEST(lstat("test.x/top/fifo", &st) != 0);
+
+        // Compressible files shrink, the others are stored
+        HEX_TEST(Run("unzip -v test.zip | grep -q 'Defl:N.* top/text$'") == 0);
+        HEX_TEST(Run("unzip -v test.zip | grep -q 'Stored.* top/random$'") == 0);
+        HEX_TEST(Run("unzip -v test.zip | grep -q 'Defl:N.* top/sub/large$'") == 0);
+    }
+
+    HEX_TEST_FATAL(Run("rm -rf test.zip test.x") == 0);
+
+    // TEST - contents of a directory named relative to it, the archive
+    // itself left out, stored on a single thread
+    {
+        HexZipWriter zip(1, 0);
+        HEX_TEST_FATAL(zip.open("test.dir/test.zip"));
+        HEX_TEST(zip.addPattern("test.dir/t*"));
+        HEX_TEST(zip.add("test.dir", ""));
+        HEX_TEST(zip.close());
+
+        HEX_TEST(Run("unzip -tq test.dir/test.zip >/dev/null") == 0);
+        HEX_TEST(Run("unzip -Z1 test.dir/test.zip | grep -qx 'test.dir/text'") == 0);
+        HEX_TEST(Run("unzip -Z1 test.dir/test.zip | grep -qx 'sub/deeper/script'") == 0);
+        HEX_TEST(Run("unzip -Z1 test.dir/test.zip | grep -q 'test.zip'") != 0);
+        HEX_TEST(Run("unzip -v test.dir/test.zip | grep -v large | grep -q 'Defl'") != 0);
+    }
+
+    // TEST - a file that cannot be read when its turn comes fails the archive
+    {
+        HexZipWriter zip;
+        HEX_TEST_FATAL(zip.open("test.zip"));
+        HEX_TEST(zip.add("test.dir/text", "text"));
+        HEX_TEST(zip.add("/proc/self/mem", "mem"));
+        HEX_TEST(!zip.close());
+    }
+    HEX_TEST_FATAL(Run("rm -f test.zip") == 0);
+
+    // TEST - a closed or unopened writer adds nothing
+    {
+        HexZipWriter zip;
+        HEX_TEST(!zip.add("test.dir", "x"));
+        HEX_TEST(!zip.close());
+    }
+
+    Run("rm -rf test.dir");
+
+    return HexTestResult;
+}
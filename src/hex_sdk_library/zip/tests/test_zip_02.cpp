@@ -0,0 +1,178 @@
+// HEX SDK
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <hex/test.h>
+#include <hex/zip.h>
+
+static void
+WriteFile(const char *path, const std::string &data)
+{
+    FILE *fp = fopen(path, "w");
+    HEX_TEST_FATAL(fp != NULL);
+    HEX_TEST_FATAL(fwrite(data.data(), 1, data.size(), fp) == data.size());
+    fclose(fp);
+}
+
+static int
+Run(const char *cmd)
+{
+    int status = system(cmd);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main()
+{
+    HEX_TEST_FATAL(Run("rm -rf test.dir test.*.zip test.x && mkdir -p test.dir/sub/deeper") == 0);
+
+    std::string text;
+    for (int i = 0; i < 10000; ++i)
+        text += "line " + std::to_string(i % 100) + " of some text that compresses\n";
+    std::string random;
+    srand(1);
+    for (int i = 0; i < 100000; ++i)
+        random += (char)rand();
+    // Large enough to be written with a data descriptor
+    std::string large;
+    while (large.size() < 40 * 1024 * 1024)
+        large += text;
+
+    WriteFile("test.dir/text", text);
+    WriteFile("test.dir/random", random);
+    WriteFile("test.dir/empty", "");
+    WriteFile("test.dir/sub/large", large);
+    WriteFile("test.dir/sub/deeper/script", "#!/bin/sh\n");
+    HEX_TEST_FATAL(chmod("test.dir/sub/deeper/script", 0751) == 0);
+    HEX_TEST_FATAL(chmod("test.dir/sub/deeper", 0700) == 0);
+    HEX_TEST_FATAL(symlink("../text", "test.dir/sub/link") == 0);
+    struct timespec times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+    HEX_TEST_FATAL(utimensat(AT_FDCWD, "test.dir/text", times, 0) == 0);
+    HEX_TEST_FATAL(utimensat(AT_FDCWD, "test.dir/sub", times, 0) == 0);
+
+    {
+        HexZipWriter zip;
+        HEX_TEST_FATAL(zip.open("test.hex.zip"));
+        HEX_TEST_FATAL(zip.add("test.dir", "top"));
+        HEX_TEST_FATAL(zip.close());
+    }
+    HEX_TEST_FATAL(Run("zip -qry test.ref.zip test.dir") == 0);
+
+    // TEST - archives from HexZipWriter and from zip extract as they were added
+    const char *archives[] = { "test.hex.zip", "test.ref.zip" };
+    const char *tops[] = { "test.x/top", "test.x/test.dir" };
+    for (int i = 0; i < 2; ++i) {
+        HEX_TEST_FATAL(Run("rm -rf test.x") == 0);
+        HexZipReader zip;
+        HEX_TEST_FATAL(zip.open(archives[i]));
+        HEX_TEST(zip.entries().size() == 9);
+        HEX_TEST(zip.extractAll("test.x"));
+
+        std::string top = tops[i];
+        HEX_TEST(Run(("diff -r --no-dereference test.dir " + top).c_str()) == 0);
+
+        char link[64];
+        ssize_t len = readlink((top + "/sub/link").c_str(), link, sizeof(link));
+        HEX_TEST(len == 7 && std::string(link, len) == "../text");
+
+        struct stat st;
+        HEX_TEST(stat((top + "/sub/deeper/script").c_str(), &st) == 0 && (st.st_mode & 07777) == 0751);
+        HEX_TEST(stat((top + "/sub/deeper").c_str(), &st) == 0 && (st.st_mode & 07777) == 0700);
+        HEX_TEST(stat((top + "/text").c_str(), &st) == 0 && st.st_mtime == 1000000000);
+        HEX_TEST(stat((top + "/sub").c_str(), &st) == 0 && st.st_mtime == 1000000000);
+    }
+
+    // TEST - one entry to a descriptor, and its details
+    {
+        HexZipReader zip;
+        HEX_TEST_FATAL(zip.open("test.hex.zip"));
+        size_t index = 0;
+        while (index < zip.entries().size() && zip.entries()[index].name != "top/text")
+            ++index;
+        HEX_TEST_FATAL(index < zip.entries().size());
+        const HexZipReader::Entry &entry = zip.entries()[index];
+        HEX_TEST(entry.size == text.size());
+        HEX_TEST(entry.csize < entry.size);
+        HEX_TEST(entry.mtime == 1000000000);
+        HEX_TEST(entry.uid == getuid());
+        HEX_TEST(S_ISREG(entry.mode));
+
+        int fd = open("test.out", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        HEX_TEST_FATAL(fd >= 0);
+        HEX_TEST(zip.extract(index, fd));
+        close(fd);
+        HEX_TEST(Run("cmp -s test.out test.dir/text") == 0);
+        unlink("test.out");
+    }
+
+    // TEST - names leading out of the directory are refused, the rest extracted
+    {
+        HexZipWriter writer;
+        HEX_TEST_FATAL(writer.open("test.bad.zip"));
+        HEX_TEST(writer.addData("good", "good\n"));
+        HEX_TEST(writer.addData("a/../../evil", "evil\n"));
+        HEX_TEST_FATAL(writer.close());
+
+        HEX_TEST_FATAL(Run("rm -rf test.x test.evil && mkdir test.x") == 0);
+        HexZipReader zip;
+        HEX_TEST_FATAL(zip.open("test.bad.zip"));
+        HEX_TEST(!zip.extractAll("test.x/in"));
+        HEX_TEST(access("test.x/in/good", F_OK) == 0);
+        HEX_TEST(access("test.x/evil", F_OK) != 0);
+    }
+
+    // TEST - a link extracted earlier does not lead later entries out of the directory
+    {
+        char cwd[PATH_MAX];
+        HEX_TEST_FATAL(getcwd(cwd, sizeof(cwd)) != NULL);
+        HEX_TEST_FATAL(Run("rm -rf test.x test.victim test.link && mkdir test.victim test.link") == 0);
+        HEX_TEST_FATAL(symlink((std::string(cwd) + "/test.victim").c_str(), "test.link/a") == 0);
+        HexZipWriter writer;
+        HEX_TEST_FATAL(writer.open("test.bad.zip"));
+        HEX_TEST(writer.add("test.link/a", "a"));
+        HEX_TEST(writer.addData("a/pwned", "pwned\n"));
+        HEX_TEST(writer.addData("good", "good\n"));
+        HEX_TEST_FATAL(writer.close());
+
+        HexZipReader zip;
+        HEX_TEST_FATAL(zip.open("test.bad.zip"));
+        HEX_TEST(!zip.extractAll("test.x"));
+        HEX_TEST(access("test.x/good", F_OK) == 0);
+        HEX_TEST(access("test.victim/pwned", F_OK) != 0);
+    }
+
+    // TEST - corrupted contents fail their CRC, other files are not zip files
+    {
+        HexZipWriter writer;
+        HEX_TEST_FATAL(writer.open("test.bad.zip"));
+        HEX_TEST(writer.addData("random", random));
+        HEX_TEST_FATAL(writer.close());
+
+        int fd = open("test.bad.zip", O_WRONLY);
+        HEX_TEST_FATAL(fd >= 0);
+        HEX_TEST_FATAL(pwrite(fd, "X", 1, 1000) == 1);
+        close(fd);
+
+        HEX_TEST_FATAL(Run("rm -rf test.x") == 0);
+        HexZipReader zip;
+        HEX_TEST_FATAL(zip.open("test.bad.zip"));
+        HEX_TEST(!zip.extractAll("test.x"));
+        HEX_TEST(access("test.x/random", F_OK) != 0);
+
+        HexZipReader notZip;
+        HEX_TEST(!notZip.open("test.dir/text"));
+        HexZipReader missing;
+        HEX_TEST(!missing.open("test.missing.zip"));
+    }
+
+    Run("rm -rf test.dir test.x test.victim test.link test.hex.zip test.ref.zip test.bad.zip");
+
+    return HexTestResult;
+}
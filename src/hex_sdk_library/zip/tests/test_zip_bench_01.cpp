@@ -0,0 +1,105 @@
+// HEX SDK
+
+// Time to archive a tree of configuration-sized files matched by several
+// patterns, against find | zip -@ per pattern and zip -r as snapshots used to
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <hex/test.h>
+#include <hex/zip.h>
+
+#define NUM_PATTERNS 10
+#define NUM_DIRS 20
+#define NUM_FILES 50
+
+static double
+Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+Run(const std::string &cmd)
+{
+    int status = system(cmd.c_str());
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static std::string
+Pattern(int p)
+{
+    return "test.tree/p" + std::to_string(p);
+}
+
+// Reference implementation: each pattern rewrites the archive, then the
+// temporary directory is added with another rewrite
+static void
+ZipArchive(const char *zip)
+{
+    for (int p = 0; p < NUM_PATTERNS; ++p)
+        Run("find \"" + Pattern(p) + "\" -depth -print | /usr/bin/zip -q " + zip + " -@");
+    Run(std::string("cd test.tree/tmp && /usr/bin/zip -qr ../../") + zip + " *");
+}
+
+int main()
+{
+    HEX_TEST_FATAL(Run("rm -rf test.tree test.*.zip && mkdir -p test.tree/tmp") == 0);
+
+    std::string text;
+    for (int i = 0; i < 200; ++i)
+        text += "setting." + std::to_string(i) + " = value " + std::to_string(i * 7) + "\n";
+
+    for (int p = 0; p < NUM_PATTERNS; ++p) {
+        for (int d = 0; d < NUM_DIRS; ++d) {
+            std::string dir = Pattern(p) + "/d" + std::to_string(d);
+            mkdir(Pattern(p).c_str(), 0755);
+            HEX_TEST_FATAL(mkdir(dir.c_str(), 0755) == 0);
+            for (int f = 0; f < NUM_FILES; ++f) {
+                FILE *fp = fopen((dir + "/f" + std::to_string(f)).c_str(), "w");
+                HEX_TEST_FATAL(fp != NULL);
+                fprintf(fp, "%d %d %d\n%s", p, d, f, text.c_str());
+                fclose(fp);
+            }
+        }
+    }
+    FILE *fp = fopen("test.tree/tmp/Comment", "w");
+    HEX_TEST_FATAL(fp != NULL);
+    fprintf(fp, "benchmark\n");
+    fclose(fp);
+
+    printf("%d patterns of %d files\n", NUM_PATTERNS, NUM_DIRS * NUM_FILES);
+
+    double start = Now();
+    ZipArchive("test.ref.zip");
+    double ref = Now() - start;
+    printf("zip -@ per pattern, zip -r:  %8.3f secs\n", ref);
+
+    start = Now();
+    {
+        HexZipWriter zip;
+        HEX_TEST_FATAL(zip.open("test.hex.zip"));
+        for (int p = 0; p < NUM_PATTERNS; ++p)
+            HEX_TEST(zip.addPattern(Pattern(p).c_str()));
+        HEX_TEST(zip.add("test.tree/tmp", ""));
+        HEX_TEST(zip.close());
+    }
+    double hex = Now() - start;
+    printf("HexZipWriter:                %8.3f secs  %.1fx\n", hex, ref / hex);
+
+    HEX_TEST(Run("unzip -tq test.hex.zip >/dev/null") == 0);
+    // The same entries either way
+    HEX_TEST(Run("unzip -Z1 test.ref.zip | sort >test.ref.out && unzip -Z1 test.hex.zip | sort >test.hex.out && "
+                 "cmp -s test.ref.out test.hex.out") == 0);
+
+    Run("rm -rf test.tree test.ref.zip test.hex.zip test.ref.out test.hex.out");
+
+    return HexTestResult;
+}
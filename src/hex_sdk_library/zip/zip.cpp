@@ -0,0 +1,1196 @@
+// HEX SDK
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include <zlib.h>
+
+#include <hex/filesystem.h>
+#include <hex/log.h>
+#include <hex/zip.h>
+
+// Files this large are deflated by the writer as they are read instead of
+// whole on a worker, so that memory stays bounded
+static const uint64_t STREAM_SIZE = 32 * 1024 * 1024;
+
+// Streamed files this large get 64-bit sizes, smaller ones are cut short
+// rather than outgrow the 32-bit ones
+static const uint64_t STREAM_ZIP64_SIZE = 0x80000000;
+static const uint64_t STREAM_MAX_SIZE = 0xF0000000;
+
+// Limits on files read but not written yet: all of their contents may be in
+// memory and each holds a descriptor open
+static const uint64_t MAX_QUEUED_BYTES = 64 * 1024 * 1024;
+static const size_t MAX_QUEUED_ENTRIES = 256;
+
+static const size_t READ_SIZE = 1024 * 1024;
+static const size_t OUTPUT_BUFFER_SIZE = 1024 * 1024;
+
+static const uint32_t LOCAL_HEADER_SIG = 0x04034b50;
+static const uint32_t DATA_DESCRIPTOR_SIG = 0x08074b50;
+static const uint32_t CENTRAL_HEADER_SIG = 0x02014b50;
+static const uint32_t ZIP64_END_SIG = 0x06064b50;
+static const uint32_t ZIP64_LOCATOR_SIG = 0x07064b50;
+static const uint32_t END_SIG = 0x06054b50;
+
+static const uint16_t ZIP64_EXTRA = 0x0001;
+static const uint16_t TIME_EXTRA = 0x5455;
+static const uint16_t UNIX_EXTRA = 0x7875;
+
+// Made by Unix, spec 3.0, so that unzip restores modes and symbolic links
+static const uint16_t VERSION_MADE_BY = (3 << 8) | 30;
+static const uint16_t VERSION_STORED = 10;
+static const uint16_t VERSION_DEFLATED = 20;
+static const uint16_t VERSION_ZIP64 = 45;
+
+static const uint16_t METHOD_STORED = 0;
+static const uint16_t METHOD_DEFLATED = 8;
+
+// Sizes and CRC follow the data in a descriptor
+static const uint16_t FLAG_DESCRIPTOR = 1 << 3;
+
+static const uint32_t MAX32 = 0xFFFFFFFF;
+static const uint16_t MAX16 = 0xFFFF;
+
+struct HexZipWriter::Entry {
+    // Name in the archive, with a trailing slash for directories
+    std::string name;
+    // Where regular files are read from, for messages
+    std::string path;
+    int fd;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    time_t mtime;
+    // Size when added
+    uint64_t size;
+    bool streamed;
+    // Ready to write, set under m_lock
+    bool done;
+    int error;
+    uint16_t method;
+    uint32_t crc;
+    uint64_t usize;
+    // Contents to add, then as written
+    std::string data;
+};
+
+struct HexZipWriter::Central {
+    std::string name;
+    uint16_t version;
+    uint16_t flags;
+    uint16_t method;
+    uint16_t dosTime;
+    uint16_t dosDate;
+    uint32_t crc;
+    uint64_t csize;
+    uint64_t usize;
+    uint64_t offset;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    time_t mtime;
+};
+
+// Little-endian header fields
+static void
+Put16(std::string &buf, uint16_t v)
+{
+    buf += (char)(v & 0xFF);
+    buf += (char)(v >> 8);
+}
+
+static void
+Put32(std::string &buf, uint32_t v)
+{
+    Put16(buf, v & 0xFFFF);
+    Put16(buf, v >> 16);
+}
+
+static void
+Put64(std::string &buf, uint64_t v)
+{
+    Put32(buf, v & MAX32);
+    Put32(buf, v >> 32);
+}
+
+static void
+DosTime(time_t t, uint16_t &dosTime, uint16_t &dosDate)
+{
+    struct tm tm;
+    if (localtime_r(&t, &tm) == NULL || tm.tm_year < 80) {
+        // 1980-01-01 00:00:00, the earliest there is
+        dosTime = 0;
+        dosDate = (1 << 5) | 1;
+        return;
+    }
+    dosTime = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+    dosDate = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+}
+
+// Modification time and owner, as zip(1) adds them
+static void
+PutUnixExtras(std::string &buf, time_t mtime, uid_t uid, gid_t gid)
+{
+    Put16(buf, TIME_EXTRA);
+    Put16(buf, 5);
+    buf += (char)1;
+    Put32(buf, (uint32_t)mtime);
+
+    Put16(buf, UNIX_EXTRA);
+    Put16(buf, 11);
+    buf += (char)1;
+    buf += (char)4;
+    Put32(buf, uid);
+    buf += (char)4;
+    Put32(buf, gid);
+}
+
+static bool
+ReadAll(int fd, std::string &data)
+{
+    char buffer[65536];
+    for (;;) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n == 0)
+            return true;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data.append(buffer, n);
+    }
+}
+
+HexZipWriter::Entry*
+HexZipWriter::newEntry(const std::string &name, const std::string &path, const struct stat &st)
+{
+    Entry *entry = new Entry();
+    entry->name = name;
+    entry->path = path;
+    entry->fd = -1;
+    entry->mode = st.st_mode;
+    entry->uid = st.st_uid;
+    entry->gid = st.st_gid;
+    entry->mtime = st.st_mtime;
+    entry->size = 0;
+    entry->streamed = false;
+    entry->done = true;
+    entry->error = 0;
+    entry->method = METHOD_STORED;
+    entry->crc = 0;
+    entry->usize = 0;
+    return entry;
+}
+
+HexZipWriter::HexZipWriter(size_t threads, int level)
+    : m_level(level), m_numThreads(threads), m_stop(false),
+      m_pending(0), m_queuedBytes(0), m_fp(NULL), m_offset(0), m_ok(false)
+{
+    if (m_numThreads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        m_numThreads = cpus > 0 ? cpus : 1;
+    }
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_workCond, NULL);
+    pthread_cond_init(&m_doneCond, NULL);
+}
+
+HexZipWriter::~HexZipWriter()
+{
+    pthread_mutex_lock(&m_lock);
+    m_stop = true;
+    pthread_cond_broadcast(&m_workCond);
+    pthread_mutex_unlock(&m_lock);
+    for (size_t i = 0; i < m_threads.size(); ++i)
+        pthread_join(m_threads[i], NULL);
+
+    for (size_t i = 0; i < m_queue.size(); ++i) {
+        if (m_queue[i]->fd >= 0)
+            ::close(m_queue[i]->fd);
+        delete m_queue[i];
+    }
+    if (m_fp)
+        fclose(m_fp);
+
+    pthread_cond_destroy(&m_doneCond);
+    pthread_cond_destroy(&m_workCond);
+    pthread_mutex_destroy(&m_lock);
+}
+
+bool
+HexZipWriter::open(const char *path)
+{
+    if (m_fp)
+        return false;
+
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        HexLogError("Could not create %s: %s", path, strerror(errno));
+        return false;
+    }
+    // Never add the archive to itself
+    fstat(fd, &m_archive);
+    m_fp = fdopen(fd, "w");
+    if (!m_fp) {
+        HexLogError("Could not open %s: %s", path, strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    setvbuf(m_fp, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    m_path = path;
+    m_ok = true;
+
+    // Compress inline if no thread can be started
+    for (size_t i = 0; i < m_numThreads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker, this) != 0)
+            break;
+        m_threads.push_back(thread);
+    }
+    return true;
+}
+
+bool
+HexZipWriter::add(const std::string &path, const std::string &name)
+{
+    if (!m_fp)
+        return false;
+
+    std::string n = name;
+    n.erase(0, n.find_first_not_of('/'));
+    while (!n.empty() && n[n.size() - 1] == '/')
+        n.erase(n.size() - 1);
+
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        HexLogDebug("Could not add %s to %s: %s", path.c_str(), m_path.c_str(), strerror(errno));
+        return false;
+    }
+    if (st.st_dev == m_archive.st_dev && st.st_ino == m_archive.st_ino)
+        return true;
+
+    switch (st.st_mode & S_IFMT) {
+    case S_IFDIR: {
+        bool ok = true;
+        if (!n.empty() && m_names.insert(n + "/").second)
+            enqueue(newEntry(n + "/", path, st));
+
+        std::vector<std::string> names;
+        if (!HexListDir(path, names)) {
+            HexLogDebug("Could not read %s: %s", path.c_str(), strerror(errno));
+            ok = false;
+        }
+
+        std::string pathPrefix = path == "/" ? path : path + "/";
+        std::string namePrefix = n.empty() ? n : n + "/";
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (!add(pathPrefix + names[i], namePrefix + names[i]))
+                ok = false;
+        }
+        return ok;
+    }
+    case S_IFREG: {
+        if (n.empty() || m_names.count(n))
+            return true;
+        int fd = ::open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            HexLogDebug("Could not open %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        m_names.insert(n);
+        Entry *entry = newEntry(n, path, st);
+        entry->fd = fd;
+        entry->size = st.st_size;
+        entry->streamed = entry->size >= STREAM_SIZE;
+        entry->done = entry->streamed;
+        enqueue(entry);
+        return true;
+    }
+    case S_IFLNK: {
+        if (n.empty() || m_names.count(n))
+            return true;
+        char link[PATH_MAX];
+        ssize_t len = readlink(path.c_str(), link, sizeof(link));
+        if (len < 0) {
+            HexLogDebug("Could not read %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        m_names.insert(n);
+        // Stored as the link's target
+        Entry *entry = newEntry(n, path, st);
+        entry->data.assign(link, len);
+        entry->usize = len;
+        entry->crc = crc32(0, (const Bytef*)link, len);
+        enqueue(entry);
+        return true;
+    }
+    default:
+        // Sockets, fifos and devices have nothing to add
+        return true;
+    }
+}
+
+bool
+HexZipWriter::addPattern(const char *pattern)
+{
+    glob_t g;
+    if (glob(pattern, 0, NULL, &g) != 0) {
+        globfree(&g);
+        HexLogDebug("Nothing to add to %s for %s", m_path.c_str(), pattern);
+        return false;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < g.gl_pathc; ++i) {
+        std::string path = g.gl_pathv[i];
+        while (path.size() > 1 && path[path.size() - 1] == '/')
+            path.erase(path.size() - 1);
+        if (!add(path, path))
+            ok = false;
+    }
+    globfree(&g);
+    return ok;
+}
+
+bool
+HexZipWriter::addData(const std::string &name, const std::string &data, mode_t mode)
+{
+    if (!m_fp)
+        return false;
+
+    std::string n = name;
+    n.erase(0, n.find_first_not_of('/'));
+    if (n.empty() || n[n.size() - 1] == '/' || !m_names.insert(n).second)
+        return false;
+
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFREG | (mode & 07777);
+    st.st_uid = getuid();
+    st.st_gid = getgid();
+    st.st_mtime = time(NULL);
+
+    Entry *entry = newEntry(n, n, st);
+    entry->size = data.size();
+    entry->done = false;
+    entry->data = data;
+    enqueue(entry);
+    return true;
+}
+
+bool
+HexZipWriter::close()
+{
+    if (!m_fp)
+        return false;
+
+    writeReady(true);
+    writeCentral();
+
+    pthread_mutex_lock(&m_lock);
+    m_stop = true;
+    pthread_cond_broadcast(&m_workCond);
+    pthread_mutex_unlock(&m_lock);
+    for (size_t i = 0; i < m_threads.size(); ++i)
+        pthread_join(m_threads[i], NULL);
+    m_threads.clear();
+
+    if (fclose(m_fp) != 0 && m_ok) {
+        HexLogError("Could not write %s: %s", m_path.c_str(), strerror(errno));
+        m_ok = false;
+    }
+    m_fp = NULL;
+    return m_ok;
+}
+
+size_t
+HexZipWriter::entries() const
+{
+    return m_central.size();
+}
+
+void*
+HexZipWriter::worker(void *arg)
+{
+    HexZipWriter *zip = (HexZipWriter*)arg;
+
+    pthread_mutex_lock(&zip->m_lock);
+    for (;;) {
+        while (!zip->m_stop && zip->m_pending >= zip->m_queue.size())
+            pthread_cond_wait(&zip->m_workCond, &zip->m_lock);
+        if (zip->m_pending >= zip->m_queue.size())
+            break;
+
+        Entry *entry = zip->m_queue[zip->m_pending++];
+        if (entry->done)
+            continue;
+
+        pthread_mutex_unlock(&zip->m_lock);
+        zip->compress(entry);
+        pthread_mutex_lock(&zip->m_lock);
+
+        entry->done = true;
+        pthread_cond_broadcast(&zip->m_doneCond);
+    }
+    pthread_mutex_unlock(&zip->m_lock);
+    return NULL;
+}
+
+void
+HexZipWriter::enqueue(Entry *entry)
+{
+    pthread_mutex_lock(&m_lock);
+    m_queue.push_back(entry);
+    if (!entry->streamed)
+        m_queuedBytes += entry->size;
+    pthread_cond_signal(&m_workCond);
+    pthread_mutex_unlock(&m_lock);
+
+    writeReady(false);
+}
+
+void
+HexZipWriter::compress(Entry *entry)
+{
+    std::string in;
+    if (entry->fd >= 0) {
+        in.reserve(entry->size);
+        if (!ReadAll(entry->fd, in))
+            entry->error = errno;
+        ::close(entry->fd);
+        entry->fd = -1;
+    }
+    else {
+        in.swap(entry->data);
+    }
+
+    entry->usize = in.size();
+    entry->crc = crc32_z(0, (const Bytef*)in.data(), in.size());
+
+    if (!in.empty() && m_level != 0) {
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        if (deflateInit2(&z, m_level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+            std::string out;
+            out.resize(deflateBound(&z, in.size()));
+            z.next_in = (Bytef*)in.data();
+            z.next_out = (Bytef*)&out[0];
+            size_t inLeft = in.size(), outLeft = out.size();
+            int rc;
+            do {
+                // Fed in pieces since the counts are only 32 bits
+                z.avail_in = std::min(inLeft, (size_t)UINT_MAX);
+                z.avail_out = std::min(outLeft, (size_t)UINT_MAX);
+                size_t availIn = z.avail_in, availOut = z.avail_out;
+                rc = deflate(&z, z.avail_in == inLeft ? Z_FINISH : Z_NO_FLUSH);
+                inLeft -= availIn - z.avail_in;
+                outLeft -= availOut - z.avail_out;
+            } while (rc == Z_OK);
+            deflateEnd(&z);
+
+            // Store what does not get any smaller
+            if (rc == Z_STREAM_END && z.total_out < in.size()) {
+                out.resize(z.total_out);
+                entry->method = METHOD_DEFLATED;
+                entry->data.swap(out);
+                return;
+            }
+        }
+    }
+
+    entry->method = METHOD_STORED;
+    entry->data.swap(in);
+}
+
+void
+HexZipWriter::writeReady(bool all)
+{
+    pthread_mutex_lock(&m_lock);
+    while (!m_queue.empty()) {
+        Entry *entry = m_queue.front();
+        if (!entry->done) {
+            if (!all && m_queue.size() < MAX_QUEUED_ENTRIES && m_queuedBytes < MAX_QUEUED_BYTES)
+                break;
+            if (m_threads.empty()) {
+                pthread_mutex_unlock(&m_lock);
+                compress(entry);
+                pthread_mutex_lock(&m_lock);
+                entry->done = true;
+            }
+            else {
+                pthread_cond_wait(&m_doneCond, &m_lock);
+            }
+            continue;
+        }
+
+        m_queue.pop_front();
+        if (m_pending > 0)
+            m_pending--;
+        if (!entry->streamed)
+            m_queuedBytes -= entry->size;
+        pthread_mutex_unlock(&m_lock);
+
+        if (entry->streamed)
+            writeStreamed(entry);
+        else
+            writeEntry(entry);
+        delete entry;
+
+        pthread_mutex_lock(&m_lock);
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+void
+HexZipWriter::writeEntry(Entry *entry)
+{
+    if (entry->error != 0) {
+        HexLogError("Could not read %s: %s", entry->path.c_str(), strerror(entry->error));
+        m_ok = false;
+        return;
+    }
+
+    Central c;
+    c.name = entry->name;
+    c.flags = 0;
+    c.method = entry->method;
+    DosTime(entry->mtime, c.dosTime, c.dosDate);
+    c.crc = entry->crc;
+    c.csize = entry->data.size();
+    c.usize = entry->usize;
+    c.offset = m_offset;
+    c.mode = entry->mode;
+    c.uid = entry->uid;
+    c.gid = entry->gid;
+    c.mtime = entry->mtime;
+
+    bool zip64 = c.usize >= MAX32 || c.csize >= MAX32;
+    c.version = zip64 ? VERSION_ZIP64 : c.method == METHOD_DEFLATED ? VERSION_DEFLATED : VERSION_STORED;
+
+    std::string extra;
+    if (zip64) {
+        Put16(extra, ZIP64_EXTRA);
+        Put16(extra, 16);
+        Put64(extra, c.usize);
+        Put64(extra, c.csize);
+    }
+    PutUnixExtras(extra, c.mtime, c.uid, c.gid);
+
+    std::string header;
+    Put32(header, LOCAL_HEADER_SIG);
+    Put16(header, c.version);
+    Put16(header, c.flags);
+    Put16(header, c.method);
+    Put16(header, c.dosTime);
+    Put16(header, c.dosDate);
+    Put32(header, c.crc);
+    Put32(header, zip64 ? MAX32 : c.csize);
+    Put32(header, zip64 ? MAX32 : c.usize);
+    Put16(header, c.name.size());
+    Put16(header, extra.size());
+    header += c.name;
+    header += extra;
+
+    output(header.data(), header.size());
+    output(entry->data.data(), entry->data.size());
+    m_central.push_back(c);
+}
+
+void
+HexZipWriter::writeStreamed(Entry *entry)
+{
+    Central c;
+    c.name = entry->name;
+    c.flags = FLAG_DESCRIPTOR;
+    c.method = METHOD_DEFLATED;
+    DosTime(entry->mtime, c.dosTime, c.dosDate);
+    c.crc = 0;
+    c.csize = 0;
+    c.usize = 0;
+    c.offset = m_offset;
+    c.mode = entry->mode;
+    c.uid = entry->uid;
+    c.gid = entry->gid;
+    c.mtime = entry->mtime;
+
+    // Whether sizes are 64 bits has to be settled before they are known
+    bool zip64 = entry->size >= STREAM_ZIP64_SIZE;
+    c.version = zip64 ? VERSION_ZIP64 : VERSION_DEFLATED;
+
+    std::string extra;
+    if (zip64) {
+        Put16(extra, ZIP64_EXTRA);
+        Put16(extra, 16);
+        Put64(extra, 0);
+        Put64(extra, 0);
+    }
+    PutUnixExtras(extra, c.mtime, c.uid, c.gid);
+
+    std::string header;
+    Put32(header, LOCAL_HEADER_SIG);
+    Put16(header, c.version);
+    Put16(header, c.flags);
+    Put16(header, c.method);
+    Put16(header, c.dosTime);
+    Put16(header, c.dosDate);
+    Put32(header, 0);
+    Put32(header, zip64 ? MAX32 : 0);
+    Put32(header, zip64 ? MAX32 : 0);
+    Put16(header, c.name.size());
+    Put16(header, extra.size());
+    header += c.name;
+    header += extra;
+    output(header.data(), header.size());
+
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, m_level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        HexLogError("Could not compress %s", entry->path.c_str());
+        m_ok = false;
+        ::close(entry->fd);
+        return;
+    }
+
+    std::vector<char> in(READ_SIZE), out(READ_SIZE);
+    bool eof = false;
+    int rc = Z_OK;
+    while (rc == Z_OK) {
+        if (!eof && z.avail_in == 0) {
+            size_t want = READ_SIZE;
+            if (!zip64)
+                want = std::min<uint64_t>(want, STREAM_MAX_SIZE - c.usize);
+            ssize_t n = want > 0 ? read(entry->fd, in.data(), want) : 0;
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0) {
+                HexLogError("Could not read all of %s: %s", entry->path.c_str(), strerror(errno));
+                m_ok = false;
+            }
+            else if (n == 0 && want == 0) {
+                HexLogError("Could not add all of %s: grew too large", entry->path.c_str());
+                m_ok = false;
+            }
+            if (n <= 0) {
+                eof = true;
+            }
+            else {
+                c.crc = crc32(c.crc, (const Bytef*)in.data(), n);
+                c.usize += n;
+                z.next_in = (Bytef*)in.data();
+                z.avail_in = n;
+            }
+        }
+
+        z.next_out = (Bytef*)out.data();
+        z.avail_out = out.size();
+        rc = deflate(&z, eof ? Z_FINISH : Z_NO_FLUSH);
+        if (rc == Z_BUF_ERROR)
+            rc = Z_OK;
+        output(out.data(), out.size() - z.avail_out);
+        c.csize += out.size() - z.avail_out;
+    }
+    deflateEnd(&z);
+    ::close(entry->fd);
+    entry->fd = -1;
+
+    if (rc != Z_STREAM_END) {
+        HexLogError("Could not compress %s", entry->path.c_str());
+        m_ok = false;
+    }
+
+    std::string descriptor;
+    Put32(descriptor, DATA_DESCRIPTOR_SIG);
+    Put32(descriptor, c.crc);
+    if (zip64) {
+        Put64(descriptor, c.csize);
+        Put64(descriptor, c.usize);
+    }
+    else {
+        Put32(descriptor, c.csize);
+        Put32(descriptor, c.usize);
+    }
+    output(descriptor.data(), descriptor.size());
+    m_central.push_back(c);
+}
+
+void
+HexZipWriter::writeCentral()
+{
+    uint64_t start = m_offset;
+
+    for (size_t i = 0; i < m_central.size(); ++i) {
+        const Central &c = m_central[i];
+
+        // 64-bit values in the order of the fields they replace
+        std::string zip64;
+        if (c.usize >= MAX32)
+            Put64(zip64, c.usize);
+        if (c.csize >= MAX32)
+            Put64(zip64, c.csize);
+        if (c.offset >= MAX32)
+            Put64(zip64, c.offset);
+
+        std::string extra;
+        if (!zip64.empty()) {
+            Put16(extra, ZIP64_EXTRA);
+            Put16(extra, zip64.size());
+            extra += zip64;
+        }
+        PutUnixExtras(extra, c.mtime, c.uid, c.gid);
+
+        std::string header;
+        Put32(header, CENTRAL_HEADER_SIG);
+        Put16(header, VERSION_MADE_BY);
+        Put16(header, zip64.empty() ? c.version : VERSION_ZIP64);
+        Put16(header, c.flags);
+        Put16(header, c.method);
+        Put16(header, c.dosTime);
+        Put16(header, c.dosDate);
+        Put32(header, c.crc);
+        Put32(header, std::min<uint64_t>(c.csize, MAX32));
+        Put32(header, std::min<uint64_t>(c.usize, MAX32));
+        Put16(header, c.name.size());
+        Put16(header, extra.size());
+        Put16(header, 0);   // comment
+        Put16(header, 0);   // disk
+        Put16(header, 0);   // internal attributes
+        // Unix mode, and the MS-DOS directory bit
+        Put32(header, ((uint32_t)c.mode << 16) | (S_ISDIR(c.mode) ? 0x10 : 0));
+        Put32(header, std::min<uint64_t>(c.offset, MAX32));
+        header += c.name;
+        header += extra;
+        output(header.data(), header.size());
+    }
+
+    uint64_t count = m_central.size();
+    uint64_t size = m_offset - start;
+
+    std::string end;
+    if (count >= MAX16 || size >= MAX32 || start >= MAX32) {
+        uint64_t zip64End = m_offset;
+        Put32(end, ZIP64_END_SIG);
+        Put64(end, 44);
+        Put16(end, VERSION_MADE_BY);
+        Put16(end, VERSION_ZIP64);
+        Put32(end, 0);
+        Put32(end, 0);
+        Put64(end, count);
+        Put64(end, count);
+        Put64(end, size);
+        Put64(end, start);
+
+        Put32(end, ZIP64_LOCATOR_SIG);
+        Put32(end, 0);
+        Put64(end, zip64End);
+        Put32(end, 1);
+    }
+    Put32(end, END_SIG);
+    Put16(end, 0);
+    Put16(end, 0);
+    Put16(end, std::min<uint64_t>(count, MAX16));
+    Put16(end, std::min<uint64_t>(count, MAX16));
+    Put32(end, std::min<uint64_t>(size, MAX32));
+    Put32(end, std::min<uint64_t>(start, MAX32));
+    Put16(end, 0);
+    output(end.data(), end.size());
+}
+
+void
+HexZipWriter::output(const void *data, size_t len)
+{
+    if (len == 0 || !m_ok)
+        return;
+    if (fwrite(data, 1, len, m_fp) != len) {
+        HexLogError("Could not write %s: %s", m_path.c_str(), strerror(errno));
+        m_ok = false;
+        return;
+    }
+    m_offset += len;
+}
+
+// Little-endian header fields
+static uint16_t
+Get16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t
+Get32(const unsigned char *p)
+{
+    return Get16(p) | ((uint32_t)Get16(p + 2) << 16);
+}
+
+static uint64_t
+Get64(const unsigned char *p)
+{
+    return Get32(p) | ((uint64_t)Get32(p + 4) << 32);
+}
+
+static bool
+PreadAll(int fd, void *buf, size_t len, uint64_t offset)
+{
+    for (size_t done = 0; done < len; ) {
+        ssize_t n = pread(fd, (char*)buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+HexZipReader::HexZipReader()
+    : m_fd(-1)
+{
+}
+
+HexZipReader::~HexZipReader()
+{
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+bool
+HexZipReader::open(const char *path)
+{
+    if (m_fd >= 0)
+        return false;
+
+    m_path = path;
+    m_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0) {
+        HexLogError("Could not open %s: %s", path, strerror(errno));
+        return false;
+    }
+    if (!readCentral()) {
+        HexLogError("Could not read %s: not a zip file", path);
+        m_entries.clear();
+        return false;
+    }
+    return true;
+}
+
+bool
+HexZipReader::readCentral()
+{
+    struct stat st;
+    if (fstat(m_fd, &st) != 0 || st.st_size < 22)
+        return false;
+    uint64_t size = st.st_size;
+
+    // The end record is last, before a comment of up to 64K
+    size_t tailLen = std::min<uint64_t>(size, 22 + MAX16);
+    std::vector<unsigned char> tail(tailLen);
+    if (!PreadAll(m_fd, tail.data(), tailLen, size - tailLen))
+        return false;
+    ssize_t pos = tailLen - 22;
+    while (pos >= 0 && Get32(&tail[pos]) != END_SIG)
+        --pos;
+    if (pos < 0)
+        return false;
+
+    const unsigned char *end = &tail[pos];
+    uint64_t count = Get16(end + 10);
+    uint64_t cdSize = Get32(end + 12);
+    uint64_t cdOffset = Get32(end + 16);
+
+    if (count == MAX16 || cdSize == MAX32 || cdOffset == MAX32) {
+        uint64_t endOffset = size - tailLen + pos;
+        unsigned char locator[20], end64[56];
+        if (endOffset < sizeof(locator) ||
+            !PreadAll(m_fd, locator, sizeof(locator), endOffset - sizeof(locator)) ||
+            Get32(locator) != ZIP64_LOCATOR_SIG ||
+            !PreadAll(m_fd, end64, sizeof(end64), Get64(locator + 8)) ||
+            Get32(end64) != ZIP64_END_SIG)
+            return false;
+        count = Get64(end64 + 32);
+        cdSize = Get64(end64 + 40);
+        cdOffset = Get64(end64 + 48);
+    }
+
+    if (cdOffset > size || cdSize > size - cdOffset)
+        return false;
+    std::vector<unsigned char> cd(cdSize);
+    if (!PreadAll(m_fd, cd.data(), cdSize, cdOffset))
+        return false;
+
+    size_t p = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        if (p + 46 > cdSize || Get32(&cd[p]) != CENTRAL_HEADER_SIG)
+            return false;
+        const unsigned char *h = &cd[p];
+        uint16_t madeBy = Get16(h + 4);
+        uint16_t nameLen = Get16(h + 28);
+        uint16_t extraLen = Get16(h + 30);
+        uint16_t commentLen = Get16(h + 32);
+        uint32_t attr = Get32(h + 38);
+        if (p + 46 + nameLen + extraLen + commentLen > cdSize)
+            return false;
+
+        Entry e;
+        e.name.assign((const char*)h + 46, nameLen);
+        e.crc = Get32(h + 16);
+        e.method = Get16(h + 10);
+        e.csize = Get32(h + 20);
+        e.size = Get32(h + 24);
+        e.offset = Get32(h + 42);
+        e.uid = 0;
+        e.gid = 0;
+
+        bool dir = !e.name.empty() && e.name[e.name.size() - 1] == '/';
+        if ((madeBy >> 8) == 3 && (attr >> 16) != 0)
+            e.mode = attr >> 16;
+        else
+            e.mode = dir ? S_IFDIR | 0755 : S_IFREG | 0644;
+
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        uint16_t dosTime = Get16(h + 12), dosDate = Get16(h + 14);
+        tm.tm_year = (dosDate >> 9) + 80;
+        tm.tm_mon = ((dosDate >> 5) & 0xF) - 1;
+        tm.tm_mday = dosDate & 0x1F;
+        tm.tm_hour = dosTime >> 11;
+        tm.tm_min = (dosTime >> 5) & 0x3F;
+        tm.tm_sec = (dosTime & 0x1F) * 2;
+        tm.tm_isdst = -1;
+        e.mtime = mktime(&tm);
+
+        const unsigned char *x = h + 46 + nameLen, *xEnd = x + extraLen;
+        while (x + 4 <= xEnd) {
+            uint16_t tag = Get16(x), len = Get16(x + 2);
+            const unsigned char *v = x + 4, *vEnd = std::min(v + len, xEnd);
+            if (tag == ZIP64_EXTRA) {
+                // Only the fields that did not fit, in order
+                if (e.size == MAX32 && v + 8 <= vEnd) {
+                    e.size = Get64(v);
+                    v += 8;
+                }
+                if (e.csize == MAX32 && v + 8 <= vEnd) {
+                    e.csize = Get64(v);
+                    v += 8;
+                }
+                if (e.offset == MAX32 && v + 8 <= vEnd)
+                    e.offset = Get64(v);
+            }
+            else if (tag == TIME_EXTRA && v + 5 <= vEnd && (v[0] & 1)) {
+                e.mtime = (time_t)(int32_t)Get32(v + 1);
+            }
+            else if (tag == UNIX_EXTRA && v + 11 <= vEnd && v[0] == 1 && v[1] == 4 && v[6] == 4) {
+                e.uid = Get32(v + 2);
+                e.gid = Get32(v + 7);
+            }
+            x += 4 + len;
+        }
+
+        m_entries.push_back(e);
+        p += 46 + nameLen + extraLen + commentLen;
+    }
+    return true;
+}
+
+bool
+HexZipReader::dataOffset(const Entry &entry, uint64_t &offset)
+{
+    unsigned char h[30];
+    if (!PreadAll(m_fd, h, sizeof(h), entry.offset) || Get32(h) != LOCAL_HEADER_SIG)
+        return false;
+    offset = entry.offset + sizeof(h) + Get16(h + 26) + Get16(h + 28);
+    return true;
+}
+
+bool
+HexZipReader::extract(size_t index, int fd)
+{
+    if (index >= m_entries.size())
+        return false;
+    const Entry &entry = m_entries[index];
+
+    uint64_t offset;
+    if (!dataOffset(entry, offset)) {
+        HexLogError("Could not read %s from %s: bad header", entry.name.c_str(), m_path.c_str());
+        return false;
+    }
+    if (entry.method != METHOD_STORED && entry.method != METHOD_DEFLATED) {
+        HexLogError("Could not read %s from %s: method %u not supported",
+                    entry.name.c_str(), m_path.c_str(), entry.method);
+        return false;
+    }
+
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (entry.method == METHOD_DEFLATED && inflateInit2(&z, -MAX_WBITS) != Z_OK)
+        return false;
+
+    std::vector<unsigned char> in(READ_SIZE), out(READ_SIZE);
+    uint64_t left = entry.csize, total = 0;
+    uint32_t crc = 0;
+    int rc = Z_OK;
+    bool ok = true;
+    while (ok && left > 0 && rc != Z_STREAM_END) {
+        size_t n = std::min<uint64_t>(left, in.size());
+        if (!PreadAll(m_fd, in.data(), n, offset)) {
+            ok = false;
+            break;
+        }
+        offset += n;
+        left -= n;
+
+        if (entry.method == METHOD_STORED) {
+            crc = crc32(crc, in.data(), n);
+            total += n;
+            ok = HexWriteAll(fd, in.data(), n) == 0;
+            continue;
+        }
+
+        z.next_in = in.data();
+        z.avail_in = n;
+        do {
+            z.next_out = out.data();
+            z.avail_out = out.size();
+            rc = inflate(&z, Z_NO_FLUSH);
+            if (rc != Z_OK && rc != Z_STREAM_END) {
+                ok = false;
+                break;
+            }
+            size_t produced = out.size() - z.avail_out;
+            crc = crc32(crc, out.data(), produced);
+            total += produced;
+            if (HexWriteAll(fd, out.data(), produced) != 0)
+                ok = false;
+        } while (ok && rc != Z_STREAM_END && (z.avail_in > 0 || z.avail_out == 0));
+    }
+    if (entry.method == METHOD_DEFLATED) {
+        if (rc != Z_STREAM_END)
+            ok = false;
+        inflateEnd(&z);
+    }
+
+    if (!ok || total != entry.size || crc != entry.crc) {
+        HexLogError("Could not extract %s from %s", entry.name.c_str(), m_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool
+HexZipReader::extract(size_t index, const std::string &path)
+{
+    if (index >= m_entries.size())
+        return false;
+    const Entry &entry = m_entries[index];
+
+    HexMakeParents(path.c_str());
+
+    switch (entry.mode & S_IFMT) {
+    case S_IFDIR:
+        if (mkdir(path.c_str(), 0700) != 0 && errno != EEXIST) {
+            HexLogError("Could not create %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        break;
+    case S_IFLNK: {
+        // Stored as the link's target
+        int fds[2];
+        if (entry.size >= PATH_MAX || pipe(fds) != 0)
+            return false;
+        bool ok = extract(index, fds[1]);
+        ::close(fds[1]);
+        char link[PATH_MAX];
+        ssize_t len = ok ? read(fds[0], link, sizeof(link) - 1) : -1;
+        ::close(fds[0]);
+        if (len < 0)
+            return false;
+        link[len] = '\0';
+        unlink(path.c_str());
+        if (symlink(link, path.c_str()) != 0) {
+            HexLogError("Could not create %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        return true;
+    }
+    case S_IFREG: {
+        unlink(path.c_str());
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            HexLogError("Could not create %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        if (!extract(index, fd)) {
+            ::close(fd);
+            unlink(path.c_str());
+            return false;
+        }
+        ::close(fd);
+        break;
+    }
+    default:
+        HexLogError("Could not extract %s from %s: not a file, link or directory",
+                    entry.name.c_str(), m_path.c_str());
+        return false;
+    }
+
+    chmod(path.c_str(), entry.mode & 07777);
+    struct timespec times[2] = { { entry.mtime, 0 }, { entry.mtime, 0 } };
+    utimensat(AT_FDCWD, path.c_str(), times, 0);
+    return true;
+}
+
+bool
+HexZipReader::extractAll(const char *dir)
+{
+    bool ok = true;
+    std::vector<size_t> dirs;
+    HexMakeParents((std::string(dir) + "/").c_str());
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        std::string name = m_entries[i].name;
+        while (!name.empty() && name[name.size() - 1] == '/')
+            name.erase(name.size() - 1);
+        if (!HexPathIsBeneath(name.c_str())) {
+            HexLogError("Could not extract %s from %s: name outside of %s",
+                        m_entries[i].name.c_str(), m_path.c_str(), dir);
+            ok = false;
+            continue;
+        }
+        // Directories are walked one at a time without following links, so a
+        // link extracted earlier cannot lead a later entry out of "dir"
+        size_t slash = name.rfind('/');
+        std::string parents = S_ISDIR(m_entries[i].mode) ? name :
+                              slash == std::string::npos ? "" : name.substr(0, slash);
+        if (!parents.empty() && HexMakeDirsBeneath(dir, parents.c_str()) != 0) {
+            HexLogError("Could not extract %s from %s: %s", m_entries[i].name.c_str(),
+                        m_path.c_str(), errno == ELOOP ? "symbolic link in its path" : strerror(errno));
+            ok = false;
+            continue;
+        }
+        std::string path = std::string(dir) + "/" + name;
+        if (S_ISDIR(m_entries[i].mode)) {
+            dirs.push_back(i);
+        }
+        else if (!extract(i, path)) {
+            ok = false;
+        }
+    }
+
+    // Directories extracted to get their own mode and time only once
+    // everything in them is written
+    for (auto i = dirs.rbegin(); i != dirs.rend(); ++i) {
+        const Entry &entry = m_entries[*i];
+        std::string path = std::string(dir) + "/" + entry.name;
+        chmod(path.c_str(), entry.mode & 07777);
+        struct timespec times[2] = { { entry.mtime, 0 }, { entry.mtime, 0 } };
+        utimensat(AT_FDCWD, path.c_str(), times, 0);
+    }
+    return ok;
+}
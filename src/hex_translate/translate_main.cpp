@@ -3,6 +3,7 @@
 // TODO:
 // need method for reporting errors back to caller
 
+#include <errno.h>
 #include <list>
 #include <map>
 #include <sys/stat.h>
@@ -389,19 +390,16 @@ ParseLines(HexTuning_t tun)
 static bool
 ParseSystem()
 {
-    FILE* fin = fopen(SYSTEM_SETTINGS, "re");
-    if (!fin) {
+    HexTuning_t tun = HexTuningAllocMapped(SYSTEM_SETTINGS);
+    if (!tun) {
+        if (errno == ENOMEM)
+            HexLogFatal("malloc failed"); // COV_IGNORE
         HexLogWarning("Could not open settings file: %s", SYSTEM_SETTINGS);
         return true;
     }
 
-    HexTuning_t tun = HexTuningAlloc(fin);
-    if (!tun)
-        HexLogFatal("malloc failed"); // COV_IGNORE
-
     bool success = ParseLines(tun);
     HexTuningRelease(tun);
-    fclose(fin);
 
     if (!success)
         HexLogError("Parsing failed");
@@ -25,56 +25,50 @@ main(int argc, char *argv[])
     char *newPrefix = argv[2];
 
     int status = 0;
-    FILE *fin = fopen(settings, "r");
-    if (fin) {
-        HexTuning_t tun = HexTuningAlloc(fin);
-        if (tun) {
-            const char *name, *value;
-            while (1) {
-                int result = HexTuningParseLine(tun, &name, &value);
-                if (result == HEX_TUNING_EOF) break;
-                if (result != HEX_TUNING_SUCCESS) {
-                    fprintf(stderr, "Error: Could not parse file\n");
-                    status = 1;
-                    break;
+    HexTuning_t tun = HexTuningAllocMapped(settings);
+    if (tun) {
+        // Match prefix against the whole name only, names are not null terminated
+        size_t prefixLen = namePrefix ? strcspn(namePrefix, "<") : 0;
+        const char *name, *value;
+        size_t nameLen, valueLen;
+        while (1) {
+            int result = HexTuningParseSlice(tun, &name, &nameLen, &value, &valueLen);
+            if (result == HEX_TUNING_EOF) break;
+            if (result != HEX_TUNING_SUCCESS) {
+                fprintf(stderr, "Error: Could not parse file\n");
+                status = 1;
+                break;
+            }
+            if (namePrefix == 0 || (nameLen >= prefixLen && strncmp(name, namePrefix, prefixLen) == 0)) {
+                printf("%s", newPrefix);
+                // Replace all periods and hyphens in name with underscores
+                const char *q = name;
+                const char *end = name + strnlen(name, nameLen);
+                while (q < end) {
+                    if (*q == '.' || *q == '-')
+                        putchar('_');
+                    else
+                        putchar(*q);
+                    q++;
                 }
-                const char *p;
-                if (namePrefix == 0 || HexMatchPrefix(name, namePrefix, &p)) {
-                    printf("%s", newPrefix);
-                    // Replace all periods and hyphens in name with underscores
-                    const char *q = name;
-                    while (*q != '\0') {
-                        size_t n = strcspn(q, ".-");
-                        if (n == 0) {
-                            printf("_");
-                            q++;
-                        } else {
-                            printf("%.*s", (int)n, q);
-                            q += n;
-                        }
-                    }
-                    printf("='");
-                    // Replace special characters in value with underscores
-                    q = value;
-                    while (*q != '\0') {
-                        size_t n = strcspn(q, "\\\"'`$");
-                        if (n == 0) {
-                            printf("_");
-                            q++;
-                        } else {
-                            printf("%.*s", (int)n, q);
-                            q += n;
-                        }
-                    }
-                    printf("'\n");
+                printf("='");
+                // Replace special characters in value with underscores
+                q = value;
+                end = value + strnlen(value, valueLen);
+                while (q < end) {
+                    if (strchr("\\\"'`$", *q) != NULL)
+                        putchar('_');
+                    else
+                        putchar(*q);
+                    q++;
                 }
+                printf("'\n");
             }
-            HexTuningRelease(tun);
-        } else {
-            fprintf(stderr, "Error: Malloc failed\n");
-            status = 1;
         }
-        fclose(fin);
+        HexTuningRelease(tun);
+    } else if (errno == ENOMEM) {
+        fprintf(stderr, "Error: Malloc failed\n");
+        status = 1;
     } else {
         fprintf(stderr, "Error: Could not open file: %s\n", settings);
         status = 1;
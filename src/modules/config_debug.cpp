@@ -5,6 +5,7 @@
 #include <map>
 #include <set>
 #include <string.h>
+#include <unistd.h>
 #include <hex/log.h>
 #include <hex/process.h>
 
@@ -19,6 +20,7 @@ CONFIG_TUNING_INT(DBG_LVL, "debug.level", TUNING_UNPUB, "Set global debug level"
 CONFIG_TUNING_INT(DBG_LVL_PROC, "debug.level.%s", TUNING_UNPUB, "Set debug level for process %s", 0, 0, 9);
 CONFIG_TUNING_BOOL(DBG_CORE_PROC, "debug.enable_core_dump.%s", TUNING_UNPUB, "Enable core dump for process %s", false);
 CONFIG_TUNING_INT(DBG_CORE_MAX, "debug.max_core_dump", TUNING_UNPUB, "Set the total number of core files before oldest are removed", 0, 0, 999);
+CONFIG_TUNING_INT(DBG_CORE_SIZE, "debug.max_core_dump_size", TUNING_UNPUB, "Set the total size in MB of core files before oldest are removed (0 for no limit)", 0, 0, 1048576);
 CONFIG_TUNING_BOOL(DBG_KERNEL_DUMP, "debug.enable_kdump", TUNING_UNPUB, "Enable kdump to collect dump from kernel panic", false);
 
 // parse tunings
@@ -26,11 +28,13 @@ PARSE_TUNING_INT(s_globalDebugLevel, DBG_LVL);
 PARSE_TUNING_INT_MAP(s_debugLevelMap, DBG_LVL_PROC);
 PARSE_TUNING_BOOL_MAP(s_enableCoreMap, DBG_CORE_PROC);
 PARSE_TUNING_INT(s_maxCore, DBG_CORE_MAX);
+PARSE_TUNING_INT(s_maxCoreSize, DBG_CORE_SIZE);
 PARSE_TUNING_BOOL(s_enableKdump, DBG_KERNEL_DUMP);
 
 static const char ENABLE_DEBUG_MARKER[] = "/etc/debug.level";
 static const char ENABLE_CORE_FILES_MARKER[] = "/etc/debug.enable_core_files";
 static const char MAX_CORE_FILE[] = "/etc/debug.max_core_files";
+static const char MAX_CORE_SIZE_FILE[] = "/etc/debug.max_core_size";
 
 static bool
 Parse(const char *name, const char *value, bool isNew)
@@ -48,6 +52,25 @@ Parse(const char *name, const char *value, bool isNew)
     return r;
 }
 
+// hex_crashd reads the limits again whenever they are written, so each is
+// written to a temporary file and renamed over the old one
+static void
+WriteLimit(const char *path, int value)
+{
+    std::string tmpPath(path);
+    tmpPath += ".tmp";
+    FILE *fp = fopen(tmpPath.c_str(), "w");
+    if (!fp) {
+        HexLogError("Unable to write %s", tmpPath.c_str());
+        return;
+    }
+    fprintf(fp, "%d\n", value);
+    if (fclose(fp) != 0 || rename(tmpPath.c_str(), path) != 0) {
+        HexLogError("Unable to write %s", path);
+        unlink(tmpPath.c_str());
+    }
+}
+
 static bool
 Commit(bool unused, int dryLevel)
 {
@@ -55,7 +78,9 @@ Commit(bool unused, int dryLevel)
     HEX_DRYRUN_BARRIER(dryLevel, true);
 
     // Delete files before creating new ones
-    HexSystemF(0, "rm -f %s* %s* %s", ENABLE_DEBUG_MARKER, ENABLE_CORE_FILES_MARKER, MAX_CORE_FILE);
+    // The core file limits are replaced in place instead: hex_crashd would
+    // otherwise housekeep cores with its defaults while they are missing
+    HexSystemF(0, "rm -f %s* %s*", ENABLE_DEBUG_MARKER, ENABLE_CORE_FILES_MARKER);
 
     if (s_globalDebugLevel > 0)
         HexSystemF(0, "echo %d > %s", (int)s_globalDebugLevel, ENABLE_DEBUG_MARKER);
@@ -80,12 +105,11 @@ Commit(bool unused, int dryLevel)
             HexLogWarning("Failed to disable kdump");
     }
 
-    FILE *maxCoreFile = fopen(MAX_CORE_FILE, "w");
-    if (maxCoreFile) {
-        HexLogDebugN(FWD, "Setting maximum number of core files: %d", (int)s_maxCore);
-        fprintf(maxCoreFile, "%d\n", (int)s_maxCore);
-        fclose(maxCoreFile);
-    }
+    HexLogDebugN(FWD, "Setting maximum number of core files: %d", (int)s_maxCore);
+    WriteLimit(MAX_CORE_FILE, (int)s_maxCore);
+
+    HexLogDebugN(FWD, "Setting maximum size of core files: %d MB", (int)s_maxCoreSize);
+    WriteLimit(MAX_CORE_SIZE_FILE, (int)s_maxCoreSize);
 
     return true;
 }
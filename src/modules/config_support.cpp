@@ -7,6 +7,7 @@
 #include <hex/process.h>
 #include <hex/log.h>
 #include <hex/tempfile.h>
+#include <hex/zip.h>
 
 #include <hex/config_module.h>
 #include <hex/config_tuning.h>
@@ -130,7 +131,8 @@ CreateMain(int argc, char* argv[])
     }
 
     unlink(path.c_str());
-    if (HexSystemF(0, "cd %s && /usr/bin/zip -r %s * >%s 2>&1", tmpdir.dir(), path.c_str(), SUPPORT_LOG) != 0)
+    HexZipWriter zip;
+    if (!zip.open(path.c_str()) || !zip.add(tmpdir.dir(), "") || !zip.close())
         HexLogFatal("Could not create support info file");
 
     // Echo new support info name to stdout
@@ -40,7 +40,7 @@ CONFIG_SUPPORT_COMMAND("cat /proc/interrupts");
 CONFIG_SUPPORT_COMMAND("dmidecode");
 
 // Move (not copy) core/map files into support info bundle
-CONFIG_SUPPORT_COMMAND("mkdir -p $HEX_SUPPORT_DIR/var/support; mv -f /var/support/vmcore /var/support/core_* /var/support/crash_* /var/support/crashmap_* $HEX_SUPPORT_DIR/var/support >/dev/null 2>&1");
+CONFIG_SUPPORT_COMMAND("mkdir -p $HEX_SUPPORT_DIR/var/support; mv -f /var/support/vmcore /var/support/core_* /var/support/crash_* /var/support/crashmap_* /var/support/crashstack_* $HEX_SUPPORT_DIR/var/support >/dev/null 2>&1");
 
 // Preserve log and support files across firmware update
 CONFIG_MODULE(supportbase, 0, 0, 0, 0, 0);